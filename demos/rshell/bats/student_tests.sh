@@ -12,3 +12,312 @@ EOF
     # Assertions
     [ "$status" -eq 0 ]
 }
+
+@test "Remote: the zygote runs a pipeline and reports its exit code" {
+    log=/tmp/dsh_zygote_$$.log
+    ./dsh -s -p 7816 > $log 3>&- &
+    sleep 0.5
+
+    output=$(printf 'seq 1 100 | grep 7 | wc -l\nrc\nsh -c "exit 3" | sh -c "cat; exit 5"\nrc\n' | ./dsh -c -p 7816)
+    printf 'stop-server\n' | ./dsh -c -p 7816
+    sleep 0.2
+    server=$(cat $log)
+    rm -f $log
+
+    echo "$output"
+    echo "$server"
+    [[ "$server" != *"zygote did not start"* ]]
+    [[ "$output" == *"dsh4> 19"* ]]
+    [[ "$output" == *"rc = 0"* ]]
+    [[ "$output" == *"rc = 5"* ]]
+}
+
+@test "Remote: compressed session (-z) output matches a plain session" {
+    ./dsh -s -p 7790 3>&- &
+    sleep 0.5
+
+    plain=$(printf 'seq 1 20000\ncat rsh_server.c\nexit\n' | ./dsh -c -p 7790)
+    compressed=$(printf 'seq 1 20000\ncat rsh_server.c\nexit\n' | ./dsh -c -z -p 7790)
+
+    printf 'stop-server\n' | ./dsh -c -p 7790
+
+    [ "$plain" = "$compressed" ]
+}
+
+@test "Remote: batch mode (-f) runs a script, -e stops at the first failure" {
+    ./dsh -s -p 7791 3>&- &
+    sleep 0.5
+
+    printf 'echo one\n# a comment\nfalse\necho two\n' > batch_test.txt
+    run ./dsh -c -p 7791 -f batch_test.txt
+    all_output="$output"
+    run ./dsh -c -p 7791 -f batch_test.txt -e
+    stop_output="$output"
+    rm -f batch_test.txt
+
+    printf 'stop-server\n' | ./dsh -c -p 7791
+
+    echo "$all_output"
+    echo "$stop_output"
+    [[ "$all_output" == *"two"* ]]
+    [[ "$stop_output" == *"line 4 skipped: echo two"* ]]
+    [[ "$stop_output" != *$'\ntwo'* ]]
+}
+
+@test "Remote: jump host (-j) carries several clients over one connection" {
+    ./dsh -s -p 7792 3>&- &
+    sleep 0.5
+    ./dsh -j -p 7792 -l 7793 3>&- &
+    sleep 0.5
+
+    printf 'sleep 1\necho slow\nexit\n' | ./dsh -c -p 7793 > jump_slow.txt &
+    slow_pid=$!
+    sleep 0.2
+    fast=$(printf 'echo fast\nseq 1 50000 | tail -1\nexit\n' | ./dsh -c -p 7793)
+    wait $slow_pid
+    slow=$(cat jump_slow.txt)
+    rm -f jump_slow.txt
+
+    printf 'stop-server\n' | ./dsh -c -p 7793
+
+    echo "$fast"
+    echo "$slow"
+    [[ "$fast" == *"fast"* ]]
+    [[ "$fast" == *"50000"* ]]
+    [[ "$slow" == *"slow"* ]]
+}
+
+@test "Remote: cd and export stay in their own session" {
+    ./dsh -s -p 7794 3>&- &
+    sleep 0.5
+    ./dsh -j -p 7794 -l 7795 3>&- &
+    sleep 0.5
+
+    printf 'cd /tmp\nexport RSH_TEST=one\nsleep 1\npwd\nprintenv RSH_TEST\nexit\n' | ./dsh -c -p 7795 > env_one.txt &
+    one_pid=$!
+    sleep 0.2
+    two=$(printf 'cd /\nexport RSH_TEST=two\npwd\nprintenv RSH_TEST\ncd /no/such/dir\nexit\n' | ./dsh -c -p 7795)
+    wait $one_pid
+    one=$(cat env_one.txt)
+    rm -f env_one.txt
+
+    printf 'stop-server\n' | ./dsh -c -p 7795
+
+    echo "$one"
+    echo "$two"
+    [[ "$one" == *"/tmp"* ]]
+    [[ "$one" == *"one"* ]]
+    [[ "$one" != *"two"* ]]
+    [[ "$two" == *"two"* ]]
+    [[ "$two" == *"cd: /no/such/dir: No such file or directory"* ]]
+}
+
+@test "Remote: -t runs commands on a terminal" {
+    ./dsh -s -p 7796 3>&- &
+    sleep 0.5
+
+    plain=$(printf 'tty\n' | ./dsh -c -p 7796)
+    #script gives the client a terminal of its own to put in raw mode
+    pty=$(printf 'tty\n' | script -qec "./dsh -c -t -p 7796" /dev/null)
+
+    printf 'stop-server\n' | ./dsh -c -p 7796
+
+    echo "$plain"
+    echo "$pty"
+    [[ "$plain" == *"not a tty"* ]]
+    [[ "$pty" == *"/dev/pts/"* ]]
+}
+
+@test "Remote: Unix domain socket transport (-u)" {
+    sock=/tmp/dsh_bats_$$.sock
+    ./dsh -s -u $sock -o backlog=5 3>&- &
+    sleep 0.5
+
+    run bash -c "printf 'echo over-unix\n' | ./dsh -c -u $sock -o nodelay=1"
+    printf 'stop-server\n' | ./dsh -c -u $sock
+    sleep 0.2
+
+    echo "$output"
+    [[ "$output" == *"path:$sock"* ]]
+    [[ "$output" == *"over-unix"* ]]
+    [ ! -e $sock ]
+}
+
+@test "Remote: -u leaves a path that is not a stale socket alone" {
+    sock=/tmp/dsh_bats_$$.sock
+    echo "not a socket" > $sock
+    run ./dsh -s -u $sock
+    file_output="$output"
+    kept=$(cat $sock)
+    rm -f $sock
+
+    ./dsh -s -u $sock 3>&- &
+    sleep 0.5
+    run ./dsh -s -u $sock
+    busy_output="$output"
+    live=$(printf 'echo still-serving\n' | ./dsh -c -u $sock)
+    printf 'stop-server\n' | ./dsh -c -u $sock
+    sleep 0.2
+
+    echo "$file_output"
+    echo "$busy_output"
+    echo "$live"
+    [[ "$file_output" == *"is not a socket, or a server is already using it"* ]]
+    [ "$kept" = "not a socket" ]
+    [[ "$busy_output" == *"is not a socket, or a server is already using it"* ]]
+    [[ "$live" == *"still-serving"* ]]
+    [ ! -e $sock ]
+}
+
+@test "Remote: stop-server drains running sessions (-x)" {
+    ./dsh -s -x -p 7797 3>&- &
+    sleep 0.5
+
+    #a command that is still running when stop-server arrives, the
+    #marker says it has started
+    go=/tmp/dsh_drain_$$.go
+    rm -f $go
+    (printf "sh -c \"touch $go; sleep 1; echo slow-done\"\necho too-late\n"; sleep 2) | ./dsh -c -p 7797 > /tmp/dsh_drain_$$.out 3>&- &
+    for i in $(seq 1 50); do [ -e $go ] && break; sleep 0.1; done
+    printf 'stop-server\n' | ./dsh -c -p 7797
+    wait
+    rm -f $go
+
+    output=$(cat /tmp/dsh_drain_$$.out)
+    rm -f /tmp/dsh_drain_$$.out
+    echo "$output"
+    [[ "$output" == *"slow-done"* ]]
+    [[ "$output" == *"server is shutting down"* ]]
+    [[ "$output" != *"dsh4> too-late"* ]]
+}
+
+@test "Remote: -m serves Prometheus metrics" {
+    ./dsh -s -x -p 7798 -m 7799 3>&- &
+    sleep 0.5
+
+    printf 'echo one\necho two\n' | ./dsh -c -p 7798
+    metrics=$(curl -s http://127.0.0.1:7799/metrics)
+    printf 'stop-server\n' | ./dsh -c -p 7798
+
+    echo "$metrics"
+    [[ "$metrics" == *"# TYPE rsh_commands_total counter"* ]]
+    [[ "$metrics" == *"rsh_connections_total 1"* ]]
+    [[ "$metrics" == *"rsh_spawn_seconds_count 2"* ]]
+    [[ "$metrics" == *'rsh_errors_total{code="ERR_RDSH_COMMUNICATION"}'* ]]
+}
+
+@test "Remote: -k authenticates and -r resumes the session" {
+    key=/tmp/dsh_key_$$
+    ticket=/tmp/dsh_ticket_$$
+    echo "bats-secret" > $key
+    echo "wrong-secret" > $key.bad
+    ./dsh -s -p 7800 -k $key 3>&- &
+    sleep 0.5
+
+    #the first client goes away without exit, its session is parked
+    printf 'cd /tmp\nexport RSH_TEST=kept\n' | ./dsh -c -p 7800 -k $key -r $ticket
+    resumed=$(printf 'pwd\nprintenv RSH_TEST\n' | ./dsh -c -p 7800 -k $key -r $ticket)
+    denied=$(printf 'pwd\n' | ./dsh -c -p 7800 -k $key.bad 2>&1)
+    nokey=$(printf 'pwd\n' | ./dsh -c -p 7800)
+    nokey_z=$(printf 'pwd\n' | ./dsh -c -z -p 7800)
+
+    printf 'stop-server\n' | ./dsh -c -p 7800 -k $key
+    rm -f $key $key.bad $ticket
+
+    echo "$resumed"
+    echo "$denied"
+    echo "$nokey"
+    echo "$nokey_z"
+    [[ "$resumed" == *"resumed session"* ]]
+    [[ "$resumed" == *"/tmp"* ]]
+    [[ "$resumed" == *"kept"* ]]
+    [[ "$denied" == *"authentication failed"* ]]
+    [[ "$denied" != *"/"* ]]
+    [[ "$denied" != *"start client"* ]]
+    [[ "$nokey" == *"requires a key"* ]]
+    [[ "$nokey" != *"RDSHAUT1"* ]]
+    [[ "$nokey_z" == *"requires a key"* ]]
+    [[ "$nokey_z" != *"RDSHAUT1"* ]]
+}
+
+@test "Remote: -b rate limits bulk output but not interactive sessions" {
+    ./dsh -s -x -p 7812 -b rate=200000,session=200000 3>&- &
+    sleep 0.5
+
+    #about 400KB at 200KB/s, the bucket starts with 64KB
+    (printf 'head -c 400000 /dev/urandom\n' | ./dsh -c -p 7812 > /dev/null; date +%s%N > /tmp/dsh_bulk_$$.end) 3>&- &
+    bulk_pid=$!
+    start=$(date +%s%N)
+    sleep 0.3
+    before=$(date +%s%N)
+    quick=$(printf 'echo interactive\n' | ./dsh -c -p 7812)
+    after=$(date +%s%N)
+    #not a bare wait, that would wait for the server too
+    wait $bulk_pid
+
+    bulk_ms=$(( ($(cat /tmp/dsh_bulk_$$.end) - start) / 1000000 ))
+    quick_ms=$(( (after - before) / 1000000 ))
+    rm -f /tmp/dsh_bulk_$$.end
+    printf 'stop-server\n' | ./dsh -c -p 7812
+
+    echo "bulk ${bulk_ms}ms, interactive ${quick_ms}ms"
+    echo "$quick"
+    [[ "$quick" == *"interactive"* ]]
+    [ $bulk_ms -ge 1500 ]
+    [ $quick_ms -lt 500 ]
+}
+
+@test "Remote: -b with only a session limit serves sessions side by side" {
+    ./dsh -s -x -p 7813 -b session=100000000 3>&- &
+    sleep 0.5
+
+    for i in 1 2 3 4; do
+        printf 'seq 1 200000 | wc -l\n' | ./dsh -c -p 7813 > /tmp/dsh_sess_$$.$i 3>&- &
+        pids="$pids $!"
+    done
+    wait $pids
+    output=$(cat /tmp/dsh_sess_$$.*)
+    rm -f /tmp/dsh_sess_$$.*
+    printf 'stop-server\n' | ./dsh -c -p 7813
+
+    echo "$output"
+    [ $(echo "$output" | grep -c "> 200000$") -eq 4 ]
+}
+
+@test "Remote: -o uring=1 serves commands through io_uring" {
+    ./dsh -s -x -p 7814 -o uring=1 3>&- &
+    sleep 0.5
+
+    run bash -c "printf 'cd /tmp\npwd\nseq 1 100000 | wc -l\nexit\n' | ./dsh -c -p 7814"
+    second=$(printf 'echo second-session\n' | ./dsh -c -p 7814)
+    printf 'stop-server\n' | ./dsh -c -p 7814
+
+    echo "$output"
+    echo "$second"
+    [[ "$output" == *"/tmp"* ]]
+    [[ "$output" == *"100000"* ]]
+    [[ "$second" == *"second-session"* ]]
+}
+
+@test "Remote: client keeps typed-ahead lines and recalls history" {
+    ./dsh -s -p 7815 3>&- &
+    sleep 0.5
+
+    #echo typed-ahead is typed while sleep runs, up arrow brings it back
+    output=$( (printf 'sleep 1\n'; sleep 0.3; printf 'echo typed-ahead\n'; sleep 1.5; printf '\033[A\n'; sleep 0.3; printf 'exit\n') | script -qec "./dsh -c -p 7815" /dev/null)
+    printf 'stop-server\n' | ./dsh -c -p 7815
+
+    echo "$output"
+    [ $(echo "$output" | grep -c "^typed-ahead") -eq 2 ]
+}
+
+@test "rsh_sendv() picks up after short writes and EAGAIN" {
+    make -s bench/rsh_zbench
+
+    #a 4KB non-blocking socket buffer cannot take a 64KB frame in one go
+    run ./bench/rsh_zbench -m 1 -b 0 -s 4096
+
+    echo "$output"
+    [ "$status" -eq 0 ]
+    [ $(echo "$output" | grep -c " ok$") -eq 4 ]
+}
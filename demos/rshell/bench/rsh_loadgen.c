@@ -0,0 +1,520 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_loadgen - open loop load generator for the rsh server
+ *
+ * Opens N sessions to a server and sends a mix of commands at a fixed
+ * total rate for a while, then reports the throughput and the latency
+ * distribution.
+ *
+ * It is open loop: request i is due at start + i / rate, whether or not
+ * the server has kept up.  Requests are dealt out to the sessions in
+ * turn.  A session only has one request out at a time (the plain
+ * protocol has no ids), so a due request waits for the one before it.
+ * Its latency is still counted from when it was due, not from when it
+ * could be sent.  A closed loop load generator that waits for a reply
+ * before it sends again quietly sends less when the server stalls, and
+ * never counts the requests it did not send (coordinated omission).  Both
+ * numbers are reported:
+ *
+ *   response  from when the request was due to its RDSH_EOF_CHAR, what a
+ *             user sending at this rate sees
+ *   service   from when it was actually sent, what a closed loop tool
+ *             would have reported
+ *
+ * The histograms are log linear, in the style of HdrHistogram: exact
+ * below LOAD_HIST_SUB usec, and after that each power of two is split
+ * into LOAD_HIST_SUB / 2 buckets.  So every value is within 1% of the
+ * truth, from a few usec to hours, in a few thousand counters.
+ *
+ * With -S the server is started (and stopped) by the load generator, so
+ * `make loadtest` can run the same load against each server mode.
+ *
+ *   usage: rsh_loadgen [-c sessions] [-r rate] [-d secs] [-w secs]
+ *                      [-f mixfile] [-i ip] [-p port] [-u path]
+ *                      [-o opts] [-S "server command"] [-n name]
+ *                      [-l results]
+ */
+
+#define LOAD_DEF_SESSIONS   4
+#define LOAD_DEF_RATE       1000        //requests per second, all sessions
+#define LOAD_DEF_SECS       5
+#define LOAD_DEF_PORT       7820
+#define LOAD_DRAIN_SECS     5           //wait this long for late responses
+#define LOAD_CONNECT_TRIES  200         //10ms apart, while the server boots
+#define LOAD_MAX_MIX        32
+#define LOAD_HIST_BITS      8
+#define LOAD_HIST_SUB       (1 << LOAD_HIST_BITS)
+#define LOAD_HIST_MAX_SHIFT 40
+#define LOAD_HIST_SZ        ((LOAD_HIST_MAX_SHIFT + 2) * (LOAD_HIST_SUB / 2))
+
+typedef struct load_hist{
+    uint64_t  counts[LOAD_HIST_SZ];
+    uint64_t  total;
+    uint64_t  max;
+}load_hist_t;
+
+typedef struct load_req{
+    uint64_t  due;              //usec, when it should have been sent
+    int       cmd;              //index into the mix
+}load_req_t;
+
+typedef struct load_conn{
+    int         sock;
+    load_req_t *queue;          //due but not sent yet, a ring
+    int         head;
+    int         count;
+    int         cap;
+    int         busy;           //a request is out
+    load_req_t  out;
+    uint64_t    sent;           //usec, when out was sent
+}load_conn_t;
+
+typedef struct load_mix{
+    char  *cmd[LOAD_MAX_MIX];
+    int    weight[LOAD_MAX_MIX];
+    int    num;
+    int    total;
+}load_mix_t;
+
+//used when there is no -f, mostly built-ins and small commands
+static const char *def_mix[][2] = {
+    {"6", "echo hello"},
+    {"2", "cd ."},
+    {"1", "ls /"},
+    {"1", "uname -a"},
+};
+
+static uint64_t now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int hist_index(uint64_t v){
+    int shift = 0;
+
+    if (v >= LOAD_HIST_SUB)
+        shift = (63 - __builtin_clzll(v)) - (LOAD_HIST_BITS - 1);
+    if (shift > LOAD_HIST_MAX_SHIFT)
+        return LOAD_HIST_SZ - 1;
+    return (shift << (LOAD_HIST_BITS - 1)) + (int)(v >> shift);
+}
+
+//the highest value that lands in bucket i
+static uint64_t hist_value(int i){
+    int half = LOAD_HIST_SUB / 2;
+    int shift = (i < LOAD_HIST_SUB) ? 0 : (i / half) - 1;
+    uint64_t sub = i - ((uint64_t)shift << (LOAD_HIST_BITS - 1));
+
+    return ((sub + 1) << shift) - 1;
+}
+
+static void hist_record(load_hist_t *h, uint64_t v){
+    h->counts[hist_index(v)]++;
+    h->total++;
+    if (v > h->max)
+        h->max = v;
+}
+
+static uint64_t hist_percentile(const load_hist_t *h, double pct){
+    uint64_t want = (uint64_t)(h->total * pct / 100.0 + 0.5);
+    uint64_t seen = 0;
+
+    if (want == 0)
+        want = 1;
+    for (int i = 0; i < LOAD_HIST_SZ; i++){
+        seen += h->counts[i];
+        if (seen >= want)
+            return (hist_value(i) < h->max) ? hist_value(i) : h->max;
+    }
+    return h->max;
+}
+
+//"weight command" per line, blank lines and # comments are skipped
+static int load_mix_file(load_mix_t *mix, const char *path){
+    char line[SH_CMD_MAX];
+    char *cmd;
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL){
+        perror(path);
+        return ERR_CMD_ARGS_BAD;
+    }
+    while ((mix->num < LOAD_MAX_MIX) && (fgets(line, sizeof(line), fp) != NULL)){
+        line[strcspn(line, "\n")] = '\0';
+        if ((line[0] == '\0') || (line[0] == '#'))
+            continue;
+        mix->weight[mix->num] = (int)strtol(line, &cmd, 10);
+        while (*cmd == ' ' || *cmd == '\t')
+            cmd++;
+        if ((mix->weight[mix->num] <= 0) || (*cmd == '\0')){
+            fprintf(stderr, "%s: bad line: %s\n", path, line);
+            fclose(fp);
+            return ERR_CMD_ARGS_BAD;
+        }
+        mix->cmd[mix->num] = strdup(cmd);
+        mix->total += mix->weight[mix->num++];
+    }
+    fclose(fp);
+    return (mix->num > 0) ? OK : ERR_CMD_ARGS_BAD;
+}
+
+static void load_mix_default(load_mix_t *mix){
+    for (size_t i = 0; i < sizeof(def_mix) / sizeof(def_mix[0]); i++){
+        mix->weight[mix->num] = atoi(def_mix[i][0]);
+        mix->cmd[mix->num] = strdup(def_mix[i][1]);
+        mix->total += mix->weight[mix->num++];
+    }
+}
+
+//the same sequence of commands every run, so runs can be compared
+static int load_mix_pick(const load_mix_t *mix, unsigned int *seed){
+    int r = rand_r(seed) % mix->total;
+
+    for (int i = 0; i < mix->num; i++){
+        r -= mix->weight[i];
+        if (r < 0)
+            return i;
+    }
+    return 0;
+}
+
+static int queue_push(load_conn_t *c, load_req_t req){
+    if (c->count == c->cap){
+        int cap = c->cap ? c->cap * 2 : 64;
+        load_req_t *q = malloc(sizeof(load_req_t) * cap);
+
+        if (q == NULL)
+            return ERR_MEMORY;
+        for (int i = 0; i < c->count; i++)
+            q[i] = c->queue[(c->head + i) % c->cap];
+        free(c->queue);
+        c->queue = q;
+        c->head = 0;
+        c->cap = cap;
+    }
+    c->queue[(c->head + c->count++) % c->cap] = req;
+    return OK;
+}
+
+//the server, its log goes to /dev/null so it does not mix with ours
+static pid_t start_server_cmd(const char *cmd){
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0){
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+//start_client() until the server is up, without its complaints meanwhile
+static int connect_server(char *ip, int port){
+    int err_fd = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    int sock = ERR_RDSH_CLIENT;
+
+    dup2(null_fd, STDERR_FILENO);
+    for (int i = 0; (i < LOAD_CONNECT_TRIES) && (sock < 0); i++){
+        sock = start_client(ip, port);
+        if (sock < 0)
+            usleep(10000);
+    }
+    dup2(err_fd, STDERR_FILENO);
+    close(err_fd);
+    close(null_fd);
+    return sock;
+}
+
+static void stop_server_cmd(pid_t pid, char *ip, int port){
+    char stop[] = "stop-server";
+    char buff[256];
+    int sock = start_client(ip, port);
+
+    if (sock >= 0){
+        rsh_send_all(sock, stop, sizeof(stop));
+        while (rsh_recv(sock, buff, sizeof(buff)) > 0)
+            ;
+        close(sock);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+static int send_next(load_conn_t *c, const load_mix_t *mix){
+    c->out = c->queue[c->head];
+    c->head = (c->head + 1) % c->cap;
+    c->count--;
+    c->busy = true;
+    c->sent = now_usec();
+    return rsh_send_all(c->sock, mix->cmd[c->out.cmd], strlen(mix->cmd[c->out.cmd]) + 1);
+}
+
+typedef struct load_result{
+    load_hist_t  response;
+    load_hist_t  service;
+    uint64_t     scheduled;
+    uint64_t     completed;
+    uint64_t     errors;
+    uint64_t     first_due;     //usec, measured window
+    uint64_t     last_done;
+}load_result_t;
+
+/*
+ * run_load(conns, n, mix, rate, secs, warm, res)
+ *      The main loop: hand out requests as they come due, send them when
+ *      their session is free, and record each response as it completes.
+ *      Requests due during the first warm seconds are sent but not
+ *      counted.
+ */
+static int run_load(load_conn_t *conns, int n, const load_mix_t *mix, int rate,
+                    int secs, int warm, load_result_t *res){
+    struct pollfd *pfd = calloc(n, sizeof(struct pollfd));
+    char *buff = malloc(RDSH_COMM_BUFF_SZ);
+    unsigned int seed = 1;
+    uint64_t start = now_usec();
+    uint64_t warm_end = start + (uint64_t)warm * 1000000;
+    uint64_t end = start + (uint64_t)(warm + secs) * 1000000;
+    uint64_t deadline = end + LOAD_DRAIN_SECS * 1000000ULL;
+    uint64_t seq = 0;
+    uint64_t next_due = start;
+    int outstanding = 0;
+    uint64_t now;
+    int timeout;
+    int rc = OK;
+
+    if ((pfd == NULL) || (buff == NULL))
+        return ERR_MEMORY;
+    res->first_due = warm_end;
+
+    while (rc == OK){
+        now = now_usec();
+
+        //everything that is due by now, even if we fell behind
+        while ((next_due <= now) && (next_due < end)){
+            load_req_t req = {next_due, load_mix_pick(mix, &seed)};
+            if (queue_push(&conns[seq % n], req) != OK)
+                return ERR_MEMORY;
+            if (next_due >= warm_end)
+                res->scheduled++;
+            outstanding++;
+            seq++;
+            next_due = start + seq * 1000000 / rate;
+        }
+        if (((now >= end) && (outstanding == 0)) || (now >= deadline))
+            break;
+
+        for (int i = 0; i < n; i++){
+            if (!conns[i].busy && (conns[i].count > 0) && (conns[i].sock >= 0) &&
+                (send_next(&conns[i], mix) != OK)){
+                close(conns[i].sock);
+                conns[i].sock = -1;
+            }
+            pfd[i].fd = conns[i].busy ? conns[i].sock : -1;
+            pfd[i].events = POLLIN;
+            pfd[i].revents = 0;
+        }
+
+        timeout = (next_due < end) ? (int)((next_due > now) ? (next_due - now) / 1000 : 0)
+                                   : 100;
+        if (poll(pfd, n, timeout) < 0)
+            continue;
+
+        now = now_usec();
+        for (int i = 0; i < n; i++){
+            load_conn_t *c = &conns[i];
+            int got;
+
+            if (!pfd[i].revents)
+                continue;
+            got = rsh_recv(c->sock, buff, RDSH_COMM_BUFF_SZ);
+            if (got <= 0){
+                //the session is gone, its requests will never complete
+                res->errors += c->count + 1;
+                outstanding -= c->count + 1;
+                c->count = 0;
+                c->busy = false;
+                close(c->sock);
+                c->sock = -1;
+                continue;
+            }
+            if (buff[got - 1] != RDSH_EOF_CHAR)
+                continue;
+
+            c->busy = false;
+            outstanding--;
+            if (c->out.due >= warm_end){
+                hist_record(&res->response, now - c->out.due);
+                hist_record(&res->service, now - c->sent);
+                res->completed++;
+                res->last_done = now;
+            }
+        }
+    }
+
+    free(pfd);
+    free(buff);
+    return rc;
+}
+
+static void report(const load_result_t *res, const char *name, int n, int rate,
+                   const char *out_path){
+    static const double pcts[] = {50, 75, 90, 99, 99.9, 99.99, 100};
+    double secs = (res->last_done > res->first_due) ?
+                  (res->last_done - res->first_due) / 1e6 : 0;
+    double tput = (secs > 0) ? res->completed / secs : 0;
+    FILE *fp;
+
+    printf("%s: %d sessions, target %d req/s, achieved %.1f req/s\n", name, n, rate, tput);
+    printf("  scheduled %llu, completed %llu, errors %llu, incomplete %llu\n",
+           (unsigned long long)res->scheduled, (unsigned long long)res->completed,
+           (unsigned long long)res->errors,
+           (unsigned long long)(res->scheduled - res->completed - res->errors));
+    printf("  %10s %14s %14s\n", "percentile", "response us", "service us");
+    for (size_t i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++){
+        printf("  %10.2f %14llu %14llu\n", pcts[i],
+               (unsigned long long)hist_percentile(&res->response, pcts[i]),
+               (unsigned long long)hist_percentile(&res->service, pcts[i]));
+    }
+
+    if (out_path == NULL)
+        return;
+    fp = fopen(out_path, "a");
+    if (fp == NULL){
+        perror(out_path);
+        return;
+    }
+    //one line per run, tab separated, for tracking runs over time
+    fprintf(fp, "%ld\t%s\t%d\t%d\t%.1f\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+            (long)time(NULL), name, n, rate, tput, (unsigned long long)res->errors,
+            (unsigned long long)hist_percentile(&res->response, 50),
+            (unsigned long long)hist_percentile(&res->response, 99),
+            (unsigned long long)hist_percentile(&res->response, 99.9),
+            (unsigned long long)res->response.max,
+            (unsigned long long)hist_percentile(&res->service, 99));
+    fclose(fp);
+}
+
+static void usage(const char *prog){
+    printf("usage: %s [-c sessions] [-r rate] [-d secs] [-w secs] [-f mixfile]\n"
+           "       %*s [-i ip] [-p port] [-u path] [-o opts] [-S cmd] [-n name]\n"
+           "       %*s [-l results]\n",
+           prog, (int)strlen(prog), "", (int)strlen(prog), "");
+    printf("  -c N      concurrent sessions (default %d)\n", LOAD_DEF_SESSIONS);
+    printf("  -r N      requests per second over all sessions (default %d)\n", LOAD_DEF_RATE);
+    printf("  -d SECS   how long to measure (default %d)\n", LOAD_DEF_SECS);
+    printf("  -w SECS   warm up first, not counted (default 0)\n");
+    printf("  -f FILE   command mix, \"weight command\" per line\n");
+    printf("  -i IP     server address (default %s)\n", RDSH_DEF_CLI_CONNECT);
+    printf("  -p PORT   server port (default %d)\n", LOAD_DEF_PORT);
+    printf("  -u PATH   connect to a Unix domain socket instead\n");
+    printf("  -o OPTS   socket options of the sessions, as for dsh -o\n");
+    printf("  -S CMD    start the server with CMD first and stop it after\n");
+    printf("  -n NAME   name of the run in the report (default \"rsh\")\n");
+    printf("  -l FILE   append a tab separated summary line to FILE\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    char ip[16] = RDSH_DEF_CLI_CONNECT;
+    int n = LOAD_DEF_SESSIONS;
+    int rate = LOAD_DEF_RATE;
+    int secs = LOAD_DEF_SECS;
+    int warm = 0;
+    int port = LOAD_DEF_PORT;
+    char *mix_path = NULL;
+    char *server_cmd = NULL;
+    char *name = "rsh";
+    char *out_path = NULL;
+    char *net_opts = NULL;
+    load_mix_t mix;
+    load_conn_t *conns;
+    load_result_t *res;
+    pid_t server = -1;
+    int rc = OK;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:r:d:w:f:i:p:u:o:S:n:l:h")) != -1){
+        switch (opt){
+            case 'c': n = atoi(optarg); break;
+            case 'r': rate = atoi(optarg); break;
+            case 'd': secs = atoi(optarg); break;
+            case 'w': warm = atoi(optarg); break;
+            case 'f': mix_path = optarg; break;
+            case 'i': strncpy(ip, optarg, sizeof(ip) - 1); break;
+            case 'p': port = atoi(optarg); break;
+            case 'u': set_net_unix_path(optarg); break;
+            case 'S': server_cmd = optarg; break;
+            case 'n': name = optarg; break;
+            case 'o': net_opts = optarg; break;
+            case 'l': out_path = optarg; break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if ((n <= 0) || (rate <= 0) || (secs <= 0) || (warm < 0) || (port <= 0))
+        usage(argv[0]);
+    if ((net_opts != NULL) && (parse_net_opts(net_opts) != OK)){
+        fprintf(stderr, "bad socket options\n");
+        return EXIT_FAILURE;
+    }
+
+    memset(&mix, 0, sizeof(mix));
+    if (mix_path != NULL){
+        if (load_mix_file(&mix, mix_path) != OK)
+            return EXIT_FAILURE;
+    } else {
+        load_mix_default(&mix);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    if (server_cmd != NULL)
+        server = start_server_cmd(server_cmd);
+
+    conns = calloc(n, sizeof(load_conn_t));
+    res = calloc(1, sizeof(load_result_t));
+    if ((conns == NULL) || (res == NULL))
+        return EXIT_FAILURE;
+    for (int i = 0; (i < n) && (rc == OK); i++){
+        conns[i].sock = connect_server(ip, port);
+        if (conns[i].sock < 0){
+            fprintf(stderr, "%s: could not open session %d\n", name, i + 1);
+            rc = ERR_RDSH_CLIENT;
+        }
+    }
+
+    if (rc == OK)
+        rc = run_load(conns, n, &mix, rate, secs, warm, res);
+    if (rc == OK)
+        report(res, name, n, rate, out_path);
+
+    for (int i = 0; i < n; i++){
+        if (conns[i].sock >= 0)
+            close(conns[i].sock);
+        free(conns[i].queue);
+    }
+    if (server > 0)
+        stop_server_cmd(server, ip, port);
+    free(conns);
+    free(res);
+    return (rc == OK) ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_netbench - per command latency over each transport
+ *
+ * Starts a real server with start_server(), the way `dsh -s` would, for
+ * each of the transport settings below and times commands from send to
+ * RDSH_EOF_CHAR with the plain protocol:
+ *
+ *   cd    `cd .`, handled in the session without a fork, so it is mostly
+ *         the round trip itself
+ *   echo  `echo hi`, a command launch on top of the round trip
+ *
+ *   usage: rsh_netbench [-n commands] [-p port] [-u path]
+ */
+
+#define BENCH_DEF_CMDS      2000
+#define BENCH_DEF_PORT      7799
+#define BENCH_DEF_PATH      "/tmp/rsh_netbench.sock"
+#define BENCH_CONNECT_TRIES 200     //10ms apart, while the server boots
+
+typedef struct bench_net{
+    const char *name;
+    int         use_unix;
+    const char *opts;
+}bench_net_t;
+
+static const bench_net_t bench_nets[] = {
+    {"tcp",          false, "nodelay=0,quickack=0"},
+    {"tcp+nodelay",  false, "nodelay=1,quickack=0"},
+    {"tcp+nd+qack",  false, "nodelay=1,quickack=1"},
+    {"unix",         true,  "nodelay=0,quickack=0"},
+};
+
+static double now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b){
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+//the server, its log goes to /dev/null so it does not mix with ours
+static pid_t fork_server(int port){
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0){
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+        _exit(start_server(RDSH_DEF_SVR_INTFACE, port, false) == OK_EXIT ? 0 : 1);
+    }
+    return pid;
+}
+
+//start_client() until the server is up, without its complaints meanwhile
+static int connect_server(int port){
+    int err_fd = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    int sock = ERR_RDSH_CLIENT;
+
+    dup2(null_fd, STDERR_FILENO);
+    for (int i = 0; (i < BENCH_CONNECT_TRIES) && (sock < 0); i++){
+        sock = start_client(RDSH_DEF_CLI_CONNECT, port);
+        if (sock < 0)
+            usleep(10000);
+    }
+    dup2(err_fd, STDERR_FILENO);
+    close(err_fd);
+    close(null_fd);
+    return sock;
+}
+
+//one command, the same exchange as exec_remote_cmd_loop() without framing
+static int round_trip(int sock, char *cmd, char *rsp_buff){
+    int n;
+
+    if (rsh_send_all(sock, cmd, strlen(cmd) + 1) != OK)
+        return ERR_RDSH_COMMUNICATION;
+    do {
+        n = rsh_recv(sock, rsp_buff, RDSH_COMM_BUFF_SZ);
+        if (n <= 0)
+            return ERR_RDSH_COMMUNICATION;
+    } while (rsp_buff[n - 1] != RDSH_EOF_CHAR);
+    return OK;
+}
+
+static void report(const char *net, const char *what, double *lat, int n){
+    double sum = 0;
+
+    for (int i = 0; i < n; i++)
+        sum += lat[i];
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf("%-12s %-5s %7d %10.1f %10.1f %10.1f %10.1f\n", net, what, n,
+           sum / n, lat[n / 2], lat[(int)(n * 0.99)], lat[n - 1]);
+}
+
+static int time_cmd(int sock, const char *net, const char *cmd, char *rsp_buff, int n){
+    double *lat = malloc(sizeof(double) * n);
+    char cmd_buff[64];
+    int rc = OK;
+
+    for (int i = 0; (i < n) && (rc == OK); i++){
+        double t0 = now_usec();
+        strcpy(cmd_buff, cmd);
+        rc = round_trip(sock, cmd_buff, rsp_buff);
+        lat[i] = now_usec() - t0;
+    }
+    if (rc == OK)
+        report(net, strncmp(cmd, "cd", 2) == 0 ? "cd" : "echo", lat, n);
+    free(lat);
+    return rc;
+}
+
+static int run_bench(const bench_net_t *net, char *path, int port, int n){
+    char *rsp_buff = malloc(RDSH_COMM_BUFF_SZ);
+    char opts[64];
+    char stop[] = "stop-server";
+    pid_t pid;
+    int sock;
+    int rc;
+
+    //the child inherits these, so both ends run with the same settings
+    strcpy(opts, net->opts);
+    parse_net_opts(opts);
+    set_net_unix_path(net->use_unix ? path : NULL);
+
+    pid = fork_server(port);
+    sock = connect_server(port);
+    if (sock < 0){
+        fprintf(stderr, "%s: could not reach the server\n", net->name);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        free(rsp_buff);
+        return ERR_RDSH_CLIENT;
+    }
+
+    rc = time_cmd(sock, net->name, "cd .", rsp_buff, n);
+    if (rc == OK)
+        rc = time_cmd(sock, net->name, "echo hi", rsp_buff, n);
+
+    round_trip(sock, stop, rsp_buff);
+    close(sock);
+    waitpid(pid, NULL, 0);
+    free(rsp_buff);
+    return rc;
+}
+
+static void usage(const char *prog){
+    printf("usage: %s [-n commands] [-p port] [-u path]\n", prog);
+    printf("  -n N      commands of each kind per transport (default %d)\n",
+           BENCH_DEF_CMDS);
+    printf("  -p PORT   port for the TCP runs (default %d)\n", BENCH_DEF_PORT);
+    printf("  -u PATH   socket path for the Unix domain run (default %s)\n",
+           BENCH_DEF_PATH);
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    int n = BENCH_DEF_CMDS;
+    int port = BENCH_DEF_PORT;
+    char *path = BENCH_DEF_PATH;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:p:u:h")) != -1){
+        switch (opt){
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'u':
+                path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if ((n <= 0) || (port <= 0))
+        usage(argv[0]);
+
+    printf("%-12s %-5s %7s %10s %10s %10s %10s\n", "transport", "cmd", "count",
+           "mean us", "p50 us", "p99 us", "max us");
+    for (size_t i = 0; i < sizeof(bench_nets) / sizeof(bench_nets[0]); i++){
+        if (run_bench(&bench_nets[i], path, port, n) != OK)
+            return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_ptybench - keystroke echo latency of a pty session
+ *
+ * Forks a server that handles one connection over loopback TCP, the way
+ * `dsh -s` would, and plays an interactive client against it.  It runs
+ * `cat` on the server's pty and then measures:
+ *
+ *   key   one keystroke sent until its echo comes back from the pty
+ *   line  "line\r" sent until both the echo and cat's copy of it are back
+ *
+ * with and without output compression.
+ *
+ *   usage: rsh_ptybench [-n keystrokes]
+ */
+
+#define BENCH_DEF_KEYS      2000
+#define BENCH_LINE          "line\r"
+#define BENCH_LINE_RSP      12      //"line\r\n" echoed plus "line\r\n" from cat
+
+static double now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b){
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int loopback_pair(int *cli, int *svr){
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    int lsock = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+        (listen(lsock, 1) < 0) ||
+        (getsockname(lsock, (struct sockaddr *)&addr, &alen) < 0)){
+        perror("loopback");
+        return -1;
+    }
+
+    *cli = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(*cli, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        perror("connect");
+        return -1;
+    }
+    *svr = accept(lsock, NULL, NULL);
+    close(lsock);
+    return (*svr < 0) ? -1 : 0;
+}
+
+//the server end, its log goes to /dev/null so it does not mix with ours
+static pid_t fork_server(int svr_sock, int cli_sock){
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0){
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+        close(cli_sock);
+        start_zygote();
+        exec_client_requests(svr_sock);
+        stop_zygote();
+        _exit(0);
+    }
+    close(svr_sock);
+    return pid;
+}
+
+static int send_keys(int sock, const char *keys, int len){
+    rdsh_frame_hdr_t hdr;
+
+    init_frame_hdr(&hdr, RDSH_FRAME_STDIN, 0, 1);
+    hdr.len = hdr.raw_len = len;
+    return send_frame(sock, &hdr, keys);
+}
+
+//reads output until want bytes of it have arrived
+static int wait_output(int sock, char *rsp_buff, int want){
+    rdsh_frame_hdr_t hdr;
+    char *data;
+    int n;
+
+    while (want > 0){
+        n = recv_frame(sock, &hdr, rsp_buff, RDSH_COMM_BUFF_SZ);
+        if ((n < 0) || (hdr.type != RDSH_FRAME_DATA))
+            return ERR_RDSH_COMMUNICATION;
+        n = frame_payload(&hdr, rsp_buff, rsp_buff + RDSH_COMM_BUFF_SZ,
+                          RDSH_COMM_BUFF_SZ, &data);
+        if (n < 0)
+            return ERR_RDSH_COMMUNICATION;
+        want -= n;
+    }
+    return OK;
+}
+
+static void report(const char *what, int compress, double *lat, int n){
+    double sum = 0;
+
+    for (int i = 0; i < n; i++)
+        sum += lat[i];
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf("%-5s %-5s %7d %10.1f %10.1f %10.1f %10.1f\n", what,
+           compress ? "lz4" : "raw", n, sum / n, lat[n / 2],
+           lat[(int)(n * 0.99)], lat[n - 1]);
+}
+
+static int run_bench(int compress, int n){
+    char *rsp_buff = malloc(RDSH_COMM_BUFF_SZ * 2);
+    double *key_lat = malloc(sizeof(double) * n);
+    double *line_lat = malloc(sizeof(double) * n);
+    char cmd[] = "cat";
+    int cli, svr;
+    pid_t pid;
+    int rc = OK;
+
+    if (loopback_pair(&cli, &svr) < 0)
+        return ERR_RDSH_CLIENT;
+    pid = fork_server(svr, cli);
+
+    set_client_pty(true);
+    set_client_compression(compress);
+    if ((negotiate_session(cli, rsp_buff) != true) ||
+        (strstr(rsp_buff, "pty=1") == NULL) ||
+        (pty_client_start(cli) != OK) ||
+        (send_request(cli, true, 1, 0, cmd) != OK)){
+        printf(RCMD_ERR_PTY_PROTO);
+        rc = ERR_RDSH_COMMUNICATION;
+    }
+
+    for (int i = 0; (i < n) && (rc == OK); i++){
+        double t0 = now_usec();
+        rc = send_keys(cli, "x", 1);
+        if (rc == OK)
+            rc = wait_output(cli, rsp_buff, 1);
+        key_lat[i] = now_usec() - t0;
+    }
+    //the x's are a line of their own for cat, get it out of the way
+    if (rc == OK)
+        rc = send_keys(cli, "\r", 1);
+    if (rc == OK)
+        rc = wait_output(cli, rsp_buff, 2 + n + 2);
+
+    for (int i = 0; (i < n) && (rc == OK); i++){
+        double t0 = now_usec();
+        rc = send_keys(cli, BENCH_LINE, strlen(BENCH_LINE));
+        if (rc == OK)
+            rc = wait_output(cli, rsp_buff, BENCH_LINE_RSP);
+        line_lat[i] = now_usec() - t0;
+    }
+
+    if (rc == OK){
+        report("key", compress, key_lat, n);
+        report("line", compress, line_lat, n);
+    }
+
+    //^D ends cat, closing the connection ends the server
+    send_keys(cli, "\x04", 1);
+    close(cli);
+    waitpid(pid, NULL, 0);
+    free(rsp_buff);
+    free(key_lat);
+    free(line_lat);
+    return rc;
+}
+
+static void usage(const char *prog){
+    printf("usage: %s [-n keystrokes]\n", prog);
+    printf("  -n N      keystrokes and lines per run (default %d)\n", BENCH_DEF_KEYS);
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    int n = BENCH_DEF_KEYS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1){
+        switch (opt){
+            case 'n':
+                n = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (n <= 0)
+        usage(argv[0]);
+
+    printf("%-5s %-5s %7s %10s %10s %10s %10s\n", "echo", "mode", "count",
+           "mean us", "p50 us", "p99 us", "max us");
+    for (int z = 0; z < 2; z++){
+        if (run_bench(z, n) != OK)
+            return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_spawnbench - command launch latency, fork from the server vs zygote
+ *
+ * Runs `true` the way rsh_execute_pipeline() does, either forking the
+ * pipeline from this process or handing it to the zygote, and times each
+ * launch from start to exit code.  Between rounds the process grows its
+ * heap, standing in for a server that has been up a while with many
+ * sessions.  Forking gets slower as the heap grows (the page tables have
+ * to be copied), the zygote stays small so it should not.
+ *
+ *   usage: rsh_spawnbench [-n launches] [-m MB,MB,...]
+ */
+
+#define BENCH_DEF_LAUNCHES  500
+#define BENCH_DEF_HEAPS     "0,256,1024"
+#define BENCH_MAX_HEAPS     8
+
+static double now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b){
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+//one launch, the same steps as rsh_execute_pipeline() minus the relay
+static double launch(command_list_t *clist, int use_zygote){
+    pid_t pids[CMD_MAX];
+    int out_pipe[2];
+    int in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    int status_fd = -1;
+    char buff[256];
+    double t0 = now_usec();
+
+    if (pipe2(out_pipe, O_CLOEXEC) < 0){
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    if (use_zygote)
+        status_fd = zygote_spawn(clist, in_fd, out_pipe[1], -1, NULL, false);
+    else if (rsh_spawn_pipeline(clist, in_fd, out_pipe[1], -1, NULL, pids) != OK)
+        exit(EXIT_FAILURE);
+    if (use_zygote && status_fd < 0)
+        exit(EXIT_FAILURE);
+    close(in_fd);
+    close(out_pipe[1]);
+
+    while (read(out_pipe[0], buff, sizeof(buff)) > 0)
+        ;
+    close(out_pipe[0]);
+
+    if (use_zygote)
+        zygote_wait(status_fd);
+    else
+        rsh_wait_pipeline(clist, pids);
+    return now_usec() - t0;
+}
+
+static void run_round(command_list_t *clist, int heap_mb, int use_zygote, int n){
+    double *lat = malloc(sizeof(double) * n);
+    double sum = 0;
+
+    for (int i = 0; i < n; i++){
+        lat[i] = launch(clist, use_zygote);
+        sum += lat[i];
+    }
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf("%7d %-7s %10.1f %10.1f %10.1f %10.1f\n", heap_mb,
+           use_zygote ? "zygote" : "fork", sum / n, lat[n / 2],
+           lat[(int)(n * 0.99)], lat[n - 1]);
+    free(lat);
+}
+
+static void usage(const char *prog){
+    printf("usage: %s [-n launches] [-m MB,MB,...]\n", prog);
+    printf("  -n N      launches per round (default %d)\n", BENCH_DEF_LAUNCHES);
+    printf("  -m HEAPS  server heap sizes in MB to test at (default %s)\n",
+           BENCH_DEF_HEAPS);
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    int n = BENCH_DEF_LAUNCHES;
+    char heaps_arg[128] = BENCH_DEF_HEAPS;
+    int heaps[BENCH_MAX_HEAPS];
+    int num_heaps = 0;
+    int grown = 0;
+    char cmd[] = "true";
+    command_list_t clist;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:m:h")) != -1){
+        switch (opt){
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'm':
+                strncpy(heaps_arg, optarg, sizeof(heaps_arg) - 1);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    for (char *tok = strtok(heaps_arg, ","); tok && num_heaps < BENCH_MAX_HEAPS;
+         tok = strtok(NULL, ","))
+        heaps[num_heaps++] = atoi(tok);
+    if (n <= 0)
+        usage(argv[0]);
+
+    //like the server, the zygote is started while we are still small
+    if (start_zygote() != OK)
+        return EXIT_FAILURE;
+    if (build_cmd_list(cmd, &clist) != OK)
+        return EXIT_FAILURE;
+
+    printf("%7s %-7s %10s %10s %10s %10s\n", "heap MB", "launch", "mean us",
+           "p50 us", "p99 us", "max us");
+    for (int h = 0; h < num_heaps; h++){
+        //grow the heap and touch it so the pages are really mapped
+        if (heaps[h] > grown){
+            size_t len = (size_t)(heaps[h] - grown) * 1024 * 1024;
+            char *mem = malloc(len);
+            if (mem == NULL){
+                perror("malloc");
+                break;
+            }
+            memset(mem, 1, len);
+            grown = heaps[h];
+        }
+        run_round(&clist, grown, false, n);
+        run_round(&clist, grown, true, n);
+    }
+
+    free_cmd_list(&clist);
+    stop_zygote();
+    return 0;
+}
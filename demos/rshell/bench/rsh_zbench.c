@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_zbench - throughput and CPU cost of rsh output compression
+ *
+ * Pushes a payload through the same send_data_frame()/recv_frame() path
+ * the server and client use, over a loopback TCP connection:
+ *
+ *   sender --socketpair--> shaper --127.0.0.1 TCP--> receiver
+ *
+ * The shaper thread is a token bucket, like a tc tbf qdisc, so we can see
+ * what compression buys on a slow link without needing root to set up tc.
+ * A rate of 0 means the shaper just copies as fast as it can.
+ *
+ * With -s the sender's end of the socketpair is non-blocking with a
+ * SO_SNDBUF of that many bytes.  A frame no longer fits in one sendmsg(),
+ * so rsh_sendv() has to pick up after short writes and EAGAIN, and the
+ * check column says whether every byte still arrived in order.  The exit
+ * status is 1 if any run did not check out.
+ *
+ *   usage: rsh_zbench [-m MB] [-b mbit,mbit,...] [-s BYTES]
+ */
+
+#define BENCH_DEF_MB        8
+#define BENCH_DEF_RATES     "0,1000,100"
+#define BENCH_MAX_RATES     8
+#define SHAPER_BURST        (64 * 1024)
+
+typedef struct bench_run{
+    const char *payload_name;
+    char       *payload;
+    int         payload_len;
+    int         compress;
+    double      rate_mbit;
+    int         sndbuf;         //-s, 0 leaves the sender blocking
+
+    //results
+    double      wall_sec;
+    double      send_cpu;
+    double      recv_cpu;
+    uint64_t    wire_bytes;
+    uint64_t    raw_bytes;
+    int         ok;
+}bench_run_t;
+
+typedef struct shaper{
+    int     in_fd;
+    int     out_fd;
+    double  rate_mbit;
+    uint64_t bytes;
+}shaper_t;
+
+typedef struct sender{
+    int          fd;
+    bench_run_t *run;
+}sender_t;
+
+static double now_sec(clockid_t clk){
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//log like text, a handful of fields that vary a little line to line
+static void make_log_payload(char *buff, int len){
+    static const char *levels[] = {"INFO", "INFO", "INFO", "WARN", "DEBUG"};
+    static const char *paths[] = {"/api/v1/items", "/api/v1/users",
+                                  "/healthz", "/api/v1/orders/search"};
+    unsigned int seed = 42;
+    int off = 0;
+    int n = 0;
+
+    while (off < len){
+        char line[256];
+        int l = snprintf(line, sizeof(line),
+            "2026-10-19T12:%02d:%02d.%03dZ %-5s [worker-%d] request id=%d "
+            "path=%s status=%d latency_ms=%d\n",
+            (n / 60000) % 60, (n / 1000) % 60, n % 1000,
+            levels[rand_r(&seed) % 5], rand_r(&seed) % 8, 100000 + n,
+            paths[rand_r(&seed) % 4], (rand_r(&seed) % 10) ? 200 : 500,
+            rand_r(&seed) % 250);
+        if (l > len - off)
+            l = len - off;
+        memcpy(buff + off, line, l);
+        off += l;
+        n++;
+    }
+}
+
+static void make_random_payload(char *buff, int len){
+    uint64_t x = 88172645463325252ULL;
+
+    for (int i = 0; i < len; i++){
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buff[i] = (char)(x >> 24);
+    }
+}
+
+static void *sender_thread(void *arg){
+    sender_t *snd = arg;
+    bench_run_t *run = snd->run;
+    rsh_lz_ctx_t lz;
+    rdsh_frame_hdr_t hdr;
+    double cpu0 = now_sec(CLOCK_THREAD_CPUTIME_ID);
+
+    memset(&lz, 0, sizeof(lz));
+    lz.enabled = run->compress;
+    lz.zbuff = malloc(RDSH_COMM_BUFF_SZ);
+
+    for (int off = 0; off < run->payload_len; off += RDSH_COMM_BUFF_SZ){
+        int len = run->payload_len - off;
+        if (len > RDSH_COMM_BUFF_SZ)
+            len = RDSH_COMM_BUFF_SZ;
+        init_frame_hdr(&hdr, RDSH_FRAME_DATA, 0, 0);
+        if (send_data_frame(snd->fd, &lz, &hdr, run->payload + off, len) != OK)
+            break;
+    }
+    send_end_frame(snd->fd, 0, 0, 0);
+    shutdown(snd->fd, SHUT_WR);
+
+    run->send_cpu = now_sec(CLOCK_THREAD_CPUTIME_ID) - cpu0;
+    free(lz.zbuff);
+    return NULL;
+}
+
+//token bucket between the sender and the TCP connection
+static void *shaper_thread(void *arg){
+    shaper_t *sh = arg;
+    char *buff = malloc(SHAPER_BURST);
+    double bytes_per_sec = sh->rate_mbit * 1e6 / 8;
+    double tokens = SHAPER_BURST;
+    double last = now_sec(CLOCK_MONOTONIC);
+    ssize_t n;
+
+    while ((n = read(sh->in_fd, buff, SHAPER_BURST)) > 0){
+        if (bytes_per_sec > 0){
+            while (1){
+                double t = now_sec(CLOCK_MONOTONIC);
+                tokens += (t - last) * bytes_per_sec;
+                last = t;
+                if (tokens > SHAPER_BURST)
+                    tokens = SHAPER_BURST;
+                if (tokens >= n)
+                    break;
+                double wait = (n - tokens) / bytes_per_sec;
+                struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+                nanosleep(&ts, NULL);
+            }
+            tokens -= n;
+        }
+        if (rsh_send_all(sh->out_fd, buff, n) != OK)
+            break;
+        sh->bytes += n;
+    }
+    shutdown(sh->out_fd, SHUT_WR);
+    free(buff);
+    return NULL;
+}
+
+static int loopback_pair(int *cli, int *svr){
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    int lsock = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+        (listen(lsock, 1) < 0) ||
+        (getsockname(lsock, (struct sockaddr *)&addr, &alen) < 0)){
+        perror("loopback");
+        return -1;
+    }
+
+    *cli = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(*cli, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        perror("connect");
+        return -1;
+    }
+    *svr = accept(lsock, NULL, NULL);
+    close(lsock);
+    return (*svr < 0) ? -1 : 0;
+}
+
+static void run_bench(bench_run_t *run){
+    int sp[2];
+    int tx, rx;
+    pthread_t snd_tid, sh_tid;
+    sender_t snd;
+    shaper_t sh;
+    rdsh_frame_hdr_t hdr;
+    char *rbuff = malloc(RDSH_COMM_BUFF_SZ);
+    char *raw = malloc(RDSH_COMM_BUFF_SZ);
+    char *data;
+    int off = 0;
+    int n;
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sp);
+    if (loopback_pair(&tx, &rx) < 0)
+        exit(EXIT_FAILURE);
+    if (run->sndbuf > 0){
+        setsockopt(sp[0], SOL_SOCKET, SO_SNDBUF, &run->sndbuf, sizeof(int));
+        fcntl(sp[0], F_SETFL, O_NONBLOCK);
+    }
+
+    memset(&sh, 0, sizeof(sh));
+    sh.in_fd = sp[1];
+    sh.out_fd = tx;
+    sh.rate_mbit = run->rate_mbit;
+    snd.fd = sp[0];
+    snd.run = run;
+
+    double t0 = now_sec(CLOCK_MONOTONIC);
+    double cpu0 = now_sec(CLOCK_THREAD_CPUTIME_ID);
+    pthread_create(&sh_tid, NULL, shaper_thread, &sh);
+    pthread_create(&snd_tid, NULL, sender_thread, &snd);
+
+    run->ok = 1;
+    while (1){
+        n = recv_frame(rx, &hdr, rbuff, RDSH_COMM_BUFF_SZ);
+        if ((n < 0) || (hdr.type == 0)){
+            run->ok = 0;
+            break;
+        }
+        if (hdr.type == RDSH_FRAME_END)
+            break;
+        n = frame_payload(&hdr, rbuff, raw, RDSH_COMM_BUFF_SZ, &data);
+        if ((n < 0) || (off + n > run->payload_len) ||
+            (memcmp(data, run->payload + off, n) != 0)){
+            run->ok = 0;
+            break;
+        }
+        off += n;
+    }
+    run->recv_cpu = now_sec(CLOCK_THREAD_CPUTIME_ID) - cpu0;
+    run->wall_sec = now_sec(CLOCK_MONOTONIC) - t0;
+    run->raw_bytes = off;
+    if (off != run->payload_len)
+        run->ok = 0;
+
+    pthread_join(snd_tid, NULL);
+    pthread_join(sh_tid, NULL);
+    run->wire_bytes = sh.bytes;
+
+    close(sp[0]);
+    close(sp[1]);
+    close(tx);
+    close(rx);
+    free(rbuff);
+    free(raw);
+}
+
+static void usage(const char *prog){
+    printf("usage: %s [-m MB] [-b mbit,mbit,...] [-s BYTES]\n", prog);
+    printf("  -m MB     payload size in MB (default %d)\n", BENCH_DEF_MB);
+    printf("  -b RATES  shaped link rates in Mbit/s, 0 is unshaped (default %s)\n",
+           BENCH_DEF_RATES);
+    printf("  -s BYTES  non-blocking sender with this SO_SNDBUF, for short writes\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    int mb = BENCH_DEF_MB;
+    char rates_arg[128] = BENCH_DEF_RATES;
+    double rates[BENCH_MAX_RATES];
+    int num_rates = 0;
+    int sndbuf = 0;
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:b:s:h")) != -1){
+        switch (opt){
+            case 'm':
+                mb = atoi(optarg);
+                break;
+            case 'b':
+                strncpy(rates_arg, optarg, sizeof(rates_arg) - 1);
+                break;
+            case 's':
+                sndbuf = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    for (char *tok = strtok(rates_arg, ","); tok && num_rates < BENCH_MAX_RATES;
+         tok = strtok(NULL, ","))
+        rates[num_rates++] = atof(tok);
+    if ((mb <= 0) || (sndbuf < 0))
+        usage(argv[0]);
+
+    int len = mb * 1024 * 1024;
+    const char *names[] = {"log", "random"};
+    char *payloads[2] = {malloc(len), malloc(len)};
+    make_log_payload(payloads[0], len);
+    make_random_payload(payloads[1], len);
+
+    printf("%-7s %-9s %-5s %9s %7s %9s %10s %10s %10s %s\n", "payload", "link",
+           "mode", "wire MB", "ratio", "wall ms", "raw MB/s", "send cpu", "recv cpu",
+           "check");
+    for (int p = 0; p < 2; p++){
+        for (int r = 0; r < num_rates; r++){
+            for (int z = 0; z < 2; z++){
+                bench_run_t run;
+                char link[32];
+
+                memset(&run, 0, sizeof(run));
+                run.payload_name = names[p];
+                run.payload = payloads[p];
+                run.payload_len = len;
+                run.compress = z;
+                run.rate_mbit = rates[r];
+                run.sndbuf = sndbuf;
+                run_bench(&run);
+                failed |= !run.ok;
+
+                if (rates[r] > 0)
+                    snprintf(link, sizeof(link), "%gMbit", rates[r]);
+                else
+                    snprintf(link, sizeof(link), "unshaped");
+                printf("%-7s %-9s %-5s %9.2f %7.2f %9.1f %10.1f %8.1fms %8.1fms %s\n",
+                       names[p], link, z ? "lz4" : "raw",
+                       run.wire_bytes / 1048576.0,
+                       (double)run.raw_bytes / (run.wire_bytes ? run.wire_bytes : 1),
+                       run.wall_sec * 1000,
+                       run.raw_bytes / 1048576.0 / run.wall_sec,
+                       run.send_cpu * 1000, run.recv_cpu * 1000,
+                       run.ok ? "ok" : "MISMATCH");
+            }
+        }
+    }
+
+    free(payloads[0]);
+    free(payloads[1]);
+    return failed ? 1 : 0;
+}
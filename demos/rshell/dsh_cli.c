@@ -14,12 +14,22 @@
 #define MODE_LCLI   0       //Local client
 #define MODE_SCLI   1       //Socket client
 #define MODE_SSVR   2       //Socket server
+#define MODE_JUMP   3       //Jump host
 
 typedef struct cmd_args{
   int   mode;
   char  ip[16];   //e.g., 192.168.100.101\0
   int   port;
   int   threaded_server;
+  int   compress;
+  char  *script;        //batch mode, run this script on the server
+  int   stop_on_fail;
+  int   jump_port;      //jump host, accept clients on this port
+  int   pty;            //run remote commands on a pty
+  char  *unix_path;     //Unix domain socket instead of TCP
+  int   metrics_port;   //serve metrics on 127.0.0.1:metrics_port
+  int   auth;           //a shared key was loaded with -k
+  char  *ticket_path;   //keep the session ticket here between runs
 }cmd_args_t;
 
 
@@ -30,13 +40,28 @@ typedef struct cmd_args{
 //with passing optional connection parameters. 
 
 void print_usage(const char *progname) {
-  printf("Usage: %s [-c | -s] [-i IP] [-p PORT] [-x] [-h]\n", progname);
+  printf("Usage: %s [-c | -s | -j] [-i IP] [-p PORT] [-x] [-z] [-t] [-f FILE [-e]] [-l PORT] [-u PATH] [-o OPTS] [-m PORT] [-b OPTS] [-k FILE [-r FILE]] [-h]\n", progname);
   printf("  Default is to run %s in local mode\n", progname);
   printf("  -c            Run as client\n");
   printf("  -s            Run as server\n");
-  printf("  -i IP         Set IP/Interface address (only valid with -c or -s)\n");
-  printf("  -p PORT       Set port number (only valid with -c or -s)\n");
+  printf("  -j            Run as a jump host, relaying clients to the server at -i/-p\n");
+  printf("  -i IP         Set IP/Interface address (only valid with -c, -s or -j)\n");
+  printf("  -p PORT       Set port number (only valid with -c, -s or -j)\n");
   printf("  -x            Enable threaded mode (only valid with -s)\n");
+  printf("  -z            Ask the server to compress output (only valid with -c or -j)\n");
+  printf("  -t            Run commands on a terminal on the server (only valid with -c)\n");
+  printf("  -f FILE       Run the commands in FILE as a batch (only valid with -c)\n");
+  printf("  -e            Stop the batch at the first failure (only valid with -f)\n");
+  printf("  -l PORT       Port the jump host accepts clients on (only valid with -j)\n");
+  printf("  -u PATH       Use the Unix domain socket PATH instead of TCP (only valid with -c or -s)\n");
+  printf("  -o OPTS       Socket options, e.g. nodelay=1,quickack=1,sndbuf=N,rcvbuf=N,backlog=N,uring=1\n");
+  printf("                (only valid with -c, -s or -j)\n");
+  printf("  -m PORT       Serve metrics on 127.0.0.1:PORT/metrics (only valid with -s)\n");
+  printf("  -b OPTS       Limit and share out output, e.g. rate=N,session=N,burst=N,quantum=N\n");
+  printf("                in bytes per second and bytes (only valid with -s)\n");
+  printf("  -k FILE       Authenticate with the shared key in FILE (only valid with -c, -s or -j)\n");
+  printf("  -r FILE       Keep the session ticket in FILE to resume the session later\n");
+  printf("                (only valid with -c and -k)\n");
   printf("  -h            Show this help message\n");
   exit(0);
 }
@@ -48,12 +73,13 @@ void parse_args(int argc, char *argv[], cmd_args_t *cargs) {
   //defaults
   cargs->mode = MODE_LCLI;
   cargs->port = RDSH_DEF_PORT;
+  cargs->jump_port = RDSH_DEF_JUMP_PORT;
 
-  while ((opt = getopt(argc, argv, "csi:p:xh")) != -1) {
+  while ((opt = getopt(argc, argv, "csji:p:xztf:el:u:o:m:b:k:r:h")) != -1) {
       switch (opt) {
           case 'c':
               if (cargs->mode != MODE_LCLI) {
-                  fprintf(stderr, "Error: Cannot use both -c and -s\n");
+                  fprintf(stderr, "Error: Only one of -c, -s and -j can be used\n");
                   exit(EXIT_FAILURE);
               }
               cargs->mode = MODE_SCLI;
@@ -61,15 +87,23 @@ void parse_args(int argc, char *argv[], cmd_args_t *cargs) {
               break;
           case 's':
               if (cargs->mode != MODE_LCLI) {
-                  fprintf(stderr, "Error: Cannot use both -c and -s\n");
+                  fprintf(stderr, "Error: Only one of -c, -s and -j can be used\n");
                   exit(EXIT_FAILURE);
               }
               cargs->mode = MODE_SSVR;
               strncpy(cargs->ip, RDSH_DEF_SVR_INTFACE, sizeof(cargs->ip) - 1);
               break;
+          case 'j':
+              if (cargs->mode != MODE_LCLI) {
+                  fprintf(stderr, "Error: Only one of -c, -s and -j can be used\n");
+                  exit(EXIT_FAILURE);
+              }
+              cargs->mode = MODE_JUMP;
+              strncpy(cargs->ip, RDSH_DEF_CLI_CONNECT, sizeof(cargs->ip) - 1);
+              break;
           case 'i':
               if (cargs->mode == MODE_LCLI) {
-                  fprintf(stderr, "Error: -i can only be used with -c or -s\n");
+                  fprintf(stderr, "Error: -i can only be used with -c, -s or -j\n");
                   exit(EXIT_FAILURE);
               }
               strncpy(cargs->ip, optarg, sizeof(cargs->ip) - 1);
@@ -77,7 +111,7 @@ void parse_args(int argc, char *argv[], cmd_args_t *cargs) {
               break;
           case 'p':
               if (cargs->mode == MODE_LCLI) {
-                  fprintf(stderr, "Error: -p can only be used with -c or -s\n");
+                  fprintf(stderr, "Error: -p can only be used with -c, -s or -j\n");
                   exit(EXIT_FAILURE);
               }
               cargs->port = atoi(optarg);
@@ -93,6 +127,97 @@ void parse_args(int argc, char *argv[], cmd_args_t *cargs) {
               }
               cargs->threaded_server = 1;
               break;
+          case 'z':
+              if ((cargs->mode != MODE_SCLI) && (cargs->mode != MODE_JUMP)) {
+                  fprintf(stderr, "Error: -z can only be used with -c or -j\n");
+                  exit(EXIT_FAILURE);
+              }
+              cargs->compress = 1;
+              break;
+          case 't':
+              if (cargs->mode != MODE_SCLI) {
+                  fprintf(stderr, "Error: -t can only be used with -c\n");
+                  exit(EXIT_FAILURE);
+              }
+              cargs->pty = 1;
+              break;
+          case 'f':
+              if (cargs->mode != MODE_SCLI) {
+                  fprintf(stderr, "Error: -f can only be used with -c\n");
+                  exit(EXIT_FAILURE);
+              }
+              cargs->script = optarg;
+              break;
+          case 'e':
+              cargs->stop_on_fail = 1;
+              break;
+          case 'l':
+              if (cargs->mode != MODE_JUMP) {
+                  fprintf(stderr, "Error: -l can only be used with -j\n");
+                  exit(EXIT_FAILURE);
+              }
+              cargs->jump_port = atoi(optarg);
+              if (cargs->jump_port <= 0) {
+                  fprintf(stderr, "Error: Invalid port number\n");
+                  exit(EXIT_FAILURE);
+              }
+              break;
+          case 'u':
+              if ((cargs->mode != MODE_SCLI) && (cargs->mode != MODE_SSVR)) {
+                  fprintf(stderr, "Error: -u can only be used with -c or -s\n");
+                  exit(EXIT_FAILURE);
+              }
+              cargs->unix_path = optarg;
+              break;
+          case 'o':
+              if (cargs->mode == MODE_LCLI) {
+                  fprintf(stderr, "Error: -o can only be used with -c, -s or -j\n");
+                  exit(EXIT_FAILURE);
+              }
+              if (parse_net_opts(optarg) != OK) {
+                  fprintf(stderr, "Error: Invalid socket option in -o\n");
+                  exit(EXIT_FAILURE);
+              }
+              break;
+          case 'm':
+              if (cargs->mode != MODE_SSVR) {
+                  fprintf(stderr, "Error: -m can only be used with -s\n");
+                  exit(EXIT_FAILURE);
+              }
+              cargs->metrics_port = atoi(optarg);
+              if (cargs->metrics_port <= 0) {
+                  fprintf(stderr, "Error: Invalid port number\n");
+                  exit(EXIT_FAILURE);
+              }
+              break;
+          case 'b':
+              if (cargs->mode != MODE_SSVR) {
+                  fprintf(stderr, "Error: -b can only be used with -s\n");
+                  exit(EXIT_FAILURE);
+              }
+              if (parse_sched_opts(optarg) != OK) {
+                  fprintf(stderr, "Error: Invalid scheduling option in -b\n");
+                  exit(EXIT_FAILURE);
+              }
+              break;
+          case 'k':
+              if (cargs->mode == MODE_LCLI) {
+                  fprintf(stderr, "Error: -k can only be used with -c, -s or -j\n");
+                  exit(EXIT_FAILURE);
+              }
+              if (set_auth_key_file(optarg) != OK) {
+                  fprintf(stderr, "Error: Cannot load the key in -k\n");
+                  exit(EXIT_FAILURE);
+              }
+              cargs->auth = 1;
+              break;
+          case 'r':
+              if (cargs->mode != MODE_SCLI) {
+                  fprintf(stderr, "Error: -r can only be used with -c\n");
+                  exit(EXIT_FAILURE);
+              }
+              cargs->ticket_path = optarg;
+              break;
           case 'h':
               print_usage(argv[0]);
               break;
@@ -105,6 +230,21 @@ void parse_args(int argc, char *argv[], cmd_args_t *cargs) {
       fprintf(stderr, "Error: -x can only be used with -s\n");
       exit(EXIT_FAILURE);
   }
+
+  if (cargs->pty && cargs->script != NULL) {
+      fprintf(stderr, "Error: -t cannot be used with -f\n");
+      exit(EXIT_FAILURE);
+  }
+
+  if (cargs->stop_on_fail && cargs->script == NULL) {
+      fprintf(stderr, "Error: -e can only be used with -f\n");
+      exit(EXIT_FAILURE);
+  }
+
+  if (cargs->ticket_path != NULL && !cargs->auth) {
+      fprintf(stderr, "Error: -r can only be used with -k\n");
+      exit(EXIT_FAILURE);
+  }
 }
 
 
@@ -128,11 +268,27 @@ int main(int argc, char *argv[]){
       rc = exec_local_cmd_loop();
       break;
     case MODE_SCLI:
-      printf("socket client mode:  addr:%s:%d\n", cargs.ip, cargs.port);
-      rc = exec_remote_cmd_loop(cargs.ip, cargs.port);
+      if (cargs.unix_path != NULL)
+        printf("socket client mode:  path:%s\n", cargs.unix_path);
+      else
+        printf("socket client mode:  addr:%s:%d\n", cargs.ip, cargs.port);
+      set_net_unix_path(cargs.unix_path);
+      set_client_compression(cargs.compress);
+      set_client_pty(cargs.pty);
+      if (cargs.ticket_path != NULL)
+        set_auth_ticket_file(cargs.ticket_path);
+      if (cargs.script != NULL)
+        rc = exec_remote_batch(cargs.ip, cargs.port, cargs.script, cargs.stop_on_fail);
+      else
+        rc = exec_remote_cmd_loop(cargs.ip, cargs.port);
       break;
     case MODE_SSVR:
-      printf("socket server mode:  addr:%s:%d\n", cargs.ip, cargs.port);
+      if (cargs.unix_path != NULL)
+        printf("socket server mode:  path:%s\n", cargs.unix_path);
+      else
+        printf("socket server mode:  addr:%s:%d\n", cargs.ip, cargs.port);
+      set_net_unix_path(cargs.unix_path);
+      set_metrics_port(cargs.metrics_port);
       if (cargs.threaded_server){
         printf("-> Multi-Threaded Mode\n");
       } else {
@@ -140,6 +296,11 @@ int main(int argc, char *argv[]){
       }
       rc = start_server(cargs.ip, cargs.port, cargs.threaded_server);
       break;
+    case MODE_JUMP:
+      printf("jump host mode:  port:%d -> addr:%s:%d\n", cargs.jump_port, cargs.ip, cargs.port);
+      set_client_compression(cargs.compress);
+      rc = start_jump_host(RDSH_DEF_SVR_INTFACE, cargs.jump_port, cargs.ip, cargs.port);
+      break;
     default:
       printf("error unknown mode\n");
       exit(EXIT_FAILURE);
@@ -0,0 +1,592 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/random.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_auth.c - shared key authentication and session tickets
+ *
+ * Anyone who could reach the port used to get a shell.  With -k FILE on
+ * both ends the server only talks to clients that know the key in FILE,
+ * and the client only talks to a server that knows it too.  The key never
+ * crosses the wire, each side proves it has the key by MACing the other's
+ * fresh nonce (HMAC-SHA-256, see rsh_hmac.c):
+ *
+ *   server -> client   "RDSHAUT1" snonce
+ *   client -> server   "RDSHAUT1" cnonce has_ticket ticket
+ *                      HMAC(key, "rdsh-cli" snonce cnonce has_ticket ticket)
+ *   server -> client   status ticket'
+ *                      HMAC(key, "rdsh-svr" cnonce snonce status ticket')
+ *
+ * The different labels keep a MAC from one direction from being played
+ * back in the other.  The exchange happens right after connect, before the
+ * hello from negotiate_session(), and costs one round trip.  Either side
+ * gives up after RDSH_AUTH_TIMEOUT_MS, so a client that connects and says
+ * nothing only holds up its own session thread.
+ *
+ * status is RDSH_AUTH_NEW for a fresh session, RDSH_AUTH_RESUMED if the
+ * client's ticket picked up an earlier session, or RDSH_AUTH_DENIED.
+ *
+ * A ticket names the directory, environment and last exit code of a
+ * session (see rsh_env.c).  When a connection drops without `exit` the
+ * session state is parked under its ticket for RDSH_TICKET_TTL_SECS, and a
+ * client that reconnects with the ticket gets it back instead of starting
+ * over in the server's directory.  Tickets are random, good for one resume
+ * and replaced every time, so an old one that leaks is worth nothing.  If
+ * the client comes back before the server noticed it was gone the old
+ * connection is shut down, and the resume waits for it to park.
+ *
+ * The client keeps its ticket in memory and, with -r FILE, in FILE so the
+ * next dsh can resume too.  exec_remote_cmd_loop() uses it to reconnect
+ * on its own when the connection drops.
+ *
+ * Only cwd, env and rc are resumed.  rsh has no background jobs to carry
+ * over, and the channels of a multiplexed connection are not resumed.
+ */
+
+#define RDSH_AUTH_MAGIC     "RDSHAUT1"
+#define RDSH_AUTH_MAGIC_SZ  8
+#define RDSH_AUTH_LBL_CLI   "rdsh-cli"
+#define RDSH_AUTH_LBL_SVR   "rdsh-svr"
+
+typedef struct rdsh_auth_hello{
+    char     magic[RDSH_AUTH_MAGIC_SZ];
+    uint8_t  snonce[RDSH_NONCE_SZ];
+}rdsh_auth_hello_t;
+
+typedef struct rdsh_auth_reply{
+    char     magic[RDSH_AUTH_MAGIC_SZ];
+    uint8_t  cnonce[RDSH_NONCE_SZ];
+    uint8_t  has_ticket;
+    uint8_t  ticket[RDSH_TICKET_SZ];
+    uint8_t  mac[RDSH_SHA256_SZ];
+}rdsh_auth_reply_t;
+
+typedef struct rdsh_auth_verdict{
+    uint8_t  status;
+    uint8_t  ticket[RDSH_TICKET_SZ];
+    uint8_t  mac[RDSH_SHA256_SZ];
+}rdsh_auth_verdict_t;
+
+//the state of a session, while it is connected or parked
+typedef struct rsh_ticket{
+    uint8_t   id[RDSH_TICKET_SZ];
+    int       in_use;
+    int       live_sock;        //socket of the session using it, -1 parked
+    time_t    expires;          //when a parked ticket is thrown away
+    int       cwd_fd;
+    char    **env;
+    int       env_count;
+    int       env_cap;
+    int       cmd_rc;
+}rsh_ticket_t;
+
+static uint8_t auth_key[RDSH_AUTH_KEY_MAX];
+static int auth_key_len = 0;
+
+static pthread_mutex_t ticket_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ticket_parked = PTHREAD_COND_INITIALIZER;
+static rsh_ticket_t tickets[RDSH_TICKET_MAX];
+
+//the client side ticket
+static char *ticket_path = NULL;
+static uint8_t cli_ticket[RDSH_TICKET_SZ];
+static int cli_has_ticket = false;
+
+/*
+ * set_auth_key_file(path)
+ *      path:  file holding the shared key, the whole file is the key
+ *             except for a trailing newline
+ *
+ *  Returns:
+ *      OK:                the key is loaded, authentication is on
+ *      ERR_CMD_ARGS_BAD:  the file could not be read or is empty
+ */
+int set_auth_key_file(char *path){
+    FILE *fp = fopen(path, "r");
+    size_t len;
+
+    if (fp == NULL){
+        perror(path);
+        return ERR_CMD_ARGS_BAD;
+    }
+    len = fread(auth_key, 1, sizeof(auth_key), fp);
+    fclose(fp);
+
+    while ((len > 0) && ((auth_key[len - 1] == '\n') || (auth_key[len - 1] == '\r')))
+        len--;
+    if (len == 0){
+        printf(RCMD_ERR_AUTH_KEY, path);
+        return ERR_CMD_ARGS_BAD;
+    }
+    auth_key_len = (int)len;
+    return OK;
+}
+
+/*
+ * set_auth_ticket_file(path)
+ *      path:  where the client keeps its ticket between runs, as hex
+ *
+ *  A missing or unreadable file just means there is no ticket yet.
+ */
+void set_auth_ticket_file(char *path){
+    char hex[RDSH_TICKET_SZ * 2 + 2];
+    unsigned int byte;
+    FILE *fp;
+
+    ticket_path = path;
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return;
+    if ((fgets(hex, sizeof(hex), fp) != NULL) && (strlen(hex) >= RDSH_TICKET_SZ * 2)){
+        cli_has_ticket = true;
+        for (int i = 0; (i < RDSH_TICKET_SZ) && cli_has_ticket; i++){
+            if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+                cli_has_ticket = false;
+            cli_ticket[i] = (uint8_t)byte;
+        }
+    }
+    fclose(fp);
+}
+
+//mode 0600, the ticket is as good as the session it names
+static void save_ticket(void){
+    FILE *fp;
+    int fd;
+
+    if (ticket_path == NULL)
+        return;
+    if (!cli_has_ticket){
+        unlink(ticket_path);
+        return;
+    }
+
+    fd = open(ticket_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if ((fd < 0) || ((fp = fdopen(fd, "w")) == NULL)){
+        perror(ticket_path);
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    for (int i = 0; i < RDSH_TICKET_SZ; i++)
+        fprintf(fp, "%02x", cli_ticket[i]);
+    fprintf(fp, "\n");
+    fclose(fp);
+}
+
+/*
+ * rsh_auth_has_ticket() and rsh_auth_drop_ticket()
+ *      Whether the client holds a ticket it could resume with, and throw
+ *      it away once the session is over for good (`exit`).
+ */
+int rsh_auth_has_ticket(void){
+    return cli_has_ticket;
+}
+
+void rsh_auth_drop_ticket(void){
+    if (!cli_has_ticket)
+        return;
+    cli_has_ticket = false;
+    save_ticket();
+}
+
+static int auth_random(void *buff, size_t len){
+    uint8_t *p = buff;
+    ssize_t n;
+
+    while (len > 0){
+        n = getrandom(p, len, 0);
+        if (n < 0){
+            if (errno == EINTR)
+                continue;
+            perror("getrandom");
+            return ERR_RDSH_COMMUNICATION;
+        }
+        p += n;
+        len -= n;
+    }
+    return OK;
+}
+
+//rsh_recv_all() that gives up after RDSH_AUTH_TIMEOUT_MS of silence, or
+//as soon as what arrived does not start with magic (if it is not NULL)
+static int auth_recv(int sock, void *buff, int len, const char *magic){
+    struct pollfd pfd;
+    char *p = buff;
+    int got = 0;
+    int n;
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    while (got < len){
+        n = poll(&pfd, 1, RDSH_AUTH_TIMEOUT_MS);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            return ERR_RDSH_COMMUNICATION;
+        n = rsh_recv(sock, p + got, len - got);
+        if (n <= 0)
+            return ERR_RDSH_COMMUNICATION;
+        got += n;
+        if ((magic != NULL) &&
+            (memcmp(buff, magic, (got < RDSH_AUTH_MAGIC_SZ) ? got : RDSH_AUTH_MAGIC_SZ) != 0))
+            return ERR_RDSH_COMMUNICATION;
+    }
+    return OK;
+}
+
+static void auth_mac(const char *label, const uint8_t *nonce1, const uint8_t *nonce2,
+                     uint8_t flag, const uint8_t *ticket, uint8_t *mac){
+    rsh_hmac_t ctx;
+
+    rsh_hmac_init(&ctx, auth_key, auth_key_len);
+    rsh_hmac_update(&ctx, label, strlen(label));
+    rsh_hmac_update(&ctx, nonce1, RDSH_NONCE_SZ);
+    rsh_hmac_update(&ctx, nonce2, RDSH_NONCE_SZ);
+    rsh_hmac_update(&ctx, &flag, 1);
+    rsh_hmac_update(&ctx, ticket, RDSH_TICKET_SZ);
+    rsh_hmac_final(&ctx, mac);
+}
+
+/*
+ * rsh_auth_connect(sock)
+ *      sock:  a socket that just connected to the server
+ *
+ *  The client half of the handshake, called by start_client().  Nothing
+ *  to do without -k.  Prints RCMD_MSG_AUTH_RESUMED when the server picked
+ *  up the session named by our ticket, and keeps the new ticket.
+ *
+ *  Returns:
+ *      sock:             authenticated, ready for negotiate_session()
+ *      ERR_RDSH_SERVER:  the server turned us away or did not prove it
+ *                        knows the key, sock has been closed and the
+ *                        reason printed
+ *      ERR_RDSH_CLIENT:  no random nonce, sock has been closed
+ */
+int rsh_auth_connect(int sock){
+    rdsh_auth_hello_t hello;
+    rdsh_auth_reply_t reply;
+    rdsh_auth_verdict_t verdict;
+    uint8_t mac[RDSH_SHA256_SZ];
+
+    if (auth_key_len == 0)
+        return sock;
+
+    if (auth_recv(sock, &hello, sizeof(hello), RDSH_AUTH_MAGIC) != OK){
+        printf(RCMD_ERR_AUTH_PROTO);
+        close(sock);
+        return ERR_RDSH_SERVER;
+    }
+
+    memcpy(reply.magic, RDSH_AUTH_MAGIC, RDSH_AUTH_MAGIC_SZ);
+    reply.has_ticket = cli_has_ticket;
+    if (cli_has_ticket)
+        memcpy(reply.ticket, cli_ticket, RDSH_TICKET_SZ);
+    else
+        memset(reply.ticket, 0, RDSH_TICKET_SZ);
+    if (auth_random(reply.cnonce, RDSH_NONCE_SZ) != OK){
+        close(sock);
+        return ERR_RDSH_CLIENT;
+    }
+    auth_mac(RDSH_AUTH_LBL_CLI, hello.snonce, reply.cnonce, reply.has_ticket,
+             reply.ticket, reply.mac);
+
+    if ((rsh_send_all(sock, &reply, sizeof(reply)) != OK) ||
+        (auth_recv(sock, &verdict, sizeof(verdict), NULL) != OK) ||
+        (verdict.status == RDSH_AUTH_DENIED)){
+        printf(RCMD_ERR_AUTH_DENIED);
+        close(sock);
+        return ERR_RDSH_SERVER;
+    }
+
+    //and the server has to know the key too
+    auth_mac(RDSH_AUTH_LBL_SVR, reply.cnonce, hello.snonce, verdict.status,
+             verdict.ticket, mac);
+    if (!rsh_mac_equal(mac, verdict.mac, RDSH_SHA256_SZ)){
+        printf(RCMD_ERR_AUTH_SERVER);
+        close(sock);
+        return ERR_RDSH_SERVER;
+    }
+
+    if (verdict.status == RDSH_AUTH_RESUMED)
+        printf(RCMD_MSG_AUTH_RESUMED);
+
+    //an all zero ticket means the server had no room to give us one
+    cli_has_ticket = false;
+    for (int i = 0; i < RDSH_TICKET_SZ; i++)
+        cli_has_ticket |= (verdict.ticket[i] != 0);
+    memcpy(cli_ticket, verdict.ticket, RDSH_TICKET_SZ);
+    save_ticket();
+    return sock;
+}
+
+/*
+ * rsh_auth_refused(sock)
+ *      sock:  a connection made without -k, with a response on its way
+ *
+ *  A server with -k opens every connection with its hello, a client
+ *  without a key would print it as the output of its first command.  The
+ *  client calls this before reading its first response.  It only peeks,
+ *  unless the hello is there, which is then read.
+ *
+ *  Returns:
+ *      true:   the server wants a key, RCMD_ERR_AUTH_REQUIRED was printed
+ *      false:  anything else, nothing has been read
+ */
+int rsh_auth_refused(int sock){
+    rdsh_auth_hello_t hello;
+    ssize_t got;
+
+    if (auth_key_len != 0)
+        return false;
+
+    got = recv(sock, &hello, RDSH_AUTH_MAGIC_SZ, MSG_PEEK);
+    //a response always ends in RDSH_EOF_CHAR, so a short match has more coming
+    if ((got > 0) && (got < RDSH_AUTH_MAGIC_SZ) &&
+        (memcmp(&hello, RDSH_AUTH_MAGIC, got) == 0))
+        got = recv(sock, &hello, RDSH_AUTH_MAGIC_SZ, MSG_PEEK | MSG_WAITALL);
+    if ((got != RDSH_AUTH_MAGIC_SZ) ||
+        (memcmp(&hello, RDSH_AUTH_MAGIC, RDSH_AUTH_MAGIC_SZ) != 0))
+        return false;
+
+    auth_recv(sock, &hello, sizeof(hello), RDSH_AUTH_MAGIC);
+    printf(RCMD_ERR_AUTH_REQUIRED);
+    return true;
+}
+
+static void ticket_release(rsh_ticket_t *t){
+    if (t->cwd_fd >= 0)
+        close(t->cwd_fd);
+    if (t->env != NULL){
+        for (int i = 0; i < t->env_count; i++)
+            free(t->env[i]);
+        free(t->env);
+    }
+    memset(t, 0, sizeof(*t));
+    t->cwd_fd = -1;
+}
+
+//the ticket called id, throwing out parked ones that have expired on the way
+static rsh_ticket_t *ticket_find(const uint8_t *id){
+    time_t now = time(NULL);
+    rsh_ticket_t *found = NULL;
+
+    for (int i = 0; i < RDSH_TICKET_MAX; i++){
+        rsh_ticket_t *t = &tickets[i];
+
+        if (!t->in_use)
+            continue;
+        if ((t->live_sock < 0) && (t->expires <= now)){
+            ticket_release(t);
+            continue;
+        }
+        if ((id != NULL) && rsh_mac_equal(t->id, id, RDSH_TICKET_SZ))
+            found = t;
+    }
+    return found;
+}
+
+//a free slot, or the parked ticket closest to expiring.  NULL if every
+//ticket belongs to a live session.
+static rsh_ticket_t *ticket_alloc(void){
+    rsh_ticket_t *oldest = NULL;
+
+    ticket_find(NULL);
+    for (int i = 0; i < RDSH_TICKET_MAX; i++){
+        rsh_ticket_t *t = &tickets[i];
+
+        if (!t->in_use){
+            t->cwd_fd = -1;
+            return t;
+        }
+        if ((t->live_sock < 0) && ((oldest == NULL) || (t->expires < oldest->expires)))
+            oldest = t;
+    }
+    if (oldest != NULL)
+        ticket_release(oldest);
+    return oldest;
+}
+
+//swap the directory, environment and rc of a session with a ticket's
+static void ticket_swap(rsh_ticket_t *t, rsh_session_t *sess){
+    int cwd_fd = t->cwd_fd;
+    char **env = t->env;
+    int env_count = t->env_count;
+    int env_cap = t->env_cap;
+    int cmd_rc = t->cmd_rc;
+
+    t->cwd_fd = sess->cwd_fd;
+    t->env = sess->env;
+    t->env_count = sess->env_count;
+    t->env_cap = sess->env_cap;
+    t->cmd_rc = sess->cmd_rc;
+    sess->cwd_fd = cwd_fd;
+    sess->env = env;
+    sess->env_count = env_count;
+    sess->env_cap = env_cap;
+    sess->cmd_rc = cmd_rc;
+}
+
+/*
+ * ticket_issue(sess, old_id)
+ *      Gives sess a fresh ticket, and with old_id the parked state of
+ *      that ticket.  If old_id still belongs to a live connection it is
+ *      shut down, and we wait up to RDSH_AUTH_TIMEOUT_MS for its session
+ *      to park.
+ *
+ *  Returns RDSH_AUTH_RESUMED or RDSH_AUTH_NEW.  sess->has_ticket is false
+ *  if the table is full of live sessions.
+ */
+static int ticket_issue(rsh_session_t *sess, const uint8_t *old_id){
+    struct timespec deadline;
+    rsh_ticket_t *t = NULL;
+    int status = RDSH_AUTH_NEW;
+    int kicked = false;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += RDSH_AUTH_TIMEOUT_MS / 1000;
+
+    pthread_mutex_lock(&ticket_lock);
+    if (old_id != NULL){
+        while (((t = ticket_find(old_id)) != NULL) && (t->live_sock >= 0)){
+            if (!kicked)
+                shutdown(t->live_sock, SHUT_RDWR);
+            kicked = true;
+            if (pthread_cond_timedwait(&ticket_parked, &ticket_lock, &deadline) == ETIMEDOUT){
+                t = NULL;
+                break;
+            }
+        }
+    }
+
+    if (t != NULL){
+        //the state sess started with goes out with the old ticket
+        ticket_swap(t, sess);
+        ticket_release(t);
+        status = RDSH_AUTH_RESUMED;
+    } else {
+        t = ticket_alloc();
+    }
+
+    sess->has_ticket = false;
+    if ((t != NULL) && (auth_random(t->id, RDSH_TICKET_SZ) == OK)){
+        t->in_use = true;
+        t->live_sock = sess->cli_socket;
+        memcpy(sess->ticket, t->id, RDSH_TICKET_SZ);
+        sess->has_ticket = true;
+    }
+    pthread_mutex_unlock(&ticket_lock);
+    return status;
+}
+
+/*
+ * rsh_auth_accept(sock, sess)
+ *      sock:  a client that just connected
+ *      sess:  its new session, right after session_init().  NULL for the
+ *             jump host, which has no sessions and hands out no tickets.
+ *
+ *  The server half of the handshake, called by exec_client_requests() and
+ *  the jump host.  Nothing to do without -k.  If the client resumed a
+ *  session the directory, environment and rc of sess are now those of
+ *  that session.
+ *
+ *  Returns:
+ *      OK:               authenticated, or no key
+ *      ERR_RDSH_SERVER:  the client did not prove it knows the key, or
+ *                        did not answer in time
+ */
+int rsh_auth_accept(int sock, rsh_session_t *sess){
+    rdsh_auth_hello_t hello;
+    rdsh_auth_reply_t reply;
+    rdsh_auth_verdict_t verdict;
+    uint8_t mac[RDSH_SHA256_SZ];
+
+    if (auth_key_len == 0)
+        return OK;
+
+    memcpy(hello.magic, RDSH_AUTH_MAGIC, RDSH_AUTH_MAGIC_SZ);
+    if ((auth_random(hello.snonce, RDSH_NONCE_SZ) != OK) ||
+        (rsh_send_all(sock, &hello, sizeof(hello)) != OK)){
+        printf(RCMD_ERR_AUTH_DENIED);
+        return ERR_RDSH_SERVER;
+    }
+
+    //most likely a client without -k that went ahead with a command, tell
+    //it in a way it will print
+    if (auth_recv(sock, &reply, sizeof(reply), RDSH_AUTH_MAGIC) != OK){
+        printf(RCMD_ERR_AUTH_DENIED);
+        send_message_string(sock, RCMD_ERR_AUTH_REQUIRED);
+        return ERR_RDSH_SERVER;
+    }
+
+    auth_mac(RDSH_AUTH_LBL_CLI, hello.snonce, reply.cnonce, reply.has_ticket,
+             reply.ticket, mac);
+    memset(&verdict, 0, sizeof(verdict));
+    if (!rsh_mac_equal(mac, reply.mac, RDSH_SHA256_SZ)){
+        printf(RCMD_ERR_AUTH_DENIED);
+        rsh_send_all(sock, &verdict, sizeof(verdict));
+        return ERR_RDSH_SERVER;
+    }
+
+    verdict.status = RDSH_AUTH_NEW;
+    if (sess != NULL)
+        verdict.status = ticket_issue(sess, reply.has_ticket ? reply.ticket : NULL);
+    if ((sess != NULL) && sess->has_ticket)
+        memcpy(verdict.ticket, sess->ticket, RDSH_TICKET_SZ);
+    auth_mac(RDSH_AUTH_LBL_SVR, reply.cnonce, hello.snonce, verdict.status,
+             verdict.ticket, verdict.mac);
+    if (verdict.status == RDSH_AUTH_RESUMED)
+        printf(RCMD_MSG_AUTH_RESUMED);
+    return rsh_send_all(sock, &verdict, sizeof(verdict));
+}
+
+/*
+ * rsh_ticket_park(sess) and rsh_ticket_forget(sess)
+ *      A session that lost its client parks its state under its ticket,
+ *      session_cleanup() does that.  One that ended for good (`exit`,
+ *      `stop-server`, or a multiplexed connection) forgets the ticket
+ *      first.  Both do nothing for a session without a ticket.
+ */
+void rsh_ticket_park(rsh_session_t *sess){
+    rsh_ticket_t *t;
+
+    if (!sess->has_ticket)
+        return;
+
+    pthread_mutex_lock(&ticket_lock);
+    t = ticket_find(sess->ticket);
+    if ((t != NULL) && (t->live_sock == sess->cli_socket)){
+        ticket_swap(t, sess);
+        t->live_sock = -1;
+        t->expires = time(NULL) + RDSH_TICKET_TTL_SECS;
+        pthread_cond_broadcast(&ticket_parked);
+    }
+    pthread_mutex_unlock(&ticket_lock);
+    sess->has_ticket = false;
+}
+
+void rsh_ticket_forget(rsh_session_t *sess){
+    rsh_ticket_t *t;
+
+    if (!sess->has_ticket)
+        return;
+
+    pthread_mutex_lock(&ticket_lock);
+    t = ticket_find(sess->ticket);
+    if ((t != NULL) && (t->live_sock == sess->cli_socket))
+        ticket_release(t);
+    pthread_cond_broadcast(&ticket_parked);
+    pthread_mutex_unlock(&ticket_lock);
+    sess->has_ticket = false;
+}
@@ -7,12 +7,73 @@
 #include <unistd.h>
 #include <sys/un.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 
 #include "dshlib.h"
 #include "rshlib.h"
 
+//set from dsh_cli.c with the -z flag, ask the server to compress output
+static int use_compression = false;
 
+void set_client_compression(int val){
+    use_compression = val;
+}
+
+//set by the jump host, ask for a multiplexed connection, see rsh_mux.c
+static int use_mux = false;
+
+void set_client_mux(int val){
+    use_mux = val;
+}
+
+//set from dsh_cli.c with the -t flag, run commands on a pty, see rsh_pty.c
+static int use_pty = false;
+
+void set_client_pty(int val){
+    use_pty = val;
+}
+
+//connection lost, reconnect and pick up the session with our ticket
+static int resume_session(char *address, int port, int is_framed, char *rsp_buff){
+    int cli_socket;
+
+    printf(RCMD_MSG_AUTH_RECONNECT);
+    cli_socket = start_client(address, port);
+    if (cli_socket < 0)
+        return ERR_RDSH_CLIENT;
+    if (is_framed && (negotiate_session(cli_socket, rsp_buff) != true)){
+        close(cli_socket);
+        return ERR_RDSH_CLIENT;
+    }
+    return cli_socket;
+}
 
+//the plain protocol, output until the RDSH_EOF_CHAR
+static ssize_t recv_plain_response(int cli_socket, char *rsp_buff, rsh_edit_t *ed){
+    ssize_t io_size;
+    int is_eof;
+
+    while (1){
+        if (client_wait(cli_socket, ed) != OK)
+            return ERR_RDSH_COMMUNICATION;
+        io_size = rsh_recv(cli_socket, rsp_buff, RDSH_COMM_BUFF_SZ);
+        if (io_size <= 0)
+            return io_size;
+
+        //see if the last character is an eof
+        is_eof = (rsp_buff[io_size - 1] == RDSH_EOF_CHAR) ? 1 : 0;
+        client_write(rsp_buff, io_size - is_eof);
+        if (is_eof)
+            return io_size;
+    }
+}
+
+//client_cleanup() for once the line editor is running
+static int loop_cleanup(rsh_edit_t *ed, int cli_socket, char *cmd_buff, char *rsp_buff, int rc){
+    edit_free(ed);
+    return client_cleanup(cli_socket, cmd_buff, rsp_buff, rc);
+}
 
 /*
  * exec_remote_cmd_loop(server_ip, port)
@@ -88,17 +149,43 @@
  *
  *   The above will return ERR_RDSH_COMMUNICATION and OK respectively to the main()
  *   function after cleaning things up.  See the documentation for client_cleanup()
+ *
+ *   If compression (-z) or a pty (-t) was requested the client first
+ *   negotiates a framed session with the server, see negotiate_session().
+ *   In that case the response to each command is a series of frames
+ *   rather than a stream ending in RDSH_EOF_CHAR.  The second half of
+ *   rsp_buff is used to hold decompressed data.  In pty mode the response
+ *   is handled by recv_pty_response(), which also sends what is typed
+ *   while the command runs.
+ *
+ *   With -k the server hands out a session ticket (see rsh_auth.c).  If the
+ *   connection drops the client reconnects once with it and carries on in
+ *   the same session, the directory and environment are as they were.  The
+ *   output of the command that was running is lost, and it is not run
+ *   again since it may well have run already.  A pty session is not
+ *   resumed.
+ *
+ *   The loop no longer takes turns between fgets() and a blocking recv()
+ *   loop.  Commands come from the line editor (see rsh_edit.c), and while
+ *   a response comes in the client polls the socket and stdin together,
+ *   see client_wait(), so what is typed meanwhile is kept for the next
+ *   prompt.  Output is written straight from rsp_buff with write() rather
+ *   than copied through stdio, see client_write().
  *      
  */
 int exec_remote_cmd_loop(char *address, int port)
 {
     char *cmd_buff;
     char *rsp_buff;
+    rsh_edit_t *ed;
     int cli_socket;
     ssize_t io_size;
-    int is_eof;
+    int is_framed = false;
+    int is_pty = false;
+    int resumed = false;
+    uint32_t req_id = 0;
 
-    rsp_buff = malloc(RDSH_COMM_BUFF_SZ);
+    rsp_buff = malloc(RDSH_COMM_BUFF_SZ * 2);
     if(rsp_buff == NULL){
         return ERR_MEMORY;
     }
@@ -112,61 +199,87 @@ int exec_remote_cmd_loop(char *address, int port)
 
     cli_socket = start_client(address,port);
     if (cli_socket < 0){
-        perror("start client");
+        //an auth failure has been reported already, errno says nothing
+        if (cli_socket == ERR_RDSH_CLIENT)
+            perror("start client");
         return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_CLIENT);
     }
 
+    if (use_pty && !isatty(STDIN_FILENO)){
+        printf(RCMD_ERR_PTY_NOTTY);
+        use_pty = false;
+    }
+
+    if (use_compression || use_pty){
+        is_framed = negotiate_session(cli_socket, rsp_buff);
+        if (is_framed < 0){
+            return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
+        }
+        is_pty = use_pty && is_framed && (strstr(rsp_buff, "pty=1") != NULL);
+        if (use_pty && !is_pty){
+            printf(RCMD_ERR_PTY_PROTO);
+        }
+        if (is_pty && (pty_client_start(cli_socket) != OK)){
+            return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
+        }
+    }
+
+    //a pty session leaves the editing to the remote terminal
+    ed = edit_new(!is_pty);
+    if (ed == NULL)
+        return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_MEMORY);
+
     while (1)
     {
-        printf("%s", SH_PROMPT);
-        if (fgets(cmd_buff, SH_CMD_MAX, stdin) == NULL)
-        {
-            printf("\n");
+        if (edit_read_line(ed, cmd_buff, SH_CMD_MAX) != OK)
             break;
-        }
-        cmd_buff[strcspn(cmd_buff, "\n")] = '\0';
 
         if (cmd_buff[0] == '\0')
         {
             continue;
         }
 
+        //the server ends the session for good, there is nothing to resume
+        if ((strcmp(cmd_buff, EXIT_CMD) == 0) || (strcmp(cmd_buff, "stop-server") == 0))
+            rsh_auth_drop_ticket();
+
         //make sure you send the null byte
-        int send_len = strlen(cmd_buff) + 1;
-        io_size = send(cli_socket, cmd_buff, send_len,0);
-        if (io_size < 0)
+        if ((is_pty && (pty_client_winch(cli_socket) != OK)) ||
+            (send_request(cli_socket, is_framed, ++req_id, 0, cmd_buff) != OK))
         {
             perror("write to backend server failed");
-            return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
+            return loop_cleanup(ed, cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
         }
 
-        
-        if (io_size != send_len){
-            printf(CMD_ERR_RDSH_SEND, (int)io_size, (int)send_len);
-            return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
+        if (is_pty){
+            io_size = recv_pty_response(cli_socket, rsp_buff, req_id);
+        } else if (is_framed){
+            io_size = recv_framed_response(cli_socket, rsp_buff, ed);
+        } else if ((req_id == 1) && (client_wait(cli_socket, ed) == OK) &&
+                   rsh_auth_refused(cli_socket)){
+            return loop_cleanup(ed, cli_socket, cmd_buff, rsp_buff, ERR_RDSH_CLIENT);
+        } else {
+            io_size = recv_plain_response(cli_socket, rsp_buff, ed);
         }
 
-        while ((io_size = recv(cli_socket, rsp_buff, RDSH_COMM_BUFF_SZ,0)) > 0) {
-            //see if the last character is an eof
-            is_eof = ((char)rsp_buff[io_size-1] == RDSH_EOF_CHAR) ? 1 : 0;
-
-            if(is_eof)
-                rsp_buff[io_size-1] = '\0';  //mark it as null to string terminate
-
-            //print data
-            printf("%.*s", (int)io_size, rsp_buff);
-
-            if (is_eof)
-                break;
+        //once in a row, a session that keeps dropping is not worth chasing
+        if ((io_size <= 0) && !is_pty && !resumed && rsh_auth_has_ticket()){
+            close(cli_socket);
+            cli_socket = resume_session(address, port, is_framed, rsp_buff);
+            if (cli_socket < 0)
+                return loop_cleanup(ed, cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
+            resumed = true;
+            continue;
         }
+        resumed = false;
 
         if (io_size == 0){
             printf(RCMD_SERVER_EXITED);
-            return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
+            return loop_cleanup(ed, cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
         }
         if (io_size < 0){
             perror("network read error");
-            return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
+            return loop_cleanup(ed, cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
         }
 
         //lets check if we got the exit command, if so we need to break out of here
@@ -174,7 +287,342 @@ int exec_remote_cmd_loop(char *address, int port)
             break;
         }
     }
-    return client_cleanup(cli_socket, cmd_buff, rsp_buff, OK);
+    return loop_cleanup(ed, cli_socket, cmd_buff, rsp_buff, OK);
+}
+
+/*
+ * client_wait(cli_socket, ed)
+ *      Waits until there is something to receive on cli_socket.  Meanwhile
+ *      whatever is typed goes to the line editor, so it is not lost and
+ *      the user can type ahead.  With ed NULL it just returns.
+ *
+ *  Returns:
+ *      OK:                      cli_socket is readable, or closed
+ *      ERR_RDSH_COMMUNICATION:  poll() failed
+ */
+int client_wait(int cli_socket, rsh_edit_t *ed){
+    struct pollfd pfd[2];
+
+    if (ed == NULL)
+        return OK;
+
+    pfd[0].fd = cli_socket;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = STDIN_FILENO;
+    pfd[1].events = POLLIN;
+    while (1){
+        if (poll(pfd, edit_eof(ed) ? 1 : 2, -1) < 0){
+            if (errno == EINTR)
+                continue;
+            return ERR_RDSH_COMMUNICATION;
+        }
+        if (!edit_eof(ed) && pfd[1].revents)
+            edit_feed(ed);
+        if (pfd[0].revents)
+            return OK;
+    }
+}
+
+/*
+ * client_write(buff, len)
+ *      Writes command output to STDOUT with write(), all of it.  Whatever
+ *      printf() still has buffered goes first so messages and output stay
+ *      in order.
+ *
+ *  Returns:
+ *      OK:               written
+ *      ERR_RDSH_CLIENT:  STDOUT is gone
+ */
+int client_write(const void *buff, int len){
+    const char *p = buff;
+    ssize_t n;
+
+    fflush(stdout);
+    while (len > 0){
+        n = write(STDOUT_FILENO, p, len);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            return ERR_RDSH_CLIENT;
+        p += n;
+        len -= n;
+    }
+    return OK;
+}
+
+/*
+ * send_request(cli_socket, is_framed, req_id, flags, cmd)
+ *      cli_socket:  socket connected to the server
+ *      is_framed:   the session was negotiated, send a REQ frame
+ *      req_id:      id the server will tag the response with
+ *      flags:       RDSH_FLAG_* for the request
+ *      cmd:         null terminated command line
+ *
+ *  Sends one command to the server.  A plain session just sends the
+ *  string including the null byte, req_id and flags are not used.
+ *
+ *  Returns:
+ *      OK:                      the request was sent
+ *      ERR_RDSH_COMMUNICATION:  send() failed
+ */
+int send_request(int cli_socket, int is_framed, uint32_t req_id, uint8_t flags,
+                 char *cmd){
+    rdsh_frame_hdr_t hdr;
+    int send_len = strlen(cmd) + 1;
+
+    if (!is_framed)
+        return rsh_send_all(cli_socket, cmd, send_len);
+
+    init_frame_hdr(&hdr, RDSH_FRAME_REQ, 0, req_id);
+    hdr.flags = flags;
+    hdr.len = hdr.raw_len = send_len;
+    return send_frame(cli_socket, &hdr, cmd);
+}
+
+/*
+ * exec_remote_batch(server_ip, port, script, stop_on_fail)
+ *      server_ip, port:  see exec_remote_cmd_loop()
+ *      script:           file with one command per line, blank lines and
+ *                        lines starting with # are ignored
+ *      stop_on_fail:     stop at the first command that fails
+ *
+ *  Runs a script of commands on the server without a round trip per
+ *  command.  Up to RDSH_BATCH_WINDOW requests are kept in flight, each
+ *  with its own id, and the responses are matched up as they arrive.
+ *  Since the server runs the requests of a session in order the responses
+ *  come back in the order they were sent, anything else is a protocol
+ *  error.
+ *
+ *  With stop_on_fail the requests carry RDSH_FLAG_STOP_ON_FAIL so the
+ *  server itself skips whatever is already in flight after a failure,
+ *  the client then stops sending.
+ *
+ *   returns:
+ *          OK:                     every command ran and returned 0
+ *          ERR_RDSH_CMD_EXEC:      at least one command failed
+ *          ERR_RDSH_CLIENT:        could not open the script or connect
+ *          ERR_RDSH_COMMUNICATION: send(), recv() or the protocol failed
+ */
+int exec_remote_batch(char *address, int port, char *script, int stop_on_fail)
+{
+    char *rsp_buff;
+    char *cmd_buff;
+    char *lines[RDSH_BATCH_WINDOW];     //command text and script line of
+    int  line_nums[RDSH_BATCH_WINDOW];  //each request in flight
+    FILE *fp;
+    int cli_socket;
+    uint32_t next_id = 1;
+    uint32_t oldest_id = 1;
+    int line_num = 0;
+    int slot;
+    int status;
+    int rc = OK;
+    int failed = false;
+    int more = true;
+
+    fp = fopen(script, "r");
+    if (fp == NULL){
+        printf(RCMD_ERR_BATCH_OPEN, script);
+        return ERR_RDSH_CLIENT;
+    }
+
+    memset(lines, 0, sizeof(lines));
+    rsp_buff = malloc(RDSH_COMM_BUFF_SZ * 2);
+    cmd_buff = malloc(SH_CMD_MAX);
+    if ((rsp_buff == NULL) || (cmd_buff == NULL)){
+        fclose(fp);
+        return client_cleanup(-1, cmd_buff, rsp_buff, ERR_MEMORY);
+    }
+
+    cli_socket = start_client(address, port);
+    if (cli_socket < 0){
+        fclose(fp);
+        return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_CLIENT);
+    }
+
+    //batching needs framed requests
+    if (negotiate_session(cli_socket, rsp_buff) != true){
+        printf(RCMD_ERR_BATCH_PROTO);
+        fclose(fp);
+        return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
+    }
+
+    while ((rc == OK) && (more || (oldest_id != next_id))){
+        //fill the window, unless we are stopping after a failure
+        while (more && ((next_id - oldest_id) < RDSH_BATCH_WINDOW)){
+            if ((failed && stop_on_fail) || (fgets(cmd_buff, SH_CMD_MAX, fp) == NULL)){
+                more = false;
+                break;
+            }
+            line_num++;
+            cmd_buff[strcspn(cmd_buff, "\n")] = '\0';
+            if ((cmd_buff[0] == '\0') || (cmd_buff[0] == '#'))
+                continue;
+
+            slot = next_id % RDSH_BATCH_WINDOW;
+            lines[slot] = strdup(cmd_buff);
+            line_nums[slot] = line_num;
+            rc = send_request(cli_socket, true, next_id,
+                              stop_on_fail ? RDSH_FLAG_STOP_ON_FAIL : 0, cmd_buff);
+            if (rc != OK)
+                break;
+            next_id++;
+        }
+        if ((rc != OK) || (oldest_id == next_id))
+            continue;
+
+        //get the response to the oldest request
+        rc = recv_batch_response(cli_socket, rsp_buff, oldest_id, &status);
+        if (rc != OK)
+            continue;
+
+        slot = oldest_id % RDSH_BATCH_WINDOW;
+        if (status == WARN_RDSH_SKIPPED){
+            printf(RCMD_MSG_BATCH_SKIPPED, line_nums[slot], lines[slot]);
+        } else if (status != OK){
+            printf(RCMD_MSG_BATCH_FAILED, line_nums[slot], status, lines[slot]);
+            failed = true;
+        }
+        free(lines[slot]);
+        lines[slot] = NULL;
+        oldest_id++;
+    }
+
+    for (int i = 0; i < RDSH_BATCH_WINDOW; i++)
+        free(lines[i]);
+    fclose(fp);
+
+    if ((rc == OK) && failed)
+        rc = ERR_RDSH_CMD_EXEC;
+    return client_cleanup(cli_socket, cmd_buff, rsp_buff, rc);
+}
+
+/*
+ * recv_batch_response(cli_socket, rsp_buff, req_id, status)
+ *      Prints the output of request req_id until its END frame, and puts
+ *      the status from the END frame in *status.  That is the exit code
+ *      of the command, a negative error code from the server, or
+ *      WARN_RDSH_SKIPPED if the server skipped the request.
+ *
+ *  Returns:
+ *      OK:                      got the whole response
+ *      ERR_RDSH_COMMUNICATION:  recv() failed, the server went away, or a
+ *                               frame for some other request showed up
+ */
+int recv_batch_response(int cli_socket, char *rsp_buff, uint32_t req_id, int *status){
+    rdsh_frame_hdr_t hdr;
+    uint32_t st;
+    char *data;
+    int rc;
+
+    while (1){
+        rc = recv_frame(cli_socket, &hdr, rsp_buff, RDSH_COMM_BUFF_SZ);
+        if ((rc < 0) || (hdr.type == 0)){
+            printf(RCMD_SERVER_EXITED);
+            return ERR_RDSH_COMMUNICATION;
+        }
+        if (hdr.req_id != req_id){
+            printf(RCMD_ERR_BATCH_ORDER, hdr.req_id, req_id);
+            return ERR_RDSH_COMMUNICATION;
+        }
+
+        if (hdr.type == RDSH_FRAME_END){
+            if (rc != sizeof(st))
+                return ERR_RDSH_COMMUNICATION;
+            memcpy(&st, rsp_buff, sizeof(st));
+            *status = (int)ntohl(st);
+            return OK;
+        }
+
+        rc = frame_payload(&hdr, rsp_buff, rsp_buff + RDSH_COMM_BUFF_SZ,
+                           RDSH_COMM_BUFF_SZ, &data);
+        if (rc < 0)
+            return ERR_RDSH_COMMUNICATION;
+        fwrite(data, 1, rc, stdout);
+    }
+}
+
+/*
+ * negotiate_session(cli_socket, rsp_buff)
+ *      cli_socket:  socket connected to the server
+ *      rsp_buff:    buffer to receive the reply into
+ *
+ *  Sends the hello control message (see RDSH_CTL_CHAR in rshlib.h) asking
+ *  for a framed session, with compressed output if -z was given, a pty if
+ *  -t was given and multiplexing if we are a jump host.  The reply comes
+ *  back the old way, ending in RDSH_EOF_CHAR.  A server that does not know
+ *  about hello will reply with some sort of error from trying to run it
+ *  as a command, in that case we just carry on with a plain session.
+ *
+ *  Returns:
+ *      true:                    the session is now framed
+ *      false:                   the server did not agree, stay plain
+ *      ERR_RDSH_COMMUNICATION:  send() or recv() failed, or the server wants
+ *                               a key, see rsh_auth_refused()
+ */
+int negotiate_session(int cli_socket, char *rsp_buff){
+    char hello[64];
+    int len;
+    int got = 0;
+    ssize_t io_size;
+
+    len = snprintf(hello, sizeof(hello), RDSH_HELLO_REQ, RDSH_CTL_CHAR,
+                   RDSH_PROTO_VER,
+                   use_compression ? RDSH_COMPRESS_LZ : RDSH_COMPRESS_NONE,
+                   use_mux, use_pty) + 1;
+    if ((rsh_send_all(cli_socket, hello, len) != OK) || rsh_auth_refused(cli_socket))
+        return ERR_RDSH_COMMUNICATION;
+
+    while (got < RDSH_COMM_BUFF_SZ - 1){
+        io_size = rsh_recv(cli_socket, rsp_buff + got, RDSH_COMM_BUFF_SZ - 1 - got);
+        if (io_size <= 0)
+            return ERR_RDSH_COMMUNICATION;
+        got += io_size;
+        if (rsp_buff[got - 1] == RDSH_EOF_CHAR)
+            break;
+    }
+    rsp_buff[got] = '\0';
+
+    return (strncmp(rsp_buff, "ok ", 3) == 0) ? true : false;
+}
+
+/*
+ * recv_framed_response(cli_socket, rsp_buff, ed)
+ *      cli_socket:  socket connected to the server
+ *      rsp_buff:    2 * RDSH_COMM_BUFF_SZ bytes, frames are received into
+ *                   the first half and decompressed into the second
+ *      ed:          takes what is typed meanwhile, see client_wait()
+ *
+ *  Framed version of the recv() loop in exec_remote_cmd_loop(), it prints
+ *  DATA frames until the END frame for the command shows up.
+ *
+ *  Returns:
+ *      1:                       got the whole response
+ *      0:                       the server closed the connection
+ *      ERR_RDSH_COMMUNICATION:  recv() failed or a frame was bad
+ */
+int recv_framed_response(int cli_socket, char *rsp_buff, rsh_edit_t *ed){
+    rdsh_frame_hdr_t hdr;
+    char *data;
+    int rc;
+
+    while (1){
+        if (client_wait(cli_socket, ed) != OK)
+            return ERR_RDSH_COMMUNICATION;
+        rc = recv_frame(cli_socket, &hdr, rsp_buff, RDSH_COMM_BUFF_SZ);
+        if (rc < 0)
+            return ERR_RDSH_COMMUNICATION;
+        if (hdr.type == 0)
+            return 0;
+        if (hdr.type == RDSH_FRAME_END)
+            return 1;
+
+        rc = frame_payload(&hdr, rsp_buff, rsp_buff + RDSH_COMM_BUFF_SZ,
+                           RDSH_COMM_BUFF_SZ, &data);
+        if (rc < 0)
+            return ERR_RDSH_COMMUNICATION;
+        client_write(data, rc);
+    }
 }
 
 /*
@@ -194,23 +642,40 @@ int exec_remote_cmd_loop(char *address, int port)
  *          1. Creating the client socket via socket()
  *          2. Calling connect()
  *          3. Returning the client socket after connecting to the server
+ *
+ *      With -u it connects to that Unix domain socket path instead, and
+ *      server_ip and port are not used.  The socket options from -o are
+ *      applied, see rsh_net.c.  With -k the client then authenticates, see
+ *      rsh_auth.c.
  * 
  *   returns:
  *          client_socket:      The file descriptor fd of the client socket
  *          ERR_RDSH_CLIENT:    If socket() or connect() fail
+ *          ERR_RDSH_SERVER:    If the server and the client do not share a
+ *                              key, rsh_auth_connect() has said so
  * 
  */
 int start_client(char *server_ip, int port){
     struct sockaddr_in addr;
+    struct sockaddr_un uaddr;
     int cli_socket;
     int ret;
 
-    cli_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (cli_socket == -1) {
-        perror("socket");
+    cli_socket = rsh_net_socket();
+    if (cli_socket < 0) {
         return ERR_RDSH_CLIENT;
     }
 
+    if (get_net_opts()->unix_path != NULL) {
+        if ((rsh_unix_addr(&uaddr) != OK) ||
+            (connect(cli_socket, (const struct sockaddr *) &uaddr, sizeof(uaddr)) == -1)) {
+            fprintf(stderr, "The server is down.\n");
+            close(cli_socket);
+            return ERR_RDSH_CLIENT;
+        }
+        return rsh_auth_connect(cli_socket);
+    }
+
     /*
      * For portability clear the whole structure, since some
      * implementations have additional (nonstandard) fields in
@@ -229,10 +694,12 @@ int start_client(char *server_ip, int port){
                    sizeof(struct sockaddr_in));
     if (ret == -1) {
         fprintf(stderr, "The server is down.\n");
+        close(cli_socket);
         return ERR_RDSH_CLIENT;
     }
 
-    return cli_socket;
+    rsh_tune_socket(cli_socket);
+    return rsh_auth_connect(cli_socket);
 }
 
 /*
@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_drain.c - graceful shutdown of the threaded server
+ *
+ * `stop-server` used to end the threaded server with exit(), which took
+ * every other session down in the middle of whatever it was running.  Now
+ * it only asks for a shutdown, and the accept loop carries it out:
+ *
+ *   1. rsh_request_shutdown() bumps an eventfd.  `stop-server` calls it
+ *      from its session thread, and so does SIGTERM, which is how a
+ *      restart is usually triggered.  A write() is all a signal handler
+ *      may safely do, so nothing else happens there.
+ *   2. process_cli_requests() polls the eventfd next to the listening
+ *      socket.  Once it fires no more clients are accepted, it calls
+ *      rsh_drain().
+ *   3. Every connection is in a registry (rsh_conn_t) that counts the
+ *      requests it is running.  Busy ones are left to finish.  A request
+ *      that arrives during the drain is refused with RCMD_ERR_DRAINING,
+ *      and the session ends.  A connection that has been idle for
+ *      RDSH_DRAIN_IDLE_MS, counted from the start of the drain or from the
+ *      end of its last request, is shut down for reading, so its session
+ *      sees the client go and ends the usual way.  The wait is what lets
+ *      a client that was just answered still hear why it was turned away,
+ *      rather than finding the connection closed under it.
+ *   4. If the session threads are not all gone by RDSH_DRAIN_SECS, the
+ *      pipelines still running are stopped with SIGTERM (see zygote_kill())
+ *      and the connections are shut down completely.  The threads get
+ *      RDSH_DRAIN_GRACE_SECS more to clean up, then the server exits
+ *      regardless.
+ *
+ * The single threaded server only ever has the one session, so there is
+ * nothing to drain.  It still watches the eventfd between clients.
+ */
+
+struct rsh_conn{
+    int               sock;
+    int               busy;         //requests running right now
+    uint64_t          idle_since;   //ms, set while draining, 0 once shut
+    struct rsh_conn  *prev;
+    struct rsh_conn  *next;
+};
+
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drain_idle = PTHREAD_COND_INITIALIZER;
+static rsh_conn_t *conn_list = NULL;
+static int num_workers = 0;         //session threads still running
+static int draining = false;
+static int shutdown_fd = -1;
+
+static uint64_t now_ms(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void on_sigterm(int sig){
+    (void)sig;
+    rsh_request_shutdown();
+}
+
+/*
+ * rsh_shutdown_init()
+ *      Creates the eventfd and installs the SIGTERM handler.  Called by
+ *      start_server() after the zygote is started, so the zygote keeps the
+ *      default SIGTERM.
+ *
+ *  Returns:
+ *      OK:               ready
+ *      ERR_RDSH_SERVER:  no eventfd, the server can still run but only
+ *                        stops when a single threaded session asks
+ */
+int rsh_shutdown_init(void){
+    struct sigaction sa;
+
+    shutdown_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shutdown_fd < 0){
+        perror("eventfd");
+        return ERR_RDSH_SERVER;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigterm;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    return OK;
+}
+
+/*
+ * rsh_shutdown_fd()
+ *      The eventfd to poll() for POLLIN, -1 if there is none.
+ */
+int rsh_shutdown_fd(void){
+    return shutdown_fd;
+}
+
+/*
+ * rsh_request_shutdown()
+ *      Asks the accept loop to start a graceful shutdown.  Safe to call
+ *      from any thread and from a signal handler.
+ */
+void rsh_request_shutdown(void){
+    uint64_t one = 1;
+    int saved_errno = errno;
+
+    if ((shutdown_fd >= 0) && (write(shutdown_fd, &one, sizeof(one)) < 0)){
+        //the counter is full, a shutdown is pending either way
+    }
+    errno = saved_errno;
+}
+
+/*
+ * rsh_conn_register(sock) and rsh_conn_unregister(conn)
+ *      Add a client connection to the registry when its session starts,
+ *      and take it out again once the session is over.  A connection that
+ *      shows up during a drain counts as idle from then on.
+ *
+ *  rsh_conn_register() returns the entry, or NULL if there is no memory.
+ *  The rsh_conn_*() functions all accept NULL and then do nothing.
+ */
+rsh_conn_t *rsh_conn_register(int sock){
+    rsh_conn_t *conn = calloc(1, sizeof(rsh_conn_t));
+
+    if (conn == NULL)
+        return NULL;
+    conn->sock = sock;
+
+    pthread_mutex_lock(&drain_lock);
+    conn->next = conn_list;
+    if (conn_list != NULL)
+        conn_list->prev = conn;
+    conn_list = conn;
+    if (draining)
+        conn->idle_since = now_ms();
+    pthread_mutex_unlock(&drain_lock);
+    return conn;
+}
+
+void rsh_conn_unregister(rsh_conn_t *conn){
+    if (conn == NULL)
+        return;
+
+    pthread_mutex_lock(&drain_lock);
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        conn_list = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+    pthread_mutex_unlock(&drain_lock);
+    free(conn);
+}
+
+/*
+ * rsh_conn_begin(conn) and rsh_conn_end(conn)
+ *      Bracket every request a connection runs, see exec_session_request().
+ *      The channels of a multiplexed connection share one entry, so busy
+ *      can be more than 1.
+ *
+ *  rsh_conn_begin() returns:
+ *      OK:                   go ahead
+ *      ERR_RDSH_SERVER:      the server is draining, refuse the request
+ */
+int rsh_conn_begin(rsh_conn_t *conn){
+    int rc = OK;
+
+    if (conn == NULL)
+        return OK;
+
+    pthread_mutex_lock(&drain_lock);
+    if (draining)
+        rc = ERR_RDSH_SERVER;
+    else
+        conn->busy++;
+    pthread_mutex_unlock(&drain_lock);
+    return rc;
+}
+
+void rsh_conn_end(rsh_conn_t *conn){
+    if (conn == NULL)
+        return;
+
+    pthread_mutex_lock(&drain_lock);
+    conn->busy--;
+    if (draining && (conn->busy == 0))
+        conn->idle_since = now_ms();
+    pthread_mutex_unlock(&drain_lock);
+}
+
+/*
+ * rsh_worker_start() and rsh_worker_done()
+ *      Count the session threads of the threaded server.  The count goes
+ *      up before the thread is created, so a client accepted just before
+ *      the drain starts is still waited for.
+ */
+void rsh_worker_start(void){
+    pthread_mutex_lock(&drain_lock);
+    num_workers++;
+    pthread_mutex_unlock(&drain_lock);
+}
+
+void rsh_worker_done(void){
+    pthread_mutex_lock(&drain_lock);
+    num_workers--;
+    pthread_cond_broadcast(&drain_idle);
+    pthread_mutex_unlock(&drain_lock);
+}
+
+//shuts down reading on the connections idle for RDSH_DRAIN_IDLE_MS
+static void drain_idle_conns(void){
+    uint64_t now = now_ms();
+
+    for (rsh_conn_t *conn = conn_list; conn != NULL; conn = conn->next){
+        if ((conn->busy == 0) && (conn->idle_since != 0) &&
+            (now - conn->idle_since >= RDSH_DRAIN_IDLE_MS)){
+            shutdown(conn->sock, SHUT_RD);
+            conn->idle_since = 0;
+        }
+    }
+}
+
+//waits for the session threads for secs, shutting idle connections as
+//they come due; returns how many are left
+static int drain_wait(int secs){
+    uint64_t deadline = now_ms() + (uint64_t)secs * 1000;
+    struct timespec tick;
+
+    while (num_workers > 0){
+        uint64_t now = now_ms();
+        uint64_t wake = now + RDSH_DRAIN_IDLE_MS / 4;
+
+        if (now >= deadline)
+            break;
+        drain_idle_conns();
+        if (wake > deadline)
+            wake = deadline;
+
+        //the condition variable runs on CLOCK_REALTIME
+        clock_gettime(CLOCK_REALTIME, &tick);
+        tick.tv_sec += (wake - now) / 1000;
+        tick.tv_nsec += ((wake - now) % 1000) * 1000000;
+        if (tick.tv_nsec >= 1000000000){
+            tick.tv_sec++;
+            tick.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&drain_idle, &drain_lock, &tick);
+    }
+    return num_workers;
+}
+
+/*
+ * rsh_drain(secs)
+ *      secs:  how long sessions get to finish what they are running
+ *
+ *  Steps 3 and 4 in the comment at the top.  Called by the accept loop
+ *  once it has stopped accepting.
+ *
+ *  Returns:
+ *      OK_EXIT:  the server can stop now.  Sessions that had to be cut off
+ *                are logged with RCMD_MSG_SVR_DRAIN_KILL.
+ */
+int rsh_drain(int secs){
+    int num_conns = 0;
+    int left;
+
+    pthread_mutex_lock(&drain_lock);
+    draining = true;
+    for (rsh_conn_t *conn = conn_list; conn != NULL; conn = conn->next){
+        if (conn->busy == 0)
+            conn->idle_since = now_ms();
+        num_conns++;
+    }
+    if (num_conns > 0)
+        printf(RCMD_MSG_SVR_DRAINING, num_conns, secs);
+
+    left = drain_wait(secs);
+    if (left > 0){
+        printf(RCMD_MSG_SVR_DRAIN_KILL, left);
+        for (rsh_conn_t *conn = conn_list; conn != NULL; conn = conn->next)
+            shutdown(conn->sock, SHUT_RDWR);
+        pthread_mutex_unlock(&drain_lock);
+        zygote_kill(SIGTERM);
+        pthread_mutex_lock(&drain_lock);
+        left = drain_wait(RDSH_DRAIN_GRACE_SECS);
+    }
+    pthread_mutex_unlock(&drain_lock);
+
+    return OK_EXIT;
+}
@@ -0,0 +1,385 @@
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_edit.c - line editing for the rsh client
+ *
+ * The client used to read commands with fgets(), so nothing typed while
+ * a command ran was seen until it was done, and the terminal's cooked
+ * mode was the only editing there was.  Now the client's loop polls the
+ * socket and stdin together (see exec_remote_cmd_loop()) and hands
+ * whatever is typed to the editor here:
+ *
+ *   - On a terminal it is put in raw mode and the editor does its own
+ *     echo.  Left and right (or ^B ^F), ^A and ^E, backspace, ^D to
+ *     delete, ^U and ^K to cut, and up and down (or ^P ^N) for the last
+ *     RDSH_HIST_MAX commands.  ^D on an empty line ends the client like
+ *     the end of input does.
+ *   - While the output of a command streams in, keys are still taken in
+ *     but nothing is echoed, so the output is not mixed up with them.
+ *     Lines finished with Enter wait their turn and are sent one at a
+ *     time.  A line typed ahead shows up after its prompt, as if it had
+ *     been typed there, and an unfinished one is waiting at the next
+ *     prompt.
+ *   - When stdin is not a terminal, or the session is a pty one (see
+ *     rsh_pty.c, the remote terminal does the editing then), input is
+ *     just split into lines and nothing is echoed, as with fgets().
+ *
+ * Editing redraws the line relative to where the cursor is, so output
+ * that did not end in a newline is left alone.  Lines longer than the
+ * terminal is wide are not handled.
+ */
+
+struct rsh_edit{
+    int             raw;            //our terminal, in raw mode
+    char            line[SH_CMD_MAX];   //the line being typed
+    int             len;
+    int             pos;            //cursor in line
+    int             shown;          //the prompt and line are on the screen
+    int             cur;            //where the cursor is on the screen
+    char            esc[8];         //escape sequence so far
+    int             esc_len;
+    char           *queue;          //finished lines waiting, each ends in \n
+    int             queue_len;
+    int             queue_cap;
+    char           *hist[RDSH_HIST_MAX];
+    int             hist_num;
+    int             hist_pos;       //hist_num while on the new line
+    char            stash[SH_CMD_MAX];  //the new line while in the history
+    int             eof;
+};
+
+//for restoring the terminal on the way out, a signal included
+static struct termios edit_saved;
+static volatile sig_atomic_t edit_is_raw = false;
+
+static void edit_restore(int sig){
+    if (edit_is_raw)
+        tcsetattr(STDIN_FILENO, TCSANOW, &edit_saved);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/*
+ * edit_new(use_tty) and edit_free(ed)
+ *      Set up and tear down the editor.  With use_tty, and stdin and
+ *      stdout both terminals, the terminal goes raw until edit_free().
+ *      ^C and the other signal keys still work, the terminal is put back
+ *      before the signal is taken.
+ *
+ *  edit_new() returns NULL if there is no memory.
+ */
+rsh_edit_t *edit_new(int use_tty){
+    rsh_edit_t *ed = calloc(1, sizeof(rsh_edit_t));
+    struct termios raw;
+
+    if (ed == NULL)
+        return NULL;
+    if (!use_tty || !isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) ||
+        (tcgetattr(STDIN_FILENO, &edit_saved) != 0))
+        return ed;
+
+    raw = edit_saved;
+    raw.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    signal(SIGINT, edit_restore);
+    signal(SIGQUIT, edit_restore);
+    signal(SIGTERM, edit_restore);
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == 0){
+        ed->raw = true;
+        edit_is_raw = true;
+    }
+    return ed;
+}
+
+void edit_free(rsh_edit_t *ed){
+    if (ed == NULL)
+        return;
+    if (ed->raw){
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &edit_saved);
+        edit_is_raw = false;
+    }
+    for (int i = 0; i < ed->hist_num; i++)
+        free(ed->hist[i]);
+    free(ed->queue);
+    free(ed);
+}
+
+//draws the line again, from where the cursor is now
+static void redraw(rsh_edit_t *ed){
+    char buff[SH_CMD_MAX + 32];
+    int n = 0;
+
+    if (!ed->shown)
+        return;
+    if (ed->cur > 0)
+        n += snprintf(buff + n, sizeof(buff) - n, "\x1b[%dD", ed->cur);
+    memcpy(buff + n, ed->line, ed->len);
+    n += ed->len;
+    n += snprintf(buff + n, sizeof(buff) - n, "\x1b[K");
+    if (ed->len > ed->pos)
+        n += snprintf(buff + n, sizeof(buff) - n, "\x1b[%dD", ed->len - ed->pos);
+    client_write(buff, n);
+    ed->cur = ed->pos;
+}
+
+static void set_line(rsh_edit_t *ed, const char *text){
+    ed->len = strlen(text);
+    memcpy(ed->line, text, ed->len);
+    ed->pos = ed->len;
+}
+
+//up (-1) and down (1) through the history
+static void history(rsh_edit_t *ed, int dir){
+    int to = ed->hist_pos + dir;
+
+    if ((to < 0) || (to > ed->hist_num))
+        return;
+    if (ed->hist_pos == ed->hist_num){
+        memcpy(ed->stash, ed->line, ed->len);
+        ed->stash[ed->len] = '\0';
+    }
+    ed->hist_pos = to;
+    set_line(ed, (to == ed->hist_num) ? ed->stash : ed->hist[to]);
+}
+
+static int queue_line(rsh_edit_t *ed, const char *text, int len){
+    if (ed->queue_len + len + 1 > ed->queue_cap){
+        int cap = (ed->queue_cap + len + 1) * 2;
+        char *q = realloc(ed->queue, cap);
+
+        if (q == NULL)
+            return ERR_MEMORY;
+        ed->queue = q;
+        ed->queue_cap = cap;
+    }
+    memcpy(ed->queue + ed->queue_len, text, len);
+    ed->queue[ed->queue_len + len] = '\n';
+    ed->queue_len += len + 1;
+    return OK;
+}
+
+//Enter, the line joins the queue and the history
+static void finish_line(rsh_edit_t *ed){
+    ed->line[ed->len] = '\0';
+    if (ed->shown)
+        client_write("\n", 1);
+    ed->shown = false;
+    ed->cur = 0;
+
+    if ((ed->len > 0) &&
+        ((ed->hist_num == 0) || (strcmp(ed->hist[ed->hist_num - 1], ed->line) != 0))){
+        if (ed->hist_num == RDSH_HIST_MAX){
+            free(ed->hist[0]);
+            memmove(ed->hist, ed->hist + 1, sizeof(char *) * (RDSH_HIST_MAX - 1));
+            ed->hist_num--;
+        }
+        ed->hist[ed->hist_num] = strdup(ed->line);
+        if (ed->hist[ed->hist_num] != NULL)
+            ed->hist_num++;
+    }
+    ed->hist_pos = ed->hist_num;
+
+    queue_line(ed, ed->line, ed->len);
+    ed->len = ed->pos = 0;
+}
+
+static void delete_chars(rsh_edit_t *ed, int at, int n){
+    memmove(ed->line + at, ed->line + at + n, ed->len - at - n);
+    ed->len -= n;
+}
+
+//an escape sequence, only the ones for the arrow, home, end and delete keys
+static void edit_escape(rsh_edit_t *ed){
+    char key = ed->esc[ed->esc_len - 1];
+
+    switch (key){
+        case 'A': history(ed, -1); break;
+        case 'B': history(ed, 1); break;
+        case 'C': if (ed->pos < ed->len) ed->pos++; break;
+        case 'D': if (ed->pos > 0) ed->pos--; break;
+        case 'H': ed->pos = 0; break;
+        case 'F': ed->pos = ed->len; break;
+        case '~':
+            if ((ed->esc[2] == '3') && (ed->pos < ed->len))
+                delete_chars(ed, ed->pos, 1);
+            break;
+        default:
+            break;
+    }
+}
+
+static void edit_key(rsh_edit_t *ed, char c){
+    if (ed->esc_len > 0){
+        ed->esc[ed->esc_len++] = c;
+        if ((ed->esc[1] != '[') && (ed->esc[1] != 'O'))
+            ed->esc_len = 0;
+        else if ((ed->esc_len >= 3) && (c >= 0x40) && (c <= 0x7e)){
+            edit_escape(ed);
+            ed->esc_len = 0;
+            redraw(ed);
+        } else if (ed->esc_len == sizeof(ed->esc)){
+            ed->esc_len = 0;
+        }
+        return;
+    }
+
+    switch (c){
+        case '\x1b':
+            ed->esc[ed->esc_len++] = c;
+            return;
+        case '\r':
+        case '\n':
+            finish_line(ed);
+            return;
+        case 0x01: ed->pos = 0; break;                          //^A
+        case 0x05: ed->pos = ed->len; break;                    //^E
+        case 0x02: if (ed->pos > 0) ed->pos--; break;           //^B
+        case 0x06: if (ed->pos < ed->len) ed->pos++; break;     //^F
+        case 0x10: history(ed, -1); break;                      //^P
+        case 0x0e: history(ed, 1); break;                       //^N
+        case 0x0b: ed->len = ed->pos; break;                    //^K
+        case 0x15:                                              //^U
+            delete_chars(ed, 0, ed->pos);
+            ed->pos = 0;
+            break;
+        case 0x04:                                              //^D
+            if (ed->len == 0){
+                ed->eof = true;
+                return;
+            }
+            if (ed->pos < ed->len)
+                delete_chars(ed, ed->pos, 1);
+            break;
+        case 0x08:                                              //^H
+        case 0x7f:                                              //backspace
+            if (ed->pos == 0)
+                return;
+            delete_chars(ed, ed->pos - 1, 1);
+            ed->pos--;
+            break;
+        default:
+            if (((unsigned char)c < 0x20) || (ed->len >= SH_CMD_MAX - 1))
+                return;
+            memmove(ed->line + ed->pos + 1, ed->line + ed->pos, ed->len - ed->pos);
+            ed->line[ed->pos++] = c;
+            ed->len++;
+            //typing at the end of the line is the usual case, just echo it
+            if (ed->shown && (ed->pos == ed->len) && (ed->cur == ed->pos - 1)){
+                client_write(&c, 1);
+                ed->cur = ed->pos;
+                return;
+            }
+            break;
+    }
+    redraw(ed);
+}
+
+//not a terminal, just cut the input into lines
+static void edit_text(rsh_edit_t *ed, char c){
+    if (c == '\n'){
+        finish_line(ed);
+        return;
+    }
+    if (ed->len < SH_CMD_MAX - 1)
+        ed->line[ed->len++] = c;
+    ed->pos = ed->len;
+}
+
+/*
+ * edit_feed(ed)
+ *      Reads what there is on stdin, once, and takes it in.  Call it when
+ *      poll() says stdin is readable.
+ */
+void edit_feed(rsh_edit_t *ed){
+    char buff[256];
+    ssize_t n = read(STDIN_FILENO, buff, sizeof(buff));
+
+    if ((n < 0) && (errno == EINTR))
+        return;
+    if (n <= 0){
+        //a last line without a newline still counts, as with fgets()
+        if (!ed->raw && (ed->len > 0))
+            finish_line(ed);
+        ed->eof = true;
+        return;
+    }
+    for (ssize_t i = 0; (i < n) && !ed->eof; i++){
+        if (ed->raw)
+            edit_key(ed, buff[i]);
+        else
+            edit_text(ed, buff[i]);
+    }
+}
+
+/*
+ * edit_eof(ed)
+ *      True once there is no more input, stdin has closed or ^D was typed
+ *      on an empty line.
+ */
+int edit_eof(rsh_edit_t *ed){
+    return ed->eof;
+}
+
+/*
+ * edit_read_line(ed, buff, sz)
+ *      Prints the prompt and gets the next line into buff, without the
+ *      newline.  A line typed ahead is taken right away and echoed after
+ *      the prompt on a terminal, otherwise this waits for one.
+ *
+ *  Returns:
+ *      OK:      there is a line in buff
+ *      OK_EXIT: no more input
+ */
+int edit_read_line(rsh_edit_t *ed, char *buff, int sz){
+    struct pollfd pfd;
+    char *nl;
+    int len;
+
+    client_write(SH_PROMPT, strlen(SH_PROMPT));
+    if (ed->queue_len > 0){
+        //typed ahead while the last command ran, nobody has seen it yet
+        nl = memchr(ed->queue, '\n', ed->queue_len);
+        if (ed->raw)
+            client_write(ed->queue, nl - ed->queue + 1);
+    } else {
+        ed->shown = ed->raw;
+        ed->cur = 0;
+        redraw(ed);
+
+        pfd.fd = STDIN_FILENO;
+        pfd.events = POLLIN;
+        while ((ed->queue_len == 0) && !ed->eof){
+            if ((poll(&pfd, 1, -1) < 0) && (errno != EINTR))
+                ed->eof = true;
+            else if (pfd.revents)
+                edit_feed(ed);
+        }
+        if (ed->queue_len == 0){
+            client_write("\n", 1);
+            ed->shown = false;
+            return OK_EXIT;
+        }
+        nl = memchr(ed->queue, '\n', ed->queue_len);
+    }
+
+    len = nl - ed->queue;
+    if (len > sz - 1)
+        len = sz - 1;
+    memcpy(buff, ed->queue, len);
+    buff[len] = '\0';
+    ed->queue_len -= nl - ed->queue + 1;
+    memmove(ed->queue, nl + 1, ed->queue_len);
+    return OK;
+}
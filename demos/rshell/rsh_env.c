@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+extern char **environ;
+
+/*
+ * rsh_env.c - working directory and environment of an rsh session
+ *
+ * The server never changes its own directory or environment.  Sessions
+ * run at the same time (threaded mode, channels of a multiplexed
+ * connection), so a chdir() or setenv() in the server would change it for
+ * all of them, and a chdir() in the child that runs `cd` does nothing at
+ * all.  Instead every session keeps:
+ *
+ *   cwd_fd  an O_PATH descriptor for its directory.  cd opens the new
+ *           directory relative to it with openat(), so it works no matter
+ *           what the server's own directory is.
+ *   env     its own NULL terminated "NAME=value" block, starting as a copy
+ *           of the server's environment.  export and unset edit it.
+ *
+ * Both are only applied in the child at spawn time, it does
+ * fchdir(cwd_fd) and execs with env, see rsh_spawn_pipeline().
+ */
+
+#define RDSH_ENV_GROW   16      //room for exports before growing the block
+
+//length of the name in "NAME" or "NAME=value", -1 if it is not valid
+static int env_name_len(const char *str, int allow_value){
+    int len = 0;
+
+    if (!((str[0] == '_') || ((str[0] | 0x20) >= 'a' && (str[0] | 0x20) <= 'z')))
+        return -1;
+    while ((str[len] == '_') || ((str[len] | 0x20) >= 'a' && (str[len] | 0x20) <= 'z') ||
+           (str[len] >= '0' && str[len] <= '9'))
+        len++;
+    if (str[len] == '\0' || (allow_value && str[len] == '='))
+        return len;
+    return -1;
+}
+
+static int env_find(rsh_session_t *sess, const char *name, int len){
+    for (int i = 0; i < sess->env_count; i++){
+        if ((strncmp(sess->env[i], name, len) == 0) && (sess->env[i][len] == '='))
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * session_state_init(sess) and session_state_free(sess)
+ *      Start a session in the server's directory with a copy of the
+ *      server's environment, and release both again.  Called from
+ *      session_init() and session_free().
+ *
+ *  session_state_init() returns OK, ERR_MEMORY, or ERR_RDSH_SERVER if
+ *  there is no directory to start in.
+ */
+int session_state_init(rsh_session_t *sess){
+    int n = 0;
+
+    sess->cwd_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (sess->cwd_fd < 0)
+        sess->cwd_fd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (sess->cwd_fd < 0)
+        return ERR_RDSH_SERVER;
+
+    while (environ[n] != NULL)
+        n++;
+    sess->env_cap = n + RDSH_ENV_GROW;
+    sess->env = calloc(sess->env_cap + 1, sizeof(char *));
+    if (sess->env == NULL)
+        return ERR_MEMORY;
+    for (sess->env_count = 0; sess->env_count < n; sess->env_count++){
+        sess->env[sess->env_count] = strdup(environ[sess->env_count]);
+        if (sess->env[sess->env_count] == NULL)
+            return ERR_MEMORY;
+    }
+    return OK;
+}
+
+void session_state_free(rsh_session_t *sess){
+    if (sess->cwd_fd >= 0)
+        close(sess->cwd_fd);
+    sess->cwd_fd = -1;
+
+    if (sess->env != NULL){
+        for (int i = 0; i < sess->env_count; i++)
+            free(sess->env[i]);
+        free(sess->env);
+    }
+    sess->env = NULL;
+    sess->env_count = 0;
+}
+
+/*
+ * session_getenv(sess, name)
+ *      Returns the value of name in the session environment, or NULL.
+ */
+const char *session_getenv(rsh_session_t *sess, const char *name){
+    int len = strlen(name);
+    int i = env_find(sess, name, len);
+
+    return (i < 0) ? NULL : sess->env[i] + len + 1;
+}
+
+/*
+ * session_setenv(sess, assign)
+ *      assign:  "NAME=value", a copy is made
+ *
+ *  Returns OK, or ERR_CMD_ARGS_BAD or ERR_MEMORY.
+ */
+int session_setenv(rsh_session_t *sess, const char *assign){
+    int len = env_name_len(assign, true);
+    char *copy;
+    char **grown;
+    int i;
+
+    if ((len < 0) || (assign[len] != '='))
+        return ERR_CMD_ARGS_BAD;
+    copy = strdup(assign);
+    if (copy == NULL)
+        return ERR_MEMORY;
+
+    i = env_find(sess, assign, len);
+    if (i >= 0){
+        free(sess->env[i]);
+        sess->env[i] = copy;
+        return OK;
+    }
+
+    if (sess->env_count == sess->env_cap){
+        grown = realloc(sess->env, (sess->env_cap + RDSH_ENV_GROW + 1) * sizeof(char *));
+        if (grown == NULL){
+            free(copy);
+            return ERR_MEMORY;
+        }
+        sess->env = grown;
+        sess->env_cap += RDSH_ENV_GROW;
+    }
+    sess->env[sess->env_count++] = copy;
+    sess->env[sess->env_count] = NULL;
+    return OK;
+}
+
+/*
+ * session_unsetenv(sess, name)
+ *      Removes name from the session environment, if it is there.
+ */
+void session_unsetenv(rsh_session_t *sess, const char *name){
+    int i = env_find(sess, name, strlen(name));
+
+    if (i < 0)
+        return;
+    free(sess->env[i]);
+    memmove(&sess->env[i], &sess->env[i + 1],
+            (sess->env_count - i) * sizeof(char *));
+    sess->env_count--;
+}
+
+/*
+ * session_chdir(sess, path, msg, msg_sz)
+ *      path:  the new directory, relative to the session directory.  NULL
+ *             means $HOME from the session environment.
+ *      msg:   an error message goes here for the client
+ *
+ *  Moves the session to another directory and keeps $PWD in step for the
+ *  programs that look at it.
+ *
+ *  Returns:
+ *      0:  the session is in the new directory
+ *      1:  it is not, msg says why
+ */
+int session_chdir(rsh_session_t *sess, const char *path, char *msg, int msg_sz){
+    char link[64];
+    char dir[PATH_MAX + 8];
+    ssize_t n;
+    int fd;
+
+    if (path == NULL)
+        path = session_getenv(sess, "HOME");
+    if (path == NULL)
+        path = "/";
+
+    fd = openat(sess->cwd_fd, path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0){
+        snprintf(msg, msg_sz, RCMD_ERR_CD, path, strerror(errno));
+        return 1;
+    }
+    close(sess->cwd_fd);
+    sess->cwd_fd = fd;
+
+    //the kernel knows the real path of the directory we just opened
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    strcpy(dir, "PWD=");
+    n = readlink(link, dir + 4, sizeof(dir) - 5);
+    if (n > 0){
+        dir[4 + n] = '\0';
+        session_setenv(sess, dir);
+    }
+    return 0;
+}
+
+/*
+ * rsh_session_builtin(sess, bi_cmd, cmd, msg, msg_sz)
+ *      sess:    the session to change
+ *      bi_cmd:  BI_CMD_CD, BI_CMD_EXPORT or BI_CMD_UNSET
+ *      cmd:     the parsed command
+ *      msg:     output for the client goes here, empty if there is none
+ *
+ *  Runs the built-ins that change the session rather than the process
+ *  running them.  exec_session_request() calls this when one of them is
+ *  the whole command line, in a pipeline they run in a child and do
+ *  nothing, just like in a subshell.
+ *
+ *    cd [dir]                  dir defaults to $HOME
+ *    export NAME=value ...     NAME on its own is accepted and ignored,
+ *                              everything in the session env is exported
+ *    unset NAME ...
+ *
+ *  Returns:
+ *      the exit status of the command, 0 or 1
+ */
+int rsh_session_builtin(rsh_session_t *sess, Built_In_Cmds bi_cmd, cmd_buff_t *cmd,
+                        char *msg, int msg_sz){
+    int status = 0;
+
+    msg[0] = '\0';
+    switch (bi_cmd){
+        case BI_CMD_CD:
+            if (cmd->argc > 2){
+                snprintf(msg, msg_sz, RCMD_ERR_CD_ARGS);
+                return 1;
+            }
+            return session_chdir(sess, cmd->argv[1], msg, msg_sz);
+        case BI_CMD_EXPORT:
+        case BI_CMD_UNSET:
+            for (int i = 1; i < cmd->argc; i++){
+                char *arg = cmd->argv[i];
+                int allow_value = (bi_cmd == BI_CMD_EXPORT);
+
+                if (env_name_len(arg, allow_value) < 0){
+                    snprintf(msg, msg_sz, RCMD_ERR_ENV_NAME, cmd->argv[0], arg);
+                    status = 1;
+                } else if (bi_cmd == BI_CMD_UNSET){
+                    session_unsetenv(sess, arg);
+                } else if ((strchr(arg, '=') != NULL) && (session_setenv(sess, arg) != OK)){
+                    snprintf(msg, msg_sz, CMD_ERR_RDSH_ITRNL, ERR_MEMORY);
+                    status = 1;
+                }
+            }
+            return status;
+        default:
+            return 1;
+    }
+}
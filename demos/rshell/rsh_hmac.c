@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_hmac.c - SHA-256 and HMAC-SHA-256 for the rsh handshake
+ *
+ * The handshake (see rsh_auth.c) proves both ends know the shared key
+ * without sending it, by MACing fresh nonces with it.  That only needs
+ * HMAC-SHA-256 (RFC 2104 over FIPS 180-4), small enough to carry in tree
+ * like the compressor in rsh_lz.c rather than link a crypto library.
+ * Speed does not matter here, it runs a handful of times per connection.
+ */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(rsh_sha256_t *ctx, const uint8_t *p){
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+
+    for (int i = 0; i < 16; i++)
+        w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) |
+               ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+    for (int i = 16; i < 64; i++){
+        uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = ctx->h[0]; b = ctx->h[1]; c = ctx->h[2]; d = ctx->h[3];
+    e = ctx->h[4]; f = ctx->h[5]; g = ctx->h[6]; h = ctx->h[7];
+    for (int i = 0; i < 64; i++){
+        uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) +
+                      ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+                      ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    ctx->h[0] += a; ctx->h[1] += b; ctx->h[2] += c; ctx->h[3] += d;
+    ctx->h[4] += e; ctx->h[5] += f; ctx->h[6] += g; ctx->h[7] += h;
+}
+
+void rsh_sha256_init(rsh_sha256_t *ctx){
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memcpy(ctx->h, iv, sizeof(iv));
+    ctx->total = 0;
+    ctx->used = 0;
+}
+
+void rsh_sha256_update(rsh_sha256_t *ctx, const void *data, size_t len){
+    const uint8_t *p = data;
+
+    ctx->total += len;
+    while (len > 0){
+        size_t n = RDSH_SHA256_BLOCK - ctx->used;
+        if (n > len)
+            n = len;
+        memcpy(ctx->buf + ctx->used, p, n);
+        ctx->used += n;
+        p += n;
+        len -= n;
+        if (ctx->used == RDSH_SHA256_BLOCK){
+            sha256_block(ctx, ctx->buf);
+            ctx->used = 0;
+        }
+    }
+}
+
+void rsh_sha256_final(rsh_sha256_t *ctx, uint8_t digest[RDSH_SHA256_SZ]){
+    uint64_t bits = ctx->total * 8;
+    uint8_t pad = 0x80;
+    uint8_t len_be[8];
+
+    rsh_sha256_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != RDSH_SHA256_BLOCK - 8)
+        rsh_sha256_update(ctx, &pad, 1);
+    for (int i = 0; i < 8; i++)
+        len_be[i] = (uint8_t)(bits >> (56 - i * 8));
+    rsh_sha256_update(ctx, len_be, 8);
+
+    for (int i = 0; i < 8; i++){
+        digest[i * 4] = (uint8_t)(ctx->h[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctx->h[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx->h[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctx->h[i];
+    }
+}
+
+/*
+ * rsh_hmac_init(ctx, key, key_len), rsh_hmac_update(ctx, data, len) and
+ * rsh_hmac_final(ctx, mac)
+ *
+ *  HMAC-SHA-256 in the usual init/update/final shape, so a MAC can be
+ *  taken over several fields without copying them together first.
+ */
+void rsh_hmac_init(rsh_hmac_t *ctx, const void *key, size_t key_len){
+    uint8_t k[RDSH_SHA256_BLOCK];
+    uint8_t pad[RDSH_SHA256_BLOCK];
+
+    memset(k, 0, sizeof(k));
+    if (key_len > RDSH_SHA256_BLOCK){
+        rsh_sha256_init(&ctx->inner);
+        rsh_sha256_update(&ctx->inner, key, key_len);
+        rsh_sha256_final(&ctx->inner, k);
+    } else {
+        memcpy(k, key, key_len);
+    }
+
+    for (int i = 0; i < RDSH_SHA256_BLOCK; i++)
+        pad[i] = k[i] ^ 0x36;
+    rsh_sha256_init(&ctx->inner);
+    rsh_sha256_update(&ctx->inner, pad, sizeof(pad));
+
+    for (int i = 0; i < RDSH_SHA256_BLOCK; i++)
+        pad[i] = k[i] ^ 0x5c;
+    rsh_sha256_init(&ctx->outer);
+    rsh_sha256_update(&ctx->outer, pad, sizeof(pad));
+}
+
+void rsh_hmac_update(rsh_hmac_t *ctx, const void *data, size_t len){
+    rsh_sha256_update(&ctx->inner, data, len);
+}
+
+void rsh_hmac_final(rsh_hmac_t *ctx, uint8_t mac[RDSH_SHA256_SZ]){
+    uint8_t inner[RDSH_SHA256_SZ];
+
+    rsh_sha256_final(&ctx->inner, inner);
+    rsh_sha256_update(&ctx->outer, inner, sizeof(inner));
+    rsh_sha256_final(&ctx->outer, mac);
+}
+
+/*
+ * rsh_mac_equal(a, b, len)
+ *      Compares two MACs in the same time whether or not they match, so
+ *      how long a rejection takes says nothing about how close a guess was.
+ */
+int rsh_mac_equal(const uint8_t *a, const uint8_t *b, size_t len){
+    uint8_t diff = 0;
+
+    for (size_t i = 0; i < len; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
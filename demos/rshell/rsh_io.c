@@ -0,0 +1,173 @@
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_io.c - socket I/O for the rsh client and server
+ *
+ * send() and recv() are allowed to move fewer bytes than asked for.  They
+ * can also be cut short by a signal (EINTR), and on a non-blocking socket
+ * they can have nothing to do right now (EAGAIN).  None of those mean the
+ * connection is broken.  The helpers here keep going until the whole
+ * message is through, and wait in poll() rather than spin while the socket
+ * is not ready.
+ *
+ * Some messages are more than one piece, a frame header and its payload or
+ * a reply and its RDSH_EOF_CHAR.  Those go out as one sendmsg() with an
+ * iovec per piece, so it is one syscall rather than one per piece.  The
+ * pieces also reach the wire together rather than the second one being held
+ * back by Nagle until the first is acked.
+ *
+ * Every byte that goes through here is counted for the server metrics,
+ * see rsh_metrics.c.
+ */
+
+//wait until sock is ready for events, EINTR just means look again
+static int io_wait(int sock, short events){
+    struct pollfd pfd;
+
+    pfd.fd = sock;
+    pfd.events = events;
+    while (poll(&pfd, 1, -1) < 0){
+        if (errno != EINTR)
+            return ERR_RDSH_COMMUNICATION;
+    }
+    return OK;
+}
+
+/*
+ * rsh_sendv(sock, iov, iovcnt)
+ *      sock:    a connected socket, blocking or not
+ *      iov:     the pieces of the message, in order.  The array is used
+ *               to keep track of what is left, so it is changed.
+ *      iovcnt:  number of pieces
+ *
+ *  Sends every byte of every piece, with as few sendmsg() calls as the
+ *  kernel allows.  Usually that is one.
+ *
+ *  Returns:
+ *      OK:                      everything was sent
+ *      ERR_RDSH_COMMUNICATION:  the connection is broken
+ */
+int rsh_sendv(int sock, struct iovec *iov, int iovcnt){
+    struct msghdr msg;
+    ssize_t sent;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    while (msg.msg_iovlen > 0){
+        //skip pieces that are done, or were empty to start with
+        if (msg.msg_iov->iov_len == 0){
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+            continue;
+        }
+
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (sent < 0){
+            if (errno == EINTR)
+                continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+                if (io_wait(sock, POLLOUT) != OK)
+                    return ERR_RDSH_COMMUNICATION;
+                continue;
+            }
+            return ERR_RDSH_COMMUNICATION;
+        }
+        rsh_metric_add(RSH_M_BYTES_OUT, sent);
+
+        //a partial send, move past what went out
+        while ((sent > 0) && (msg.msg_iovlen > 0)){
+            size_t part = ((size_t)sent < msg.msg_iov->iov_len) ?
+                          (size_t)sent : msg.msg_iov->iov_len;
+
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + part;
+            msg.msg_iov->iov_len -= part;
+            sent -= part;
+            if (msg.msg_iov->iov_len == 0){
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            }
+        }
+    }
+    return OK;
+}
+
+/*
+ * rsh_send_all(sock, buff, len)
+ *      rsh_sendv() for a message that is all in one piece.
+ *
+ *  Returns:
+ *      OK:                      everything was sent
+ *      ERR_RDSH_COMMUNICATION:  the connection is broken
+ */
+int rsh_send_all(int sock, const void *buff, int len){
+    struct iovec iov;
+
+    iov.iov_base = (void *)buff;
+    iov.iov_len = len;
+    return rsh_sendv(sock, &iov, 1);
+}
+
+/*
+ * rsh_recv(sock, buff, len)
+ *      A recv() that only returns once it has something to report, EINTR
+ *      and EAGAIN are retried.  With quickack=1 (see rsh_net.c) the ack
+ *      for whatever arrives goes out right away.
+ *
+ *  Returns:
+ *      <number>:                bytes received, at most len
+ *      0:                       the other side closed the connection
+ *      ERR_RDSH_COMMUNICATION:  recv() failed
+ */
+int rsh_recv(int sock, void *buff, int len){
+    ssize_t rc;
+
+    rsh_quickack(sock);
+    while (1){
+        rc = recv(sock, buff, len, 0);
+        if (rc >= 0){
+            rsh_metric_add(RSH_M_BYTES_IN, rc);
+            return (int)rc;
+        }
+        if (errno == EINTR)
+            continue;
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+            if (io_wait(sock, POLLIN) != OK)
+                return ERR_RDSH_COMMUNICATION;
+            continue;
+        }
+        return ERR_RDSH_COMMUNICATION;
+    }
+}
+
+/*
+ * rsh_recv_all(sock, buff, len)
+ *      Keeps calling rsh_recv() until exactly len bytes have arrived.
+ *
+ *  Returns:
+ *      len:                     all of the bytes were received
+ *      0:                       the other side closed the connection
+ *      ERR_RDSH_COMMUNICATION:  recv() failed
+ */
+int rsh_recv_all(int sock, void *buff, int len){
+    char *p = buff;
+    int got = 0;
+    int rc;
+
+    while (got < len){
+        rc = rsh_recv(sock, p + got, len - got);
+        if (rc <= 0)
+            return rc;
+        got += rc;
+    }
+    return got;
+}
@@ -0,0 +1,246 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "rshlib.h"
+
+/*
+ * rsh_lz.c - a small in-tree block compressor for rsh output streams
+ *
+ * The encoded format follows the LZ4 block format so it can be checked
+ * with off the shelf tools if needed.  Each sequence is:
+ *
+ *   +-------+------------------+----------+--------+-------------------+
+ *   | token | extra lit length | literals | offset | extra match length|
+ *   +-------+------------------+----------+--------+-------------------+
+ *
+ *   token:  high 4 bits literal count, low 4 bits (match length - 4).  A
+ *           value of 15 means more length bytes follow (255 means keep
+ *           adding).  The offset is 2 bytes, little endian.
+ *
+ * The last sequence in a block only has literals.  We keep things simple
+ * and only look for matches via a single hash table of 4 byte sequences,
+ * which is plenty for log like command output.
+ */
+
+#define RSH_LZ_HASH_LOG     12
+#define RSH_LZ_MIN_MATCH    4
+#define RSH_LZ_MAX_OFFSET   65535
+#define RSH_LZ_LAST_LITS    5       //last 5 bytes are always literals
+#define RSH_LZ_MF_LIMIT     12      //last match must start 12 bytes before end
+
+static uint32_t lz_read32(const uint8_t *p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t seq){
+    return (seq * 2654435761U) >> (32 - RSH_LZ_HASH_LOG);
+}
+
+//writes the 255 run used for lengths >= 15, returns NULL if out of room
+static uint8_t *lz_put_len(uint8_t *op, uint8_t *oend, int len){
+    while (len >= 255){
+        if (op >= oend)
+            return NULL;
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= oend)
+        return NULL;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/*
+ * rsh_lz_bound(src_len)
+ *      Worst case size of a compressed block, useful for sizing buffers.
+ */
+int rsh_lz_bound(int src_len){
+    return src_len + (src_len / 255) + 16;
+}
+
+/*
+ * rsh_lz_compress(src, src_len, dst, dst_cap)
+ *      src/src_len:  raw bytes to compress
+ *      dst/dst_cap:  where the compressed block goes
+ *
+ *  Note that dst_cap can be smaller than rsh_lz_bound(), the compressor
+ *  gives up as soon as the output would not fit.  The rsh server uses this
+ *  to bail out early on data that is not worth compressing.
+ *
+ *  Returns:
+ *      <number>:   size of the compressed block
+ *      -1:         the compressed block would not fit in dst_cap
+ */
+int rsh_lz_compress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap){
+    uint32_t table[1 << RSH_LZ_HASH_LOG];
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *iend = src + src_len;
+    const uint8_t *mflimit = iend - RSH_LZ_MF_LIMIT;
+    const uint8_t *matchlimit = iend - RSH_LZ_LAST_LITS;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_cap;
+    uint8_t *token;
+    int lit_len;
+
+    if (src_len > RSH_LZ_MF_LIMIT){
+        memset(table, 0, sizeof(table));
+        ip++;
+
+        while (ip < mflimit){
+            uint32_t seq = lz_read32(ip);
+            uint32_t h = lz_hash(seq);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+
+            if ((ref >= ip) || ((ip - ref) > RSH_LZ_MAX_OFFSET) ||
+                (lz_read32(ref) != seq)){
+                //the longer we go without a match, the faster we skip,
+                //this keeps random data from costing much CPU
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            //found a match, see how far it goes
+            const uint8_t *mp = ip + RSH_LZ_MIN_MATCH;
+            const uint8_t *rp = ref + RSH_LZ_MIN_MATCH;
+            while ((mp < matchlimit) && (*mp == *rp)){
+                mp++;
+                rp++;
+            }
+
+            int match_len = (int)(mp - ip) - RSH_LZ_MIN_MATCH;
+            int offset = (int)(ip - ref);
+            lit_len = (int)(ip - anchor);
+
+            //token + literals + offset, lengths checked as they are written
+            if ((oend - op) < 1 + lit_len + 2)
+                return -1;
+            token = op++;
+            if (lit_len >= 15){
+                *token = 15 << 4;
+                op = lz_put_len(op, oend, lit_len - 15);
+                if ((op == NULL) || ((oend - op) < lit_len + 2))
+                    return -1;
+            } else {
+                *token = (uint8_t)(lit_len << 4);
+            }
+            memcpy(op, anchor, lit_len);
+            op += lit_len;
+
+            *op++ = (uint8_t)(offset & 0xff);
+            *op++ = (uint8_t)(offset >> 8);
+
+            if (match_len >= 15){
+                *token |= 15;
+                op = lz_put_len(op, oend, match_len - 15);
+                if (op == NULL)
+                    return -1;
+            } else {
+                *token |= (uint8_t)match_len;
+            }
+
+            //prime the table with a position inside the match
+            table[lz_hash(lz_read32(mp - 2))] = (uint32_t)(mp - 2 - src);
+
+            ip = mp;
+            anchor = ip;
+        }
+    }
+
+    //last literals
+    lit_len = (int)(iend - anchor);
+    if ((oend - op) < 1 + lit_len)
+        return -1;
+    token = op++;
+    if (lit_len >= 15){
+        *token = 15 << 4;
+        op = lz_put_len(op, oend, lit_len - 15);
+        if ((op == NULL) || ((oend - op) < lit_len))
+            return -1;
+    } else {
+        *token = (uint8_t)(lit_len << 4);
+    }
+    memcpy(op, anchor, lit_len);
+    op += lit_len;
+
+    return (int)(op - dst);
+}
+
+/*
+ * rsh_lz_decompress(src, src_len, dst, dst_cap)
+ *      src/src_len:  a compressed block from rsh_lz_compress()
+ *      dst/dst_cap:  where the raw bytes go
+ *
+ *  The block comes off the network so every length and offset is checked
+ *  before it is used.
+ *
+ *  Returns:
+ *      <number>:   size of the decompressed data
+ *      -1:         the block is corrupt or does not fit in dst_cap
+ */
+int rsh_lz_decompress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap){
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + src_len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_cap;
+
+    while (ip < iend){
+        uint8_t token = *ip++;
+        int lit_len = token >> 4;
+        int match_len = token & 15;
+        int offset;
+        uint8_t b;
+
+        if (lit_len == 15){
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                lit_len += b;
+            } while (b == 255);
+        }
+        if ((lit_len > (iend - ip)) || (lit_len > (oend - op)))
+            return -1;
+        memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
+
+        //the last sequence only carries literals
+        if (ip == iend)
+            break;
+
+        if ((iend - ip) < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > (op - dst)))
+            return -1;
+
+        if (match_len == 15){
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += RSH_LZ_MIN_MATCH;
+        if (match_len > (oend - op))
+            return -1;
+
+        const uint8_t *ref = op - offset;
+        if (offset >= match_len){
+            memcpy(op, ref, match_len);
+            op += match_len;
+        } else {
+            //overlapping copy, this is how runs get encoded
+            while (match_len--)
+                *op++ = *ref++;
+        }
+    }
+
+    return (int)(op - dst);
+}
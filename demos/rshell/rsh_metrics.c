@@ -0,0 +1,295 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_metrics.c - server counters and histograms, Prometheus text format
+ *
+ * The server counts connections, sessions, commands, bytes and errors, and
+ * keeps histograms of how long a pipeline takes to launch and to run.  With
+ * -m PORT they can be scraped at http://127.0.0.1:PORT/metrics, a small
+ * thread of its own answers every request with all of them.
+ *
+ * The counters are bumped on every send and recv, from every session
+ * thread.  One shared set would bounce its cache line between the cores
+ * those threads run on, so there are RDSH_METRICS_SHARDS copies instead,
+ * each cache line aligned.  A thread picks one the first time it counts
+ * something and keeps it.  Two threads can share a shard once there are
+ * more threads than shards, so the updates are still atomic, but relaxed
+ * atomics on a line nobody else is using cost about as much as a plain add.
+ * A scrape adds the shards up, it may see one counter a little ahead of
+ * another, which is fine for monitoring.
+ */
+
+#define RDSH_METRICS_SHARDS     16
+#define RDSH_METRICS_CACHELINE  64
+#define RDSH_METRICS_PAGE_SZ    (1024*16)
+#define RDSH_METRICS_PATH       "/metrics"
+
+//upper bounds of the histogram buckets in usec, there is a +Inf bucket too
+static const uint64_t hist_bounds[RSH_HIST_BUCKETS] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+};
+
+static const char *counter_names[RSH_M_NUM_COUNTERS][2] = {
+    [RSH_M_CONNECTIONS] = {"rsh_connections_total", "Client connections accepted."},
+    [RSH_M_COMMANDS]    = {"rsh_commands_total", "Requests run, built-ins included."},
+    [RSH_M_BYTES_IN]    = {"rsh_received_bytes_total", "Bytes received from clients."},
+    [RSH_M_BYTES_OUT]   = {"rsh_sent_bytes_total", "Bytes sent to clients."},
+};
+
+static const char *hist_names[RSH_H_NUM][2] = {
+    [RSH_H_SPAWN]   = {"rsh_spawn_seconds", "Time to launch a pipeline (zygote or fork/exec)."},
+    [RSH_H_COMMAND] = {"rsh_command_seconds", "Time from launching a pipeline to its exit code."},
+};
+
+//in ERR_RDSH_* order, starting at ERR_RDSH_COMMUNICATION
+static const char *error_names[RSH_M_NUM_ERRORS] = {
+    "ERR_RDSH_COMMUNICATION", "ERR_RDSH_SERVER", "ERR_RDSH_CLIENT",
+    "ERR_RDSH_CMD_EXEC", "WARN_RDSH_SKIPPED",
+};
+
+typedef struct rsh_metric_shard{
+    uint64_t  counters[RSH_M_NUM_COUNTERS];
+    uint64_t  errors[RSH_M_NUM_ERRORS];
+    int64_t   sessions;
+    uint64_t  buckets[RSH_H_NUM][RSH_HIST_BUCKETS + 1];
+    uint64_t  sum_usec[RSH_H_NUM];
+}__attribute__((aligned(RDSH_METRICS_CACHELINE))) rsh_metric_shard_t;
+
+static rsh_metric_shard_t shards[RDSH_METRICS_SHARDS];
+static unsigned int next_shard = 0;
+static __thread rsh_metric_shard_t *my_shard = NULL;
+
+static int metrics_port = 0;
+static int metrics_sock = -1;
+static pthread_t metrics_tid;
+
+static rsh_metric_shard_t *shard(void){
+    if (my_shard == NULL){
+        unsigned int n = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED);
+        my_shard = &shards[n % RDSH_METRICS_SHARDS];
+    }
+    return my_shard;
+}
+
+/*
+ * rsh_metric_add(m, n), rsh_metric_sessions(delta), rsh_metric_error(code)
+ * and rsh_metric_observe(h, usec)
+ *
+ *  The hot path updates, all lock free.  rsh_metric_error() counts the
+ *  ERR_RDSH_* codes and ignores anything else.
+ */
+void rsh_metric_add(rsh_metric_t m, uint64_t n){
+    __atomic_fetch_add(&shard()->counters[m], n, __ATOMIC_RELAXED);
+}
+
+void rsh_metric_sessions(int delta){
+    __atomic_fetch_add(&shard()->sessions, delta, __ATOMIC_RELAXED);
+}
+
+void rsh_metric_error(int code){
+    int i = ERR_RDSH_COMMUNICATION - code;
+
+    if ((i >= 0) && (i < RSH_M_NUM_ERRORS))
+        __atomic_fetch_add(&shard()->errors[i], 1, __ATOMIC_RELAXED);
+}
+
+void rsh_metric_observe(rsh_hist_t h, uint64_t usec){
+    rsh_metric_shard_t *s = shard();
+    int b = 0;
+
+    while ((b < RSH_HIST_BUCKETS) && (usec > hist_bounds[b]))
+        b++;
+    __atomic_fetch_add(&s->buckets[h][b], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->sum_usec[h], usec, __ATOMIC_RELAXED);
+}
+
+/*
+ * rsh_metric_now()
+ *      Monotonic clock in usec, for rsh_metric_observe().
+ */
+uint64_t rsh_metric_now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t sum_field(size_t offset){
+    uint64_t total = 0;
+
+    for (int i = 0; i < RDSH_METRICS_SHARDS; i++)
+        total += __atomic_load_n((uint64_t *)((char *)&shards[i] + offset), __ATOMIC_RELAXED);
+    return total;
+}
+
+#define SUM(field)  sum_field(offsetof(rsh_metric_shard_t, field))
+
+/*
+ * rsh_metrics_render(buff, len)
+ *      Writes every metric to buff in the Prometheus text format.
+ *
+ *  Returns:
+ *      the length of the text, it is cut short if buff is too small
+ */
+int rsh_metrics_render(char *buff, int len){
+    int n = 0;
+
+#define EMIT(...) \
+    do { if (n < len) n += snprintf(buff + n, len - n, __VA_ARGS__); } while (0)
+
+    for (int m = 0; m < RSH_M_NUM_COUNTERS; m++){
+        EMIT("# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_names[m][0],
+             counter_names[m][1], counter_names[m][0], counter_names[m][0],
+             (unsigned long long)SUM(counters[m]));
+    }
+
+    EMIT("# HELP rsh_sessions_active Sessions open now, channels included.\n"
+         "# TYPE rsh_sessions_active gauge\nrsh_sessions_active %lld\n",
+         (long long)SUM(sessions));
+
+    EMIT("# HELP rsh_errors_total Errors by ERR_RDSH_* code.\n"
+         "# TYPE rsh_errors_total counter\n");
+    for (int e = 0; e < RSH_M_NUM_ERRORS; e++){
+        EMIT("rsh_errors_total{code=\"%s\"} %llu\n", error_names[e],
+             (unsigned long long)SUM(errors[e]));
+    }
+
+    for (int h = 0; h < RSH_H_NUM; h++){
+        uint64_t count = 0;
+
+        EMIT("# HELP %s %s\n# TYPE %s histogram\n", hist_names[h][0],
+             hist_names[h][1], hist_names[h][0]);
+        for (int b = 0; b <= RSH_HIST_BUCKETS; b++){
+            count += SUM(buckets[h][b]);
+            if (b < RSH_HIST_BUCKETS)
+                EMIT("%s_bucket{le=\"%g\"} %llu\n", hist_names[h][0],
+                     hist_bounds[b] / 1e6, (unsigned long long)count);
+            else
+                EMIT("%s_bucket{le=\"+Inf\"} %llu\n", hist_names[h][0],
+                     (unsigned long long)count);
+        }
+        EMIT("%s_sum %.6f\n%s_count %llu\n", hist_names[h][0],
+             SUM(sum_usec[h]) / 1e6, hist_names[h][0], (unsigned long long)count);
+    }
+#undef EMIT
+
+    return (n < len) ? n : len - 1;
+}
+
+//plain send(), the rsh_io.c helpers would count the scrape as client bytes
+static int metrics_send(int sock, const char *buff, int len){
+    ssize_t n;
+
+    while (len > 0){
+        n = send(sock, buff, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return ERR_RDSH_COMMUNICATION;
+        buff += n;
+        len -= n;
+    }
+    return OK;
+}
+
+//answers one scrape, whatever was asked for, then hangs up
+static void metrics_reply(int sock, char *page){
+    struct timeval tv = {.tv_sec = 1};
+    char req[512];
+    char hdr[160];
+    int len;
+
+    //the request itself does not matter, but read it so closing does not
+    //reset the connection before the client has the reply
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (recv(sock, req, sizeof(req), 0) <= 0)
+        return;
+
+    len = rsh_metrics_render(page, RDSH_METRICS_PAGE_SZ);
+    snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+             "Content-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: %d\r\n\r\n", len);
+    if (metrics_send(sock, hdr, strlen(hdr)) == OK)
+        metrics_send(sock, page, len);
+}
+
+static void *metrics_thread(void *arg){
+    char *page = malloc(RDSH_METRICS_PAGE_SZ);
+    int sock;
+
+    (void)arg;
+    while (page != NULL){
+        sock = accept(metrics_sock, NULL, NULL);
+        if (sock < 0)
+            break;          //rsh_metrics_stop() shut the socket down
+        metrics_reply(sock, page);
+        close(sock);
+    }
+    free(page);
+    return NULL;
+}
+
+void set_metrics_port(int port){
+    metrics_port = port;
+}
+
+/*
+ * rsh_metrics_start() and rsh_metrics_stop()
+ *      Start and stop the scrape endpoint, if -m asked for one.  It only
+ *      listens on 127.0.0.1, anything further away should come through
+ *      a local agent.  start_server() calls these around serving clients.
+ *
+ *  rsh_metrics_start() returns OK, or ERR_RDSH_SERVER if the endpoint
+ *  could not be started.  The server runs either way.
+ */
+int rsh_metrics_start(void){
+    struct sockaddr_in addr;
+    int enable = 1;
+
+    if (metrics_port <= 0)
+        return OK;
+
+    metrics_sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (metrics_sock < 0){
+        perror("metrics socket");
+        return ERR_RDSH_SERVER;
+    }
+    setsockopt(metrics_sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(metrics_port);
+    if ((bind(metrics_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+        (listen(metrics_sock, RDSH_DEF_BACKLOG) < 0) ||
+        (pthread_create(&metrics_tid, NULL, metrics_thread, NULL) != 0)){
+        perror("metrics endpoint");
+        close(metrics_sock);
+        metrics_sock = -1;
+        return ERR_RDSH_SERVER;
+    }
+
+    printf(RCMD_MSG_SVR_METRICS, metrics_port, RDSH_METRICS_PATH);
+    return OK;
+}
+
+void rsh_metrics_stop(void){
+    if (metrics_sock < 0)
+        return;
+    shutdown(metrics_sock, SHUT_RDWR);
+    pthread_join(metrics_tid, NULL);
+    close(metrics_sock);
+    metrics_sock = -1;
+}
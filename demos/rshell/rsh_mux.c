@@ -0,0 +1,676 @@
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_mux.c - many rsh sessions over one connection
+ *
+ * A client that asks for mux=1 in its hello gets a multiplexed
+ * connection, much like the channels of an ssh connection.  Every frame
+ * carries a channel number and each channel is a session of its own with
+ * its own rsh_session_t.  On top of the frames from rsh_proto.c a
+ * multiplexed connection uses:
+ *
+ *   OPEN    client -> server   start a session on hdr.channel
+ *   REQ     client -> server   run a command on hdr.channel, as before
+ *   WINDOW  client -> server   the client has consumed some output, the
+ *                              payload is the number of bytes
+ *   CLOSE   client -> server   the client is done with the channel
+ *   CLOSE   server -> client   the channel is gone, the client may now
+ *                              reuse its number
+ *
+ * The thread that accepted the connection only reads frames and hands
+ * requests to the channels.  Every channel has a worker thread that runs
+ * its requests in order, so a long running command on one channel does
+ * not hold up the others.
+ *
+ * Flow control is per channel.  A channel may have at most
+ * RDSH_MUX_WINDOW bytes of output that the client has not handed back
+ * with a WINDOW frame, so one channel with a lot of output cannot bury
+ * the others or pile up in the client.
+ *
+ * The other half of this file is the jump host (dsh -j).  It accepts
+ * plain rsh clients and carries each of them as a channel over a single
+ * connection to the server.
+ */
+
+//a request waiting for its channel worker
+typedef struct rsh_chan_req{
+    struct rsh_chan_req *next;
+    uint32_t  req_id;
+    uint8_t   flags;
+    char      cmd[];
+}rsh_chan_req_t;
+
+typedef struct rsh_channel{
+    rsh_session_t    sess;          //must be first, see mux_send_frame()
+    pthread_cond_t   cond;          //request queued, window opened or closing
+    rsh_chan_req_t  *head;
+    rsh_chan_req_t  *tail;
+    int64_t          window;        //bytes of output we may still send
+    int              closing;       //client closed the channel
+}rsh_channel_t;
+
+typedef struct rsh_mux{
+    int              sock;
+    int              lz_enabled;
+    rsh_conn_t      *conn;          //drain registry entry of the connection
+    pthread_mutex_t  lock;          //channel table, queues and windows
+    pthread_mutex_t  send_lock;     //one frame at a time on sock
+    pthread_cond_t   idle;          //a channel worker finished
+    int              num_channels;  //workers still running
+    int              rc;            //OK_EXIT once stop-server has run
+    rsh_channel_t   *channels[RDSH_MUX_MAX_CHANNELS];
+}rsh_mux_t;
+
+static int mux_send(rsh_mux_t *mux, rdsh_frame_hdr_t *hdr, const void *payload){
+    int rc;
+
+    pthread_mutex_lock(&mux->send_lock);
+    rc = send_frame(mux->sock, hdr, payload);
+    pthread_mutex_unlock(&mux->send_lock);
+    return rc;
+}
+
+static int mux_send_close(rsh_mux_t *mux, uint16_t channel){
+    rdsh_frame_hdr_t hdr;
+
+    init_frame_hdr(&hdr, RDSH_FRAME_CLOSE, channel, 0);
+    return mux_send(mux, &hdr, NULL);
+}
+
+/*
+ * mux_send_frame(sess, hdr, payload)
+ *      sess:     a channel of a multiplexed connection
+ *      hdr:      frame to send, DATA frames count against the window
+ *
+ *  The send_session_*() functions end up here for a channel.  Output
+ *  waits until the client has made room for it, and then the frame is
+ *  sent under the connection send lock so frames from different channels
+ *  do not get mixed together.  The data was already compressed by the
+ *  caller, so the lock is only held while sending.
+ *
+ *  Returns:
+ *      OK:                      the frame was sent
+ *      ERR_RDSH_COMMUNICATION:  send() failed or the channel is closing
+ */
+int mux_send_frame(rsh_session_t *sess, rdsh_frame_hdr_t *hdr, const void *payload){
+    rsh_channel_t *ch = (rsh_channel_t *)sess;
+    rsh_mux_t *mux = sess->mux;
+    int closing;
+
+    if (hdr->type == RDSH_FRAME_DATA){
+        pthread_mutex_lock(&mux->lock);
+        while ((ch->window < (int64_t)hdr->raw_len) && !ch->closing)
+            pthread_cond_wait(&ch->cond, &mux->lock);
+        closing = ch->closing;
+        if (!closing)
+            ch->window -= hdr->raw_len;
+        pthread_mutex_unlock(&mux->lock);
+
+        if (closing)
+            return ERR_RDSH_COMMUNICATION;
+    }
+    return mux_send(mux, hdr, payload);
+}
+
+/*
+ * mux_channel_worker(arg)
+ *      Thread that runs the requests of one channel.  It stops when the
+ *      client closes the channel or the connection, or runs `exit` or
+ *      `stop-server`.  On the way out it takes the channel out of the
+ *      table and then tells the client with a CLOSE frame, so the client
+ *      can never reuse the number while we still have it.
+ */
+static void *mux_channel_worker(void *arg){
+    rsh_channel_t *ch = arg;
+    rsh_mux_t *mux = ch->sess.mux;
+    uint16_t id = ch->sess.channel;
+    rsh_chan_req_t *req;
+    int rc = OK;
+
+    while (rc == OK){
+        pthread_mutex_lock(&mux->lock);
+        while ((ch->head == NULL) && !ch->closing)
+            pthread_cond_wait(&ch->cond, &mux->lock);
+        if (ch->closing){
+            pthread_mutex_unlock(&mux->lock);
+            break;
+        }
+        req = ch->head;
+        ch->head = req->next;
+        if (ch->head == NULL)
+            ch->tail = NULL;
+        pthread_mutex_unlock(&mux->lock);
+
+        ch->sess.req_id = req->req_id;
+        ch->sess.req_flags = req->flags;
+        rc = exec_session_request(&ch->sess, req->cmd);
+        free(req);
+    }
+
+    if (rc == STOP_SERVER_SC){
+        printf(RCMD_MSG_SVR_STOP_REQ);
+        pthread_mutex_lock(&mux->lock);
+        mux->rc = OK_EXIT;
+        pthread_mutex_unlock(&mux->lock);
+        //wakes up the reader in exec_mux_requests()
+        shutdown(mux->sock, SHUT_RD);
+    }
+
+    pthread_mutex_lock(&mux->lock);
+    mux->channels[id] = NULL;
+    while ((req = ch->head) != NULL){
+        ch->head = req->next;
+        free(req);
+    }
+    pthread_mutex_unlock(&mux->lock);
+
+    mux_send_close(mux, id);
+    printf(RCMD_MSG_MUX_CLOSED, id);
+    session_free(&ch->sess);
+    pthread_cond_destroy(&ch->cond);
+    free(ch);
+
+    //last thing, once this is down to 0 mux may be freed
+    pthread_mutex_lock(&mux->lock);
+    mux->num_channels--;
+    pthread_cond_broadcast(&mux->idle);
+    pthread_mutex_unlock(&mux->lock);
+    return NULL;
+}
+
+/*
+ * mux_open_channel(mux, id)
+ *      Starts a session and its worker thread for an OPEN frame.  If we
+ *      cannot, the client gets an immediate CLOSE for the channel.
+ *
+ *  Returns:
+ *      OK:                      the channel is open, or was refused
+ *      ERR_RDSH_COMMUNICATION:  the channel number is still in use, or the
+ *                               refusal could not be sent
+ */
+static int mux_open_channel(rsh_mux_t *mux, uint16_t id){
+    rsh_channel_t *ch;
+    pthread_attr_t attr;
+    pthread_t tid;
+    int rc;
+
+    pthread_mutex_lock(&mux->lock);
+    rc = (mux->channels[id] == NULL) ? OK : ERR_RDSH_COMMUNICATION;
+    pthread_mutex_unlock(&mux->lock);
+    if (rc != OK)
+        return rc;
+
+    ch = calloc(1, sizeof(rsh_channel_t));
+    if (ch == NULL)
+        return mux_send_close(mux, id);
+    if (session_init(&ch->sess, mux->sock) != OK){
+        session_free(&ch->sess);
+        free(ch);
+        return mux_send_close(mux, id);
+    }
+    ch->sess.is_framed = true;
+    ch->sess.lz.enabled = mux->lz_enabled;
+    ch->sess.channel = id;
+    ch->sess.mux = mux;
+    ch->sess.conn = mux->conn;
+    ch->window = RDSH_MUX_WINDOW;
+    pthread_cond_init(&ch->cond, NULL);
+
+    pthread_mutex_lock(&mux->lock);
+    mux->channels[id] = ch;
+    mux->num_channels++;
+    pthread_mutex_unlock(&mux->lock);
+
+    //channels mostly sit waiting, they do not need a full size stack
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, RDSH_MUX_STACK_SZ);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&tid, &attr, mux_channel_worker, ch);
+    pthread_attr_destroy(&attr);
+
+    if (rc != 0){
+        perror("could not create channel thread");
+        pthread_mutex_lock(&mux->lock);
+        mux->channels[id] = NULL;
+        mux->num_channels--;
+        pthread_mutex_unlock(&mux->lock);
+        session_free(&ch->sess);
+        pthread_cond_destroy(&ch->cond);
+        free(ch);
+        return mux_send_close(mux, id);
+    }
+
+    printf(RCMD_MSG_MUX_OPEN, id);
+    return OK;
+}
+
+/*
+ * mux_queue_request(mux, hdr, cmd, len)
+ *      Hands a REQ frame to its channel.  A request for a channel that is
+ *      not open gets an error response right away so the client is not
+ *      left waiting.
+ */
+static int mux_queue_request(rsh_mux_t *mux, rdsh_frame_hdr_t *hdr, char *cmd, int len){
+    rsh_channel_t *ch;
+    rsh_chan_req_t *req;
+    uint32_t st = htonl((uint32_t)ERR_RDSH_SERVER);
+
+    req = malloc(sizeof(rsh_chan_req_t) + len + 1);
+    if (req == NULL)
+        return ERR_RDSH_SERVER;
+    req->next = NULL;
+    req->req_id = hdr->req_id;
+    req->flags = hdr->flags;
+    memcpy(req->cmd, cmd, len);
+    req->cmd[len] = '\0';
+
+    pthread_mutex_lock(&mux->lock);
+    ch = mux->channels[hdr->channel];
+    if ((ch != NULL) && !ch->closing){
+        if (ch->tail != NULL)
+            ch->tail->next = req;
+        else
+            ch->head = req;
+        ch->tail = req;
+        pthread_cond_signal(&ch->cond);
+        req = NULL;
+    }
+    pthread_mutex_unlock(&mux->lock);
+
+    if (req == NULL)
+        return OK;
+
+    free(req);
+    hdr->type = RDSH_FRAME_END;
+    hdr->flags = 0;
+    hdr->len = hdr->raw_len = sizeof(st);
+    return mux_send(mux, hdr, &st);
+}
+
+/*
+ * exec_mux_requests(conn, io_buff)
+ *      conn:     the session that negotiated mux=1, its socket is shared
+ *                by all of the channels
+ *      io_buff:  RDSH_COMM_BUFF_SZ receive buffer
+ *
+ *  Reads frames off a multiplexed connection until the client goes away
+ *  or a channel runs `stop-server`, then waits for the channel workers to
+ *  finish.  This takes the place of the loop in exec_client_requests().
+ *
+ *  Returns:
+ *      OK:                      the client closed the connection
+ *      OK_EXIT:                 a channel ran `stop-server`
+ *      ERR_RDSH_COMMUNICATION:  recv() failed or the client broke protocol
+ *      ERR_RDSH_SERVER:         could not allocate the connection state
+ */
+int exec_mux_requests(rsh_session_t *conn, char *io_buff){
+    rsh_mux_t *mux;
+    rdsh_frame_hdr_t hdr;
+    rsh_channel_t *ch;
+    uint32_t credit;
+    int len;
+    int rc = OK;
+
+    mux = calloc(1, sizeof(rsh_mux_t));
+    if (mux == NULL)
+        return ERR_RDSH_SERVER;
+    mux->sock = conn->cli_socket;
+    mux->lz_enabled = conn->lz.enabled;
+    mux->conn = conn->conn;
+    pthread_mutex_init(&mux->lock, NULL);
+    pthread_mutex_init(&mux->send_lock, NULL);
+    pthread_cond_init(&mux->idle, NULL);
+
+    while (rc == OK){
+        len = recv_frame(mux->sock, &hdr, io_buff, RDSH_COMM_BUFF_SZ - 1);
+        if (len < 0){
+            rc = ERR_RDSH_COMMUNICATION;
+            break;
+        }
+        if (hdr.type == 0)
+            break;
+        if (hdr.channel >= RDSH_MUX_MAX_CHANNELS){
+            rc = ERR_RDSH_COMMUNICATION;
+            break;
+        }
+
+        switch (hdr.type){
+            case RDSH_FRAME_OPEN:
+                rc = mux_open_channel(mux, hdr.channel);
+                break;
+            case RDSH_FRAME_REQ:
+                rc = mux_queue_request(mux, &hdr, io_buff, len);
+                break;
+            case RDSH_FRAME_WINDOW:
+                if (len != sizeof(credit)){
+                    rc = ERR_RDSH_COMMUNICATION;
+                    break;
+                }
+                memcpy(&credit, io_buff, sizeof(credit));
+                pthread_mutex_lock(&mux->lock);
+                ch = mux->channels[hdr.channel];
+                if (ch != NULL){
+                    ch->window += ntohl(credit);
+                    pthread_cond_signal(&ch->cond);
+                }
+                pthread_mutex_unlock(&mux->lock);
+                break;
+            case RDSH_FRAME_CLOSE:
+                pthread_mutex_lock(&mux->lock);
+                ch = mux->channels[hdr.channel];
+                if (ch != NULL){
+                    ch->closing = true;
+                    pthread_cond_signal(&ch->cond);
+                }
+                pthread_mutex_unlock(&mux->lock);
+                break;
+            default:
+                rc = ERR_RDSH_COMMUNICATION;
+        }
+    }
+
+    //tell every channel to wrap up, then wait for the workers
+    pthread_mutex_lock(&mux->lock);
+    for (int i = 0; i < RDSH_MUX_MAX_CHANNELS; i++){
+        if (mux->channels[i] != NULL){
+            mux->channels[i]->closing = true;
+            pthread_cond_signal(&mux->channels[i]->cond);
+        }
+    }
+    while (mux->num_channels > 0)
+        pthread_cond_wait(&mux->idle, &mux->lock);
+    if (mux->rc == OK_EXIT)
+        rc = OK_EXIT;
+    pthread_mutex_unlock(&mux->lock);
+
+    if (rc == OK)
+        printf(RCMD_MSG_CLIENT_EXITED);
+
+    pthread_cond_destroy(&mux->idle);
+    pthread_mutex_destroy(&mux->send_lock);
+    pthread_mutex_destroy(&mux->lock);
+    free(mux);
+    return rc;
+}
+
+//---------------------------------------------------------------------
+// jump host
+//---------------------------------------------------------------------
+
+//one plain client carried as a channel
+typedef struct jump_chan{
+    int       cli_socket;       //-1 once the client has gone
+    int       in_use;           //until the server sends CLOSE
+    uint32_t  req_id;
+    uint32_t  unacked;          //output not yet handed back as WINDOW
+    int       req_len;          //partial request in req_buff
+    char      req_buff[SH_CMD_MAX];
+}jump_chan_t;
+
+static int jump_send_ctl(int upstream, uint8_t type, uint16_t channel){
+    rdsh_frame_hdr_t hdr;
+
+    init_frame_hdr(&hdr, type, channel, 0);
+    return send_frame(upstream, &hdr, NULL);
+}
+
+//client went away or misbehaved, the slot stays in use until the server
+//closes its end of the channel
+static int jump_drop_client(int upstream, jump_chan_t *chans, uint16_t id){
+    close(chans[id].cli_socket);
+    chans[id].cli_socket = -1;
+    return jump_send_ctl(upstream, RDSH_FRAME_CLOSE, id);
+}
+
+static int jump_accept(int svr_socket, int upstream, jump_chan_t *chans){
+    int cli_socket;
+    int id;
+
+    cli_socket = accept(svr_socket, NULL, NULL);
+    if (cli_socket >= 0)
+        rsh_tune_socket(cli_socket);
+    if (cli_socket < 0)
+        return (errno == EINTR) ? OK : ERR_RDSH_COMMUNICATION;
+
+    //with -k our clients need the key too, they get no tickets from us.
+    //This runs on the one thread, so a silent client holds everyone up
+    //for up to RDSH_AUTH_TIMEOUT_MS.
+    if (rsh_auth_accept(cli_socket, NULL) != OK){
+        close(cli_socket);
+        return OK;
+    }
+
+    for (id = 0; id < RDSH_MUX_MAX_CHANNELS; id++){
+        if (!chans[id].in_use)
+            break;
+    }
+    if (id == RDSH_MUX_MAX_CHANNELS){
+        printf(RCMD_ERR_JUMP_FULL);
+        close(cli_socket);
+        return OK;
+    }
+
+    memset(&chans[id], 0, sizeof(jump_chan_t));
+    chans[id].cli_socket = cli_socket;
+    chans[id].in_use = true;
+    return jump_send_ctl(upstream, RDSH_FRAME_OPEN, id);
+}
+
+//a plain client sends null terminated commands, turn each into a REQ
+static int jump_from_client(int upstream, jump_chan_t *chans, uint16_t id){
+    jump_chan_t *ch = &chans[id];
+    rdsh_frame_hdr_t hdr;
+    ssize_t n;
+    char *end;
+    int len;
+
+    n = rsh_recv(ch->cli_socket, ch->req_buff + ch->req_len,
+                 sizeof(ch->req_buff) - ch->req_len);
+    if (n <= 0)
+        return jump_drop_client(upstream, chans, id);
+    ch->req_len += n;
+
+    while ((end = memchr(ch->req_buff, '\0', ch->req_len)) != NULL){
+        len = (int)(end - ch->req_buff) + 1;
+        init_frame_hdr(&hdr, RDSH_FRAME_REQ, id, ++ch->req_id);
+        hdr.len = hdr.raw_len = len;
+        if (send_frame(upstream, &hdr, ch->req_buff) != OK)
+            return ERR_RDSH_COMMUNICATION;
+        ch->req_len -= len;
+        memmove(ch->req_buff, ch->req_buff + len, ch->req_len);
+    }
+
+    //no room left and still no end of the command
+    if (ch->req_len == (int)sizeof(ch->req_buff))
+        return jump_drop_client(upstream, chans, id);
+    return OK;
+}
+
+/*
+ * jump_from_server(upstream, chans, buff)
+ *      Handles one frame from the server.  Output goes to the plain
+ *      client with RDSH_EOF_CHAR at the end, and is handed back to the
+ *      server as window credit once it has been written out.
+ *
+ *  Returns OK, OK_EXIT when the server has gone away, or
+ *  ERR_RDSH_COMMUNICATION.
+ */
+static int jump_from_server(int upstream, jump_chan_t *chans, char *buff){
+    rdsh_frame_hdr_t hdr;
+    jump_chan_t *ch;
+    uint32_t credit;
+    char *data;
+    int n;
+
+    n = recv_frame(upstream, &hdr, buff, RDSH_COMM_BUFF_SZ);
+    if (n < 0)
+        return ERR_RDSH_COMMUNICATION;
+    if (hdr.type == 0)
+        return OK_EXIT;
+    if ((hdr.channel >= RDSH_MUX_MAX_CHANNELS) || !chans[hdr.channel].in_use)
+        return ERR_RDSH_COMMUNICATION;
+    ch = &chans[hdr.channel];
+
+    switch (hdr.type){
+        case RDSH_FRAME_DATA:
+            n = frame_payload(&hdr, buff, buff + RDSH_COMM_BUFF_SZ,
+                              RDSH_COMM_BUFF_SZ, &data);
+            if (n < 0)
+                return ERR_RDSH_COMMUNICATION;
+            if ((ch->cli_socket >= 0) &&
+                (rsh_send_all(ch->cli_socket, data, n) != OK)){
+                if (jump_drop_client(upstream, chans, hdr.channel) != OK)
+                    return ERR_RDSH_COMMUNICATION;
+            }
+
+            ch->unacked += hdr.raw_len;
+            if (ch->unacked >= RDSH_MUX_WINDOW / 2){
+                credit = htonl(ch->unacked);
+                init_frame_hdr(&hdr, RDSH_FRAME_WINDOW, hdr.channel, 0);
+                hdr.len = hdr.raw_len = sizeof(credit);
+                ch->unacked = 0;
+                return send_frame(upstream, &hdr, &credit);
+            }
+            return OK;
+        case RDSH_FRAME_END:
+            if ((ch->cli_socket >= 0) &&
+                (rsh_send_all(ch->cli_socket, &RDSH_EOF_CHAR, 1) != OK))
+                return jump_drop_client(upstream, chans, hdr.channel);
+            return OK;
+        case RDSH_FRAME_CLOSE:
+            //the plain client sees the server hang up, same as after exit
+            if (ch->cli_socket >= 0)
+                close(ch->cli_socket);
+            ch->cli_socket = -1;
+            ch->in_use = false;
+            return OK;
+        default:
+            return ERR_RDSH_COMMUNICATION;
+    }
+}
+
+/*
+ * start_jump_host(ifaces, port, svr_ip, svr_port)
+ *      ifaces, port:      where to accept plain rsh clients
+ *      svr_ip, svr_port:  the rsh server to relay them to
+ *
+ *  Runs a jump host.  It makes one multiplexed connection to the server
+ *  and every client that connects to us gets a channel on it, so the
+ *  server sees one socket no matter how many clients there are.  The
+ *  clients do not need to know, they speak the plain protocol.
+ *
+ *  Everything runs on one thread with poll().  Writes to the clients
+ *  block, which is fine for interactive use, the flow control windows
+ *  keep the server from getting far ahead of us.
+ *
+ *  The jump host exits when the server goes away, for example after a
+ *  client runs `stop-server`.
+ *
+ *  Returns:
+ *      OK:                      the server closed the connection
+ *      ERR_RDSH_CLIENT:         could not connect to the server
+ *      ERR_RDSH_COMMUNICATION:  the server does not do mux, or the
+ *                               connection failed
+ *      other:                   see boot_server()
+ */
+int start_jump_host(char *ifaces, int port, char *svr_ip, int svr_port){
+    struct pollfd *fds;
+    uint16_t *fd_chan;
+    jump_chan_t *chans;
+    char *buff;
+    int svr_socket;
+    int upstream;
+    int nfds;
+    int rc;
+
+    svr_socket = boot_server(ifaces, port);
+    if (svr_socket < 0)
+        return svr_socket;
+
+    upstream = start_client(svr_ip, svr_port);
+    if (upstream < 0){
+        stop_server(svr_socket);
+        return ERR_RDSH_CLIENT;
+    }
+
+    fds = malloc(sizeof(struct pollfd) * (RDSH_MUX_MAX_CHANNELS + 2));
+    fd_chan = malloc(sizeof(uint16_t) * (RDSH_MUX_MAX_CHANNELS + 2));
+    chans = calloc(RDSH_MUX_MAX_CHANNELS, sizeof(jump_chan_t));
+    buff = malloc(RDSH_COMM_BUFF_SZ * 2);
+    rc = OK;
+    if ((fds == NULL) || (fd_chan == NULL) || (chans == NULL) || (buff == NULL))
+        rc = ERR_MEMORY;
+
+    if (rc == OK){
+        set_client_mux(true);
+        if ((negotiate_session(upstream, buff) != true) ||
+            (strstr(buff, "mux=1") == NULL)){
+            printf(RCMD_ERR_JUMP_PROTO);
+            rc = ERR_RDSH_COMMUNICATION;
+        }
+    }
+    if (rc == OK)
+        printf(RCMD_MSG_JUMP_START, svr_ip, svr_port);
+
+    while (rc == OK){
+        nfds = 0;
+        fds[nfds].fd = svr_socket;
+        fds[nfds++].events = POLLIN;
+        fds[nfds].fd = upstream;
+        fds[nfds++].events = POLLIN;
+        for (int id = 0; id < RDSH_MUX_MAX_CHANNELS; id++){
+            if (chans[id].in_use && (chans[id].cli_socket >= 0)){
+                fds[nfds].fd = chans[id].cli_socket;
+                fds[nfds].events = POLLIN;
+                fd_chan[nfds++] = id;
+            }
+        }
+
+        if (poll(fds, nfds, -1) < 0){
+            if (errno == EINTR)
+                continue;
+            rc = ERR_RDSH_COMMUNICATION;
+            break;
+        }
+
+        //server first, a CLOSE there frees up channel numbers
+        if (fds[1].revents)
+            rc = jump_from_server(upstream, chans, buff);
+        for (int i = 2; (rc == OK) && (i < nfds); i++){
+            if (fds[i].revents && (chans[fd_chan[i]].cli_socket == fds[i].fd))
+                rc = jump_from_client(upstream, chans, fd_chan[i]);
+        }
+        if ((rc == OK) && (fds[0].revents & POLLIN))
+            rc = jump_accept(svr_socket, upstream, chans);
+    }
+
+    if (rc == OK_EXIT){
+        printf(RCMD_SERVER_EXITED);
+        rc = OK;
+    }
+
+    if (chans != NULL){
+        for (int id = 0; id < RDSH_MUX_MAX_CHANNELS; id++){
+            if (chans[id].in_use && (chans[id].cli_socket >= 0))
+                close(chans[id].cli_socket);
+        }
+    }
+    free(fds);
+    free(fd_chan);
+    free(chans);
+    free(buff);
+    close(upstream);
+    stop_server(svr_socket);
+    return rc;
+}
@@ -0,0 +1,176 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_net.c - transport options for the rsh client and server
+ *
+ * By default rsh is TCP with whatever the kernel picks for everything.
+ * dsh_cli.c can change that:
+ *
+ *   -u PATH    use a Unix domain socket at PATH instead of TCP.  Only for
+ *              a client and server on the same host, but it skips the
+ *              TCP/IP stack entirely.
+ *   -o LIST    comma separated socket options, see parse_net_opts():
+ *
+ *                nodelay=1     TCP_NODELAY, send small writes right away
+ *                              instead of waiting (Nagle)
+ *                quickack=1    TCP_QUICKACK, ack right away instead of
+ *                              delaying it.  Linux turns it back off by
+ *                              itself, so it is set again before every
+ *                              recv, see rsh_recv().
+ *                sndbuf=BYTES  SO_SNDBUF and SO_RCVBUF.  Set before
+ *                rcvbuf=BYTES  listen() or connect() so TCP can pick a
+ *                              window scale to match.
+ *                backlog=N     listen() backlog, RDSH_DEF_BACKLOG by default
+ *                uring=1       server only, accept, receive and relay
+ *                              output through io_uring, see rsh_uring.c
+ *
+ * The options are kept here rather than passed around, like the other
+ * client and server settings from the command line.
+ */
+
+static rsh_net_opts_t net_opts = {
+    .unix_path = NULL,
+    .backlog = RDSH_DEF_BACKLOG,
+};
+
+void set_net_unix_path(char *path){
+    net_opts.unix_path = path;
+}
+
+/*
+ * parse_net_opts(list)
+ *      list:  e.g. "nodelay=1,sndbuf=262144", it is modified while it is
+ *             parsed
+ *
+ *  Returns:
+ *      OK:                the options are set
+ *      ERR_CMD_ARGS_BAD:  an option is unknown or its value is not a
+ *                         number, nothing after it is set
+ */
+int parse_net_opts(char *list){
+    char *save = NULL;
+    char *val;
+    char *end;
+    long n;
+
+    for (char *opt = strtok_r(list, ",", &save); opt != NULL;
+         opt = strtok_r(NULL, ",", &save)){
+        val = strchr(opt, '=');
+        if (val == NULL)
+            return ERR_CMD_ARGS_BAD;
+        *val++ = '\0';
+        n = strtol(val, &end, 10);
+        if ((*val == '\0') || (*end != '\0') || (n < 0))
+            return ERR_CMD_ARGS_BAD;
+
+        if (strcmp(opt, "nodelay") == 0)
+            net_opts.nodelay = (n != 0);
+        else if (strcmp(opt, "quickack") == 0)
+            net_opts.quickack = (n != 0);
+        else if (strcmp(opt, "sndbuf") == 0)
+            net_opts.sndbuf = (int)n;
+        else if (strcmp(opt, "rcvbuf") == 0)
+            net_opts.rcvbuf = (int)n;
+        else if ((strcmp(opt, "backlog") == 0) && (n > 0))
+            net_opts.backlog = (int)n;
+        else if (strcmp(opt, "uring") == 0)
+            net_opts.uring = (n != 0);
+        else
+            return ERR_CMD_ARGS_BAD;
+    }
+    return OK;
+}
+
+/*
+ * get_net_opts()
+ *      The options in effect, read only.
+ */
+const rsh_net_opts_t *get_net_opts(void){
+    return &net_opts;
+}
+
+/*
+ * rsh_net_socket()
+ *      Creates the socket for boot_server() or start_client(), a Unix
+ *      domain socket if -u was given and TCP otherwise.  The buffer sizes
+ *      are set here since they have to be in place before listen() or
+ *      connect().
+ *
+ *  Returns:
+ *      <fd>:                    the new socket
+ *      ERR_RDSH_COMMUNICATION:  socket() failed
+ */
+int rsh_net_socket(void){
+    int sock;
+
+    sock = socket((net_opts.unix_path != NULL) ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (sock < 0){
+        perror("socket");
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    if ((net_opts.sndbuf > 0) &&
+        (setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &net_opts.sndbuf, sizeof(int)) < 0))
+        perror("SO_SNDBUF");
+    if ((net_opts.rcvbuf > 0) &&
+        (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &net_opts.rcvbuf, sizeof(int)) < 0))
+        perror("SO_RCVBUF");
+    return sock;
+}
+
+/*
+ * rsh_unix_addr(addr)
+ *      Fills in addr for the -u path.
+ *
+ *  Returns OK, or ERR_RDSH_COMMUNICATION if the path is too long for a
+ *  sockaddr_un.
+ */
+int rsh_unix_addr(struct sockaddr_un *addr){
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(net_opts.unix_path) >= sizeof(addr->sun_path)){
+        fprintf(stderr, RCMD_ERR_UNIX_PATH, net_opts.unix_path);
+        return ERR_RDSH_COMMUNICATION;
+    }
+    strcpy(addr->sun_path, net_opts.unix_path);
+    return OK;
+}
+
+/*
+ * rsh_tune_socket(sock)
+ *      Applies the per connection TCP options to a connected socket, one
+ *      from accept() or start_client().  Nothing to do for a Unix domain
+ *      socket.
+ */
+void rsh_tune_socket(int sock){
+    int one = 1;
+
+    if (net_opts.unix_path != NULL)
+        return;
+    if (net_opts.nodelay &&
+        (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0))
+        perror("TCP_NODELAY");
+    rsh_quickack(sock);
+}
+
+/*
+ * rsh_quickack(sock)
+ *      Sets TCP_QUICKACK again if quickack=1, it does not stay on.  Called
+ *      before every receive.
+ */
+void rsh_quickack(int sock){
+    int one = 1;
+
+    if (net_opts.quickack && (net_opts.unix_path == NULL))
+        setsockopt(sock, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+}
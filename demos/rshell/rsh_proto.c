@@ -0,0 +1,209 @@
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_proto.c - framed streams shared by the rsh client and server
+ *
+ * Once a client negotiates it (see the hello control message in
+ * rshlib.h) the client and server stop sending null terminated requests
+ * and raw byte streams ending with RDSH_EOF_CHAR and instead send frames:
+ *
+ *   +-------------------------+--------------------------------+
+ *   | rdsh_frame_hdr_t (16B)  | payload (hdr.len bytes)........|
+ *   +-------------------------+--------------------------------+
+ *
+ * Framing lets the payload carry any byte (including 0x04), lets each
+ * chunk of output be compressed or not on its own, and tags everything
+ * with a request id so requests can be pipelined.
+ *
+ * The socket I/O underneath, partial sends and all, is in rsh_io.c.
+ */
+
+/*
+ * init_frame_hdr(hdr, type, channel, req_id)
+ *      Sets up a frame header in host byte order with no payload.  The
+ *      senders below fill in the lengths and convert it for the wire.
+ */
+void init_frame_hdr(rdsh_frame_hdr_t *hdr, uint8_t type, uint16_t channel,
+                    uint32_t req_id){
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->type = type;
+    hdr->channel = channel;
+    hdr->req_id = req_id;
+}
+
+/*
+ * send_frame(sock, hdr, payload)
+ *      Sends a frame header followed by its payload.  hdr is in host byte
+ *      order, hdr->len bytes of payload are sent.  Both go out in one
+ *      sendmsg(), see rsh_sendv().
+ */
+int send_frame(int sock, rdsh_frame_hdr_t *hdr, const void *payload){
+    rdsh_frame_hdr_t net;
+    struct iovec iov[2];
+
+    net.type = hdr->type;
+    net.flags = hdr->flags;
+    net.channel = htons(hdr->channel);
+    net.req_id = htonl(hdr->req_id);
+    net.raw_len = htonl(hdr->raw_len);
+    net.len = htonl(hdr->len);
+
+    iov[0].iov_base = &net;
+    iov[0].iov_len = sizeof(net);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = hdr->len;
+    return rsh_sendv(sock, iov, (hdr->len > 0) ? 2 : 1);
+}
+
+/*
+ * pack_data_frame(lz, hdr, buff, len)
+ *      lz:     compression state for the stream, NULL or lz->enabled==0
+ *              sends the data as is
+ *      hdr:    a DATA header from init_frame_hdr(), the flags and lengths
+ *              are filled in
+ *
+ *  Gets a chunk of output ready to send, compressing it if that is worth
+ *  it.  The compressor is only given RDSH_LZ_MIN_SAVING worth of room, so
+ *  chunks that do not shrink enough are abandoned early and go out raw.
+ *  After a poor chunk we also stop trying for a few chunks (doubling each
+ *  time), so a stream of random data costs almost no CPU.
+ *
+ *  This is split out from send_data_frame() so the server can compress
+ *  without holding the lock on a multiplexed socket.
+ *
+ *  Returns:
+ *      the payload to send, either buff or lz->zbuff
+ */
+const char *pack_data_frame(rsh_lz_ctx_t *lz, rdsh_frame_hdr_t *hdr,
+                            const char *buff, int len){
+    int zlen = -1;
+
+    if ((lz != NULL) && lz->enabled && (len >= RDSH_LZ_MIN_CHUNK)){
+        if (lz->skip > 0){
+            lz->skip--;
+        } else {
+            zlen = rsh_lz_compress((const uint8_t *)buff, len, lz->zbuff,
+                                   len - (len / RDSH_LZ_MIN_SAVING));
+            if (zlen < 0){
+                if (lz->backoff < RDSH_LZ_MAX_BACKOFF)
+                    lz->backoff = (lz->backoff == 0) ? 1 : lz->backoff * 2;
+                lz->skip = lz->backoff;
+            } else {
+                lz->backoff = 0;
+            }
+        }
+    }
+
+    hdr->raw_len = len;
+    if (zlen > 0){
+        hdr->flags |= RDSH_FLAG_LZ;
+        hdr->len = zlen;
+    } else {
+        hdr->flags &= ~RDSH_FLAG_LZ;
+        hdr->len = len;
+    }
+
+    if (lz != NULL){
+        lz->raw_bytes += len;
+        lz->wire_bytes += hdr->len + sizeof(rdsh_frame_hdr_t);
+    }
+    return (zlen > 0) ? (const char *)lz->zbuff : buff;
+}
+
+/*
+ * send_data_frame(sock, lz, hdr, buff, len)
+ *      Compresses (see pack_data_frame()) and sends a chunk of output.
+ *      hdr supplies the channel and request id.
+ */
+int send_data_frame(int sock, rsh_lz_ctx_t *lz, rdsh_frame_hdr_t *hdr,
+                    const char *buff, int len){
+    const char *payload = pack_data_frame(lz, hdr, buff, len);
+    return send_frame(sock, hdr, payload);
+}
+
+/*
+ * send_end_frame(sock, channel, req_id, status)
+ *      Marks the end of the output of a request, this takes the place of
+ *      RDSH_EOF_CHAR in framed mode.  The exit status of the command is
+ *      the payload.
+ */
+int send_end_frame(int sock, uint16_t channel, uint32_t req_id, int status){
+    rdsh_frame_hdr_t hdr;
+    uint32_t st = htonl((uint32_t)status);
+
+    init_frame_hdr(&hdr, RDSH_FRAME_END, channel, req_id);
+    hdr.len = hdr.raw_len = sizeof(st);
+    return send_frame(sock, &hdr, &st);
+}
+
+/*
+ * recv_frame(sock, hdr, buff, buff_sz)
+ *      Receives one frame.  The header fields in hdr are converted to host
+ *      byte order and the payload lands in buff.
+ *
+ *  Returns:
+ *      <number>:                the payload length
+ *      0 with hdr->type == 0:   the other side closed the connection
+ *      ERR_RDSH_COMMUNICATION:  recv() failed or the frame is too big
+ */
+int recv_frame(int sock, rdsh_frame_hdr_t *hdr, void *buff, int buff_sz){
+    int rc;
+
+    rc = rsh_recv_all(sock, hdr, sizeof(*hdr));
+    if (rc == 0){
+        memset(hdr, 0, sizeof(*hdr));
+        return 0;
+    }
+    if (rc < 0)
+        return ERR_RDSH_COMMUNICATION;
+
+    hdr->channel = ntohs(hdr->channel);
+    hdr->req_id = ntohl(hdr->req_id);
+    hdr->raw_len = ntohl(hdr->raw_len);
+    hdr->len = ntohl(hdr->len);
+    if (hdr->len > (uint32_t)buff_sz)
+        return ERR_RDSH_COMMUNICATION;
+
+    if (hdr->len > 0){
+        rc = rsh_recv_all(sock, buff, hdr->len);
+        if (rc <= 0)
+            return ERR_RDSH_COMMUNICATION;
+    }
+    return (int)hdr->len;
+}
+
+/*
+ * frame_payload(hdr, buff, raw_buff, raw_sz, out)
+ *      Gets at the data in a DATA frame that was received with
+ *      recv_frame(), decompressing it into raw_buff if needed.  *out is
+ *      pointed at the usable bytes.
+ *
+ *  Returns:
+ *      <number>:                the number of usable bytes
+ *      ERR_RDSH_COMMUNICATION:  the frame could not be decompressed
+ */
+int frame_payload(rdsh_frame_hdr_t *hdr, char *buff, char *raw_buff,
+                  int raw_sz, char **out){
+    int n;
+
+    if ((hdr->flags & RDSH_FLAG_LZ) == 0){
+        *out = buff;
+        return (int)hdr->len;
+    }
+
+    n = rsh_lz_decompress((const uint8_t *)buff, hdr->len,
+                          (uint8_t *)raw_buff, raw_sz);
+    if ((n < 0) || ((uint32_t)n != hdr->raw_len))
+        return ERR_RDSH_COMMUNICATION;
+    *out = raw_buff;
+    return n;
+}
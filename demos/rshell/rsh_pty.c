@@ -0,0 +1,496 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_pty.c - run remote commands on a pseudo terminal
+ *
+ * Normally the STDOUT of a command is a pipe back to the server.  stdio
+ * then buffers output fully, so it arrives in bursts, and programs like
+ * top or less will not run at all.  A client started with -t asks for
+ * pty=1 in its hello (see RDSH_CTL_CHAR in rshlib.h).  After that every
+ * pipeline of the session gets a pty of its own:
+ *
+ *   client --STDIN, WINSIZE frames--> server --write--> pty master
+ *   client <-------DATA frames------- server <--read--- pty master
+ *                                                           |
+ *                                          leader (setsid, TIOCSCTTY)
+ *                                                           |
+ *                                                 cmd | cmd | cmd
+ *
+ * The leader is the zygote runner, or a process forked here if there is
+ * no zygote.  It makes the pty its controlling terminal before starting
+ * the pipeline.  So ^C typed on the client becomes a SIGINT for the
+ * pipeline through the line discipline, just like on a local terminal,
+ * and /dev/tty works.  While a command runs the client's own terminal is
+ * raw, the pty does the echo and line editing.
+ *
+ * Keystrokes and their echo are tiny frames, often several back to back,
+ * e.g. the echo of a line and then the command's output.  With Nagle on
+ * the second one waits for the first to be acked, and delayed acks make
+ * that up to 40ms, so both ends turn on TCP_NODELAY for a pty session, as
+ * ssh does for interactive sessions.
+ *
+ * Job control is not supported.  The suspend character is turned off so
+ * ^Z cannot stop a pipeline that nobody could resume.
+ */
+
+static void pty_ignore(int sig){
+    (void)sig;
+}
+
+//write() everything we can, stops early if fd is non-blocking and full
+static int pty_write(int fd, const char *buff, int len){
+    int done = 0;
+    ssize_t n;
+
+    while (done < len){
+        n = write(fd, buff + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+/*
+ * pty_nodelay(sock)
+ *      Turns off Nagle for an interactive session, see above.  It fails
+ *      quietly on a socket that is not TCP.
+ */
+void pty_nodelay(int sock){
+    int one = 1;
+
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/*
+ * pty_open(sess, slave_fd)
+ *      sess:      the session, its last window size is used
+ *      slave_fd:  the terminal side of the new pty goes here
+ *
+ *  Allocates a pty for one pipeline.  Both ends are close on exec, the
+ *  pipeline gets the slave through rsh_spawn_pipeline()'s dup2()s.  The
+ *  master is non-blocking so a command that does not read its input
+ *  cannot stop us relaying its output.
+ *
+ *  Returns:
+ *      <fd>:               the master side
+ *      ERR_RDSH_CMD_EXEC:  no pty could be allocated
+ */
+int pty_open(rsh_session_t *sess, int *slave_fd){
+    struct termios tio;
+    struct winsize ws;
+    char name[64];
+    int master_fd;
+
+    master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master_fd < 0){
+        perror("posix_openpt");
+        return ERR_RDSH_CMD_EXEC;
+    }
+    if ((grantpt(master_fd) < 0) || (unlockpt(master_fd) < 0) ||
+        (ptsname_r(master_fd, name, sizeof(name)) != 0) ||
+        ((*slave_fd = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0)){
+        perror("pty");
+        close(master_fd);
+        return ERR_RDSH_CMD_EXEC;
+    }
+
+    if (tcgetattr(*slave_fd, &tio) == 0){
+        tio.c_cc[VSUSP] = _POSIX_VDISABLE;
+        tcsetattr(*slave_fd, TCSANOW, &tio);
+    }
+    memset(&ws, 0, sizeof(ws));
+    ws.ws_row = sess->pty_rows;
+    ws.ws_col = sess->pty_cols;
+    ioctl(*slave_fd, TIOCSWINSZ, &ws);
+
+    fcntl(master_fd, F_SETFL, O_NONBLOCK);
+    return master_fd;
+}
+
+/*
+ * pty_leader(slave_fd)
+ *      Run in the process that is about to start a pipeline on a pty.  It
+ *      becomes a session leader with the pty as its controlling terminal,
+ *      and the pty as its STDIN, STDOUT and STDERR so every command in the
+ *      pipeline gets it by default.
+ *
+ *      ^C and ^\ go to the whole foreground process group, us included,
+ *      and we have to live to report the exit code.  A handler rather
+ *      than SIG_IGN, since exec() puts handlers back to the default for
+ *      the commands.
+ *
+ *  Returns OK, or ERR_RDSH_CMD_EXEC if the pty could not be made the
+ *  controlling terminal.
+ */
+int pty_leader(int slave_fd){
+    struct sigaction sa;
+
+    if ((setsid() < 0) || (ioctl(slave_fd, TIOCSCTTY, 0) < 0)){
+        perror("pty leader");
+        return ERR_RDSH_CMD_EXEC;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = pty_ignore;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGQUIT, &sa, NULL);
+
+    dup2(slave_fd, STDIN_FILENO);
+    dup2(slave_fd, STDOUT_FILENO);
+    dup2(slave_fd, STDERR_FILENO);
+    return OK;
+}
+
+//fallback when there is no zygote, fork a leader that does what the
+//zygote runner would.  Same contract as zygote_spawn(), plus the leader
+//has to be waited for.
+static int pty_spawn(rsh_session_t *sess, command_list_t *clist, int slave_fd,
+                     pid_t *leader){
+    pid_t pids[CMD_MAX];
+    int st_pipe[2];
+    int exit_code = ERR_RDSH_CMD_EXEC;
+
+    if (pipe2(st_pipe, O_CLOEXEC) < 0)
+        return ERR_RDSH_CMD_EXEC;
+
+    fflush(stdout);
+    *leader = fork();
+    if (*leader < 0){
+        perror("fork");
+        close(st_pipe[0]);
+        close(st_pipe[1]);
+        return ERR_RDSH_CMD_EXEC;
+    }
+    if (*leader == 0){
+        close(st_pipe[0]);
+        if ((pty_leader(slave_fd) == OK) &&
+            (rsh_spawn_pipeline(clist, slave_fd, slave_fd, sess->cwd_fd, sess->env,
+                                pids) == OK)){
+            close(slave_fd);
+            exit_code = rsh_wait_pipeline(clist, pids);
+        }
+        if (write(st_pipe[1], &exit_code, sizeof(exit_code)) < 0)
+            perror("pty status");
+        _exit(0);
+    }
+
+    close(st_pipe[1]);
+    return st_pipe[0];
+}
+
+/*
+ * pty_winsize(sess, master_fd, payload, len)
+ *      sess:       the session the WINSIZE frame arrived on
+ *      master_fd:  the pty of the running command, or -1 between commands
+ *      payload:    rows and columns, uint16_t each in network byte order
+ *
+ *  Remembers the size for the next pty, and resizes the current one.  The
+ *  kernel sends SIGWINCH to the pipeline for us.
+ */
+void pty_winsize(rsh_session_t *sess, int master_fd, const char *payload, int len){
+    struct winsize ws;
+    uint16_t dim[2];
+
+    if (len != sizeof(dim))
+        return;
+    memcpy(dim, payload, sizeof(dim));
+    sess->pty_rows = ntohs(dim[0]);
+    sess->pty_cols = ntohs(dim[1]);
+
+    if (master_fd >= 0){
+        memset(&ws, 0, sizeof(ws));
+        ws.ws_row = sess->pty_rows;
+        ws.ws_col = sess->pty_cols;
+        ioctl(master_fd, TIOCSWINSZ, &ws);
+    }
+}
+
+//one frame from the client while a command is running
+static int pty_from_client(rsh_session_t *sess, int master_fd){
+    rdsh_frame_hdr_t hdr;
+    char buff[RDSH_PTY_IO_SZ];
+    int len;
+
+    len = recv_frame(sess->cli_socket, &hdr, buff, sizeof(buff));
+    if ((len < 0) || (hdr.type == 0))
+        return ERR_RDSH_COMMUNICATION;
+
+    switch (hdr.type){
+        case RDSH_FRAME_STDIN:
+            //like a real terminal, what does not fit in the input queue
+            //is lost
+            if (hdr.req_id == sess->req_id)
+                pty_write(master_fd, buff, len);
+            return OK;
+        case RDSH_FRAME_WINSIZE:
+            pty_winsize(sess, master_fd, buff, len);
+            return OK;
+        default:
+            return ERR_RDSH_COMMUNICATION;
+    }
+}
+
+/*
+ * pty_relay(sess, master_fd)
+ *      The pty version of relay_output().  Output from the pty goes to the
+ *      client as DATA frames, keystrokes and window size changes from the
+ *      client go to the pty.  It is done when every process has closed the
+ *      terminal, reading the master then fails with EIO.
+ *
+ *  Returns:
+ *      OK:                      the pipeline is done with the pty
+ *      ERR_RDSH_COMMUNICATION:  the client went away, closing the master
+ *                               then hangs up on the pipeline
+ */
+static int pty_relay(rsh_session_t *sess, int master_fd){
+    struct pollfd pfd[2];
+    rdsh_frame_hdr_t hdr;
+    const char *payload;
+    ssize_t n;
+    int rc;
+
+    pfd[0].fd = master_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sess->cli_socket;
+    pfd[1].events = POLLIN;
+
+    while (1){
+        if (poll(pfd, 2, -1) < 0){
+            if (errno == EINTR)
+                continue;
+            return ERR_RDSH_COMMUNICATION;
+        }
+
+        if (pfd[0].revents){
+            if (rsh_flow_writable(sess->flow, sess->cli_socket) != OK)
+                return ERR_RDSH_COMMUNICATION;
+            n = read(master_fd, sess->relay_buff, rsh_sched_chunk());
+            if ((n < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+                n = 0;
+            else if (n <= 0)
+                return OK;
+
+            if (n > 0){
+                rsh_flow_acquire(sess->flow, n);
+                init_frame_hdr(&hdr, RDSH_FRAME_DATA, sess->channel, sess->req_id);
+                payload = pack_data_frame(&sess->lz, &hdr, sess->relay_buff, n);
+                rc = send_session_frame(sess, &hdr, payload);
+                if (rc != OK)
+                    return rc;
+            }
+        }
+
+        if (pfd[1].revents){
+            rc = pty_from_client(sess, master_fd);
+            if (rc != OK)
+                return rc;
+        }
+    }
+}
+
+/*
+ * rsh_execute_pty(sess, clist)
+ *      rsh_execute_pipeline() for a session that asked for pty=1.  The
+ *      pipeline is started on a new pty by the zygote, or by a leader we
+ *      fork if there is no zygote, and relayed until it is done with it.
+ *
+ *  Returns:
+ *      the exit code of the pipeline, see rsh_execute_pipeline(), or
+ *      ERR_RDSH_CMD_EXEC if it could not be started
+ */
+int rsh_execute_pty(rsh_session_t *sess, command_list_t *clist){
+    pid_t leader = -1;
+    int master_fd;
+    int slave_fd;
+    int status_fd;
+    int exit_code;
+    uint64_t t0;
+
+    master_fd = pty_open(sess, &slave_fd);
+    if (master_fd < 0)
+        return ERR_RDSH_CMD_EXEC;
+
+    t0 = rsh_metric_now();
+    status_fd = zygote_spawn(clist, slave_fd, slave_fd, sess->cwd_fd, sess->env, true);
+    if (status_fd < 0)
+        status_fd = pty_spawn(sess, clist, slave_fd, &leader);
+    rsh_metric_observe(RSH_H_SPAWN, rsh_metric_now() - t0);
+    close(slave_fd);
+    if (status_fd < 0){
+        close(master_fd);
+        return ERR_RDSH_CMD_EXEC;
+    }
+
+    pty_relay(sess, master_fd);
+    close(master_fd);
+
+    exit_code = zygote_wait(status_fd);
+    if (leader > 0)
+        waitpid(leader, NULL, 0);
+    rsh_metric_observe(RSH_H_COMMAND, rsh_metric_now() - t0);
+    return exit_code;
+}
+
+/*
+ * Client side.  The window size is sent once when the session starts and
+ * again on every SIGWINCH.  The handler only sets a flag, it is picked up
+ * by the loop in recv_pty_response() or before the next request.
+ */
+
+static volatile sig_atomic_t winch_pending = false;
+
+static void pty_on_winch(int sig){
+    (void)sig;
+    winch_pending = true;
+}
+
+static int pty_send_winsize(int cli_socket){
+    rdsh_frame_hdr_t hdr;
+    struct winsize ws;
+    uint16_t dim[2];
+
+    winch_pending = false;
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) < 0)
+        return OK;
+    dim[0] = htons(ws.ws_row);
+    dim[1] = htons(ws.ws_col);
+
+    init_frame_hdr(&hdr, RDSH_FRAME_WINSIZE, 0, 0);
+    hdr.len = hdr.raw_len = sizeof(dim);
+    return send_frame(cli_socket, &hdr, dim);
+}
+
+/*
+ * pty_client_start(cli_socket) and pty_client_winch(cli_socket)
+ *      Call pty_client_start() once the server has agreed to pty=1, it
+ *      turns off Nagle, sends our window size and starts watching for
+ *      changes.  Call
+ *      pty_client_winch() before each request to pass on a change that
+ *      happened at the prompt.
+ *
+ *  Both return OK or ERR_RDSH_COMMUNICATION.
+ */
+int pty_client_start(int cli_socket){
+    struct sigaction sa;
+
+    //the line editor's poll() and read() at the prompt retry on EINTR,
+    //SA_RESTART keeps a resize from cutting short a send() or recv()
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = pty_on_winch;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
+
+    pty_nodelay(cli_socket);
+    return pty_send_winsize(cli_socket);
+}
+
+int pty_client_winch(int cli_socket){
+    return winch_pending ? pty_send_winsize(cli_socket) : OK;
+}
+
+/*
+ * recv_pty_response(cli_socket, rsp_buff, req_id)
+ *      cli_socket:  socket connected to the server
+ *      rsp_buff:    2 * RDSH_COMM_BUFF_SZ bytes, see recv_framed_response()
+ *      req_id:      the request that is running
+ *
+ *  recv_framed_response() for a pty session.  Our terminal goes raw for
+ *  as long as the command runs and every keystroke is sent to the server
+ *  as it is typed, output is written straight to STDOUT without stdio
+ *  buffering it.  The terminal is put back before returning.
+ *
+ *  Returns:
+ *      1:                       got the whole response
+ *      0:                       the server closed the connection
+ *      ERR_RDSH_COMMUNICATION:  recv() or send() failed or a frame was bad
+ */
+int recv_pty_response(int cli_socket, char *rsp_buff, uint32_t req_id){
+    struct termios saved, raw;
+    struct pollfd pfd[2];
+    rdsh_frame_hdr_t hdr;
+    char in_buff[RDSH_PTY_IO_SZ];
+    char *data;
+    int nfds = 2;
+    ssize_t n;
+    int rc;
+
+    tcgetattr(STDIN_FILENO, &saved);
+    raw = saved;
+    cfmakeraw(&raw);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+    fflush(stdout);
+
+    pfd[0].fd = cli_socket;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = STDIN_FILENO;
+    pfd[1].events = POLLIN;
+
+    while (1){
+        if (winch_pending && (pty_send_winsize(cli_socket) != OK)){
+            rc = ERR_RDSH_COMMUNICATION;
+            break;
+        }
+        if (poll(pfd, nfds, -1) < 0){
+            if (errno == EINTR)
+                continue;
+            rc = ERR_RDSH_COMMUNICATION;
+            break;
+        }
+
+        if ((nfds > 1) && pfd[1].revents){
+            n = read(STDIN_FILENO, in_buff, sizeof(in_buff));
+            if (n <= 0){
+                nfds = 1;       //nothing more to type, just wait it out
+            } else {
+                init_frame_hdr(&hdr, RDSH_FRAME_STDIN, 0, req_id);
+                hdr.len = hdr.raw_len = n;
+                if (send_frame(cli_socket, &hdr, in_buff) != OK){
+                    rc = ERR_RDSH_COMMUNICATION;
+                    break;
+                }
+            }
+        }
+
+        if (pfd[0].revents){
+            rc = recv_frame(cli_socket, &hdr, rsp_buff, RDSH_COMM_BUFF_SZ);
+            if (rc < 0)
+                break;
+            if (hdr.type == 0)
+                break;
+            if (hdr.type == RDSH_FRAME_END){
+                rc = 1;
+                break;
+            }
+            rc = frame_payload(&hdr, rsp_buff, rsp_buff + RDSH_COMM_BUFF_SZ,
+                               RDSH_COMM_BUFF_SZ, &data);
+            if (rc < 0)
+                break;
+            pty_write(STDOUT_FILENO, data, rc);
+        }
+    }
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+    return rc;
+}
@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_sched.c - output rate limiting and fair scheduling
+ *
+ * In threaded mode every session sends its own output as fast as the
+ * client takes it, so one session running `cat` on a huge file gets as
+ * much of the server's uplink as it can and everyone else's output queues
+ * up behind it.  With -b the server shares its output out instead:
+ *
+ *   -b LIST    comma separated, see parse_sched_opts():
+ *
+ *                rate=BYTES     output of the whole server, per second
+ *                session=BYTES  output of any one session, per second
+ *                burst=BYTES    how far a bucket may fill up while idle
+ *                quantum=BYTES  bytes a session may send per turn
+ *
+ * Each limit is a token bucket.  A session (an rsh_flow_t) waits in
+ * rsh_flow_acquire() before each chunk of output until both its own bucket
+ * and the server's hold enough tokens.  When sessions are waiting for the
+ * server's bucket they take turns by deficit round robin: a session at
+ * the head of the queue has quantum bytes added to its deficit, and sends
+ * if the deficit covers its chunk, otherwise it goes to the back.  So each
+ * busy session gets the same number of bytes per round no matter how big
+ * its chunks are.
+ *
+ * Interactive sessions send a little now and then.  A session that has
+ * been quiet for RDSH_SCHED_SPARSE_MS goes on a second queue that is
+ * served first, with a fresh quantum, the same trick fq_codel uses for
+ * sparse flows.  A prompt or the output of `ls` goes out right away,
+ * while the bulk sessions split whatever is left between them.
+ *
+ * A session does not join the queue until its socket has room, see
+ * rsh_flow_writable().  Until then it also stops reading the pipeline's
+ * output, and the pipeline blocks on a full pipe.  A slow client
+ * therefore never holds a turn that the others could use.
+ *
+ * Without -b none of this runs.  rsh_flow_new() returns NULL, and the
+ * rsh_flow_*() functions do nothing for NULL.
+ */
+
+struct rsh_flow{
+    struct rsh_flow *next;      //in one of the queues while waiting
+    int       granted;
+    int       want;             //bytes it is waiting to send
+    int64_t   deficit;
+    double    tokens;           //the session's own bucket
+    uint64_t  refilled;         //usec, when tokens was last topped up
+    uint64_t  last_active;      //usec, when it last sent
+};
+
+typedef struct rsh_flow_queue{
+    rsh_flow_t  *head;
+    rsh_flow_t  *tail;
+}rsh_flow_queue_t;
+
+static struct {
+    long  rate;
+    long  session_rate;
+    long  burst;
+    long  quantum;
+} sched_opts = {
+    .burst = RDSH_SCHED_DEF_BURST,
+    .quantum = RDSH_SCHED_DEF_QUANTUM,
+};
+
+static pthread_once_t sched_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_cond;
+static rsh_flow_queue_t sparse_q;       //served first
+static rsh_flow_queue_t bulk_q;
+static int num_waiting = 0;
+static double link_tokens;
+static uint64_t link_refilled;
+
+/*
+ * parse_sched_opts(list)
+ *      list:  e.g. "rate=10000000,session=2000000", it is modified while
+ *             it is parsed
+ *
+ *  Returns:
+ *      OK:                the options are set
+ *      ERR_CMD_ARGS_BAD:  an option is unknown or its value is not a
+ *                         number, nothing after it is set
+ */
+int parse_sched_opts(char *list){
+    char *save = NULL;
+    char *val;
+    char *end;
+    long n;
+
+    for (char *opt = strtok_r(list, ",", &save); opt != NULL;
+         opt = strtok_r(NULL, ",", &save)){
+        val = strchr(opt, '=');
+        if (val == NULL)
+            return ERR_CMD_ARGS_BAD;
+        *val++ = '\0';
+        n = strtol(val, &end, 10);
+        if ((*val == '\0') || (*end != '\0') || (n < 0))
+            return ERR_CMD_ARGS_BAD;
+
+        if (strcmp(opt, "rate") == 0)
+            sched_opts.rate = n;
+        else if (strcmp(opt, "session") == 0)
+            sched_opts.session_rate = n;
+        else if ((strcmp(opt, "burst") == 0) && (n > 0))
+            sched_opts.burst = n;
+        else if ((strcmp(opt, "quantum") == 0) && (n > 0))
+            sched_opts.quantum = n;
+        else
+            return ERR_CMD_ARGS_BAD;
+    }
+    return OK;
+}
+
+static int sched_enabled(void){
+    return (sched_opts.rate > 0) || (sched_opts.session_rate > 0);
+}
+
+/*
+ * rsh_sched_chunk()
+ *      How much output to read from a pipeline at a time.  With -b it is
+ *      one quantum, so turns are short, and never more than a bucket holds.
+ */
+int rsh_sched_chunk(void){
+    long chunk = RDSH_COMM_BUFF_SZ;
+
+    if (!sched_enabled())
+        return chunk;
+    if (sched_opts.quantum < chunk)
+        chunk = sched_opts.quantum;
+    if (sched_opts.burst < chunk)
+        chunk = sched_opts.burst;
+    return (int)chunk;
+}
+
+static void sched_init(void){
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sched_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    link_tokens = sched_opts.burst;
+    link_refilled = rsh_metric_now();
+}
+
+/*
+ * rsh_flow_new() and rsh_flow_free(flow)
+ *      The scheduling state of a session, session_init() and
+ *      session_free() call these.  rsh_flow_new() returns NULL without -b,
+ *      or if there is no memory, and the session is then not scheduled.
+ */
+rsh_flow_t *rsh_flow_new(void){
+    rsh_flow_t *flow;
+
+    if (!sched_enabled())
+        return NULL;
+    pthread_once(&sched_once, sched_init);
+
+    flow = calloc(1, sizeof(rsh_flow_t));
+    if (flow == NULL)
+        return NULL;
+    flow->tokens = sched_opts.burst;
+    flow->refilled = rsh_metric_now();
+    return flow;
+}
+
+void rsh_flow_free(rsh_flow_t *flow){
+    free(flow);
+}
+
+//tops up a bucket for the time since it was last done, rate 0 is no limit
+static void refill(double *tokens, uint64_t *refilled, long rate, uint64_t now){
+    if (rate == 0)
+        *tokens = sched_opts.burst;
+    else
+        *tokens += (double)rate * (now - *refilled) / 1e6;
+    if (*tokens > sched_opts.burst)
+        *tokens = sched_opts.burst;
+    *refilled = now;
+}
+
+//usec until a bucket holding tokens has want of them, a bucket with no
+//limit is full again at the next look
+static uint64_t refill_wait(double tokens, int want, long rate){
+    if (rate == 0)
+        return 1;
+    return (uint64_t)((want - tokens) * 1e6 / rate) + 1;
+}
+
+static void queue_push(rsh_flow_queue_t *q, rsh_flow_t *flow){
+    flow->next = NULL;
+    if (q->tail != NULL)
+        q->tail->next = flow;
+    else
+        q->head = flow;
+    q->tail = flow;
+}
+
+static rsh_flow_t *queue_pop(rsh_flow_queue_t *q){
+    rsh_flow_t *flow = q->head;
+
+    if (flow != NULL){
+        q->head = flow->next;
+        if (q->head == NULL)
+            q->tail = NULL;
+    }
+    return flow;
+}
+
+/*
+ * sched_dispatch(now)
+ *      Hands out turns to waiting sessions while the buckets allow, sparse
+ *      sessions first, then deficit round robin over the bulk ones.  Called
+ *      with sched_lock held by whichever session is waiting.
+ *
+ *  Returns usec until a waiting session could go, 0 if none is waiting.
+ */
+static uint64_t sched_dispatch(uint64_t now){
+    rsh_flow_queue_t *q;
+    rsh_flow_t *flow;
+    uint64_t wait = 0;
+    uint64_t w;
+    int skipped = 0;
+
+    refill(&link_tokens, &link_refilled, sched_opts.rate, now);
+
+    while (skipped < num_waiting){
+        q = (sparse_q.head != NULL) ? &sparse_q : &bulk_q;
+        flow = queue_pop(q);
+
+        //over its own limit, it does not hold up the others
+        refill(&flow->tokens, &flow->refilled, sched_opts.session_rate, now);
+        if (flow->tokens < flow->want){
+            w = refill_wait(flow->tokens, flow->want, sched_opts.session_rate);
+            if ((wait == 0) || (w < wait))
+                wait = w;
+            queue_push(&bulk_q, flow);
+            skipped++;
+            continue;
+        }
+
+        if (flow->deficit < flow->want){
+            flow->deficit += sched_opts.quantum;
+            queue_push(&bulk_q, flow);
+            continue;
+        }
+
+        //its turn, but the server is out of tokens, everyone waits.  With
+        //no rate only session= is set, there is no link limit to check
+        if ((sched_opts.rate > 0) && (link_tokens < flow->want)){
+            w = refill_wait(link_tokens, flow->want, sched_opts.rate);
+            if ((wait == 0) || (w < wait))
+                wait = w;
+            //put it back at the head, it is still next
+            flow->next = q->head;
+            q->head = flow;
+            if (q->tail == NULL)
+                q->tail = flow;
+            break;
+        }
+
+        if (sched_opts.rate > 0)
+            link_tokens -= flow->want;
+        flow->tokens -= flow->want;
+        flow->deficit -= flow->want;
+        flow->granted = true;
+        num_waiting--;
+        skipped = 0;
+        pthread_cond_broadcast(&sched_cond);
+    }
+    return wait;
+}
+
+/*
+ * rsh_flow_acquire(flow, len)
+ *      Waits until the session may send len more bytes, see the comment
+ *      at the top.  len is at most rsh_sched_chunk().
+ */
+void rsh_flow_acquire(rsh_flow_t *flow, int len){
+    struct timespec deadline;
+    uint64_t now = rsh_metric_now();
+    uint64_t wait;
+
+    if ((flow == NULL) || (len <= 0))
+        return;
+
+    pthread_mutex_lock(&sched_lock);
+    flow->want = len;
+    flow->granted = false;
+    if (now - flow->last_active > RDSH_SCHED_SPARSE_MS * 1000){
+        flow->deficit = sched_opts.quantum;
+        queue_push(&sparse_q, flow);
+    } else {
+        queue_push(&bulk_q, flow);
+    }
+    num_waiting++;
+
+    while (!flow->granted){
+        wait = sched_dispatch(rsh_metric_now());
+        if (flow->granted)
+            break;
+
+        //someone else's grant or our refill, whichever comes first
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        if (wait == 0)
+            wait = RDSH_SCHED_SPARSE_MS * 1000;
+        deadline.tv_sec += wait / 1000000;
+        deadline.tv_nsec += (wait % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&sched_cond, &sched_lock, &deadline);
+    }
+    flow->last_active = rsh_metric_now();
+    pthread_mutex_unlock(&sched_lock);
+}
+
+/*
+ * rsh_flow_writable(flow, sock)
+ *      With -b, waits until sock has room for more output before the
+ *      session reads any more of it.  Without -b the blocking send
+ *      already holds the session up, so there is nothing to do.
+ *
+ *  Returns:
+ *      OK:                      go ahead
+ *      ERR_RDSH_COMMUNICATION:  the client is gone
+ */
+int rsh_flow_writable(rsh_flow_t *flow, int sock){
+    struct pollfd pfd;
+
+    if (flow == NULL)
+        return OK;
+
+    pfd.fd = sock;
+    pfd.events = POLLOUT;
+    while (poll(&pfd, 1, -1) < 0){
+        if (errno != EINTR)
+            return ERR_RDSH_COMMUNICATION;
+    }
+    return (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) ? ERR_RDSH_COMMUNICATION : OK;
+}
@@ -1,6 +1,10 @@
 
+#define _GNU_SOURCE
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +12,8 @@
 #include <unistd.h>
 #include <sys/un.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 
 //INCLUDES for extra credit
 #include <signal.h>
@@ -18,12 +24,16 @@
 #include "rshlib.h"
 
 extern void print_dragon();
+extern char **environ;
 
 //do not include in template, students need to figure out how to 
 //structure adding support for a threaded server, to keep things
 //simple we will use a global and set it in dsh_cli based on the 
 //command line args
 static int is_threaded_server = false;
+static int made_unix_socket = false;  //the -u socket file is ours to remove
+
+static int accept_client(int svr_socket);
 
 
 
@@ -44,10 +54,15 @@ static int is_threaded_server = false;
  *                   per thread connections for clients   
  * 
  *      This function basically runs the server by: 
- *          1. Booting up the server
- *          2. Processing client requests until the client requests the
- *             server to stop by running the `stop-server` command
- *          3. Stopping the server. 
+ *          1. Starting the zygote that launches commands, see rsh_zygote.c.
+ *             This has to happen first, while we are still single threaded
+ *             and before the listening socket exists.  If it cannot be
+ *             started the server forks commands itself.
+ *          2. Booting up the server
+ *          3. Processing client requests until the client requests the
+ *             server to stop by running the `stop-server` command, or
+ *             the server gets SIGTERM, see rsh_drain.c
+ *          4. Stopping the server. 
  * 
  *      This function is fully implemented for you and should not require
  *      any changes. 
@@ -57,16 +72,29 @@ int start_server(char *ifaces, int port, int is_threaded){
     int rc;
 
     is_threaded_server = is_threaded;
+
+    if (start_zygote() != OK)
+        printf(RCMD_ERR_ZYGOTE);
+    if (get_net_opts()->uring && (rsh_uring_init() != OK))
+        printf(RCMD_ERR_URING);
+    rsh_shutdown_init();
+    rsh_metrics_start();
     
     svr_socket = boot_server(ifaces, port);
     if (svr_socket < 0){
         int err_code = svr_socket;  //server socket will carry error code
+        rsh_metrics_stop();
+        stop_zygote();
         return err_code;
     }
 
     rc = process_cli_requests(svr_socket);
 
     stop_server(svr_socket);
+    if (made_unix_socket)
+        unlink(get_net_opts()->unix_path);
+    rsh_metrics_stop();
+    stop_zygote();
     return rc;
 }
 
@@ -82,6 +110,23 @@ int stop_server(int svr_socket){
     return close(svr_socket);
 }
 
+//true if the -u path is a socket no server answers on any more
+static int stale_unix_socket(const struct sockaddr_un *uaddr){
+    struct stat sb;
+    int sock;
+    int stale;
+
+    if ((lstat(uaddr->sun_path, &sb) < 0) || !S_ISSOCK(sb.st_mode))
+        return false;
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+        return false;
+    stale = (connect(sock, (const struct sockaddr *) uaddr, sizeof(*uaddr)) < 0) &&
+            (errno == ECONNREFUSED);
+    close(sock);
+    return stale;
+}
+
 /*
  * boot_server(ifaces, port)
  *      ifaces & port:  see start_server for description.  They are passed
@@ -93,6 +138,13 @@ int stop_server(int svr_socket){
  *      1. Create the server socket using the socket() function. 
  *      2. Calling bind to "bind" the server to the interface and port
  *      3. Calling listen to get the server ready to listen for connections.
+ *
+ *      With -u the socket is a Unix domain socket bound to that path
+ *      instead, and ifaces and port are not used.  A socket file left
+ *      behind by a server that did not stop cleanly is removed first, but
+ *      anything else at the path, or a socket a server still answers on,
+ *      is left alone and the server does not start.  The
+ *      socket options and backlog come from -o, see rsh_net.c.
  * 
  *      after creating the socket and prior to calling bind you might want to 
  *      include the following code:
@@ -116,18 +168,50 @@ int stop_server(int svr_socket){
  * 
  */
 int boot_server(char *ifaces, int port){
+    const rsh_net_opts_t *opts = get_net_opts();
     int svr_socket;
     int ret;
     
     struct sockaddr_in addr;
+    struct sockaddr_un uaddr;
 
     /* Create local socket. */
-    svr_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (svr_socket == -1) {
-        perror("socket");
+    svr_socket = rsh_net_socket();
+    if (svr_socket < 0) {
         return ERR_RDSH_COMMUNICATION;
     }
 
+    if (opts->unix_path != NULL) {
+        if (rsh_unix_addr(&uaddr) != OK) {
+            close(svr_socket);
+            return ERR_RDSH_COMMUNICATION;
+        }
+        if (access(opts->unix_path, F_OK) == 0) {
+            if (!stale_unix_socket(&uaddr)) {
+                fprintf(stderr, RCMD_ERR_UNIX_IN_USE, opts->unix_path);
+                close(svr_socket);
+                return ERR_RDSH_COMMUNICATION;
+            }
+            unlink(opts->unix_path);
+        }
+        ret = bind(svr_socket, (const struct sockaddr *) &uaddr, sizeof(uaddr));
+        if (ret == -1) {
+            perror("bind");
+            close(svr_socket);
+            return ERR_RDSH_COMMUNICATION;
+        }
+        made_unix_socket = true;
+        ret = listen(svr_socket, opts->backlog);
+        if (ret == -1) {
+            perror("listen");
+            close(svr_socket);
+            unlink(opts->unix_path);
+            made_unix_socket = false;
+            return ERR_RDSH_COMMUNICATION;
+        }
+        return svr_socket;
+    }
+
     /*
      * NOTE this is good for development as sometimes port numbers
      * get held up, this forces the port to be bound, do not use
@@ -145,17 +229,19 @@ int boot_server(char *ifaces, int port){
                sizeof(struct sockaddr_in));
     if (ret == -1) {
         perror("bind");
+        close(svr_socket);
         return ERR_RDSH_COMMUNICATION;
     }
 
     /*
-     * Prepare for accepting connections. The backlog size is set
-     * to 20. So while one request is being processed other requests
-     * can be waiting.
+     * Prepare for accepting connections. The backlog size defaults
+     * to 20 (-o backlog=N). So while one request is being processed
+     * other requests can be waiting.
      */
-    ret = listen(svr_socket, 20);
+    ret = listen(svr_socket, opts->backlog);
     if (ret == -1) {
         perror("listen");
+        close(svr_socket);
         return ERR_RDSH_COMMUNICATION;
     }
 
@@ -184,6 +270,15 @@ int boot_server(char *ifaces, int port){
  *          negative if the client requested the server to stop by sending
  *          the `stop-server` command.  If this is the case step 2b breaks
  *          out of the while(1) loop. 
+ *
+ *          The threaded server cannot see that return code, the session
+ *          is on a thread of its own.  It asks for a shutdown instead (see
+ *          rsh_drain.c), so while waiting for a client we also poll() the
+ *          shutdown eventfd.  When it fires we stop accepting and give the
+ *          other sessions time to finish with rsh_drain().
+ *
+ *          With -o uring=1 the waiting and accepting is done through
+ *          io_uring instead, see rsh_uring_accept().
  * 
  *      2.  After we exit the loop, we need to cleanup.  Dont forget to 
  *          free the buffer you allocated in step #1.  Then call stop_server()
@@ -204,15 +299,29 @@ int boot_server(char *ifaces, int port){
  * 
  */
 int process_cli_requests(int svr_socket){
+    rsh_ring_t *ring = NULL;
     int     cli_socket;
     int     rc = OK;    
 
+    if (rsh_uring_enabled())
+        ring = rsh_ring_new(RDSH_URING_ACCEPT_DEPTH);
+
     while(1){
-        cli_socket = accept(svr_socket, NULL, NULL);
-        if (cli_socket == -1){
-            perror("accept");
-            return ERR_RDSH_COMMUNICATION;
+        if (ring != NULL)
+            cli_socket = rsh_uring_accept(ring, svr_socket, rsh_shutdown_fd());
+        else
+            cli_socket = accept_client(svr_socket);
+        if (cli_socket == OK_EXIT){
+            printf(RCMD_MSG_SVR_SHUTDOWN);
+            rc = is_threaded_server ? rsh_drain(RDSH_DRAIN_SECS) : OK_EXIT;
+            break;
+        }
+        if (cli_socket < 0){
+            rc = ERR_RDSH_COMMUNICATION;
+            break;
         }
+        rsh_tune_socket(cli_socket);
+        rsh_metric_add(RSH_M_CONNECTIONS, 1);
 
         //we only need the exec_client_requests if we are not doing
         //the extra credit
@@ -229,10 +338,50 @@ int process_cli_requests(int svr_socket){
         }
     }
 
-    stop_server(cli_socket);
+    rsh_ring_free(ring);
     return rc;
 }
 
+/*
+ * accept_client(svr_socket)
+ *      Waits in poll() for a client or the shutdown eventfd, whichever
+ *      comes first, and accepts the client.
+ *
+ *  Returns:
+ *      <fd>:                    the new client
+ *      OK_EXIT:                 a shutdown was asked for
+ *      ERR_RDSH_COMMUNICATION:  poll() or accept() failed
+ */
+static int accept_client(int svr_socket){
+    struct pollfd pfd[2];
+    int cli_socket;
+
+    pfd[0].fd = svr_socket;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = rsh_shutdown_fd();
+    pfd[1].events = POLLIN;
+
+    while (1){
+        if (poll(pfd, (pfd[1].fd >= 0) ? 2 : 1, -1) < 0){
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return ERR_RDSH_COMMUNICATION;
+        }
+        if (pfd[1].revents)
+            return OK_EXIT;
+        if (pfd[0].revents)
+            break;
+    }
+
+    cli_socket = accept(svr_socket, NULL, NULL);
+    if (cli_socket == -1){
+        perror("accept");
+        return ERR_RDSH_COMMUNICATION;
+    }
+    return cli_socket;
+}
+
 //extra credit threaded handler
 typedef struct thread_info{
     int server_socket;
@@ -246,8 +395,10 @@ int exec_client_thread(int main_socket, int cli_socket) {
     tinfo->server_socket = main_socket;
     tinfo->client_socket = cli_socket;
 
-    if (pthread_create(&thread_id, NULL, handle_client, (void *)tinfo) < 0) {
+    rsh_worker_start();
+    if (pthread_create(&thread_id, NULL, handle_client, (void *)tinfo) != 0) {
         perror("could not create thread");
+        rsh_worker_done();
         close(tinfo->client_socket);
         free(tinfo);
         return OK;
@@ -265,16 +416,16 @@ void *handle_client(void *arg) {
 
     //handles client requests in loop.
     rc = exec_client_requests(tinfo->client_socket);
-    if (rc == OK){
-        free(tinfo);        //was malloc'd
-        //just return since this is a detached thread handler
-        return NULL;
-    } else {
-        //unexpected error, force the overall process to close
-        close(tinfo->server_socket);
-        free(tinfo);        //was malloc'd
-        exit(0);    //force the entire process to end
-    }
+    free(tinfo);        //was malloc'd
+
+    //stop-server, the accept loop drains the other sessions and stops.
+    //Any other error only ends this session.
+    if (rc == OK_EXIT)
+        rsh_request_shutdown();
+
+    //just return since this is a detached thread handler
+    rsh_worker_done();
+    return NULL;
 }
 
 /*
@@ -321,16 +472,20 @@ void *handle_client(void *arg) {
 int exec_client_requests(int cli_socket) {
 
     int io_size;
-    command_list_t cmd_list;
     int rc;
-    int cmd_rc;
-    int last_rc;
     char *io_buff;
+    rsh_session_t sess;
 
     io_buff = malloc(RDSH_COMM_BUFF_SZ);
-    if (io_buff == NULL){
-        return ERR_RDSH_SERVER;
+    if ((session_init(&sess, cli_socket) != OK) || (io_buff == NULL)){
+        return session_cleanup(&sess, io_buff, ERR_RDSH_SERVER);
     }
+    sess.conn = rsh_conn_register(cli_socket);
+    if (rsh_auth_accept(cli_socket, &sess) != OK){
+        return session_cleanup(&sess, io_buff, OK);
+    }
+    if (rsh_uring_enabled())
+        sess.ring = rsh_ring_new(RDSH_URING_SESSION_DEPTH);
 
     //starting receive, execute loop, return on "exit" command
     //exit command means this cli-session is closed we can 
@@ -339,12 +494,15 @@ int exec_client_requests(int cli_socket) {
         //clear buffers
         memset(io_buff, 0, RDSH_COMM_BUFF_SZ);
 
-        io_size = recv(cli_socket, io_buff, RDSH_COMM_BUFF_SZ, 0);
-        if (io_size == -1){
+        if (sess.is_framed)
+            io_size = recv_request_frame(&sess, io_buff);
+        else if (sess.ring != NULL)
+            io_size = rsh_uring_recv(&sess, io_buff, RDSH_COMM_BUFF_SZ);
+        else
+            io_size = rsh_recv(cli_socket, io_buff, RDSH_COMM_BUFF_SZ);
+        if (io_size < 0){
             perror("recv");
-            free(io_buff);
-            close(cli_socket);
-            return ERR_RDSH_COMMUNICATION;
+            return session_cleanup(&sess, io_buff, ERR_RDSH_COMMUNICATION);
         }
 
         //client terminated gracefully if I receive zero bytes
@@ -353,65 +511,422 @@ int exec_client_requests(int cli_socket) {
             break;      //leave loop, close connection
         }
 
-        //at this point null terminated string expected to be in req_buff
-        rc = build_cmd_list((char *)io_buff, &cmd_list);
-        switch (rc) {
-            case ERR_MEMORY:
-                sprintf((char *)io_buff, CMD_ERR_RDSH_ITRNL, ERR_MEMORY);
-                send_message_string(cli_socket, (char *)io_buff);
-                continue;
-            case WARN_NO_CMDS:
-                sprintf((char *)io_buff, CMD_ERR_RDSH_ITRNL, WARN_NO_CMDS);
-                send_message_string(cli_socket, (char *)io_buff);
-                continue;
-            case ERR_CMD_OR_ARGS_TOO_BIG:
-                sprintf((char *)io_buff, CMD_ERR_PIPE_LIMIT, CMD_MAX);
-                send_message_string(cli_socket, (char *)io_buff);
-                continue;
-            default:
-                break;
+        //control messages are for the server, not commands to run
+        if (io_buff[0] == RDSH_CTL_CHAR){
+            rc = rsh_session_ctl(&sess, io_buff + 1);
+            if (rc != OK){
+                printf(CMD_ERR_RDSH_COMM);
+                return session_cleanup(&sess, io_buff, ERR_RDSH_COMMUNICATION);
+            }
+            //from here on the connection carries channels, each of which
+            //is a session of its own
+            if (sess.is_mux){
+                rsh_ticket_forget(&sess);
+                rc = exec_mux_requests(&sess, io_buff);
+                return session_cleanup(&sess, io_buff, rc);
+            }
+            continue;
         }
 
-        last_rc = cmd_rc;
-        cmd_rc = rsh_execute_pipeline(cli_socket, &cmd_list);
-
-        switch(cmd_rc){
-            case RC_SC:
-                sprintf((char *)io_buff, RCMD_MSG_SVR_RC_CMD, last_rc);
-                send_message_string(cli_socket, (char *)io_buff);
+        rc = exec_session_request(&sess, io_buff);
+        switch (rc){
+            case OK:
                 continue;
             case EXIT_SC:
                 printf(RCMD_MSG_CLIENT_EXITED);
-                free(io_buff);
-                close(cli_socket);
-                return OK;
+                rsh_ticket_forget(&sess);
+                return session_cleanup(&sess, io_buff, OK);
             case STOP_SERVER_SC:
                 printf(RCMD_MSG_SVR_STOP_REQ);
-                free(io_buff);
-                close(cli_socket);
-                return OK_EXIT;
+                rsh_ticket_forget(&sess);
+                return session_cleanup(&sess, io_buff, OK_EXIT);
             default:
-                break;
+                printf(CMD_ERR_RDSH_COMM);
+                return session_cleanup(&sess, io_buff, ERR_RDSH_COMMUNICATION);
         }
-        
-
-        //we now need to send the EOF command to prepare to receive
-        //the next command
-        rc = send_message_eof(cli_socket);
-        if (rc != OK){
-            printf(CMD_ERR_RDSH_COMM);
-            free(io_buff);
-            close(cli_socket);
-            return ERR_RDSH_COMMUNICATION;
+    }
+    return session_cleanup(&sess, io_buff, OK);
+}
+
+//the body of exec_session_request(), between rsh_conn_begin() and _end()
+static int run_session_request(rsh_session_t *sess, char *cmd){
+    command_list_t cmd_list;
+    Built_In_Cmds bi_cmd;
+    char msg[PATH_MAX + 64];
+    int last_rc;
+    int rc;
+
+    //a batch request after a failed one in the same batch is skipped
+    if (sess->req_flags & RDSH_FLAG_STOP_ON_FAIL){
+        if (sess->batch_failed){
+            printf(RCMD_MSG_SVR_SKIPPED, sess->req_id);
+            rsh_metric_error(WARN_RDSH_SKIPPED);
+            return send_session_eof(sess, WARN_RDSH_SKIPPED);
         }
+    } else {
+        sess->batch_failed = false;
+    }
 
-        printf(RCMD_MSG_SVR_EXEC_REQ, io_buff);
+    //at this point null terminated string expected to be in cmd
+    rc = build_cmd_list(cmd, &cmd_list);
+    switch (rc) {
+        case ERR_MEMORY:
+        case WARN_NO_CMDS:
+            snprintf(msg, sizeof(msg), CMD_ERR_RDSH_ITRNL, rc);
+            sess->batch_failed = true;
+            return send_session_string(sess, msg, rc);
+        case ERR_CMD_OR_ARGS_TOO_BIG:
+            snprintf(msg, sizeof(msg), CMD_ERR_PIPE_LIMIT, CMD_MAX);
+            sess->batch_failed = true;
+            return send_session_string(sess, msg, rc);
+        default:
+            break;
     }
-    free(io_buff);
-    close(cli_socket);
+
+    //cd, export and unset on their own change the session itself
+    bi_cmd = rsh_match_command(cmd_list.commands[0].argv[0]);
+    if ((cmd_list.num == 1) &&
+        ((bi_cmd == BI_CMD_CD) || (bi_cmd == BI_CMD_EXPORT) || (bi_cmd == BI_CMD_UNSET))){
+        sess->cmd_rc = rsh_session_builtin(sess, bi_cmd, &cmd_list.commands[0],
+                                           msg, sizeof(msg));
+        free_cmd_list(&cmd_list);
+        if (sess->cmd_rc != OK)
+            sess->batch_failed = true;
+        printf(RCMD_MSG_SVR_EXEC_REQ, cmd);
+        if (msg[0] != '\0')
+            return send_session_string(sess, msg, sess->cmd_rc);
+        return send_session_eof(sess, sess->cmd_rc);
+    }
+
+    last_rc = sess->cmd_rc;
+    sess->cmd_rc = rsh_execute_pipeline(sess, &cmd_list);
+    free_cmd_list(&cmd_list);
+
+    switch(sess->cmd_rc){
+        case RC_SC:
+            snprintf(msg, sizeof(msg), RCMD_MSG_SVR_RC_CMD, last_rc);
+            return send_session_string(sess, msg, OK);
+        case EXIT_SC:
+        case STOP_SERVER_SC:
+            return sess->cmd_rc;
+        default:
+            break;
+    }
+
+    if (sess->cmd_rc != OK)
+        sess->batch_failed = true;
+    if (sess->cmd_rc == ERR_RDSH_CMD_EXEC)
+        rsh_metric_error(ERR_RDSH_CMD_EXEC);
+
+    //we now need to send the EOF command to prepare to receive
+    //the next command
+    rc = send_session_eof(sess, sess->cmd_rc);
+    if (rc != OK)
+        return ERR_RDSH_COMMUNICATION;
+
+    printf(RCMD_MSG_SVR_EXEC_REQ, cmd);
     return OK;
 }
 
+/*
+ * exec_session_request(sess, cmd)
+ *      sess:  the session the request arrived on
+ *      cmd:   the null terminated command line, it is modified while
+ *             it is parsed
+ *
+ *  Runs one request and sends its response, this is the body of the loop
+ *  in exec_client_requests().  It is split out because a multiplexed
+ *  connection runs the requests of each channel on a thread of its own,
+ *  see rsh_mux.c.
+ *
+ *  While the server is draining (see rsh_drain.c) new requests are
+ *  refused, the client gets RCMD_ERR_DRAINING and the session ends as if
+ *  it had sent `exit`.
+ *
+ *  Returns:
+ *      OK:                      the request was handled, keep going
+ *      EXIT_SC:                 the client sent `exit`, or the server is
+ *                               draining
+ *      STOP_SERVER_SC:          the client sent `stop-server`
+ *      ERR_RDSH_COMMUNICATION:  the response could not be sent
+ */
+int exec_session_request(rsh_session_t *sess, char *cmd){
+    int rc;
+
+    if (rsh_conn_begin(sess->conn) != OK){
+        send_session_string(sess, RCMD_ERR_DRAINING, ERR_RDSH_SERVER);
+        return EXIT_SC;
+    }
+    rsh_metric_add(RSH_M_COMMANDS, 1);
+    rc = run_session_request(sess, cmd);
+    rsh_conn_end(sess->conn);
+    return rc;
+}
+
+/*
+ * session_init(sess, cli_socket) and session_free(sess)
+ *
+ *  Set up and tear down the state of a session, the buffers are
+ *  RDSH_COMM_BUFF_SZ each, and the directory and environment of the
+ *  session (see rsh_env.c).  session_free() does not close the socket since
+ *  the channels of a multiplexed connection all share one.  It does send
+ *  anything still queued on the session's ring, see rsh_uring.c.
+ *
+ *  session_init() returns OK or ERR_MEMORY, sess is safe to pass to
+ *  session_free() either way.
+ */
+int session_init(rsh_session_t *sess, int cli_socket){
+    rsh_metric_sessions(1);
+    memset(sess, 0, sizeof(*sess));
+    sess->cli_socket = cli_socket;
+    sess->cwd_fd = -1;
+    sess->pty_rows = RDSH_PTY_DEF_ROWS;
+    sess->pty_cols = RDSH_PTY_DEF_COLS;
+    sess->relay_buff = malloc(RDSH_COMM_BUFF_SZ);
+    sess->lz.zbuff = malloc(RDSH_COMM_BUFF_SZ);
+    if ((sess->relay_buff == NULL) || (sess->lz.zbuff == NULL))
+        return ERR_MEMORY;
+    sess->flow = rsh_flow_new();
+    return session_state_init(sess);
+}
+
+void session_free(rsh_session_t *sess){
+    rsh_metric_sessions(-1);
+    if (sess->lz.enabled && (sess->lz.raw_bytes > 0)){
+        printf(RCMD_MSG_SVR_LZ_STATS, (unsigned long long)sess->lz.raw_bytes,
+               (unsigned long long)sess->lz.wire_bytes);
+    }
+
+    free(sess->relay_buff);
+    free(sess->lz.zbuff);
+    sess->relay_buff = NULL;
+    sess->lz.zbuff = NULL;
+    rsh_flow_free(sess->flow);
+    sess->flow = NULL;
+    rsh_uring_flush(sess);
+    rsh_ring_free(sess->ring);
+    sess->ring = NULL;
+    session_state_free(sess);
+}
+
+/*
+ * session_cleanup(sess, io_buff, rc)
+ *      sess:     the session being torn down
+ *      io_buff:  the receive buffer from exec_client_requests()
+ *
+ *  Like client_cleanup() in rsh_cli.c this is a helper for the many exit
+ *  points of exec_client_requests().  It parks the session under its
+ *  ticket if it has one (see rsh_auth.c), frees the session buffers, takes
+ *  the connection out of the drain registry, closes the client socket and
+ *  returns rc so the caller can just
+ *  return session_cleanup(...)
+ */
+int session_cleanup(rsh_session_t *sess, char *io_buff, int rc){
+    if ((rc < 0) && (rc != OK_EXIT))
+        rsh_metric_error(rc);
+    rsh_ticket_park(sess);
+    free(io_buff);
+    rsh_conn_unregister(sess->conn);
+    sess->conn = NULL;
+    session_free(sess);
+    close(sess->cli_socket);
+    return rc;
+}
+
+/*
+ * rsh_session_ctl(sess, msg)
+ *      sess:  the session the control message arrived on
+ *      msg:   the control message, without the leading RDSH_CTL_CHAR
+ *
+ *  Handles control messages from the client.  For now the only one is
+ *  hello, which turns on framed responses and optionally compression,
+ *  multiplexing or pty mode for the rest of the connection.  See RDSH_CTL_CHAR in
+ *  rshlib.h for the format.  The reply to a hello is sent in whatever mode
+ *  the session was in when the hello arrived, so a new client always gets
+ *  a plain reply.
+ *
+ *  Returns:
+ *      OK:                      the reply was sent
+ *      ERR_RDSH_COMMUNICATION:  the reply could not be sent
+ */
+int rsh_session_ctl(rsh_session_t *sess, char *msg){
+    char rsp[64];
+    int rc;
+
+    if (strncmp(msg, RDSH_CTL_HELLO, strlen(RDSH_CTL_HELLO)) != 0){
+        return send_session_string(sess, CMD_ERR_RDSH_CTL, ERR_RDSH_SERVER);
+    }
+
+    sess->lz.enabled = (strstr(msg, "compress=" RDSH_COMPRESS_LZ) != NULL);
+    sess->is_mux = (strstr(msg, "mux=1") != NULL);
+    sess->is_pty = !sess->is_mux && (strstr(msg, "pty=1") != NULL);
+    if (sess->is_pty)
+        pty_nodelay(sess->cli_socket);
+    snprintf(rsp, sizeof(rsp), RDSH_HELLO_RSP, RDSH_PROTO_VER,
+             sess->lz.enabled ? RDSH_COMPRESS_LZ : RDSH_COMPRESS_NONE,
+             sess->is_mux, sess->is_pty);
+
+    rc = send_session_string(sess, rsp, OK);
+    sess->is_framed = true;
+
+    printf(RCMD_MSG_SVR_HELLO, sess->is_framed,
+           sess->lz.enabled ? RDSH_COMPRESS_LZ : RDSH_COMPRESS_NONE, sess->is_pty);
+    return rc;
+}
+
+/*
+ * send_session_string(sess, buff, status) and send_session_eof(sess, status)
+ *
+ *  Session aware versions of send_message_string() and send_message_eof().
+ *  For a plain session they just call those functions, or queue the EOF
+ *  on the session's ring (see rsh_uring_send_eof()).  For a framed
+ *  session the message goes out as a DATA frame and the end of the
+ *  response is an END frame that carries the status of the request, both
+ *  tagged with the channel and id of the request being answered.
+ */
+int send_session_string(rsh_session_t *sess, char *buff, int status){
+    rdsh_frame_hdr_t hdr;
+    const char *payload;
+    int rc;
+
+    if (!sess->is_framed){
+        if (rsh_uring_flush(sess) != OK)
+            return ERR_RDSH_COMMUNICATION;
+        return send_message_string(sess->cli_socket, buff);
+    }
+
+    init_frame_hdr(&hdr, RDSH_FRAME_DATA, sess->channel, sess->req_id);
+    payload = pack_data_frame(NULL, &hdr, buff, strlen(buff));
+    rc = send_session_frame(sess, &hdr, payload);
+    if (rc != OK)
+        return rc;
+    return send_session_eof(sess, status);
+}
+
+int send_session_eof(rsh_session_t *sess, int status){
+    rdsh_frame_hdr_t hdr;
+    uint32_t st = htonl((uint32_t)status);
+
+    if (!sess->is_framed && (sess->ring != NULL))
+        return rsh_uring_send_eof(sess);
+    if (!sess->is_framed)
+        return send_message_eof(sess->cli_socket);
+
+    init_frame_hdr(&hdr, RDSH_FRAME_END, sess->channel, sess->req_id);
+    hdr.len = hdr.raw_len = sizeof(st);
+    return send_session_frame(sess, &hdr, &st);
+}
+
+/*
+ * send_session_frame(sess, hdr, payload)
+ *      Sends a frame for a framed session.  The channels of a multiplexed
+ *      connection share the socket and have to stay inside their flow
+ *      control window, mux_send_frame() takes care of that.
+ */
+int send_session_frame(rsh_session_t *sess, rdsh_frame_hdr_t *hdr, const void *payload){
+    if (sess->mux != NULL)
+        return mux_send_frame(sess, hdr, payload);
+    return send_frame(sess->cli_socket, hdr, payload);
+}
+
+/*
+ * recv_request_frame(sess, io_buff)
+ *      sess:     a framed session
+ *      io_buff:  RDSH_COMM_BUFF_SZ buffer for the command line
+ *
+ *  Framed version of the recv() in exec_client_requests().  Requests can
+ *  be pipelined, so there may be several waiting on the socket, framing is
+ *  what lets us pull exactly one off at a time.  The id and flags of the
+ *  request are saved in the session so the response can be tagged.
+ *
+ *  A pty client may send keystrokes typed just after its last command
+ *  finished, those are dropped.  Window size changes between commands
+ *  are kept for the next pty, see rsh_pty.c.
+ *
+ *  Returns:
+ *      <number>:                length of the command line in io_buff
+ *      0:                       the client closed the connection
+ *      ERR_RDSH_COMMUNICATION:  recv() failed or it was not a request
+ */
+int recv_request_frame(rsh_session_t *sess, char *io_buff){
+    rdsh_frame_hdr_t hdr;
+    int len;
+
+    do {
+        memset(&hdr, 0, sizeof(hdr));
+        len = recv_frame(sess->cli_socket, &hdr, io_buff, RDSH_COMM_BUFF_SZ - 1);
+        if ((len > 0) && (hdr.type == RDSH_FRAME_WINSIZE))
+            pty_winsize(sess, -1, io_buff, len);
+    } while ((len >= 0) && ((hdr.type == RDSH_FRAME_STDIN) ||
+                            (hdr.type == RDSH_FRAME_WINSIZE)));
+    if ((len <= 0) && (hdr.type == 0))
+        return len;
+    if ((len < 0) || (hdr.type != RDSH_FRAME_REQ))
+        return ERR_RDSH_COMMUNICATION;
+
+    io_buff[len] = '\0';
+    sess->req_id = hdr.req_id;
+    sess->req_flags = hdr.flags;
+    return len;
+}
+
+/*
+ * relay_output(sess, out_fd)
+ *      sess:    the session to send the output to
+ *      out_fd:  read end of the pipe the last command in the pipeline
+ *               writes its stdout and stderr to
+ *
+ *  Pipeline output no longer goes straight to the socket, it comes back
+ *  through a pipe so the server can decide how to send it.  Plain
+ *  sessions get the bytes as is, framed sessions get DATA frames that
+ *  might be compressed.  If the client goes away we keep reading until
+ *  the pipe closes so the pipeline is not left blocked on a full pipe.
+ *
+ *  With -b every chunk waits for room on the socket and then for the
+ *  session's turn, see rsh_sched.c.  Otherwise a plain session with a
+ *  ring splices the pipe into the socket, see rsh_uring_relay().
+ *
+ *  Returns:
+ *      OK:                      all of the output was sent
+ *      ERR_RDSH_COMMUNICATION:  reading the pipe or sending failed
+ */
+int relay_output(rsh_session_t *sess, int out_fd){
+    rdsh_frame_hdr_t hdr;
+    const char *payload;
+    int chunk = rsh_sched_chunk();
+    ssize_t n;
+    int rc = OK;
+
+    if (!sess->is_framed && (sess->flow == NULL) && (sess->ring != NULL))
+        return rsh_uring_relay(sess, out_fd);
+
+    while (1){
+        if ((rc == OK) && (rsh_flow_writable(sess->flow, sess->cli_socket) != OK))
+            rc = ERR_RDSH_COMMUNICATION;
+
+        n = read(out_fd, sess->relay_buff, chunk);
+        if (n == 0)
+            break;
+        if (n < 0){
+            if (errno == EINTR)
+                continue;
+            return ERR_RDSH_COMMUNICATION;
+        }
+        if (rc != OK)
+            continue;
+
+        rsh_flow_acquire(sess->flow, n);
+        if (sess->is_framed){
+            init_frame_hdr(&hdr, RDSH_FRAME_DATA, sess->channel, sess->req_id);
+            payload = pack_data_frame(&sess->lz, &hdr, sess->relay_buff, n);
+            rc = send_session_frame(sess, &hdr, payload);
+        } else {
+            rc = rsh_send_all(sess->cli_socket, sess->relay_buff, n);
+        }
+    }
+    return rc;
+}
+
 /*
  * send_message_eof(cli_socket)
  *      cli_socket:  The server-side socket that is connected to the client
@@ -423,18 +938,11 @@ int exec_client_requests(int cli_socket) {
  * 
  *      OK:  The EOF character was sent successfully. 
  * 
- *      ERR_RDSH_COMMUNICATION:  The send() socket call returned an error or if
- *           we were unable to send the EOF character. 
+ *      ERR_RDSH_COMMUNICATION:  The connection is broken and we were unable
+ *           to send the EOF character. 
  */
 int send_message_eof(int cli_socket){
-    int send_len = (int)sizeof(RDSH_EOF_CHAR);
-    int sent_len;
-    sent_len = send(cli_socket, &RDSH_EOF_CHAR, send_len, 0);
-
-    if (sent_len != send_len){
-        return ERR_RDSH_COMMUNICATION;
-    }
-    return OK;
+    return rsh_send_all(cli_socket, &RDSH_EOF_CHAR, sizeof(RDSH_EOF_CHAR));
 }
 
 /*
@@ -443,33 +951,34 @@ int send_message_eof(int cli_socket){
  *      buff:        A C string (aka null terminated) of a message we want
  *                   to send to the client. 
  *   
- *  Sends a message to the client.  Note this command executes both a send()
- *  to send the message and a send_message_eof() to send the EOF character to
- *  the client to indicate command execution terminated. 
+ *  Sends a message to the client followed by the EOF character to
+ *  indicate command execution terminated.  Both go out together in one
+ *  sendmsg(), and a send() that only takes part of the message is not an
+ *  error, see rsh_sendv() in rsh_io.c.
  * 
  *  Returns:
  * 
  *      OK:  The message in buff followed by the EOF character was 
  *           sent successfully. 
  * 
- *      ERR_RDSH_COMMUNICATION:  The send() socket call returned an error or if
- *           we were unable to send the message followed by the EOF character. 
+ *      ERR_RDSH_COMMUNICATION:  The connection is broken and we were unable
+ *           to send the message followed by the EOF character. 
  */
 int send_message_string(int cli_socket, char *buff){
-    int send_len = strlen(buff);
-    int sent_len;
-    sent_len = send(cli_socket, buff, send_len, 0);
+    struct iovec iov[2];
 
-    if (sent_len != send_len){
-        return ERR_RDSH_COMMUNICATION;
-    }
-    return send_message_eof(cli_socket);
+    iov[0].iov_base = buff;
+    iov[0].iov_len = strlen(buff);
+    iov[1].iov_base = (void *)&RDSH_EOF_CHAR;
+    iov[1].iov_len = sizeof(RDSH_EOF_CHAR);
+    return rsh_sendv(cli_socket, iov, 2);
 }
 
 
 /*
- * rsh_execute_pipeline(int cli_sock, command_list_t *clist)
- *      cli_sock:    The server-side socket that is connected to the client
+ * rsh_execute_pipeline(rsh_session_t *sess, command_list_t *clist)
+ *      sess:        The session for the client, sess->cli_socket is the
+ *                   server-side socket that is connected to the client
  *      clist:       The command_list_t structure that we implemented in
  *                   the last shell. 
  *   
@@ -479,6 +988,15 @@ int send_message_string(int cli_socket, char *buff){
  *  main file descriptor on the first executable in the pipeline for STDIN,
  *  and the cli_sock for the file descriptor for STDOUT, and STDERR for the
  *  last executable in the pipeline.  See picture below:  
+ *
+ *  The output side actually goes through a pipe back to the server (see
+ *  relay_output()) so it can be framed and compressed before it is sent.
+ *  Framed sessions also give the first process /dev/null for STDIN since
+ *  the socket is carrying frames, not something a command can read.
+ *
+ *  The server does not fork the pipeline itself, it hands it to the
+ *  zygote along with the file descriptors, see rsh_zygote.c.  A session
+ *  in pty mode runs the pipeline on a terminal instead, see rsh_pty.c.
  * 
  *      
  *┌───────────┐                                                    ┌───────────┐
@@ -505,51 +1023,151 @@ int send_message_string(int cli_socket, char *buff){
  *                  macro that we discussed during our fork/exec lecture to
  *                  get this value. 
  */
-int rsh_execute_pipeline(int cli_sock, command_list_t *clist) {
-    int pipes[clist->num - 1][2];  // Array of pipes
+int rsh_execute_pipeline(rsh_session_t *sess, command_list_t *clist) {
+    int out_pipe[2];               // Output of the pipeline back to us
     pid_t pids[clist->num];
-    int  pids_st[clist->num];         // Array to store process IDs
-    Built_In_Cmds bi_cmd;
+    int in_fd;
+    int status_fd;
     int exit_code;
+    uint64_t t0;
+
+    // the client asked for a terminal, see rsh_pty.c
+    if (sess->is_pty)
+        return rsh_execute_pty(sess, clist);
+
+    // close on exec so other sessions' children never hold our output
+    // pipe open, otherwise relay_output() would not see the end of it
+    if (pipe2(out_pipe, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return ERR_RDSH_CMD_EXEC;
+    }
+
+    // the socket is carrying frames for a framed session, not something
+    // a command can read
+    if (sess->is_framed)
+        in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    else
+        in_fd = sess->cli_socket;
+    if (in_fd < 0) {
+        perror("open");
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return ERR_RDSH_CMD_EXEC;
+    }
+
+    // the zygote does the forking if it is running, see rsh_zygote.c,
+    // otherwise fall back to forking the pipeline ourselves
+    t0 = rsh_metric_now();
+    status_fd = zygote_spawn(clist, in_fd, out_pipe[1], sess->cwd_fd, sess->env, false);
+    if (status_fd < 0 &&
+        rsh_spawn_pipeline(clist, in_fd, out_pipe[1], sess->cwd_fd, sess->env, pids) != OK)
+        pids[0] = -1;
+    rsh_metric_observe(RSH_H_SPAWN, rsh_metric_now() - t0);
+    if (sess->is_framed)
+        close(in_fd);
+
+    // Send the output to the client until the pipeline closes the pipe
+    close(out_pipe[1]);
+    relay_output(sess, out_pipe[0]);
+    close(out_pipe[0]);
+
+    if (status_fd >= 0)
+        exit_code = zygote_wait(status_fd);
+    else if (pids[0] != -1)
+        exit_code = rsh_wait_pipeline(clist, pids);
+    else
+        exit_code = ERR_RDSH_CMD_EXEC;
+    rsh_metric_observe(RSH_H_COMMAND, rsh_metric_now() - t0);
+    return exit_code;
+}
+
+/*
+ * rsh_spawn_pipeline(clist, in_fd, out_fd, cwd_fd, envp, pids)
+ *      clist:   the pipeline to start
+ *      in_fd:   STDIN for the first process
+ *      out_fd:  STDOUT and STDERR for the last process
+ *      cwd_fd:  directory to run in, -1 for our own
+ *      envp:    environment for the commands, NULL for our own
+ *      pids:    clist->num entries, the process ids are stored here
+ *
+ *  Forks and execs every process in the pipeline, wiring up the pipes
+ *  between them as in the picture above.  The caller keeps its copies of
+ *  in_fd and out_fd and has to close them.  This runs in a runner forked
+ *  by the zygote (see rsh_zygote.c), or in the server itself if there is
+ *  no zygote.
+ *
+ *  Returns:
+ *      OK:                 every process was started
+ *      ERR_RDSH_CMD_EXEC:  a pipe or fork failed, the processes that were
+ *                          started have been waited for
+ */
+int rsh_spawn_pipeline(command_list_t *clist, int in_fd, int out_fd, int cwd_fd,
+                       char **envp, pid_t *pids) {
+    int pipes[clist->num - 1][2];  // Array of pipes
+    Built_In_Cmds bi_cmd;
 
-    // Create all necessary pipes
+    // Create all necessary pipes, close on exec since the children of
+    // other channels on a multiplexed connection are forked concurrently
     for (int i = 0; i < clist->num - 1; i++) {
-        if (pipe(pipes[i]) == -1) {
+        if (pipe2(pipes[i], O_CLOEXEC) == -1) {
             perror("pipe");
-            exit(EXIT_FAILURE);
+            for (int j = 0; j < i; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            return ERR_RDSH_CMD_EXEC;
         }
     }
 
+    // built-ins exit() in the child, do not let that flush a copy of
+    // whatever we have buffered for our own stdout
+    fflush(stdout);
+
     // Create processes for each command
     for (int i = 0; i < clist->num; i++) {
         pids[i] = fork();
         if (pids[i] == -1) {
             perror("fork");
-            exit(EXIT_FAILURE);
+            for (int j = 0; j < clist->num - 1; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            for (int j = 0; j < i; j++)
+                waitpid(pids[j], NULL, 0);
+            return ERR_RDSH_CMD_EXEC;
         }
 
         if (pids[i] == 0) {  // Child process
-            // For first command in pipeline, read from socket unless input redirected
+            // Move to the session directory first so relative paths in
+            // redirections work, this only affects the child
+            if (cwd_fd >= 0 && fchdir(cwd_fd) == -1) {
+                perror("fchdir");
+                exit(EXIT_FAILURE);
+            }
+
+            // For first command in pipeline, read from in_fd unless input redirected
             if (i == 0 && !clist->commands[i].input_file) {
-                dup2(cli_sock, STDIN_FILENO);
+                dup2(in_fd, STDIN_FILENO);
             }
 
-            // For last command in pipeline, write to socket unless output redirected
+            // For last command in pipeline, write to the output pipe unless
+            // output redirected, the server relays it to the socket
             if (i == clist->num - 1 && !clist->commands[i].output_file) {
-                dup2(cli_sock, STDOUT_FILENO);
-                dup2(cli_sock, STDERR_FILENO);  // Also redirect stderr to socket
+                dup2(out_fd, STDOUT_FILENO);
+                dup2(out_fd, STDERR_FILENO);  // Also redirect stderr
             }
+            close(out_fd);
 
             /* extra credit */
             // Handle input redirection
             if (clist->commands[i].input_file) {
-                int in_fd = open(clist->commands[i].input_file, O_RDONLY);
-                if (in_fd < 0) {
+                int file_fd = open(clist->commands[i].input_file, O_RDONLY);
+                if (file_fd < 0) {
                     perror("open input file");
                     exit(EXIT_FAILURE);
                 }
-                dup2(in_fd, STDIN_FILENO);
-                close(in_fd);
+                dup2(file_fd, STDIN_FILENO);
+                close(file_fd);
             }
 
             // Handle output redirection
@@ -563,13 +1181,13 @@ int rsh_execute_pipeline(int cli_sock, command_list_t *clist) {
                     flags |= O_TRUNC;  // Truncate mode
                 }
             
-                int out_fd = open(clist->commands[i].output_file, flags, mode);
-                if (out_fd < 0) {
+                int file_fd = open(clist->commands[i].output_file, flags, mode);
+                if (file_fd < 0) {
                     perror("open output file");
                     exit(EXIT_FAILURE);
                 }
-                dup2(out_fd, STDOUT_FILENO);
-                close(out_fd);
+                dup2(file_fd, STDOUT_FILENO);
+                close(file_fd);
             }
              /* end extra credit */
 
@@ -605,7 +1223,11 @@ int rsh_execute_pipeline(int cli_sock, command_list_t *clist) {
                 exit(0); // done get next command
             }
 
-            // Execute command
+            // Execute command with the session environment.  execvpe()
+            // would still search our own PATH, so swap environ instead,
+            // we are the child so it only changes us
+            if (envp != NULL)
+                environ = envp;
             execvp(clist->commands[i].argv[0], clist->commands[i].argv);
             perror("execvp");
             exit(EXIT_FAILURE);
@@ -617,8 +1239,20 @@ int rsh_execute_pipeline(int cli_sock, command_list_t *clist) {
         close(pipes[i][0]);
         close(pipes[i][1]);
     }
+    return OK;
+}
+
+/*
+ * rsh_wait_pipeline(clist, pids)
+ *      Waits for the processes started by rsh_spawn_pipeline() and works
+ *      out the exit code of the pipeline, see rsh_execute_pipeline().
+ */
+int rsh_wait_pipeline(command_list_t *clist, pid_t *pids) {
+    int  pids_st[clist->num];
+    int exit_code;
 
     // Wait for all children
+    memset(pids_st, 0, sizeof(pids_st));
     for (int i = 0; i < clist->num; i++) {
         waitpid(pids[i], &pids_st[i], 0);
     }
@@ -673,6 +1307,10 @@ Built_In_Cmds rsh_match_command(const char *input)
         return BI_CMD_STOP_SVR;
     if (strcmp(input, "rc") == 0)
         return BI_CMD_RC;
+    if (strcmp(input, "export") == 0)
+        return BI_CMD_EXPORT;
+    if (strcmp(input, "unset") == 0)
+        return BI_CMD_UNSET;
     return BI_NOT_BI;
 }
 
@@ -696,9 +1334,11 @@ Built_In_Cmds rsh_match_command(const char *input)
  *                   in so it should be sent to your fork/exec logic
  *      BI_EXECUTED: Indicates that this function handled the direct execution
  *                   of the command and there is nothing else to do, consider
- *                   it executed.  For example the cmd of "cd" gets the value of
- *                   BI_CMD_CD from rsh_match_command().  It then makes the libc
- *                   call to chdir(cmd->argv[1]); and finally returns BI_EXECUTED
+ *                   it executed.  For example the cmd of "dragon" gets the value of
+ *                   BI_CMD_DRAGON from rsh_match_command().  It then prints the
+ *                   dragon and finally returns BI_EXECUTED.  Note that "cd" does
+ *                   not call chdir() here, this runs in a child process, the
+ *                   session keeps its own directory, see rsh_env.c
  *      BI_CMD_*     Indicates that a built-in command was matched and the caller
  *                   is responsible for executing it.  For example if this function
  *                   returns BI_CMD_STOP_SVR the caller of this function is
@@ -725,7 +1365,11 @@ Built_In_Cmds rsh_built_in_cmd(cmd_buff_t *cmd)
     case BI_CMD_RC:
         return BI_CMD_RC;
     case BI_CMD_CD:
-        chdir(cmd->argv[1]);
+    case BI_CMD_EXPORT:
+    case BI_CMD_UNSET:
+        //on their own these change the session before we ever get here,
+        //see rsh_session_builtin().  Inside a pipeline they only run in
+        //this child, like a subshell, so there is nothing to do
         return BI_EXECUTED;
     default:
         return BI_NOT_BI;
@@ -0,0 +1,496 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+//linux/io_uring.h pulls in linux/limits.h, dshlib.h has its own ARG_MAX
+#undef ARG_MAX
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_uring.c - io_uring backend for the server
+ *
+ * Every step of serving a request is its own blocking syscall: recv() the
+ * command, read() the pipeline's output and send() it, once per chunk,
+ * then send() the RDSH_EOF_CHAR.  With -o uring=1 the server does these
+ * through io_uring instead, a pair of rings shared with the kernel where
+ * we queue operations and the kernel posts their results.  One
+ * io_uring_enter() submits everything queued and waits for what we need.
+ *
+ *   accept   process_cli_requests() keeps one multishot accept queued on
+ *            the listening socket, next to a poll of the shutdown
+ *            eventfd.  Clients that connect together come back from one
+ *            io_uring_enter(), or none if they are already posted.
+ *   output   relay_output() splices the pipe straight into the socket,
+ *            one syscall per chunk instead of a read() and a send(), and
+ *            the bytes are never copied out to us.
+ *   EOF      The RDSH_EOF_CHAR ending a response is not sent right away,
+ *            it is queued and linked to the recv() of the next command.
+ *            Both go in with the same io_uring_enter(), and if the send
+ *            fails the kernel cancels the recv.
+ *
+ * The sessions still run one per thread, blocking until each step is
+ * done, so each session has a small ring of its own, rings are not
+ * meant to be shared between threads.  Framed, multiplexed and pty
+ * sessions and sessions under -b keep the plain syscalls: their output is
+ * rewritten into frames or scheduled, so there is nothing to splice.
+ *
+ * There is no liburing here, the rings are set up with the raw
+ * io_uring_setup() and io_uring_enter() syscalls.  rsh_uring_init()
+ * checks the kernel supports every operation we use.  If it does not, or
+ * io_uring is turned off (io_uring_disabled, seccomp), the server says
+ * so and uses the plain syscalls.
+ */
+
+struct rsh_ring{
+    int                   fd;
+    void                 *map;          //SQ and CQ rings, one mapping
+    size_t                map_sz;
+    struct io_uring_sqe  *sqes;
+    size_t                sqes_sz;
+    unsigned             *sq_head;
+    unsigned             *sq_tail;
+    unsigned             *sq_array;
+    unsigned              sq_mask;
+    unsigned              sq_entries;
+    unsigned             *cq_head;
+    unsigned             *cq_tail;
+    unsigned              cq_mask;
+    struct io_uring_cqe  *cqes;
+    unsigned              tail;         //our copy of *sq_tail
+    unsigned              queued;       //sqes not submitted yet
+    int                   inflight;     //submitted or queued, not reaped
+    int                   eof_failed;   //a queued RDSH_EOF_CHAR was not sent
+    int                   accept_armed; //the accept loop, see rsh_uring_accept()
+    int                   multishot;
+    int                   shutdown_armed;
+};
+
+//what a completion is for, in user_data
+enum {
+    URING_ACCEPT = 1,
+    URING_SHUTDOWN,
+    URING_EOF,
+    URING_RECV,
+    URING_SPLICE,
+};
+
+static const int uring_ops[] = {
+    IORING_OP_ACCEPT, IORING_OP_POLL_ADD, IORING_OP_SEND,
+    IORING_OP_RECV, IORING_OP_SPLICE,
+};
+
+static int uring_ok = false;
+
+/*
+ * rsh_ring_new(entries) and rsh_ring_free(ring)
+ *      Sets up a ring with room for entries operations at a time, and
+ *      tears it down.  Closing the ring cancels whatever is still queued
+ *      in the kernel.
+ *
+ *  rsh_ring_new() returns NULL if the ring cannot be set up, the caller
+ *  then uses the plain syscalls.
+ */
+rsh_ring_t *rsh_ring_new(unsigned entries){
+    struct io_uring_params p;
+    rsh_ring_t *ring;
+    size_t sq_sz;
+    size_t cq_sz;
+
+    ring = calloc(1, sizeof(rsh_ring_t));
+    if (ring == NULL)
+        return NULL;
+
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0){
+        free(ring);
+        return NULL;
+    }
+
+    //kernels older than 5.4 map the rings separately, not worth the code
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)){
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+    sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->map_sz = (sq_sz > cq_sz) ? sq_sz : cq_sz;
+    ring->map = mmap(NULL, ring->map_sz, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if ((ring->map == MAP_FAILED) || (ring->sqes == MAP_FAILED)){
+        if (ring->map != MAP_FAILED)
+            munmap(ring->map, ring->map_sz);
+        if (ring->sqes != MAP_FAILED)
+            munmap(ring->sqes, ring->sqes_sz);
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_head = (unsigned *)((char *)ring->map + p.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *)ring->map + p.sq_off.tail);
+    ring->sq_array = (unsigned *)((char *)ring->map + p.sq_off.array);
+    ring->sq_mask = *(unsigned *)((char *)ring->map + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+    ring->cq_head = (unsigned *)((char *)ring->map + p.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->map + p.cq_off.tail);
+    ring->cq_mask = *(unsigned *)((char *)ring->map + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->map + p.cq_off.cqes);
+    ring->tail = *ring->sq_tail;
+    ring->multishot = true;
+    return ring;
+}
+
+void rsh_ring_free(rsh_ring_t *ring){
+    if (ring == NULL)
+        return;
+    munmap(ring->sqes, ring->sqes_sz);
+    munmap(ring->map, ring->map_sz);
+    close(ring->fd);
+    free(ring);
+}
+
+//io_uring_enter(), submits what is queued and waits for wait_nr results
+static int ring_enter(rsh_ring_t *ring, unsigned wait_nr){
+    int rc;
+
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+    while (1){
+        rc = syscall(__NR_io_uring_enter, ring->fd, ring->queued, wait_nr,
+                     wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (rc >= 0){
+            ring->queued -= rc;
+            if ((ring->queued == 0) || (wait_nr == 0))
+                return OK;
+            continue;
+        }
+        if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY))
+            continue;
+        return ERR_RDSH_COMMUNICATION;
+    }
+}
+
+//the next free sqe, cleared, NULL if the queue is full even after submitting
+static struct io_uring_sqe *ring_sqe(rsh_ring_t *ring, uint64_t op){
+    struct io_uring_sqe *sqe;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if ((ring->tail - head >= ring->sq_entries) &&
+        ((ring_enter(ring, 0) != OK) ||
+         (ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)))
+        return NULL;
+
+    sqe = &ring->sqes[ring->tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = op;
+    ring->sq_array[ring->tail & ring->sq_mask] = ring->tail & ring->sq_mask;
+    ring->tail++;
+    ring->queued++;
+    ring->inflight++;
+    return sqe;
+}
+
+/*
+ * ring_cqe(ring, op, res, flags)
+ *      Takes the next completion off the ring, waiting for one if there
+ *      are none.  Its user_data, result and flags are stored in op, res
+ *      and flags.
+ */
+static int ring_cqe(rsh_ring_t *ring, uint64_t *op, int *res, unsigned *flags){
+    struct io_uring_cqe *cqe;
+    unsigned head;
+
+    while (1){
+        head = *ring->cq_head;
+        if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+            break;
+        if (ring_enter(ring, 1) != OK)
+            return ERR_RDSH_COMMUNICATION;
+    }
+    cqe = &ring->cqes[head & ring->cq_mask];
+    *op = cqe->user_data;
+    *res = cqe->res;
+    *flags = cqe->flags;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    if (!(*flags & IORING_CQE_F_MORE))
+        ring->inflight--;
+    return OK;
+}
+
+/*
+ * rsh_uring_init()
+ *      Called once by start_server() with -o uring=1.  Checks that a ring
+ *      can be set up and that the kernel supports every operation used
+ *      here.
+ *
+ *  Returns:
+ *      OK:                  the server uses io_uring
+ *      ERR_RDSH_SERVER:     it does not, the caller says so
+ */
+int rsh_uring_init(void){
+    size_t sz = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe;
+    rsh_ring_t *ring;
+    int rc = OK;
+
+    ring = rsh_ring_new(2);
+    probe = calloc(1, sz);
+    if ((ring == NULL) || (probe == NULL) ||
+        (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE,
+                 probe, IORING_OP_LAST) < 0)){
+        rc = ERR_RDSH_SERVER;
+    }
+    for (size_t i = 0; (rc == OK) && (i < sizeof(uring_ops) / sizeof(uring_ops[0])); i++){
+        if ((uring_ops[i] > probe->last_op) ||
+            !(probe->ops[uring_ops[i]].flags & IO_URING_OP_SUPPORTED))
+            rc = ERR_RDSH_SERVER;
+    }
+    free(probe);
+    rsh_ring_free(ring);
+    uring_ok = (rc == OK);
+    return rc;
+}
+
+/*
+ * rsh_uring_enabled()
+ *      True when the server was started with -o uring=1 and io_uring
+ *      works here, see rsh_uring_init().
+ */
+int rsh_uring_enabled(void){
+    return uring_ok;
+}
+
+/*
+ * rsh_uring_accept(ring, svr_socket, shutdown_fd)
+ *      The io_uring version of the poll() and accept() in
+ *      process_cli_requests().  The first call queues a multishot accept
+ *      on svr_socket and a poll of shutdown_fd (-1 for none), later calls
+ *      just take the next result off the ring.  Kernels without multishot
+ *      accept (before 5.19) get a plain accept queued again after each
+ *      client.
+ *
+ *  Returns:
+ *      <fd>:                    a new client
+ *      OK_EXIT:                 shutdown_fd fired
+ *      ERR_RDSH_COMMUNICATION:  accepting failed
+ */
+int rsh_uring_accept(rsh_ring_t *ring, int svr_socket, int shutdown_fd){
+    struct io_uring_sqe *sqe;
+    uint64_t op;
+    unsigned flags;
+    int res;
+
+    while (1){
+        if (!ring->accept_armed){
+            sqe = ring_sqe(ring, URING_ACCEPT);
+            if (sqe == NULL)
+                return ERR_RDSH_COMMUNICATION;
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = svr_socket;
+            if (ring->multishot)
+                sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            ring->accept_armed = true;
+        }
+        if (!ring->shutdown_armed && (shutdown_fd >= 0)){
+            sqe = ring_sqe(ring, URING_SHUTDOWN);
+            if (sqe == NULL)
+                return ERR_RDSH_COMMUNICATION;
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = shutdown_fd;
+            sqe->poll32_events = POLLIN;
+            ring->shutdown_armed = true;
+        }
+
+        if (ring_cqe(ring, &op, &res, &flags) != OK){
+            perror("io_uring_enter");
+            return ERR_RDSH_COMMUNICATION;
+        }
+        if (op == URING_SHUTDOWN)
+            return OK_EXIT;
+
+        if (!(flags & IORING_CQE_F_MORE))
+            ring->accept_armed = false;
+        if (res >= 0)
+            return res;
+        if ((res == -EINVAL) && ring->multishot){
+            ring->multishot = false;
+            continue;
+        }
+        if ((res == -EINTR) || (res == -EAGAIN) || (res == -ECONNABORTED))
+            continue;
+        errno = -res;
+        perror("accept");
+        return ERR_RDSH_COMMUNICATION;
+    }
+}
+
+//waits for the result of op, the RDSH_EOF_CHAR queued ahead of it comes first
+static int session_wait(rsh_ring_t *ring, uint64_t want, int *res){
+    uint64_t op;
+    unsigned flags;
+    int r;
+
+    while (ring->inflight > 0){
+        if (ring_cqe(ring, &op, &r, &flags) != OK)
+            return ERR_RDSH_COMMUNICATION;
+        if (op == URING_EOF){
+            if (r > 0)
+                rsh_metric_add(RSH_M_BYTES_OUT, r);
+            else
+                ring->eof_failed = true;
+            continue;
+        }
+        if (op == want){
+            *res = r;
+            return OK;
+        }
+    }
+    return ERR_RDSH_COMMUNICATION;
+}
+
+/*
+ * rsh_uring_send_eof(sess)
+ *      send_message_eof() for a session with a ring.  The RDSH_EOF_CHAR is
+ *      only queued, linked to whatever is queued next, normally the
+ *      rsh_uring_recv() of the next command.  rsh_uring_flush() sends it
+ *      if nothing else comes, session_free() calls it.
+ *
+ *  Returns:
+ *      OK:                      it is queued
+ *      ERR_RDSH_COMMUNICATION:  the ring is full and could not be flushed
+ */
+int rsh_uring_send_eof(rsh_session_t *sess){
+    struct io_uring_sqe *sqe = ring_sqe(sess->ring, URING_EOF);
+
+    if (sqe == NULL)
+        return ERR_RDSH_COMMUNICATION;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = sess->cli_socket;
+    sqe->addr = (uintptr_t)&RDSH_EOF_CHAR;
+    sqe->len = sizeof(RDSH_EOF_CHAR);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->flags = IOSQE_IO_LINK;
+    return OK;
+}
+
+/*
+ * rsh_uring_flush(sess)
+ *      Submits whatever the session has queued and waits for all of it,
+ *      before anything is sent on the socket without the ring.
+ *
+ *  Returns:
+ *      OK:                      everything was sent
+ *      ERR_RDSH_COMMUNICATION:  something was not
+ */
+int rsh_uring_flush(rsh_session_t *sess){
+    rsh_ring_t *ring = sess->ring;
+    int res;
+
+    if (ring == NULL)
+        return OK;
+    //no op is 0, so this reaps everything in flight
+    session_wait(ring, 0, &res);
+    res = ring->eof_failed ? ERR_RDSH_COMMUNICATION : OK;
+    ring->eof_failed = false;
+    return res;
+}
+
+/*
+ * rsh_uring_recv(sess, buff, len)
+ *      rsh_recv() for a session with a ring, the RDSH_EOF_CHAR from the
+ *      last response goes out in the same io_uring_enter().
+ *
+ *  Returns:
+ *      <number>:                bytes received, at most len
+ *      0:                       the client closed the connection
+ *      ERR_RDSH_COMMUNICATION:  the receive, or the send before it, failed
+ */
+int rsh_uring_recv(rsh_session_t *sess, char *buff, int len){
+    rsh_ring_t *ring = sess->ring;
+    struct io_uring_sqe *sqe;
+    int res;
+
+    rsh_quickack(sess->cli_socket);
+    sqe = ring_sqe(ring, URING_RECV);
+    if (sqe == NULL)
+        return ERR_RDSH_COMMUNICATION;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sess->cli_socket;
+    sqe->addr = (uintptr_t)buff;
+    sqe->len = len;
+
+    if (session_wait(ring, URING_RECV, &res) != OK)
+        return ERR_RDSH_COMMUNICATION;
+    if (ring->eof_failed){
+        ring->eof_failed = false;
+        errno = EPIPE;
+        return ERR_RDSH_COMMUNICATION;
+    }
+    if (res < 0){
+        errno = -res;
+        return ERR_RDSH_COMMUNICATION;
+    }
+    rsh_metric_add(RSH_M_BYTES_IN, res);
+    return res;
+}
+
+/*
+ * rsh_uring_relay(sess, out_fd)
+ *      relay_output() for a plain session with a ring.  Splices the pipe
+ *      into the socket until the pipeline closes it.  If the client goes
+ *      away the rest is read and dropped, so the pipeline is not left
+ *      blocked on a full pipe.
+ *
+ *  Returns:
+ *      OK:                      all of the output was sent
+ *      ERR_RDSH_COMMUNICATION:  sending failed
+ */
+int rsh_uring_relay(rsh_session_t *sess, int out_fd){
+    struct io_uring_sqe *sqe;
+    ssize_t n;
+    int res;
+
+    while (1){
+        sqe = ring_sqe(sess->ring, URING_SPLICE);
+        if (sqe == NULL)
+            break;
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->fd = sess->cli_socket;
+        sqe->off = (uint64_t)-1;
+        sqe->splice_fd_in = out_fd;
+        sqe->splice_off_in = (uint64_t)-1;
+        sqe->len = RDSH_URING_SPLICE_SZ;
+        sqe->splice_flags = SPLICE_F_MOVE;
+
+        if (session_wait(sess->ring, URING_SPLICE, &res) != OK)
+            break;
+        if (res == 0)
+            return OK;
+        if (res > 0){
+            rsh_metric_add(RSH_M_BYTES_OUT, res);
+            continue;
+        }
+        if ((res != -EINTR) && (res != -EAGAIN))
+            break;
+    }
+
+    while (((n = read(out_fd, sess->relay_buff, RDSH_COMM_BUFF_SZ)) > 0) ||
+           ((n < 0) && (errno == EINTR)))
+        ;
+    return ERR_RDSH_COMMUNICATION;
+}
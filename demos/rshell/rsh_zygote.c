@@ -0,0 +1,437 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * rsh_zygote.c - launch commands from a small helper process
+ *
+ * Forking the server to run a command gets slower as the server grows
+ * (fork has to copy its page tables), and in threaded mode it means
+ * forking a multi-threaded process, where the child can inherit locks
+ * held by other threads.  So before the server does anything else it
+ * forks a zygote, a helper that stays small and single threaded, and
+ * from then on the server never forks:
+ *
+ *   server --SOCK_SEQPACKET--> zygote --fork--> runner --fork/exec--> cmds
+ *
+ * Each request is one packet holding the pipeline, with the fds the
+ * pipeline needs passed along via SCM_RIGHTS:
+ *
+ *   fds[0]  STDIN for the first command
+ *   fds[1]  STDOUT/STDERR for the last command, the server's output pipe
+ *   fds[2]  status pipe, the pipeline exit code is written here
+ *   fds[3]  the session directory, if it has one, see rsh_env.c
+ *
+ * The zygote forks a runner per request so it can go straight back to
+ * waiting for the next one.  The runner starts the pipeline with
+ * rsh_spawn_pipeline(), waits for it and writes the exit code (an int)
+ * to the status pipe.  Packets are sent whole, so server threads can
+ * send requests at the same time without a lock.
+ *
+ * The zygote exits when the server closes its end of the socket.  It runs
+ * in a process group of its own, which its runners and (non pty)
+ * pipelines inherit, so zygote_kill() can stop everything the server has
+ * launched with one kill().  See rsh_drain.c.
+ *
+ * The pipeline is packed as:
+ *
+ *   flags              ZYG_FLAG_PTY: fds[0] is a pty, the runner makes it
+ *                      its controlling terminal first, see rsh_pty.c
+ *   num
+ *   for each command:  argc, append_mode, has_input, has_output,
+ *                      argv[0]\0 ... argv[argc-1]\0 [input\0] [output\0]
+ *   env count (2 bytes, 0 for the zygote's own environment)
+ *   NAME=value\0 ...
+ *
+ * where the other numbers are single bytes, commands are small.  The
+ * environment is what makes a request big, so requests are built in a
+ * RDSH_ZYG_MSG_MAX heap buffer rather than on a channel's small stack.
+ */
+
+#define ZYG_MIN_FDS     3
+#define ZYG_NUM_FDS     4
+#define ZYG_FLAG_PTY    0x01
+
+static int zygote_sock = -1;
+static pid_t zygote_pid = -1;
+
+static int zyg_put_str(char *buff, int off, int max, const char *str){
+    int len = strlen(str) + 1;
+
+    if (off + len > max)
+        return -1;
+    memcpy(buff + off, str, len);
+    return off + len;
+}
+
+static const char *zyg_get_str(const char *buff, int *off, int len){
+    const char *str = buff + *off;
+    const char *end = memchr(str, '\0', len - *off);
+
+    if (end == NULL)
+        return NULL;
+    *off += (int)(end - str) + 1;
+    return str;
+}
+
+//returns the packed length, or -1 if it does not fit
+static int zygote_pack(command_list_t *clist, char **envp, int flags, char *buff,
+                       int max){
+    int env_count = 0;
+    int off = 0;
+
+    buff[off++] = (char)flags;
+    buff[off++] = (char)clist->num;
+    for (int i = 0; i < clist->num; i++){
+        cmd_buff_t *cmd = &clist->commands[i];
+
+        if (off + 4 > max)
+            return -1;
+        buff[off++] = (char)cmd->argc;
+        buff[off++] = (char)cmd->append_mode;
+        buff[off++] = (cmd->input_file != NULL);
+        buff[off++] = (cmd->output_file != NULL);
+        for (int a = 0; (a < cmd->argc) && (off >= 0); a++)
+            off = zyg_put_str(buff, off, max, cmd->argv[a]);
+        if ((off >= 0) && (cmd->input_file != NULL))
+            off = zyg_put_str(buff, off, max, cmd->input_file);
+        if ((off >= 0) && (cmd->output_file != NULL))
+            off = zyg_put_str(buff, off, max, cmd->output_file);
+        if (off < 0)
+            return -1;
+    }
+
+    while ((envp != NULL) && (envp[env_count] != NULL))
+        env_count++;
+    if ((off + 2 > max) || (env_count > 0xffff))
+        return -1;
+    buff[off++] = (char)(env_count >> 8);
+    buff[off++] = (char)(env_count & 0xff);
+    for (int e = 0; (e < env_count) && (off >= 0); e++)
+        off = zyg_put_str(buff, off, max, envp[e]);
+    return off;
+}
+
+//rebuilds the pipeline with its strings pointing into buff, *envp is NULL
+//or a malloc()ed array for the environment, also pointing into buff
+static int zygote_unpack(command_list_t *clist, char ***envp, int *flags,
+                         const char *buff, int len){
+    int env_count;
+    int off = 0;
+
+    *envp = NULL;
+    memset(clist, 0, sizeof(*clist));
+    if (len < 2)
+        return ERR_CMD_ARGS_BAD;
+    *flags = (unsigned char)buff[off++];
+    clist->num = (unsigned char)buff[off++];
+    if ((clist->num < 1) || (clist->num > CMD_MAX))
+        return ERR_CMD_ARGS_BAD;
+
+    for (int i = 0; i < clist->num; i++){
+        cmd_buff_t *cmd = &clist->commands[i];
+        int has_in, has_out;
+
+        if (off + 4 > len)
+            return ERR_CMD_ARGS_BAD;
+        cmd->argc = (unsigned char)buff[off++];
+        cmd->append_mode = buff[off++];
+        has_in = buff[off++];
+        has_out = buff[off++];
+        if ((cmd->argc < 1) || (cmd->argc >= CMD_ARGV_MAX))
+            return ERR_CMD_ARGS_BAD;
+
+        for (int a = 0; a < cmd->argc; a++){
+            cmd->argv[a] = (char *)zyg_get_str(buff, &off, len);
+            if (cmd->argv[a] == NULL)
+                return ERR_CMD_ARGS_BAD;
+        }
+        cmd->argv[cmd->argc] = NULL;
+        if (has_in && ((cmd->input_file = (char *)zyg_get_str(buff, &off, len)) == NULL))
+            return ERR_CMD_ARGS_BAD;
+        if (has_out && ((cmd->output_file = (char *)zyg_get_str(buff, &off, len)) == NULL))
+            return ERR_CMD_ARGS_BAD;
+    }
+
+    if (off + 2 > len)
+        return ERR_CMD_ARGS_BAD;
+    env_count = ((unsigned char)buff[off] << 8) | (unsigned char)buff[off + 1];
+    off += 2;
+    if (env_count == 0)
+        return OK;
+    *envp = calloc(env_count + 1, sizeof(char *));
+    if (*envp == NULL)
+        return ERR_MEMORY;
+    for (int e = 0; e < env_count; e++){
+        (*envp)[e] = (char *)zyg_get_str(buff, &off, len);
+        if ((*envp)[e] == NULL)
+            return ERR_CMD_ARGS_BAD;
+    }
+    return OK;
+}
+
+//runs one pipeline and reports the exit code, never returns
+static void zygote_runner(char *buff, int len, int *fds, int nfds){
+    command_list_t clist;
+    char **envp;
+    pid_t pids[CMD_MAX];
+    int cwd_fd = (nfds > ZYG_MIN_FDS) ? fds[3] : -1;
+    int exit_code = ERR_RDSH_CMD_EXEC;
+    int flags = 0;
+    int started;
+
+    started = (zygote_unpack(&clist, &envp, &flags, buff, len) == OK) &&
+              (!(flags & ZYG_FLAG_PTY) || (pty_leader(fds[0]) == OK)) &&
+              (rsh_spawn_pipeline(&clist, fds[0], fds[1], cwd_fd, envp, pids) == OK);
+
+    //only the pipeline may hold the client socket and the output pipe
+    //now, the server is waiting for the pipe to close
+    close(fds[0]);
+    close(fds[1]);
+    if (started)
+        exit_code = rsh_wait_pipeline(&clist, pids);
+
+    if (write(fds[2], &exit_code, sizeof(exit_code)) < 0)
+        perror("zygote status");
+    _exit(0);
+}
+
+//the zygote itself, never returns
+static void zygote_main(int sock){
+    char buff[RDSH_ZYG_MSG_MAX];
+    char cbuf[CMSG_SPACE(sizeof(int) * ZYG_NUM_FDS)];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    int fds[ZYG_NUM_FDS];
+    int nfds;
+    ssize_t len;
+    pid_t pid;
+
+    //runners are never waited for, let the kernel reap them
+    signal(SIGCHLD, SIG_IGN);
+
+    while (1){
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = buff;
+        iov.iov_len = sizeof(buff);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+
+        //received fds are close on exec, the commands only get the
+        //copies rsh_spawn_pipeline() dup2()s into place
+        len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            _exit(0);
+
+        nfds = 0;
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if ((cmsg != NULL) && (cmsg->cmsg_level == SOL_SOCKET) &&
+            (cmsg->cmsg_type == SCM_RIGHTS)){
+            nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nfds);
+        }
+        if ((nfds < ZYG_MIN_FDS) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))){
+            for (int i = 0; i < nfds; i++)
+                close(fds[i]);
+            continue;
+        }
+
+        pid = fork();
+        if (pid == 0){
+            signal(SIGCHLD, SIG_DFL);
+            close(sock);
+            zygote_runner(buff, (int)len, fds, nfds);
+        }
+        if (pid < 0){
+            int exit_code = ERR_RDSH_CMD_EXEC;
+            if (write(fds[2], &exit_code, sizeof(exit_code)) < 0)
+                perror("zygote status");
+        }
+        for (int i = 0; i < nfds; i++)
+            close(fds[i]);
+    }
+}
+
+/*
+ * start_zygote()
+ *      Forks the zygote.  Call this before starting any threads or
+ *      opening anything the zygote should not hold on to.
+ *
+ *  Returns:
+ *      OK:               the zygote is running
+ *      ERR_RDSH_SERVER:  it could not be started, zygote_spawn() will
+ *                        fail and the server has to fork for itself
+ */
+int start_zygote(void){
+    int sv[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0){
+        perror("zygote socketpair");
+        return ERR_RDSH_SERVER;
+    }
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0){
+        perror("zygote fork");
+        close(sv[0]);
+        close(sv[1]);
+        return ERR_RDSH_SERVER;
+    }
+    if (pid == 0){
+        close(sv[0]);
+        setpgid(0, 0);
+        zygote_main(sv[1]);
+    }
+
+    //in the parent too, so zygote_kill() cannot run before the child has
+    setpgid(pid, pid);
+    close(sv[1]);
+    zygote_sock = sv[0];
+    zygote_pid = pid;
+    return OK;
+}
+
+/*
+ * stop_zygote()
+ *      Closing our end of the socket tells the zygote to exit.  Runners
+ *      that are still going finish on their own.
+ */
+void stop_zygote(void){
+    if (zygote_sock < 0)
+        return;
+    close(zygote_sock);
+    waitpid(zygote_pid, NULL, 0);
+    zygote_sock = -1;
+    zygote_pid = -1;
+}
+
+/*
+ * zygote_kill(sig)
+ *      Sends sig to the zygote's process group, the zygote, its runners
+ *      and the pipelines they started.  Pty pipelines have a session of
+ *      their own, they are hung up on when the server closes the master.
+ *      stop_zygote() still has to be called to reap the zygote.
+ */
+void zygote_kill(int sig){
+    if (zygote_pid > 0)
+        kill(-zygote_pid, sig);
+}
+
+/*
+ * zygote_spawn(clist, in_fd, out_fd, cwd_fd, envp, is_pty)
+ *      clist:   the pipeline to run
+ *      in_fd:   STDIN for the first command
+ *      out_fd:  STDOUT and STDERR for the last command
+ *      cwd_fd:  directory to run in, -1 for the zygote's own
+ *      envp:    environment for the commands, NULL for the zygote's own
+ *      is_pty:  in_fd is the slave side of a pty, see rsh_pty.c
+ *
+ *  Asks the zygote to run a pipeline.  The caller still owns the fds and
+ *  should close in_fd and out_fd, the zygote has its own copies.  Once
+ *  the output has been read, zygote_wait() gets the exit code.
+ *
+ *  Returns:
+ *      <fd>:              the status pipe to pass to zygote_wait()
+ *      ERR_RDSH_SERVER:   no zygote, or the request could not be sent or
+ *                         is too big, fall back to rsh_spawn_pipeline()
+ */
+int zygote_spawn(command_list_t *clist, int in_fd, int out_fd, int cwd_fd,
+                 char **envp, int is_pty){
+    char cbuf[CMSG_SPACE(sizeof(int) * ZYG_NUM_FDS)];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    int st_pipe[2];
+    int fds[ZYG_NUM_FDS];
+    int nfds = (cwd_fd >= 0) ? ZYG_NUM_FDS : ZYG_MIN_FDS;
+    char *buff;
+    int len;
+    ssize_t rc;
+
+    if (zygote_sock < 0)
+        return ERR_RDSH_SERVER;
+    buff = malloc(RDSH_ZYG_MSG_MAX);
+    if (buff == NULL)
+        return ERR_RDSH_SERVER;
+    len = zygote_pack(clist, envp, is_pty ? ZYG_FLAG_PTY : 0, buff, RDSH_ZYG_MSG_MAX);
+    if ((len < 0) || (pipe2(st_pipe, O_CLOEXEC) < 0)){
+        free(buff);
+        return ERR_RDSH_SERVER;
+    }
+
+    fds[0] = in_fd;
+    fds[1] = out_fd;
+    fds[2] = st_pipe[1];
+    fds[3] = cwd_fd;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base = buff;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+    do {
+        rc = sendmsg(zygote_sock, &msg, MSG_NOSIGNAL);
+    } while (rc < 0 && errno == EINTR);
+    close(st_pipe[1]);
+    free(buff);
+
+    if (rc != len){
+        perror("zygote send");
+        close(st_pipe[0]);
+        return ERR_RDSH_SERVER;
+    }
+    return st_pipe[0];
+}
+
+/*
+ * zygote_wait(status_fd)
+ *      Reads the exit code of a pipeline started with zygote_spawn() and
+ *      closes status_fd.
+ *
+ *  Returns:
+ *      the exit code, see rsh_execute_pipeline(), or ERR_RDSH_CMD_EXEC if
+ *      the runner died without reporting one
+ */
+int zygote_wait(int status_fd){
+    int exit_code;
+    int got = 0;
+    ssize_t n;
+
+    while (got < (int)sizeof(exit_code)){
+        n = read(status_fd, (char *)&exit_code + got, sizeof(exit_code) - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(status_fd);
+
+    return (got == (int)sizeof(exit_code)) ? exit_code : ERR_RDSH_CMD_EXEC;
+}
@@ -1,6 +1,10 @@
 #ifndef __RSH_LIB_H__
     #define __RSH_LIB_H__
 
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include "dshlib.h"
 
 //common remote shell client and server constants and definitions
@@ -13,6 +17,31 @@
 #define RDSH_DEF_SVR_INTFACE    "0.0.0.0"   //Default start all interfaces
 #define RDSH_DEF_CLI_CONNECT    "127.0.0.1" //Default server is running on
                                             //localhost 127.0.0.1
+#define RDSH_DEF_BACKLOG        20          //listen() backlog, see rsh_net.c
+#define RDSH_DRAIN_SECS         30          //stop-server waits this long for
+                                            //running commands, rsh_drain.c
+#define RDSH_DRAIN_GRACE_SECS   2           //and this long after stopping them
+#define RDSH_DRAIN_IDLE_MS      500         //an idle client gets this long to
+                                            //send a request it can be refused
+
+//shared key authentication and session tickets, see rsh_auth.c
+#define RDSH_AUTH_KEY_MAX       4096        //longest key file we read
+#define RDSH_AUTH_TIMEOUT_MS    5000        //either side waits this long
+#define RDSH_NONCE_SZ           16
+#define RDSH_TICKET_SZ          16
+#define RDSH_TICKET_TTL_SECS    300         //a parked session is kept this long
+#define RDSH_TICKET_MAX         256         //sessions with tickets, live or parked
+#define RDSH_AUTH_DENIED        0           //status in the server's verdict
+#define RDSH_AUTH_NEW           1
+#define RDSH_AUTH_RESUMED       2
+
+//output scheduling with -b, see rsh_sched.c
+#define RDSH_SCHED_DEF_BURST    (1024*64)   //bytes a bucket holds when full
+#define RDSH_SCHED_DEF_QUANTUM  (1024*16)   //bytes a session sends per turn
+#define RDSH_SCHED_SPARSE_MS    50          //quiet this long, served first
+#define RDSH_URING_ACCEPT_DEPTH 64          //io_uring entries, accept loop
+#define RDSH_URING_SESSION_DEPTH 8          //io_uring entries, per session
+#define RDSH_URING_SPLICE_SZ    (64 * 1024) //pipe to socket per splice
 
 //constants for buffer sizes
 #define RDSH_COMM_BUFF_SZ       (1024*64)   //64K
@@ -29,11 +58,182 @@
 //linux based systems. 
 static const char RDSH_EOF_CHAR = 0x04;    
 
+//control messages.  A request from the client that starts with this
+//character is not a command, it is a message for the server itself.  The
+//first one a client can send is a hello to negotiate session options:
+//
+//      \x01hello proto=4 compress=lz4 mux=0 pty=0\0
+//
+//the server answers (still using the RDSH_EOF_CHAR convention) with
+//
+//      ok proto=4 compress=lz4 mux=0 pty=0\x04   or   ok proto=4 compress=none mux=0 pty=0\x04
+//
+//and from then on requests and responses are sent as frames, see
+//rdsh_frame_hdr_t.  mux=1 asks for a multiplexed connection, see rsh_mux.c.
+//pty=1 asks for commands to be run on a terminal, see rsh_pty.c, it is
+//not available on a multiplexed connection.
+//An older server just tries to run "\x01hello" as a command, so a client
+//that does not get "ok" back keeps using the plain stream.
+static const char RDSH_CTL_CHAR = 0x01;
+#define RDSH_CTL_HELLO          "hello"
+#define RDSH_PROTO_VER          4
+#define RDSH_HELLO_REQ          "%chello proto=%d compress=%s mux=%d pty=%d"
+#define RDSH_HELLO_RSP          "ok proto=%d compress=%s mux=%d pty=%d"
+#define RDSH_COMPRESS_LZ        "lz4"
+#define RDSH_COMPRESS_NONE      "none"
+
+//framed messages, all fields are in network byte order on the wire.  Every
+//request carries an id picked by the client, and the server tags all of
+//the response frames for that request with the same id.  The server runs
+//the requests of a session in the order they arrive, so a client can send
+//several before reading any responses.  The channel is always 0 unless
+//the connection is multiplexed.
+typedef struct rdsh_frame_hdr{
+    uint8_t   type;         //RDSH_FRAME_* below
+    uint8_t   flags;        //RDSH_FLAG_* below
+    uint16_t  channel;      //session this frame belongs to
+    uint32_t  req_id;       //request this frame belongs to
+    uint32_t  raw_len;      //payload length after decompression
+    uint32_t  len;          //payload length on the wire
+}rdsh_frame_hdr_t;
+
+#define RDSH_FRAME_DATA         1       //command output
+#define RDSH_FRAME_END          2       //end of command output, payload is
+                                        //the exit status as a uint32_t
+#define RDSH_FRAME_REQ          3       //client request, payload is a null
+                                        //terminated command line
+#define RDSH_FRAME_OPEN         4       //mux: client opens hdr.channel
+#define RDSH_FRAME_WINDOW       5       //mux: client returns output credit,
+                                        //payload is a uint32_t byte count
+#define RDSH_FRAME_CLOSE        6       //mux: channel closed, see rsh_mux.c
+#define RDSH_FRAME_STDIN        7       //pty: keystrokes for the running request
+#define RDSH_FRAME_WINSIZE      8       //pty: terminal size, payload is rows and
+                                        //columns as uint16_t
+#define RDSH_FLAG_LZ            0x01    //payload compressed with rsh_lz
+#define RDSH_FLAG_STOP_ON_FAIL  0x02    //REQ: skip this request if an earlier
+                                        //one with this flag failed
+
+//batch mode, see exec_remote_batch()
+#define RDSH_BATCH_WINDOW       32      //max requests in flight
+
+//client line editor, see rsh_edit.c
+#define RDSH_HIST_MAX           100     //commands kept for up and down
+
+//multiplexed connections, see rsh_mux.c
+#define RDSH_MUX_MAX_CHANNELS   1024    //channels per connection
+#define RDSH_MUX_WINDOW         (RDSH_COMM_BUFF_SZ * 4)  //unacked output
+                                        //per channel, at least one chunk
+#define RDSH_MUX_STACK_SZ       (256 * 1024)    //channel worker threads
+#define RDSH_DEF_JUMP_PORT      1235    //jump host listens here by default
+
+//pty sessions, see rsh_pty.c
+#define RDSH_PTY_IO_SZ          4096    //largest STDIN frame
+#define RDSH_PTY_DEF_ROWS       24      //until the client sends its size
+#define RDSH_PTY_DEF_COLS       80
+
+//largest pipeline plus environment sent to the zygote, see rsh_zygote.c
+#define RDSH_ZYG_MSG_MAX        RDSH_COMM_BUFF_SZ
+
+//output compression state for one stream, see send_data_frame()
+#define RDSH_LZ_MIN_CHUNK       64      //smaller chunks are not worth it
+#define RDSH_LZ_MIN_SAVING      8       //must save at least 1/8 of a chunk
+#define RDSH_LZ_MAX_BACKOFF     16      //max chunks skipped after a poor one
+
+typedef struct rsh_lz_ctx{
+    int       enabled;
+    int       skip;         //chunks to send raw before trying again
+    int       backoff;
+    uint8_t  *zbuff;        //RDSH_COMM_BUFF_SZ scratch for compression
+    uint64_t  raw_bytes;    //stats, bytes before and after compression
+    uint64_t  wire_bytes;
+}rsh_lz_ctx_t;
+
+//transport options from the command line, see rsh_net.c
+typedef struct rsh_net_opts{
+    char  *unix_path;       //Unix domain socket instead of TCP, or NULL
+    int    nodelay;         //TCP_NODELAY
+    int    quickack;        //TCP_QUICKACK, set again before every recv
+    int    sndbuf;          //SO_SNDBUF, 0 for the kernel default
+    int    rcvbuf;          //SO_RCVBUF, 0 for the kernel default
+    int    backlog;         //listen() backlog
+    int    uring;           //server I/O through io_uring, see rsh_uring.c
+}rsh_net_opts_t;
+
+//server metrics, see rsh_metrics.c
+typedef enum {
+    RSH_M_CONNECTIONS,
+    RSH_M_COMMANDS,
+    RSH_M_BYTES_IN,
+    RSH_M_BYTES_OUT,
+    RSH_M_NUM_COUNTERS,
+} rsh_metric_t;
+
+typedef enum {
+    RSH_H_SPAWN,            //launching a pipeline
+    RSH_H_COMMAND,          //launch to exit code
+    RSH_H_NUM,
+} rsh_hist_t;
+
+#define RSH_M_NUM_ERRORS        5   //ERR_RDSH_COMMUNICATION .. WARN_RDSH_SKIPPED
+#define RSH_HIST_BUCKETS        17  //not counting +Inf
+
+//SHA-256 and HMAC-SHA-256, see rsh_hmac.c
+#define RDSH_SHA256_SZ          32
+#define RDSH_SHA256_BLOCK       64
+
+typedef struct rsh_sha256{
+    uint32_t  h[8];
+    uint64_t  total;            //bytes hashed so far
+    uint8_t   buf[RDSH_SHA256_BLOCK];
+    size_t    used;
+}rsh_sha256_t;
+
+typedef struct rsh_hmac{
+    rsh_sha256_t  inner;
+    rsh_sha256_t  outer;
+}rsh_hmac_t;
+
+struct rsh_mux;
+struct sockaddr_un;
+typedef struct rsh_conn rsh_conn_t;     //registry entry, see rsh_drain.c
+typedef struct rsh_flow rsh_flow_t;     //output scheduling, see rsh_sched.c
+typedef struct rsh_ring rsh_ring_t;     //io_uring backend, see rsh_uring.c
+typedef struct rsh_edit rsh_edit_t;     //client line editor, see rsh_edit.c
+
+//server side state for one connected client, or for one channel of a
+//multiplexed connection
+typedef struct rsh_session{
+    int           cli_socket;
+    int           is_framed;    //client sent a hello, respond with frames
+    int           is_mux;       //client asked for a multiplexed connection
+    int           is_pty;       //client asked for commands to run on a pty
+    uint16_t      pty_rows;     //last window size the client sent
+    uint16_t      pty_cols;
+    uint16_t      channel;      //channel this session is, when multiplexed
+    struct rsh_mux *mux;        //NULL unless multiplexed
+    rsh_conn_t   *conn;         //the connection, shared by its channels
+    rsh_flow_t   *flow;         //NULL unless output is scheduled (-b)
+    rsh_ring_t   *ring;         //NULL unless the session uses io_uring
+    uint32_t      req_id;       //id and flags of the request being run
+    uint8_t       req_flags;
+    int           batch_failed; //a RDSH_FLAG_STOP_ON_FAIL request failed
+    int           cmd_rc;       //status of the last command, for rc
+    int           cwd_fd;       //working directory and environment of the
+    char        **env;          //session, see rsh_env.c
+    int           env_count;
+    int           env_cap;
+    rsh_lz_ctx_t  lz;
+    char         *relay_buff;   //pipeline output is read into here
+    int           has_ticket;   //the client can resume this session with
+    uint8_t       ticket[RDSH_TICKET_SZ];   //ticket, see rsh_auth.c
+}rsh_session_t;
+
 //rdsh specific error codes for functions
 #define ERR_RDSH_COMMUNICATION  -50     //Used for communication errors
 #define ERR_RDSH_SERVER         -51     //General server errors
 #define ERR_RDSH_CLIENT         -52     //General client errors
 #define ERR_RDSH_CMD_EXEC       -53     //RSH command execution errors
+#define WARN_RDSH_SKIPPED       -54     //Batch request skipped after a failure
 #define WARN_RDSH_NOT_IMPL      -99     //Not Implemented yet warning
 
 //Output message constants for server
@@ -41,21 +241,78 @@ static const char RDSH_EOF_CHAR = 0x04;
 #define CMD_ERR_RDSH_EXEC   "rdsh-error: command execution error\n"
 #define CMD_ERR_RDSH_ITRNL  "rdsh-error: internal server error - %d\n"
 #define CMD_ERR_RDSH_SEND   "rdsh-error: partial send.  Sent %d, expected to send %d\n"
+#define CMD_ERR_RDSH_CTL    "rdsh-error: unknown control message\n"
+#define RCMD_ERR_CD         "cd: %s: %s\n"
+#define RCMD_ERR_CD_ARGS    "cd: too many arguments\n"
+#define RCMD_ERR_ENV_NAME   "%s: `%s': not a valid identifier\n"
 #define RCMD_SERVER_EXITED  "server appeared to terminate - exiting\n"
+#define RCMD_ERR_UNIX_PATH  "rdsh-error: socket path too long: %s\n"
+#define RCMD_ERR_UNIX_IN_USE "rdsh-error: %s is not a socket, or a server is already using it\n"
+#define RCMD_ERR_PTY_NOTTY  "rdsh-error: -t needs a terminal, running without a pty\n"
+#define RCMD_ERR_PTY_PROTO  "rdsh-error: server does not support pty mode\n"
+#define RCMD_ERR_AUTH_KEY   "rdsh-error: no key in %s\n"
+#define RCMD_ERR_AUTH_PROTO "rdsh-auth:  server did not start the handshake, is it using -k?\n"
+#define RCMD_ERR_AUTH_DENIED "rdsh-auth:  authentication failed\n"
+#define RCMD_ERR_AUTH_REQUIRED "\nrdsh-auth:  this server requires a key, see -k\n"
+#define RCMD_ERR_AUTH_SERVER "rdsh-auth:  server does not know the key, hanging up\n"
+#define RCMD_MSG_AUTH_RESUMED "rdsh-auth:  resumed session\n"
+#define RCMD_MSG_AUTH_RECONNECT "rdsh-auth:  connection lost, resuming session...\n"
 
 //Output message constants for client
 #define RCMD_MSG_CLIENT_EXITED  "client exited: getting next connection...\n"
 #define RCMD_MSG_SVR_STOP_REQ   "client requested server to stop, stopping...\n"
 #define RCMD_MSG_SVR_EXEC_REQ   "rdsh-exec:  %s\n"
 #define RCMD_MSG_SVR_RC_CMD     "rdsh-exec:  rc = %d\n"
+#define RCMD_MSG_SVR_HELLO      "rdsh-hello: framed=%d compress=%s pty=%d\n"
+#define RCMD_MSG_SVR_LZ_STATS   "rdsh-lz:    %llu bytes sent as %llu\n"
+#define RCMD_MSG_SVR_SKIPPED    "rdsh-exec:  skipped request %u\n"
+#define RCMD_MSG_MUX_OPEN       "rdsh-mux:   channel %u opened\n"
+#define RCMD_MSG_MUX_CLOSED     "rdsh-mux:   channel %u closed\n"
+#define RCMD_MSG_SVR_METRICS    "rdsh-metrics: http://127.0.0.1:%d%s\n"
+#define RCMD_MSG_SVR_SHUTDOWN   "rdsh-drain: shutting down, no longer accepting clients\n"
+#define RCMD_MSG_SVR_DRAINING   "rdsh-drain: waiting for %d session(s), up to %ds\n"
+#define RCMD_MSG_SVR_DRAIN_KILL "rdsh-drain: stopping %d session(s) that did not finish\n"
+#define RCMD_ERR_DRAINING       "rdsh-error: server is shutting down\n"
+#define RCMD_ERR_ZYGOTE         "rdsh-error: zygote did not start, forking commands directly\n"
+#define RCMD_ERR_URING          "rdsh-error: io_uring not available, using plain syscalls\n"
+
+//Output message constants for the jump host
+#define RCMD_MSG_JUMP_START     "rdsh-jump:  relaying to %s:%d over one connection\n"
+#define RCMD_ERR_JUMP_PROTO     "rdsh-jump:  server does not support multiplexing\n"
+#define RCMD_ERR_JUMP_FULL      "rdsh-jump:  out of channels, dropping client\n"
+
+//Output message constants for batch mode
+#define RCMD_ERR_BATCH_OPEN     "rdsh-batch: cannot open script %s\n"
+#define RCMD_ERR_BATCH_PROTO    "rdsh-batch: server does not support batch mode\n"
+#define RCMD_ERR_BATCH_ORDER    "rdsh-batch: response for request %u, expected %u\n"
+#define RCMD_MSG_BATCH_FAILED   "rdsh-batch: line %d failed (rc=%d): %s\n"
+#define RCMD_MSG_BATCH_SKIPPED  "rdsh-batch: line %d skipped: %s\n"
 
 //client prototypes for rsh_cli.c - - see documentation for each function to
 //see what they do
 int start_client(char *address, int port);
 int client_cleanup(int cli_socket, char *cmd_buff, char *rsp_buff, int rc);
 int exec_remote_cmd_loop(char *address, int port);
+void set_client_compression(int val);
+void set_client_mux(int val);
+void set_client_pty(int val);
+int negotiate_session(int cli_socket, char *rsp_buff);
+int recv_framed_response(int cli_socket, char *rsp_buff, rsh_edit_t *ed);
+int client_wait(int cli_socket, rsh_edit_t *ed);
+int client_write(const void *buff, int len);
+int send_request(int cli_socket, int is_framed, uint32_t req_id, uint8_t flags,
+                 char *cmd);
+int exec_remote_batch(char *address, int port, char *script, int stop_on_fail);
+int recv_batch_response(int cli_socket, char *rsp_buff, uint32_t req_id, int *status);
     
 
+//client line editor, rsh_edit.c
+rsh_edit_t *edit_new(int use_tty);
+void edit_free(rsh_edit_t *ed);
+void edit_feed(rsh_edit_t *ed);
+int edit_eof(rsh_edit_t *ed);
+int edit_read_line(rsh_edit_t *ed, char *buff, int sz);
+
 //server prototypes for rsh_server.c - see documentation for each function to
 //see what they do
 int start_server(char *ifaces, int port, int is_threaded);
@@ -65,11 +322,151 @@ int send_message_eof(int cli_socket);
 int send_message_string(int cli_socket, char *buff);
 int process_cli_requests(int svr_socket);
 int exec_client_requests(int cli_socket);
-int rsh_execute_pipeline(int socket_fd, command_list_t *clist);
+int exec_session_request(rsh_session_t *sess, char *cmd);
+int session_init(rsh_session_t *sess, int cli_socket);
+void session_free(rsh_session_t *sess);
+int rsh_execute_pipeline(rsh_session_t *sess, command_list_t *clist);
+int rsh_spawn_pipeline(command_list_t *clist, int in_fd, int out_fd, int cwd_fd,
+                       char **envp, pid_t *pids);
+int rsh_wait_pipeline(command_list_t *clist, pid_t *pids);
+int session_cleanup(rsh_session_t *sess, char *io_buff, int rc);
+int rsh_session_ctl(rsh_session_t *sess, char *msg);
+int send_session_string(rsh_session_t *sess, char *buff, int status);
+int recv_request_frame(rsh_session_t *sess, char *io_buff);
+int send_session_eof(rsh_session_t *sess, int status);
+int send_session_frame(rsh_session_t *sess, rdsh_frame_hdr_t *hdr, const void *payload);
+int relay_output(rsh_session_t *sess, int out_fd);
 
 Built_In_Cmds rsh_match_command(const char *input);
 Built_In_Cmds rsh_built_in_cmd(cmd_buff_t *cmd);
 
+//socket I/O shared by client and server, rsh_io.c
+int rsh_sendv(int sock, struct iovec *iov, int iovcnt);
+int rsh_send_all(int sock, const void *buff, int len);
+int rsh_recv(int sock, void *buff, int len);
+int rsh_recv_all(int sock, void *buff, int len);
+
+//transport options shared by client and server, rsh_net.c
+void set_net_unix_path(char *path);
+int parse_net_opts(char *list);
+const rsh_net_opts_t *get_net_opts(void);
+int rsh_net_socket(void);
+int rsh_unix_addr(struct sockaddr_un *addr);
+void rsh_tune_socket(int sock);
+void rsh_quickack(int sock);
+
+//framing and compression shared by client and server, rsh_proto.c and
+//rsh_lz.c
+void init_frame_hdr(rdsh_frame_hdr_t *hdr, uint8_t type, uint16_t channel,
+                    uint32_t req_id);
+int send_frame(int sock, rdsh_frame_hdr_t *hdr, const void *payload);
+const char *pack_data_frame(rsh_lz_ctx_t *lz, rdsh_frame_hdr_t *hdr,
+                            const char *buff, int len);
+int send_data_frame(int sock, rsh_lz_ctx_t *lz, rdsh_frame_hdr_t *hdr,
+                    const char *buff, int len);
+int send_end_frame(int sock, uint16_t channel, uint32_t req_id, int status);
+int recv_frame(int sock, rdsh_frame_hdr_t *hdr, void *buff, int buff_sz);
+int frame_payload(rdsh_frame_hdr_t *hdr, char *buff, char *raw_buff,
+                  int raw_sz, char **out);
+int rsh_lz_bound(int src_len);
+int rsh_lz_compress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap);
+int rsh_lz_decompress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap);
+
+//SHA-256 and HMAC for the handshake, rsh_hmac.c
+void rsh_sha256_init(rsh_sha256_t *ctx);
+void rsh_sha256_update(rsh_sha256_t *ctx, const void *data, size_t len);
+void rsh_sha256_final(rsh_sha256_t *ctx, uint8_t digest[RDSH_SHA256_SZ]);
+void rsh_hmac_init(rsh_hmac_t *ctx, const void *key, size_t key_len);
+void rsh_hmac_update(rsh_hmac_t *ctx, const void *data, size_t len);
+void rsh_hmac_final(rsh_hmac_t *ctx, uint8_t mac[RDSH_SHA256_SZ]);
+int rsh_mac_equal(const uint8_t *a, const uint8_t *b, size_t len);
+
+//per session directory and environment, rsh_env.c
+int session_state_init(rsh_session_t *sess);
+void session_state_free(rsh_session_t *sess);
+const char *session_getenv(rsh_session_t *sess, const char *name);
+int session_setenv(rsh_session_t *sess, const char *assign);
+void session_unsetenv(rsh_session_t *sess, const char *name);
+int session_chdir(rsh_session_t *sess, const char *path, char *msg, int msg_sz);
+int rsh_session_builtin(rsh_session_t *sess, Built_In_Cmds bi_cmd, cmd_buff_t *cmd,
+                        char *msg, int msg_sz);
+
+//command launching, rsh_zygote.c
+int start_zygote(void);
+void stop_zygote(void);
+int zygote_spawn(command_list_t *clist, int in_fd, int out_fd, int cwd_fd,
+                 char **envp, int is_pty);
+int zygote_wait(int status_fd);
+void zygote_kill(int sig);
+
+//server metrics and the scrape endpoint, rsh_metrics.c
+void rsh_metric_add(rsh_metric_t m, uint64_t n);
+void rsh_metric_sessions(int delta);
+void rsh_metric_error(int code);
+void rsh_metric_observe(rsh_hist_t h, uint64_t usec);
+uint64_t rsh_metric_now(void);
+int rsh_metrics_render(char *buff, int len);
+void set_metrics_port(int port);
+int rsh_metrics_start(void);
+void rsh_metrics_stop(void);
+
+//graceful shutdown of the threaded server, rsh_drain.c
+int rsh_shutdown_init(void);
+int rsh_shutdown_fd(void);
+void rsh_request_shutdown(void);
+rsh_conn_t *rsh_conn_register(int sock);
+void rsh_conn_unregister(rsh_conn_t *conn);
+int rsh_conn_begin(rsh_conn_t *conn);
+void rsh_conn_end(rsh_conn_t *conn);
+void rsh_worker_start(void);
+void rsh_worker_done(void);
+int rsh_drain(int secs);
+
+//shared key authentication and session tickets, rsh_auth.c
+int set_auth_key_file(char *path);
+void set_auth_ticket_file(char *path);
+int rsh_auth_has_ticket(void);
+void rsh_auth_drop_ticket(void);
+int rsh_auth_connect(int sock);
+int rsh_auth_refused(int sock);
+int rsh_auth_accept(int sock, rsh_session_t *sess);
+void rsh_ticket_park(rsh_session_t *sess);
+void rsh_ticket_forget(rsh_session_t *sess);
+
+//output rate limiting and fair scheduling, rsh_sched.c
+int parse_sched_opts(char *list);
+int rsh_sched_chunk(void);
+rsh_flow_t *rsh_flow_new(void);
+void rsh_flow_free(rsh_flow_t *flow);
+void rsh_flow_acquire(rsh_flow_t *flow, int len);
+int rsh_flow_writable(rsh_flow_t *flow, int sock);
+
+//io_uring backend for the server, rsh_uring.c
+int rsh_uring_init(void);
+int rsh_uring_enabled(void);
+rsh_ring_t *rsh_ring_new(unsigned entries);
+void rsh_ring_free(rsh_ring_t *ring);
+int rsh_uring_accept(rsh_ring_t *ring, int svr_socket, int shutdown_fd);
+int rsh_uring_recv(rsh_session_t *sess, char *buff, int len);
+int rsh_uring_send_eof(rsh_session_t *sess);
+int rsh_uring_flush(rsh_session_t *sess);
+int rsh_uring_relay(rsh_session_t *sess, int out_fd);
+
+//pseudo terminal sessions, rsh_pty.c
+void pty_nodelay(int sock);
+int pty_open(rsh_session_t *sess, int *slave_fd);
+int pty_leader(int slave_fd);
+void pty_winsize(rsh_session_t *sess, int master_fd, const char *payload, int len);
+int rsh_execute_pty(rsh_session_t *sess, command_list_t *clist);
+int pty_client_start(int cli_socket);
+int pty_client_winch(int cli_socket);
+int recv_pty_response(int cli_socket, char *rsp_buff, uint32_t req_id);
+
+//multiplexed connections and the jump host, rsh_mux.c
+int exec_mux_requests(rsh_session_t *conn, char *io_buff);
+int mux_send_frame(rsh_session_t *sess, rdsh_frame_hdr_t *hdr, const void *payload);
+int start_jump_host(char *ifaces, int port, char *svr_ip, int svr_port);
+
 //eliminate from template, for extra credit
 void set_threaded_server(int val);
 int exec_client_thread(int main_socket, int cli_socket);
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_bench - the fd and mmap storage engines side by side
+ *
+ * Builds a database of students with ids 1, 1+stride, 1+2*stride, ... up
+ * to MAX_STD_ID and then, for each engine, times the two access patterns
+ * sdbsc has: full scans (count_db_records() and print_db(), with the
+ * output thrown away) and random point lookups with get_student(), which
+ * mostly miss once the stride is above 1.  The file is warm in the page cache for both engines,
+ * so this is the cost of the syscalls and copies, not of the disk.
+ *
+ *   usage: sdb_bench [-f file] [-s stride] [-l lookups] [-r rounds]
+ */
+
+#define BENCH_DEF_FILE      "bench_student.db"
+#define BENCH_DEF_STRIDE    1
+#define BENCH_DEF_LOOKUPS   1000000
+#define BENCH_DEF_ROUNDS    5
+
+static double now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int build_db(const char *file, int stride){
+    student_t *table = calloc(MAX_STD_ID + 1, sizeof(student_t));
+    int last = 0;
+    int fd;
+
+    for (int id = MIN_STD_ID; id <= MAX_STD_ID; id += stride){
+        table[id].id = id;
+        snprintf(table[id].fname, sizeof(table[id].fname), "first%d", id);
+        snprintf(table[id].lname, sizeof(table[id].lname), "last%d", id);
+        table[id].gpa = id % (MAX_STD_GPA + 1);
+        last = id;
+    }
+
+    fd = open_db((char *)file, true);
+    if (fd < 0)
+        exit(EXIT_FAILURE);
+    //one write per record like sdbsc -a would, so the holes stay holes
+    for (int id = MIN_STD_ID; id <= last; id += stride){
+        if (pwrite(fd, &table[id], sizeof(student_t),
+                   (off_t)id * sizeof(student_t)) != sizeof(student_t)){
+            perror("pwrite");
+            exit(EXIT_FAILURE);
+        }
+    }
+    close(fd);
+    free(table);
+    return (last - MIN_STD_ID) / stride + 1;
+}
+
+//the scans print, send that to /dev/null while timing them
+static int quiet(void){
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+
+    fflush(stdout);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+    return saved;
+}
+
+static void loud(int saved){
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+//best of rounds, in ms
+static double time_scan(int fd, int (*scan)(int), int rounds){
+    double best = 0;
+
+    for (int r = 0; r < rounds; r++){
+        int saved = quiet();
+        double t0 = now_usec();
+        scan(fd);
+        double t = now_usec() - t0;
+        loud(saved);
+        if ((r == 0) || (t < best))
+            best = t;
+    }
+    return best / 1000.0;
+}
+
+//mean ns per lookup, and the number found as a sanity check
+static double time_lookups(int fd, int lookups, int *found){
+    student_t s;
+    double t0;
+
+    srand(42);
+    *found = 0;
+    t0 = now_usec();
+    for (int i = 0; i < lookups; i++){
+        int id = MIN_STD_ID + rand() % MAX_STD_ID;
+        if (get_student(fd, id, &s) == NO_ERROR)
+            (*found)++;
+    }
+    return (now_usec() - t0) * 1000.0 / lookups;
+}
+
+static void run_engine(const char *file, const char *engine, int rounds, int lookups){
+    int fd;
+    int found;
+
+    setenv(SDB_ENGINE_ENV, engine, 1);
+    fd = open_db((char *)file, false);
+    if ((fd < 0) || (attach_engine(fd) != NO_ERROR))
+        exit(EXIT_FAILURE);
+
+    double count_ms = time_scan(fd, count_db_records, rounds);
+    double print_ms = time_scan(fd, print_db, rounds);
+    double lookup_ns = time_lookups(fd, lookups, &found);
+
+    printf("%-6s %12.2f %12.2f %12.1f %10d\n", engine, count_ms, print_ms,
+           lookup_ns, found);
+    close_db(fd);
+}
+
+static void bench_usage(const char *prog){
+    printf("usage: %s [-f file] [-s stride] [-l lookups] [-r rounds]\n", prog);
+    printf("  -f FILE   database file to build (default %s)\n", BENCH_DEF_FILE);
+    printf("  -s N      put a student at every Nth id (default %d)\n", BENCH_DEF_STRIDE);
+    printf("  -l N      random lookups per engine (default %d)\n", BENCH_DEF_LOOKUPS);
+    printf("  -r N      scans per engine, the best is reported (default %d)\n",
+           BENCH_DEF_ROUNDS);
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    char *file = BENCH_DEF_FILE;
+    int stride = BENCH_DEF_STRIDE;
+    int lookups = BENCH_DEF_LOOKUPS;
+    int rounds = BENCH_DEF_ROUNDS;
+    int students;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:s:l:r:h")) != -1){
+        switch (opt){
+            case 'f':
+                file = optarg;
+                break;
+            case 's':
+                stride = atoi(optarg);
+                break;
+            case 'l':
+                lookups = atoi(optarg);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if ((stride <= 0) || (lookups <= 0) || (rounds <= 0))
+        bench_usage(argv[0]);
+
+    students = build_db(file, stride);
+    printf("%d students, one every %d ids, in %s\n", students, stride, file);
+    printf("%-6s %12s %12s %12s %10s\n", "engine", "count ms", "print ms",
+           "lookup ns", "found");
+    run_engine(file, "fd", rounds, lookups);
+    run_engine(file, "mmap", rounds, lookups);
+
+    unlink(file);
+    return 0;
+}
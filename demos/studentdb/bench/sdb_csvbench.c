@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_csvbench - bulk CSV import and export against one add at a time
+ *
+ * Writes a CSV file of students with ids 1, 1+stride, ... in shuffled
+ * order, then loads it three ways into a fresh database: add_student()
+ * once per student in this process (what a loop of `sdbsc -a` does, less
+ * the process launches), the same followed by an fsync(), and
+ * import_csv().  Then it exports the database back to CSV.  Rates are in
+ * students per second, and the import includes its fsync().
+ *
+ *   usage: sdb_csvbench [-f file] [-s stride]
+ */
+
+#define BENCH_DEF_FILE      "bench_student.db"
+#define BENCH_CSV_FILE      "bench_students.csv"
+#define BENCH_DEF_STRIDE    1
+
+static double now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+//the students, shuffled so the import has to sort them
+static int write_csv(const char *csv, int stride, int **ids_out){
+    int n = (MAX_STD_ID - MIN_STD_ID) / stride + 1;
+    int *ids = malloc(n * sizeof(int));
+    FILE *f = fopen(csv, "w");
+
+    if ((ids == NULL) || (f == NULL)){
+        perror(csv);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++)
+        ids[i] = MIN_STD_ID + i * stride;
+    srand(42);
+    for (int i = n - 1; i > 0; i--){
+        int j = rand() % (i + 1);
+        int t = ids[i];
+        ids[i] = ids[j];
+        ids[j] = t;
+    }
+    fprintf(f, "id,first_name,last_name,gpa\n");
+    for (int i = 0; i < n; i++)
+        fprintf(f, "%d,first%d,last%d,%d\n", ids[i], ids[i], ids[i],
+                ids[i] % (MAX_STD_GPA + 1));
+    fclose(f);
+    *ids_out = ids;
+    return n;
+}
+
+static int quiet(void){
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+
+    fflush(stdout);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+    return saved;
+}
+
+static void loud(int saved){
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+static void report(const char *how, int n, double usec){
+    printf("%-18s %10.1f %14.0f\n", how, usec / 1000.0, n / (usec / 1e6));
+}
+
+static double add_each(const char *file, int *ids, int n, bool sync){
+    char fname[24];
+    char lname[32];
+    int fd = open_db((char *)file, true);
+    int saved = quiet();
+    double t0 = now_usec();
+
+    for (int i = 0; i < n; i++){
+        snprintf(fname, sizeof(fname), "first%d", ids[i]);
+        snprintf(lname, sizeof(lname), "last%d", ids[i]);
+        add_student(fd, ids[i], fname, lname, ids[i] % (MAX_STD_GPA + 1));
+    }
+    if (sync)
+        fsync(fd);
+    double t = now_usec() - t0;
+    loud(saved);
+    close_db(fd);
+    return t;
+}
+
+static double bulk(const char *file, bool import){
+    int fd = open_db((char *)file, import);
+    int saved = quiet();
+    double t0 = now_usec();
+    int rc = import ? import_csv(fd, BENCH_CSV_FILE) : export_csv(fd, BENCH_CSV_FILE);
+    double t = now_usec() - t0;
+
+    loud(saved);
+    close_db(fd);
+    if (rc < 0){
+        fprintf(stderr, "%s failed\n", import ? "import" : "export");
+        exit(EXIT_FAILURE);
+    }
+    return t;
+}
+
+static void bench_usage(const char *prog){
+    printf("usage: %s [-f file] [-s stride]\n", prog);
+    printf("  -f FILE   database file to build (default %s)\n", BENCH_DEF_FILE);
+    printf("  -s N      put a student at every Nth id (default %d)\n", BENCH_DEF_STRIDE);
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    char *file = BENCH_DEF_FILE;
+    int stride = BENCH_DEF_STRIDE;
+    int *ids;
+    int n;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:s:h")) != -1){
+        switch (opt){
+            case 'f':
+                file = optarg;
+                break;
+            case 's':
+                stride = atoi(optarg);
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if (stride <= 0)
+        bench_usage(argv[0]);
+
+    n = write_csv(BENCH_CSV_FILE, stride, &ids);
+    printf("%d students, one every %d ids\n", n, stride);
+    printf("%-18s %10s %14s\n", "load", "ms", "students/s");
+    report("add_student", n, add_each(file, ids, n, false));
+    report("add_student+fsync", n, add_each(file, ids, n, true));
+    report("import_csv", n, bulk(file, true));
+    report("export_csv", n, bulk(file, false));
+
+    free(ids);
+    unlink(BENCH_CSV_FILE);
+    unlink(file);
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_idxbench - finding students by last name, with and without the index
+ *
+ * Adds n students with ids spread over the whole id range and last names
+ * drawn from l different ones, first with no index and then with the
+ * last name index kept up to date, to time what the index costs each
+ * add.  Then times:
+ *   exact    one last name, through find_lname() and by scan_db()
+ *            looking at every student
+ *   prefix   every last name starting with a 3 character prefix, as
+ *            `sdbsc -n name12*` would
+ *   rebuild  idx_rebuild(), as after `sdbsc -r` or an import
+ * Query rates are queries per second, and each query's matches are
+ * checked against the scan.
+ *
+ *   usage: sdb_idxbench [-f file] [-n students] [-l lnames] [-q queries]
+ */
+
+#define BENCH_DEF_FILE      "bench_student.db"
+#define BENCH_IDX_FILE      "bench_student.db-lname"
+#define BENCH_DEF_STUDENTS  50000
+#define BENCH_DEF_LNAMES    5000
+#define BENCH_DEF_QUERIES   200
+
+typedef struct match {
+    const char *pattern;
+    size_t len;             //compare this much, all of lname when exact
+    int count;
+    long id_sum;
+} match_t;
+
+static double now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void die(const char *what){
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static int count_match(student_t *s, void *arg){
+    match_t *m = arg;
+    m->count++;
+    m->id_sum += s->id;
+    return NO_ERROR;
+}
+
+static int scan_match(student_t *s, void *arg){
+    match_t *m = arg;
+    if (strncmp(s->lname, m->pattern, m->len) == 0)
+        return count_match(s, arg);
+    return NO_ERROR;
+}
+
+//n students, with the index kept if it is open
+static double add_students(int fd, int n, int lnames){
+    student_t s = {0};
+    int stride = (MAX_STD_ID - MIN_STD_ID) / n;
+
+    srand(1);
+    double t0 = now_usec();
+    for (int i = 0; i < n; i++){
+        s.id = MIN_STD_ID + i * stride;
+        s.gpa = s.id % (MAX_STD_GPA + 1);
+        snprintf(s.fname, sizeof(s.fname), "first%d", s.id);
+        snprintf(s.lname, sizeof(s.lname), "name%d", rand() % lnames);
+        if (insert_student(fd, &s) != NO_ERROR)
+            die("insert_student");
+    }
+    return now_usec() - t0;
+}
+
+static void queries(int fd, int lnames, int q, bool prefix){
+    char pattern[32];
+    double t_idx = 0;
+    double t_scan = 0;
+    long found = 0;
+
+    for (int i = 0; i < q; i++){
+        int name = rand() % lnames;
+        if (prefix)
+            snprintf(pattern, sizeof(pattern), "name%d*", name % 1000);
+        else
+            snprintf(pattern, sizeof(pattern), "name%d", name);
+
+        match_t by_idx = { pattern, 0, 0, 0 };
+        match_t by_scan = { pattern, prefix ? strlen(pattern) - 1 : sizeof(((student_t *)0)->lname), 0, 0 };
+
+        double t0 = now_usec();
+        if (find_lname(fd, pattern, count_match, &by_idx) != NO_ERROR)
+            die("find_lname");
+        double t1 = now_usec();
+        if (scan_db(fd, scan_match, &by_scan) != NO_ERROR)
+            die("scan_db");
+        t_scan += now_usec() - t1;
+        t_idx += t1 - t0;
+
+        if ((by_idx.count != by_scan.count) || (by_idx.id_sum != by_scan.id_sum)){
+            fprintf(stderr, "%s: index found %d, scan %d\n", pattern, by_idx.count, by_scan.count);
+            exit(EXIT_FAILURE);
+        }
+        found += by_idx.count;
+    }
+    printf("%-8s %-6s %8d %10.1f %12.0f %10.1f\n", prefix ? "prefix" : "exact", "index",
+           q, t_idx / 1000.0, q / (t_idx / 1e6), (double)found / q);
+    printf("%-8s %-6s %8d %10.1f %12.0f %10.1f\n", prefix ? "prefix" : "exact", "scan",
+           q, t_scan / 1000.0, q / (t_scan / 1e6), (double)found / q);
+}
+
+static void bench_usage(const char *prog){
+    printf("usage: %s [-f file] [-n students] [-l lnames] [-q queries]\n", prog);
+    printf("  -f FILE   database file to build (default %s)\n", BENCH_DEF_FILE);
+    printf("  -n N      students to add (default %d)\n", BENCH_DEF_STUDENTS);
+    printf("  -l N      different last names (default %d)\n", BENCH_DEF_LNAMES);
+    printf("  -q N      queries of each kind (default %d)\n", BENCH_DEF_QUERIES);
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    char *file = BENCH_DEF_FILE;
+    int n = BENCH_DEF_STUDENTS;
+    int lnames = BENCH_DEF_LNAMES;
+    int q = BENCH_DEF_QUERIES;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:l:q:h")) != -1){
+        switch (opt){
+            case 'f':
+                file = optarg;
+                break;
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'l':
+                lnames = atoi(optarg);
+                break;
+            case 'q':
+                q = atoi(optarg);
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if ((n <= 0) || (n > MAX_STD_ID - MIN_STD_ID) || (lnames <= 0) || (q <= 0))
+        bench_usage(argv[0]);
+
+    int fd = open_db(file, true);
+    if (fd < 0)
+        die(file);
+    double t_plain = add_students(fd, n, lnames);
+    close_db(fd);
+
+    fd = open_db(file, true);
+    if ((fd < 0) || (idx_reset(BENCH_IDX_FILE) != NO_ERROR) ||
+        (idx_open(fd, BENCH_IDX_FILE) != NO_ERROR))
+        die(BENCH_IDX_FILE);
+    double t_idx = add_students(fd, n, lnames);
+
+    printf("%d students, %d last names\n", n, lnames);
+    printf("%-15s %8s %10s %12s\n", "add", "students", "ms", "students/s");
+    printf("%-15s %8d %10.1f %12.0f\n", "no index", n, t_plain / 1000.0, n / (t_plain / 1e6));
+    printf("%-15s %8d %10.1f %12.0f\n", "index", n, t_idx / 1000.0, n / (t_idx / 1e6));
+
+    printf("%-8s %-6s %8s %10s %12s %10s\n", "query", "how", "queries", "ms", "queries/s", "matches");
+    queries(fd, lnames, q, false);
+    queries(fd, lnames, q, true);
+
+    double t0 = now_usec();
+    if (idx_rebuild() != n)
+        die("idx_rebuild");
+    printf("%-15s %8d %10.1f\n", "rebuild", n, (now_usec() - t0) / 1000.0);
+
+    close_db(fd);
+    unlink(file);
+    unlink(BENCH_IDX_FILE);
+    return 0;
+}
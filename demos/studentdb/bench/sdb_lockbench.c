@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_lockbench - several processes adding students to one database
+ *
+ * Forks 1, 2, 4 and 8 writers on an empty database, each with its own
+ * open_db() as separate sdbsc runs would have, and times two loads:
+ *   split  the ids are dealt out round robin, so neighbouring records,
+ *          in the same block, belong to different writers
+ *   same   every writer tries to add every id, so each add races the
+ *          others and all but one must be turned away as duplicates
+ * Each load ends with a check that every id is in the database exactly
+ * once and, for same, that exactly one writer added each.  Rates are
+ * attempted adds per second over all writers.  -w puts the writes
+ * through the write ahead log, a flush per add, as sdbsc does.
+ *
+ *   usage: sdb_lockbench [-f file] [-n students] [-w]
+ */
+
+#define BENCH_DEF_FILE      "bench_student.db"
+#define BENCH_DEF_STUDENTS  20000
+#define BENCH_WAL_FILE      "bench_student.db-wal"
+#define BENCH_MAX_WRITERS   8
+
+static double now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void writer(const char *file, int me, int writers, int n, bool same,
+                   bool wal, int *added){
+    int fd = open_db((char *)file, false);
+    student_t s = {0};
+
+    if ((fd < 0) || (wal && (wal_open(fd, BENCH_WAL_FILE, false) != NO_ERROR)))
+        _exit(EXIT_FAILURE);
+    for (int i = same ? 0 : me; i < n; i += same ? 1 : writers){
+        s.id = MIN_STD_ID + i;
+        s.gpa = s.id % (MAX_STD_GPA + 1);
+        snprintf(s.fname, sizeof(s.fname), "first%d", s.id);
+        snprintf(s.lname, sizeof(s.lname), "last%d", s.id);
+        int rc = insert_student(fd, &s);
+        if (rc == NO_ERROR)
+            added[i]++;     //only this writer writes added[i] for a new id
+        else if (rc != ERR_DB_OP)
+            _exit(EXIT_FAILURE);
+    }
+    close_db(fd);
+    _exit(EXIT_OK);
+}
+
+static int students_in(const char *file){
+    int fd = open_db((char *)file, false);
+    int count = 0;
+
+    scan_db(fd, count_student, &count);
+    close_db(fd);
+    return count;
+}
+
+static void run(const char *file, int writers, int n, bool same, bool wal){
+    int *added = mmap(NULL, n * sizeof(int), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    int fd = open_db((char *)file, true);
+    bool ok = true;
+
+    if ((added == MAP_FAILED) || (fd < 0)){
+        perror("setup");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    unlink(BENCH_WAL_FILE);
+
+    double t0 = now_usec();
+    for (int w = 0; w < writers; w++){
+        pid_t pid = fork();
+        if (pid == 0)
+            writer(file, w, writers, n, same, wal, added);
+        if (pid < 0){
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int w = 0; w < writers; w++){
+        int status;
+        if ((wait(&status) < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_OK))
+            ok = false;
+    }
+    double t = now_usec() - t0;
+
+    for (int i = 0; i < n; i++)
+        ok = ok && (added[i] == 1);
+    ok = ok && (students_in(file) == n);
+
+    int attempts = same ? n * writers : n;
+    printf("%-6s %8d %10d %10.1f %12.0f  %s\n", same ? "same" : "split", writers,
+           attempts, t / 1000.0, attempts / (t / 1e6), ok ? "ok" : "WRONG");
+    munmap(added, n * sizeof(int));
+    if (!ok)
+        exit(EXIT_FAILURE);
+}
+
+static void bench_usage(const char *prog){
+    printf("usage: %s [-f file] [-n students] [-w]\n", prog);
+    printf("  -f FILE   database file to build (default %s)\n", BENCH_DEF_FILE);
+    printf("  -n N      students to add (default %d)\n", BENCH_DEF_STUDENTS);
+    printf("  -w        log every add to the write ahead log\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    char *file = BENCH_DEF_FILE;
+    int n = BENCH_DEF_STUDENTS;
+    bool wal = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:wh")) != -1){
+        switch (opt){
+            case 'f':
+                file = optarg;
+                break;
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'w':
+                wal = true;
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if ((n <= 0) || (n > MAX_STD_ID - MIN_STD_ID + 1))
+        bench_usage(argv[0]);
+
+    printf("%d students%s\n", n, wal ? ", logged" : "");
+    printf("%-6s %8s %10s %10s %12s\n", "ids", "writers", "attempts", "ms", "attempts/s");
+    for (int writers = 1; writers <= BENCH_MAX_WRITERS; writers *= 2)
+        run(file, writers, n, false, wal);
+    for (int writers = 1; writers <= BENCH_MAX_WRITERS; writers *= 2)
+        run(file, writers, n, true, wal);
+
+    unlink(file);
+    unlink(BENCH_WAL_FILE);
+    return 0;
+}
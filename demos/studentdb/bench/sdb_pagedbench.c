@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_pagedbench - the original direct addressed format against format 2
+ *
+ * Adds n students two ways and times random lookups of them, then
+ * reports the size of each file:
+ *   legacy   ids 1 to n (dense, the best case for it) through
+ *            get_student(), one pread() at id * 64
+ *   dense    the same ids in format 2, through pdb_get(), the header and
+ *            one bucket page
+ *   sparse   n random 64 bit ids in format 2; the original format could
+ *            not hold them, and the size it would need is for the highest
+ *            id
+ * Lookups of ids that are not there are timed as well.  Every lookup is
+ * checked.  Rates are per second, best of -r runs.
+ *
+ *   usage: sdb_pagedbench [-f file] [-n students] [-q lookups] [-r runs]
+ */
+
+#define BENCH_DEF_FILE      "bench_student.db"
+#define BENCH_DEF_STUDENTS  50000
+#define BENCH_DEF_LOOKUPS   200000
+#define BENCH_DEF_RUNS      5
+
+static double now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void die(const char *what){
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+//a random odd id from 1 to PDB_MAX_ID, so even ones are never there
+static long long rand_id(void){
+    uint64_t r = ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ (uint64_t)rand();
+    return (long long)(r & (uint64_t)PDB_MAX_ID) | 1;
+}
+
+static void make_student(long long id, student_t *s){
+    memset(s, 0, sizeof(*s));
+    s->id = (id <= MAX_STD_ID) ? (int)id : 0;
+    s->gpa = id % (MAX_STD_GPA + 1);
+    snprintf(s->fname, sizeof(s->fname), "first%lld", id % 100000);
+    snprintf(s->lname, sizeof(s->lname), "last%lld", id % 1000);
+}
+
+static off_t file_size(int fd){
+    struct stat sb;
+    if (fstat(fd, &sb) < 0)
+        die("fstat");
+    return sb.st_size;
+}
+
+static int open_paged(const char *file){
+    int fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0640);
+    if ((fd < 0) || (pdb_create(fd) != NO_ERROR) || (pdb_open(fd) != NO_ERROR))
+        die(file);
+    return fd;
+}
+
+static double add_paged(const long long *ids, int n){
+    student_t s;
+    double t0 = now_usec();
+    for (int i = 0; i < n; i++){
+        make_student(ids[i], &s);
+        if (pdb_insert(ids[i], &s) != NO_ERROR)
+            die("pdb_insert");
+    }
+    return now_usec() - t0;
+}
+
+//q lookups, of the ids in probe, in the legacy file fd or in format 2
+static double time_lookups(int fd, bool paged, const long long *probe, int q, int runs, bool missing){
+    student_t s, want;
+    double best = 0;
+    for (int r = 0; r < runs; r++){
+        double t0 = now_usec();
+        for (int i = 0; i < q; i++){
+            int rc = paged ? pdb_get(probe[i], &s) : get_student(fd, (int)probe[i], &s);
+            if (rc != (missing ? SRCH_NOT_FOUND : NO_ERROR))
+                die("lookup");
+            if (!missing){
+                make_student(probe[i], &want);
+                if (memcmp(&s, &want, sizeof(s)) != 0)
+                    die("lookup found the wrong student");
+            }
+        }
+        double t = now_usec() - t0;
+        if ((r == 0) || (t < best))
+            best = t;
+    }
+    return best;
+}
+
+static void report(const char *layout, const char *what, int count, double usec){
+    printf("%-8s %-8s %8d %10.1f %12.0f\n", layout, what, count, usec / 1000.0, count / (usec / 1e6));
+}
+
+static void report_size(const char *layout, int n, double bytes){
+    printf("%-8s %8d %14.0f %12.1f\n", layout, n, bytes, bytes / n);
+}
+
+static void bench_usage(const char *prog){
+    printf("usage: %s [-f file] [-n students] [-q lookups] [-r runs]\n", prog);
+    printf("  -f FILE   database file to build (default %s)\n", BENCH_DEF_FILE);
+    printf("  -n N      students (default %d, less than %d)\n", BENCH_DEF_STUDENTS, MAX_STD_ID);
+    printf("  -q N      lookups of each kind (default %d)\n", BENCH_DEF_LOOKUPS);
+    printf("  -r N      runs of each, the best is reported (default %d)\n", BENCH_DEF_RUNS);
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    char *file = BENCH_DEF_FILE;
+    int n = BENCH_DEF_STUDENTS;
+    int q = BENCH_DEF_LOOKUPS;
+    int runs = BENCH_DEF_RUNS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:q:r:h")) != -1){
+        switch (opt){
+            case 'f':
+                file = optarg;
+                break;
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'q':
+                q = atoi(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if ((n <= 0) || (n >= MAX_STD_ID) || (q <= 0) || (runs <= 0))
+        bench_usage(argv[0]);
+
+    long long *dense = malloc(n * sizeof(long long));
+    long long *sparse = malloc(n * sizeof(long long));
+    long long *probe = malloc(q * sizeof(long long));
+    long long *absent = malloc(q * sizeof(long long));
+    if ((dense == NULL) || (sparse == NULL) || (probe == NULL) || (absent == NULL))
+        die("malloc");
+    srand(1);
+    long long highest = 0;
+    for (int i = 0; i < n; i++){
+        dense[i] = i + 1;
+        sparse[i] = rand_id();
+        if (sparse[i] > highest)
+            highest = sparse[i];
+    }
+
+    printf("%d students, %d lookups of each kind\n", n, q);
+    printf("%-8s %-8s %8s %10s %12s\n", "layout", "what", "count", "ms", "per second");
+
+    // the original format, ids 1 to n
+    int fd = open_db(file, true);
+    if (fd < 0)
+        die(file);
+    student_t s;
+    double t0 = now_usec();
+    for (int i = 0; i < n; i++){
+        make_student(dense[i], &s);
+        if (pwrite(fd, &s, sizeof(s), (off_t)dense[i] * STUDENT_RECORD_SIZE) != sizeof(s))
+            die("pwrite");
+    }
+    report("legacy", "add", n, now_usec() - t0);
+    for (int i = 0; i < q; i++){
+        probe[i] = dense[rand() % n];
+        absent[i] = n + 1 + rand() % (MAX_STD_ID - n);
+    }
+    report("legacy", "find", q, time_lookups(fd, false, probe, q, runs, false));
+    report("legacy", "missing", q, time_lookups(fd, false, absent, q, runs, true));
+    off_t legacy_size = file_size(fd);
+    close(fd);
+
+    // format 2, the same ids
+    fd = open_paged(file);
+    report("dense", "add", n, add_paged(dense, n));
+    report("dense", "find", q, time_lookups(fd, true, probe, q, runs, false));
+    report("dense", "missing", q, time_lookups(fd, true, absent, q, runs, true));
+    if (pdb_close() != NO_ERROR)
+        die("pdb_close");
+    off_t dense_size = file_size(fd);
+    close(fd);
+
+    // format 2, random 64 bit ids
+    fd = open_paged(file);
+    report("sparse", "add", n, add_paged(sparse, n));
+    for (int i = 0; i < q; i++){
+        probe[i] = sparse[rand() % n];
+        absent[i] = rand_id() & ~1LL;
+    }
+    report("sparse", "find", q, time_lookups(fd, true, probe, q, runs, false));
+    report("sparse", "missing", q, time_lookups(fd, true, absent, q, runs, true));
+    if (pdb_close() != NO_ERROR)
+        die("pdb_close");
+    off_t sparse_size = file_size(fd);
+    close(fd);
+
+    printf("%-8s %8s %14s %12s\n", "layout", "students", "file bytes", "per student");
+    report_size("legacy", n, legacy_size);
+    report_size("dense", n, dense_size);
+    report_size("sparse", n, sparse_size);
+    printf("the original format would need %.3g bytes for the sparse ids, up to %lld\n",
+           (double)(highest + 1) * STUDENT_RECORD_SIZE, highest);
+
+    unlink(file);
+    free(dense);
+    free(sparse);
+    free(probe);
+    free(absent);
+    return 0;
+}
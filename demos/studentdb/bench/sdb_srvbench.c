@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <sys/wait.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_srvbench - lookups through the server against a process per command
+ *
+ * Builds a database of students in a scratch directory, starts the server
+ * on it in a child process, and then looks students up three ways:
+ * running `sdbsc -f id` once per lookup (what a script does today), one
+ * request at a time to the server, waiting for each response, and to the
+ * server with `depth` requests in flight.  Rates are in lookups per
+ * second.
+ *
+ *   usage: sdb_srvbench [-b sdbsc] [-n lookups] [-p launches] [-d depth]
+ */
+
+#define BENCH_SOCKET        "bench.sock"
+#define BENCH_DEF_SDBSC     "./sdbsc"
+#define BENCH_DEF_OPS       200000
+#define BENCH_DEF_LAUNCHES  500
+#define BENCH_DEF_DEPTH     64
+#define BENCH_STUDENTS      10000
+
+static double now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void die(const char *what){
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static int student_id(int i){
+    return MIN_STD_ID + (i * 7919) % BENCH_STUDENTS;
+}
+
+static void build_db(void){
+    int fd = open_db(DB_FILE, true);
+    student_t s = {0};
+
+    if (fd < 0)
+        die(DB_FILE);
+    for (int i = 0; i < BENCH_STUDENTS; i++){
+        s.id = MIN_STD_ID + i;
+        s.gpa = i % (MAX_STD_GPA + 1);
+        snprintf(s.fname, sizeof(s.fname), "first%d", s.id);
+        snprintf(s.lname, sizeof(s.lname), "last%d", s.id);
+        if (insert_student(fd, &s) != NO_ERROR)
+            die("insert_student");
+    }
+    close_db(fd);
+}
+
+static pid_t start_server(void){
+    pid_t pid = fork();
+
+    if (pid < 0)
+        die("fork");
+    if (pid == 0){
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        exit(start_db_server(BENCH_SOCKET) == NO_ERROR ? 0 : 1);
+    }
+    //wait for it to be listening
+    for (int tries = 0; tries < 500; tries++){
+        int sock = db_connect(BENCH_SOCKET);
+        if (sock >= 0){
+            close(sock);
+            return pid;
+        }
+        usleep(10000);
+    }
+    fprintf(stderr, "server did not start\n");
+    exit(EXIT_FAILURE);
+}
+
+static double launches(const char *sdbsc, int n){
+    double t0 = now_usec();
+
+    for (int i = 0; i < n; i++){
+        char id[16];
+        pid_t pid = fork();
+
+        snprintf(id, sizeof(id), "%d", student_id(i));
+        if (pid == 0){
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            execl(sdbsc, sdbsc, "-f", id, (char *)NULL);
+            _exit(127);
+        }
+        int status;
+        if ((pid < 0) || (waitpid(pid, &status, 0) < 0) ||
+            !WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_OK)){
+            fprintf(stderr, "%s -f %s failed\n", sdbsc, id);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return now_usec() - t0;
+}
+
+//n lookups with up to depth of them in flight
+static double lookups(int n, int depth){
+    int sock = db_connect(BENCH_SOCKET);
+    sdb_rsp_t rsp;
+    student_t s;
+    double t0 = now_usec();
+
+    if (sock < 0)
+        die("db_connect");
+    for (int sent = 0, got = 0; got < n; ){
+        while ((sent < n) && (sent - got < depth))
+            if (db_request(sock, SDB_OP_GET, student_id(sent++), NULL) != NO_ERROR)
+                die("db_request");
+        if ((db_response(sock, &rsp, &s) != NO_ERROR) || (rsp.rc != NO_ERROR)){
+            fprintf(stderr, "lookup %d failed\n", got);
+            exit(EXIT_FAILURE);
+        }
+        got++;
+    }
+    double t = now_usec() - t0;
+    close(sock);
+    return t;
+}
+
+static void report(const char *how, int n, double usec){
+    printf("%-18s %8d %10.1f %12.0f %10.2f\n", how, n, usec / 1000.0,
+           n / (usec / 1e6), usec / n);
+}
+
+static void bench_usage(const char *prog){
+    printf("usage: %s [-b sdbsc] [-n lookups] [-p launches] [-d depth]\n", prog);
+    printf("  -b PATH   sdbsc to launch (default %s)\n", BENCH_DEF_SDBSC);
+    printf("  -n N      lookups through the server (default %d)\n", BENCH_DEF_OPS);
+    printf("  -p N      sdbsc processes to launch (default %d)\n", BENCH_DEF_LAUNCHES);
+    printf("  -d N      requests in flight when pipelined (default %d)\n", BENCH_DEF_DEPTH);
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    char sdbsc[PATH_MAX];
+    char dir[] = "/tmp/sdb_srvbench.XXXXXX";
+    char *sdbsc_arg = BENCH_DEF_SDBSC;
+    int ops = BENCH_DEF_OPS;
+    int n_launch = BENCH_DEF_LAUNCHES;
+    int depth = BENCH_DEF_DEPTH;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:n:p:d:h")) != -1){
+        switch (opt){
+            case 'b':
+                sdbsc_arg = optarg;
+                break;
+            case 'n':
+                ops = atoi(optarg);
+                break;
+            case 'p':
+                n_launch = atoi(optarg);
+                break;
+            case 'd':
+                depth = atoi(optarg);
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if ((ops <= 0) || (n_launch <= 0) || (depth <= 0))
+        bench_usage(argv[0]);
+
+    //the server and sdbsc both work on DB_FILE in the current directory
+    if (realpath(sdbsc_arg, sdbsc) == NULL)
+        die(sdbsc_arg);
+    if ((mkdtemp(dir) == NULL) || (chdir(dir) < 0))
+        die(dir);
+
+    build_db();
+    pid_t server = start_server();
+
+    printf("%d students, lookups by id\n", BENCH_STUDENTS);
+    printf("%-18s %8s %10s %12s %10s\n", "how", "lookups", "ms", "lookups/s", "us/lookup");
+    report("sdbsc -f", n_launch, launches(sdbsc, n_launch));
+    report("server", ops, lookups(ops, 1));
+    char how[32];
+    snprintf(how, sizeof(how), "server depth %d", depth);
+    report(how, ops, lookups(ops, depth));
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    unlink(DB_FILE);
+    if (chdir("/") == 0)
+        rmdir(dir);
+    return 0;
+}
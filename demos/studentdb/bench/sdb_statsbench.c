@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_statsbench - GPA statistics by columnar scan against row at a time
+ *
+ * Builds a database of n students, every id from 1 (dense, 100000 by
+ * default, the most there can be), warms the page cache, and times the
+ * same totals three ways:
+ *   text     each student formatted as print_db() prints it and parsed
+ *            back, what a script looping over `sdbsc -p` does at best
+ *   scan_db  a visitor adding up each record scan_db() hands it
+ *   columns  gpa_stats(), with 1, 2, 4 ... up to -t threads
+ * Every way's totals are checked against the scan_db() ones.  Rates are
+ * in millions of records per second, best of -r runs.
+ *
+ *   usage: sdb_statsbench [-f file] [-n students] [-r runs] [-t threads]
+ */
+
+#define BENCH_DEF_FILE      "bench_student.db"
+#define BENCH_DEF_RUNS      10
+#define BENCH_LO            200
+#define BENCH_HI            350
+
+static double now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void die(const char *what){
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static void add_row(gpa_stats_t *st, int gpa){
+    int b = gpa / (MAX_STD_GPA / GPA_BUCKETS);
+    st->count++;
+    st->sum += gpa;
+    st->in_range += (gpa >= BENCH_LO) && (gpa <= BENCH_HI);
+    st->hist[(b < GPA_BUCKETS) ? b : GPA_BUCKETS - 1]++;
+    if (gpa < st->min)
+        st->min = gpa;
+    if (gpa > st->max)
+        st->max = gpa;
+}
+
+static int visit_row(student_t *s, void *arg){
+    add_row(arg, s->gpa);
+    return NO_ERROR;
+}
+
+static int visit_text(student_t *s, void *arg){
+    char line[128];
+    char fname[32], lname[32];
+    int id;
+    double gpa;
+
+    snprintf(line, sizeof(line), STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, s->gpa / 100.0);
+    if (sscanf(line, "%d %31s %31s %lf", &id, fname, lname, &gpa) != 4)
+        return ERR_DB_FILE;
+    add_row(arg, (int)(gpa * 100.0 + 0.5));
+    return NO_ERROR;
+}
+
+static void stats_init(gpa_stats_t *st){
+    memset(st, 0, sizeof(*st));
+    st->min = INT_MAX;
+    st->max = INT_MIN;
+}
+
+static void check(const char *how, const gpa_stats_t *st, const gpa_stats_t *want){
+    bool same = (st->count == want->count) && (st->sum == want->sum) &&
+                (st->min == want->min) && (st->max == want->max) &&
+                (st->in_range == want->in_range) &&
+                (memcmp(st->hist, want->hist, sizeof(st->hist)) == 0);
+    if (!same){
+        fprintf(stderr, "%s: totals differ\n", how);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void report(const char *how, int threads, int n, double usec){
+    printf("%-8s %8d %10.2f %12.1f\n", how, threads, usec / 1000.0, n / usec);
+}
+
+static double time_scan(int fd, int runs, int (*visit)(student_t *, void *), gpa_stats_t *st){
+    double best = 0;
+    for (int r = 0; r < runs; r++){
+        stats_init(st);
+        double t0 = now_usec();
+        if (scan_db(fd, visit, st) != NO_ERROR)
+            die("scan_db");
+        double t = now_usec() - t0;
+        if ((r == 0) || (t < best))
+            best = t;
+    }
+    return best;
+}
+
+static double time_columns(int fd, int runs, int threads, gpa_stats_t *st){
+    double best = 0;
+    for (int r = 0; r < runs; r++){
+        double t0 = now_usec();
+        if (gpa_stats(fd, threads, BENCH_LO, BENCH_HI, st) != NO_ERROR)
+            die("gpa_stats");
+        double t = now_usec() - t0;
+        if ((r == 0) || (t < best))
+            best = t;
+    }
+    return best;
+}
+
+static void bench_usage(const char *prog){
+    printf("usage: %s [-f file] [-n students] [-r runs] [-t threads]\n", prog);
+    printf("  -f FILE   database file to build (default %s)\n", BENCH_DEF_FILE);
+    printf("  -n N      students, ids 1 to N (default %d)\n", MAX_STD_ID);
+    printf("  -r N      runs of each, the best is reported (default %d)\n", BENCH_DEF_RUNS);
+    printf("  -t N      most threads to try (default the number of CPUs)\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    char *file = BENCH_DEF_FILE;
+    int n = MAX_STD_ID;
+    int runs = BENCH_DEF_RUNS;
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:r:t:h")) != -1){
+        switch (opt){
+            case 'f':
+                file = optarg;
+                break;
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if ((n <= 0) || (n > MAX_STD_ID) || (runs <= 0) || (max_threads <= 0))
+        bench_usage(argv[0]);
+
+    int fd = open_db(file, true);
+    if (fd < 0)
+        die(file);
+    srand(1);
+    for (int id = 1; id <= n; id++){
+        student_t s = {0};
+        s.id = id;
+        s.gpa = rand() % (MAX_STD_GPA + 1);
+        snprintf(s.fname, sizeof(s.fname), "first%d", id);
+        snprintf(s.lname, sizeof(s.lname), "last%d", id);
+        if (pwrite(fd, &s, sizeof(s), (off_t)id * STUDENT_RECORD_SIZE) != sizeof(s))
+            die("pwrite");
+    }
+
+    gpa_stats_t want, st;
+    printf("%d students, GPA from %.2f to %.2f counted\n", n, BENCH_LO / 100.0, BENCH_HI / 100.0);
+    printf("%-8s %8s %10s %12s\n", "how", "threads", "ms", "Mrecords/s");
+    double t_row = time_scan(fd, runs, visit_row, &want);
+    report("text", 1, n, time_scan(fd, 1, visit_text, &st));
+    check("text", &st, &want);
+    report("scan_db", 1, n, t_row);
+    for (int threads = 1; ; threads *= 2){
+        if (threads > max_threads)
+            threads = max_threads;
+        report("columns", threads, n, time_columns(fd, runs, threads, &st));
+        check("columns", &st, &want);
+        if (threads == max_threads)
+            break;
+    }
+
+    close(fd);
+    unlink(file);
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <sys/wait.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_walbench - what the write ahead log costs, and what group commit
+ *                gets back
+ *
+ * In a scratch directory under the current one (so on the disk the
+ * database would be on, not /tmp), times:
+ *   - fdatasync() after each small append, the floor for any commit
+ *   - insert_student() with no log, nothing is flushed
+ *   - insert_student() with the log, one fdatasync() per student
+ *   - the log deferred and committed every 8 and every 64 students
+ *   - adds through the server from 1, 8 and 64 clients at once, each
+ *     waiting for its answer before sending the next, so the only way
+ *     they share a flush is the server's group commit
+ * Rates are in students (or syncs) per second.
+ *
+ *   usage: sdb_walbench [-n adds]
+ */
+
+#define BENCH_DEF_ADDS  5000
+#define BENCH_SOCKET    "bench.sock"
+
+static double now_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void die(const char *what){
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static void make_student(student_t *s, int id){
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+    s->gpa = id % (MAX_STD_GPA + 1);
+    snprintf(s->fname, sizeof(s->fname), "first%d", id);
+    snprintf(s->lname, sizeof(s->lname), "last%d", id);
+}
+
+static void report(const char *how, int n, double usec){
+    printf("%-22s %8d %10.1f %12.0f\n", how, n, usec / 1000.0, n / (usec / 1e6));
+}
+
+static double raw_syncs(int n){
+    char entry[88] = {0};
+    int fd = open("sync.tmp", O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    double t0 = now_usec();
+
+    if (fd < 0)
+        die("sync.tmp");
+    for (int i = 0; i < n; i++){
+        if ((write(fd, entry, sizeof(entry)) != sizeof(entry)) || (fdatasync(fd) < 0))
+            die("fdatasync");
+    }
+    double t = now_usec() - t0;
+    close(fd);
+    unlink("sync.tmp");
+    return t;
+}
+
+//n students into an empty database, committing every batch (0 for no log)
+static double adds(int n, int batch){
+    student_t s;
+    int fd = open_db(DB_FILE, true);
+
+    if ((fd < 0) || (wal_reset(WAL_FILE) != NO_ERROR))
+        die(DB_FILE);
+    if ((batch > 0) && (wal_open(fd, WAL_FILE, false) != NO_ERROR))
+        die(WAL_FILE);
+    if (batch > 1)
+        wal_defer(true);
+
+    double t0 = now_usec();
+    for (int i = 0; i < n; i++){
+        make_student(&s, MIN_STD_ID + i);
+        if (insert_student(fd, &s) != NO_ERROR)
+            die("insert_student");
+        if ((batch > 1) && ((i + 1) % batch == 0) && (wal_sync() != NO_ERROR))
+            die("wal_sync");
+    }
+    if ((batch > 1) && (wal_sync() != NO_ERROR))
+        die("wal_sync");
+    double t = now_usec() - t0;
+
+    close_db(fd);
+    return t;
+}
+
+static pid_t start_server(void){
+    int fd = open_db(DB_FILE, true);
+
+    if ((fd < 0) || (wal_reset(WAL_FILE) != NO_ERROR))
+        die(DB_FILE);
+    close(fd);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        die("fork");
+    if (pid == 0){
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        exit(start_db_server(BENCH_SOCKET) == NO_ERROR ? 0 : 1);
+    }
+    for (int tries = 0; tries < 500; tries++){
+        int sock = db_connect(BENCH_SOCKET);
+        if (sock >= 0){
+            close(sock);
+            return pid;
+        }
+        usleep(10000);
+    }
+    fprintf(stderr, "server did not start\n");
+    exit(EXIT_FAILURE);
+}
+
+//n adds from clients that each have one add in flight at a time
+static double server_adds(int n, int clients){
+    pid_t server = start_server();
+    int socks[clients];
+    student_t s;
+    sdb_rsp_t rsp;
+    int next = 0;
+
+    for (int c = 0; c < clients; c++)
+        if ((socks[c] = db_connect(BENCH_SOCKET)) < 0)
+            die("db_connect");
+
+    double t0 = now_usec();
+    while (next < n){
+        int sent = 0;
+        for (int c = 0; (c < clients) && (next < n); c++, sent++){
+            make_student(&s, MIN_STD_ID + next++);
+            if (db_request(socks[c], SDB_OP_ADD, s.id, &s) != NO_ERROR)
+                die("db_request");
+        }
+        for (int c = 0; c < sent; c++){
+            if ((db_response(socks[c], &rsp, NULL) != NO_ERROR) || (rsp.rc != NO_ERROR)){
+                fprintf(stderr, "add failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    double t = now_usec() - t0;
+
+    for (int c = 0; c < clients; c++)
+        close(socks[c]);
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    return t;
+}
+
+static void bench_usage(const char *prog){
+    printf("usage: %s [-n adds]\n", prog);
+    printf("  -n N      students to add in each run (default %d)\n", BENCH_DEF_ADDS);
+    exit(0);
+}
+
+int main(int argc, char *argv[]){
+    char dir[] = "sdb_walbench.XXXXXX";
+    int n = BENCH_DEF_ADDS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1){
+        switch (opt){
+            case 'n':
+                n = atoi(optarg);
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if ((n <= 0) || (n > MAX_STD_ID))
+        bench_usage(argv[0]);
+    if ((mkdtemp(dir) == NULL) || (chdir(dir) < 0))
+        die(dir);
+
+    printf("%-22s %8s %10s %12s\n", "commit", "ops", "ms", "ops/s");
+    report("fdatasync", n, raw_syncs(n));
+    report("no log", n, adds(n, 0));
+    report("log, every add", n, adds(n, 1));
+    report("log, every 8 adds", n, adds(n, 8));
+    report("log, every 64 adds", n, adds(n, 64));
+    report("server, 1 client", n, server_adds(n, 1));
+    report("server, 8 clients", n, server_adds(n, 8));
+    report("server, 64 clients", n, server_adds(n, 64));
+
+    unlink(DB_FILE);
+    unlink(WAL_FILE);
+    if (chdir("..") == 0)
+        rmdir(dir);
+    return 0;
+}
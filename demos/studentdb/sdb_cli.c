@@ -0,0 +1,698 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <limits.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_cli.c - command line front end for the student database
+ *
+ * Parses the option, opens DB_FILE and runs one operation on it.  The
+ * database functions themselves are in sdbsc.c.  With SDB_SOCKET set the
+ * operation is sent to a server started with -s instead, see
+ * sdb_server.c.
+ */
+
+/*
+ *  usage
+ *      exename:  the name of the executable from argv[0]
+ *
+ *  Prints this programs expected usage
+ *
+ *  returns:    nothing, this is a void function
+ *
+ *  console:  This function prints the usage information
+ *
+ */
+void usage(char *exename)
+{
+    printf("usage: %s -[h|a|c|d|f|g|n|p|x|z|i|e|r|m|s] options.  Where:\n", exename);
+    printf("\t-h:  prints help\n");
+    printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+    printf("\t-c:  counts the records in the database\n");
+    printf("\t-d id:  deletes a student\n");
+    printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-n last_name|prefix*:  finds and prints students by last name\n");
+    printf("\t-g [lo hi]:  GPA statistics, or the students with a GPA from lo to hi\n");
+    printf("\t-p:  prints all records in the student database\n");
+    printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
+    printf("\t-z:  zero db file (remove all records)\n");
+    printf("\t-i file.csv:  imports the students in a CSV file\n");
+    printf("\t-e file.csv:  exports all of the students to a CSV file\n");
+    printf("\t-r:  rebuilds the last name index\n");
+    printf("\t-m:  migrates the database file to format 2 (paged, ids up to %lld)\n",
+           PDB_MAX_ID);
+    printf("\t-s [socket]:  serves the database on a Unix socket (default %s)\n",
+           SDB_DEF_SOCKET);
+    printf("With %s=socket set, -a -c -d -f -n -p and -x are sent to that server\n",
+           SDB_SOCKET_ENV);
+}
+
+//prints the students of an SDB_OP_SCAN or SDB_OP_LNAME response as they
+//arrive, returns the number printed
+static int remote_print(int sock, int count)
+{
+    student_t batch[256];
+    int rows = 0;
+
+    while (count > 0)
+    {
+        int n = (count < 256) ? count : 256;
+        if (db_read(sock, batch, n * sizeof(student_t)) != NO_ERROR)
+            return ERR_DB_FILE;
+        for (int i = 0; i < n; i++)
+            print_row(&batch[i], &rows);
+        count -= n;
+    }
+    return rows;
+}
+
+/*
+ *  remote_cmd
+ *      sock_path:  where the server is listening, from SDB_SOCKET
+ *      argc/argv:  the command line
+ *
+ *  Runs the operation on the command line against the server, with the
+ *  same output and exit codes as running it on DB_FILE directly.  -z, -i,
+ *  -e, -r, -g and -m need the files themselves and are not sent.
+ *
+ *  returns:  the exit code for the shell
+ */
+int remote_cmd(char *sock_path, int argc, char *argv[])
+{
+    char opt = argv[1][1];
+    student_t student = {0};
+    sdb_rsp_t rsp;
+    int exit_code = EXIT_OK;
+    int rc_rows;
+    int id = 0;
+    int sock;
+
+    // check the arguments before connecting, as main() does
+    if ((((opt == 'd') || (opt == 'f') || (opt == 'n')) && (argc != 3)) ||
+        ((opt == 'a') && (argc != 6)))
+    {
+        usage(argv[0]);
+        return EXIT_FAIL_ARGS;
+    }
+    if ((opt == 'z') || (opt == 'i') || (opt == 'e') || (opt == 'r') || (opt == 'g') ||
+        (opt == 'm'))
+    {
+        printf(M_NOT_IMPL);
+        return EXIT_NOT_IMPL;
+    }
+    if ((opt != 'a') && (opt != 'c') && (opt != 'd') && (opt != 'f') &&
+        (opt != 'n') && (opt != 'p') && (opt != 'x'))
+    {
+        usage(argv[0]);
+        return EXIT_FAIL_ARGS;
+    }
+    if (opt == 'n')
+        strncpy(student.lname, argv[2], sizeof(student.lname) - 1);
+    else if (argc > 2)
+        id = atoi(argv[2]);
+    if (opt == 'a')
+    {
+        student.gpa = atoi(argv[5]);
+        if (validate_range(id, student.gpa) != NO_ERROR)
+        {
+            printf(M_ERR_STD_RNG);
+            return EXIT_FAIL_ARGS;
+        }
+        student.id = id;
+        strncpy(student.fname, argv[3], sizeof(student.fname) - 1);
+        strncpy(student.lname, argv[4], sizeof(student.lname) - 1);
+    }
+
+    sock = db_connect(sock_path);
+    if (sock < 0)
+    {
+        printf(M_ERR_SRV_CONNECT, sock_path);
+        return EXIT_FAIL_DB;
+    }
+
+    int op = (opt == 'a') ? SDB_OP_ADD : (opt == 'c') ? SDB_OP_COUNT :
+             (opt == 'd') ? SDB_OP_DEL : (opt == 'f') ? SDB_OP_GET :
+             (opt == 'n') ? SDB_OP_LNAME : (opt == 'p') ? SDB_OP_SCAN :
+             SDB_OP_COMPACT;
+    if ((db_request(sock, op, id, &student) != NO_ERROR) ||
+        (db_response(sock, &rsp, (op == SDB_OP_GET) ? &student : NULL) != NO_ERROR))
+    {
+        printf(M_ERR_SRV_LOST);
+        close(sock);
+        return EXIT_FAIL_DB;
+    }
+
+    switch (rsp.rc)
+    {
+    case NO_ERROR:
+        if (op == SDB_OP_ADD)
+            printf(M_STD_ADDED, id);
+        else if (op == SDB_OP_DEL)
+            printf(M_STD_DEL_MSG, id);
+        else if (op == SDB_OP_GET)
+            print_student(&student);
+        else if (op == SDB_OP_COMPACT)
+            printf(M_DB_COMPRESSED_OK);
+        else if (op == SDB_OP_COUNT)
+            printf(M_DB_EMPTY);
+        else if ((rc_rows = remote_print(sock, rsp.count)) < 0)
+        {
+            printf(M_ERR_SRV_LOST);
+            exit_code = EXIT_FAIL_DB;
+        }
+        else if ((rc_rows == 0) && (op == SDB_OP_SCAN))
+            printf(M_DB_EMPTY);
+        else if (rc_rows == 0)
+        {
+            printf(M_LNAME_NOT_FND, argv[2]);
+            exit_code = EXIT_FAIL_DB;
+        }
+        break;
+    case ERR_DB_OP:
+        // for a compact it means the server's file system cannot punch holes
+        if (op == SDB_OP_ADD)
+            printf(M_ERR_DB_ADD_DUP, id);
+        else
+            printf(M_ERR_DB_WRITE);
+        exit_code = EXIT_FAIL_DB;
+        break;
+    case SRCH_NOT_FOUND:
+        printf(M_STD_NOT_FND_MSG, id);
+        exit_code = EXIT_FAIL_DB;
+        break;
+    case ERR_DB_RANGE:
+        printf(M_ERR_STD_RNG);
+        exit_code = EXIT_FAIL_ARGS;
+        break;
+    case ERR_DB_WRITE:
+        printf(M_ERR_DB_WRITE);
+        exit_code = EXIT_FAIL_DB;
+        break;
+    default:
+        if ((op == SDB_OP_COUNT) && (rsp.rc > 0))
+            printf(M_DB_RECORD_CNT, rsp.rc);
+        else
+        {
+            printf(M_ERR_DB_READ);
+            exit_code = EXIT_FAIL_DB;
+        }
+        break;
+    }
+
+    close(sock);
+    return exit_code;
+}
+
+typedef struct paged_row {
+    long long id;
+    student_t s;
+} paged_row_t;
+
+typedef struct paged_rows {
+    paged_row_t *rows;
+    int n;
+    int cap;
+} paged_rows_t;
+
+static int collect_row(long long id, student_t *s, void *arg)
+{
+    paged_rows_t *all = arg;
+
+    if (all->n == all->cap)
+    {
+        int cap = (all->cap == 0) ? 256 : all->cap * 2;
+        paged_row_t *rows = realloc(all->rows, cap * sizeof(paged_row_t));
+        if (rows == NULL)
+            return ERR_DB_FILE;
+        all->rows = rows;
+        all->cap = cap;
+    }
+    all->rows[all->n].id = id;
+    all->rows[all->n++].s = *s;
+    return NO_ERROR;
+}
+
+static int row_cmp(const void *a, const void *b)
+{
+    long long x = ((const paged_row_t *)a)->id;
+    long long y = ((const paged_row_t *)b)->id;
+
+    return (x > y) - (x < y);
+}
+
+static void print_paged_row(long long id, student_t *s, bool header)
+{
+    if (header)
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+    printf(PDB_PRINT_FMT_STRING, id, s->fname, s->lname, s->gpa / 100.0);
+}
+
+/*
+ *  paged_cmd
+ *      fd:         DB_FILE, in format 2
+ *      argc/argv:  the command line
+ *
+ *  Runs the operation on the command line against a database in format
+ *  2, see sdb_paged.c, with the same output and exit codes as on the
+ *  original format, other than that ids go up to PDB_MAX_ID.  -a, -c, -d,
+ *  -f, -p and -z are supported; the rest need the original format.
+ *
+ *  returns:  the exit code for the shell
+ */
+int paged_cmd(int fd, int argc, char *argv[])
+{
+    char opt = argv[1][1];
+    student_t student = {0};
+    paged_rows_t all = { NULL, 0, 0 };
+    int exit_code = EXIT_OK;
+    long long id = 0;
+    int rc = NO_ERROR;
+
+    if ((((opt == 'd') || (opt == 'f') || (opt == 'n')) && (argc != 3)) ||
+        ((opt == 'a') && (argc != 6)))
+    {
+        close(fd);
+        usage(argv[0]);
+        return EXIT_FAIL_ARGS;
+    }
+    if ((opt == 'x') || (opt == 'i') || (opt == 'e') || (opt == 'n') || (opt == 'r') ||
+        (opt == 'g'))
+    {
+        close(fd);
+        printf(M_ERR_DB_PAGED);
+        return EXIT_NOT_IMPL;
+    }
+    if ((opt != 'a') && (opt != 'c') && (opt != 'd') && (opt != 'f') &&
+        (opt != 'p') && (opt != 'z') && (opt != 'm'))
+    {
+        close(fd);
+        usage(argv[0]);
+        return EXIT_FAIL_ARGS;
+    }
+    if (opt == 'm')
+    {
+        close(fd);
+        printf(M_DB_IS_PAGED);
+        return EXIT_OK;
+    }
+    if (pdb_open(fd) != NO_ERROR)
+    {
+        printf(M_ERR_DB_OPEN);
+        close(fd);
+        return EXIT_FAIL_DB;
+    }
+    if (argc > 2)
+        id = atoll(argv[2]);
+
+    switch (opt)
+    {
+    case 'a':
+        student.gpa = atoi(argv[5]);
+        if ((id < MIN_STD_ID) || (student.gpa < MIN_STD_GPA) || (student.gpa > MAX_STD_GPA))
+        {
+            printf(M_ERR_STD_RNG);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        student.id = (id <= INT_MAX) ? (int)id : 0;
+        strncpy(student.fname, argv[3], sizeof(student.fname) - 1);
+        strncpy(student.lname, argv[4], sizeof(student.lname) - 1);
+        rc = pdb_insert(id, &student);
+        if (rc == NO_ERROR)
+            printf(M_PDB_ADDED, id);
+        else if (rc == ERR_DB_OP)
+            printf(M_PDB_ADD_DUP, id);
+        else
+            printf(M_ERR_DB_WRITE);
+        break;
+
+    case 'd':
+        rc = pdb_remove(id);
+        if (rc == NO_ERROR)
+            printf(M_PDB_DEL_MSG, id);
+        else if (rc == SRCH_NOT_FOUND)
+            printf(M_PDB_NOT_FND_MSG, id);
+        else
+            printf(M_ERR_DB_WRITE);
+        break;
+
+    case 'f':
+        rc = pdb_get(id, &student);
+        if (rc == NO_ERROR)
+            print_paged_row(id, &student, true);
+        else if (rc == SRCH_NOT_FOUND)
+            printf(M_PDB_NOT_FND_MSG, id);
+        else
+            printf(M_ERR_DB_READ);
+        break;
+
+    case 'c':
+    case 'p':
+        // buckets are in hash order, -p prints in id order like the
+        // original format
+        rc = pdb_scan(collect_row, &all);
+        if (rc != NO_ERROR)
+            printf(M_ERR_DB_READ);
+        else if (all.n == 0)
+            printf(M_DB_EMPTY);
+        else if (opt == 'c')
+            printf(M_DB_RECORD_CNT, all.n);
+        else
+        {
+            qsort(all.rows, all.n, sizeof(paged_row_t), row_cmp);
+            for (int i = 0; i < all.n; i++)
+                print_paged_row(all.rows[i].id, &all.rows[i].s, i == 0);
+        }
+        free(all.rows);
+        break;
+
+    case 'z':
+        // still format 2, just empty
+        pdb_close();
+        if ((ftruncate(fd, 0) < 0) || (pdb_create(fd) != NO_ERROR) || (pdb_open(fd) != NO_ERROR))
+        {
+            printf(M_ERR_DB_WRITE);
+            rc = ERR_DB_FILE;
+            break;
+        }
+        printf(M_DB_ZERO_OK);
+        break;
+    }
+
+    if ((exit_code == EXIT_OK) && (rc != NO_ERROR))
+        exit_code = EXIT_FAIL_DB;
+    if ((pdb_close() != NO_ERROR) && (exit_code == EXIT_OK))
+    {
+        printf(M_ERR_DB_WRITE);
+        exit_code = EXIT_FAIL_DB;
+    }
+    close(fd);
+    return exit_code;
+}
+
+// Welcome to main()
+int main(int argc, char *argv[])
+{
+    char opt;      // user selected option
+    int fd;        // file descriptor of database files
+    int rc;        // return code from various operations
+    int exit_code; // exit code to shell
+    int id;        // userid from argv[2]
+    int gpa;       // gpa from argv[5]
+
+    // space for a student structure which we will get back from
+    // some of the functions we will be writing such as get_student(),
+    // and print_student().
+    student_t student = {0};
+
+    // This function must have at least one arg, and the arg must start
+    // with a dash
+    if ((argc < 2) || (*argv[1] != '-'))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    // The option is the first character after the dash for example
+    //-h -a -c -d -f -p -x -z
+    opt = (char)*(argv[1] + 1); // get the option flag
+
+    // handle the help flag and then exit normally
+    if (opt == 'h')
+    {
+        usage(argv[0]);
+        exit(EXIT_OK);
+    }
+
+    // -s runs the server, it opens the database itself
+    if (opt == 's')
+    {
+        rc = start_db_server((argc > 2) ? argv[2] : SDB_DEF_SOCKET);
+        exit((rc == NO_ERROR) ? EXIT_OK : EXIT_FAIL_DB);
+    }
+
+    // with a server running the operation goes to it instead of the file
+    if (getenv(SDB_SOCKET_ENV) != NULL)
+        exit(remote_cmd(getenv(SDB_SOCKET_ENV), argc, argv));
+
+    // now lets open the file and continue if there is no error
+    // note we are not truncating the file using the second
+    // parameter
+    fd = open_db(DB_FILE, false);
+    if (fd < 0)
+    {
+        exit(EXIT_FAIL_DB);
+    }
+    // a database in format 2 has its own, smaller, set of operations
+    if (pdb_detect(fd))
+        exit(paged_cmd(fd, argc, argv));
+    if (attach_engine(fd) != NO_ERROR)
+    {
+        close(fd);
+        exit(EXIT_FAIL_DB);
+    }
+
+    // set rc to the return code of the operation to ensure the program
+    // use that to determine the proper exit_code.  Look at the header
+    // sdbsc.h for expected values.
+
+    exit_code = EXIT_OK;
+    switch (opt)
+    {
+    case 'a':
+        //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]
+        // prog_name     -a      id  first_name last_name     gpa
+        //-------------------------------------------------------
+        // example:  prog_name -a 1 John Doe 341
+        if (argc != 6)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+
+        // convert id and gpa to ints from argv.  For this assignment assume
+        // they are valid numbers
+        id = atoi(argv[2]);
+        gpa = atoi(argv[5]);
+
+        exit_code = validate_range(id, gpa);
+        if (exit_code == EXIT_FAIL_ARGS)
+        {
+            printf(M_ERR_STD_RNG);
+            break;
+        }
+
+        rc = add_student(fd, id, argv[3], argv[4], gpa);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+
+        break;
+
+    case 'c':
+        //    arv[0] arv[1]
+        // prog_name     -c
+        //-----------------
+        // example:  prog_name -c
+        rc = count_db_records(fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'd':
+        //   arv[0]  arv[1]  arv[2]
+        // prog_name     -d      id
+        //-------------------------
+        // example:  prog_name -d 100
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        id = atoi(argv[2]);
+        rc = del_student(fd, id);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+
+        break;
+
+    case 'f':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -f      id
+        //-------------------------
+        // example:  prog_name -f 100
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        id = atoi(argv[2]);
+        rc = get_student(fd, id, &student);
+
+        switch (rc)
+        {
+        case NO_ERROR:
+            print_student(&student);
+            break;
+        case SRCH_NOT_FOUND:
+            printf(M_STD_NOT_FND_MSG, id);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        default:
+            printf(M_ERR_DB_READ);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        break;
+
+    case 'n':
+        //    arv[0] arv[1]     arv[2]
+        // prog_name     -n  last_name
+        //----------------------------
+        // example:  prog_name -n Smith, or prog_name -n 'Smi*'
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = print_lname(fd, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'g':
+        //    arv[0] arv[1]  [arv[2] arv[3]]
+        // prog_name     -g  [lo     hi]
+        //---------------------------------
+        // example:  prog_name -g, or prog_name -g 300 400
+        if ((argc != 2) && (argc != 4))
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (argc == 4)
+        {
+            int lo = atoi(argv[2]);
+            int hi = atoi(argv[3]);
+            if ((lo < MIN_STD_GPA) || (hi > MAX_STD_GPA) || (lo > hi))
+            {
+                printf(M_ERR_GPA_RNG);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = print_gpa_stats(fd, lo, hi);
+        }
+        else
+            rc = print_gpa_stats(fd, -1, -1);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'r':
+        //    arv[0] arv[1]
+        // prog_name     -r
+        //-----------------
+        // example:  prog_name -r
+        rc = rebuild_index(fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'p':
+        //    arv[0] arv[1]
+        // prog_name     -p
+        //-----------------
+        // example:  prog_name -p
+        rc = print_db(fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'i':
+    case 'e':
+        //    arv[0] arv[1]       arv[2]
+        // prog_name  -i|-e  file.csv
+        //-------------------------------
+        // example:  prog_name -i students.csv
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = (opt == 'i') ? import_csv(fd, argv[2]) : export_csv(fd, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'x':
+        //    arv[0] arv[1]
+        // prog_name     -x
+        //-----------------
+        // example:  prog_name -x
+
+        // remember compress_db returns a fd of the compressed database.
+        // we close it after this switch statement
+        fd = compress_db(fd);
+        if (fd < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'm':
+        //    arv[0] arv[1]
+        // prog_name     -m
+        //-----------------
+        // example:  prog_name -m
+
+        // like compress_db, the fd returned is of the new file
+        fd = migrate_db(fd);
+        if (fd < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'z':
+        //    arv[0] arv[1]
+        // prog_name     -x
+        //-----------------
+        // example:  prog_name -x
+        // HINT:  close the db file, we already have fd
+        //       and reopen db indicating truncate=true
+        close_db(fd);
+        fd = open_db(DB_FILE, true);
+        if (fd < 0)
+        {
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        // nothing in the log may be replayed over the empty file, and
+        // the index is built again, empty, when it is next opened
+        if ((wal_reset(WAL_FILE) != NO_ERROR) || (idx_reset(IDX_FILE) != NO_ERROR))
+        {
+            printf(M_ERR_DB_WRITE);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        printf(M_DB_ZERO_OK);
+        exit_code = EXIT_OK;
+        break;
+    default:
+        usage(argv[0]);
+        exit_code = EXIT_FAIL_ARGS;
+    }
+
+    // dont forget to close the file before exiting, and setting the
+    // proper exit code - see the header file for expected values
+    if ((close_db(fd) != NO_ERROR) && (exit_code == EXIT_OK))
+        exit_code = EXIT_FAIL_DB;
+    exit(exit_code);
+}
@@ -0,0 +1,474 @@
+#define _GNU_SOURCE    //pwritev()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_csv.c - bulk import and export of students as CSV
+ *
+ * Loading students one `sdbsc -a` at a time costs a process launch, an
+ * open(), a check and a one record write() each.  import_csv() instead
+ * reads the whole CSV file, parses and validates every line before it
+ * writes anything, and then writes the students in id order.  Students
+ * with consecutive ids are consecutive in the file, so each run of them
+ * goes out with one pwritev() whose iovecs point straight at the parsed
+ * records, and there is a single fsync() at the end.  Short gaps inside a
+ * run are filled with EMPTY_STUDENT_RECORD rather than splitting it, the
+ * gap lies in blocks the run writes anyway so no storage is lost.  With
+ * the write ahead log open the students are logged first as one commit,
+ * so an import cut short by a crash is replayed whole or not at all.
+ *
+ * The format is one student per line, id,first_name,last_name,gpa with
+ * the gpa as the same 3 digit int -a takes.  A name with a comma or quote
+ * in it is double quoted, with quotes doubled inside, as usual for CSV.
+ * export_csv() writes a header line, import_csv() skips a first line that
+ * does not start with a digit.
+ */
+
+#define CSV_IO_BUFF_SZ  (64 * 1024)
+#define CSV_FILL_GAP    DB_BLOCK_RECORDS   //empty slots that do not break a run
+
+//copies one field into out, which holds out_sz - 1 characters plus the
+//'\0', longer names are cut like add_student() cuts them.  Returns where
+//the field ends, on the ',' or end of line, or NULL for a bad quote
+static char *parse_field(char *p, char *out, int out_sz)
+{
+    int len = 0;
+
+    if (*p != '"')
+    {
+        char *start = p;
+        while ((*p != ',') && (*p != '\n') && (*p != '\r') && (*p != '\0'))
+            p++;
+        len = p - start;
+        if (len > out_sz - 1)
+            len = out_sz - 1;
+        memcpy(out, start, len);
+        out[len] = '\0';
+        return p;
+    }
+
+    for (p++; ; p++)
+    {
+        if (*p == '\0')
+            return NULL;
+        if (*p == '"')
+        {
+            if (p[1] != '"')
+                break;
+            p++;
+        }
+        if (len < out_sz - 1)
+            out[len++] = *p;
+    }
+    out[len] = '\0';
+    return p + 1;
+}
+
+//a non-negative int, NULL if there are no digits or too many
+static char *parse_int(char *p, int *val)
+{
+    char *start = p;
+    int v = 0;
+
+    while ((*p >= '0') && (*p <= '9') && (p - start < 9))
+        v = v * 10 + (*p++ - '0');
+    if ((p == start) || ((*p >= '0') && (*p <= '9')))
+        return NULL;
+    *val = v;
+    return p;
+}
+
+//one line into *s, returns the start of the next line or NULL if the line
+//is not a student
+static char *parse_line(char *p, student_t *s)
+{
+    *s = EMPTY_STUDENT_RECORD;
+    if (((p = parse_int(p, &s->id)) == NULL) || (*p++ != ','))
+        return NULL;
+    if (((p = parse_field(p, s->fname, sizeof(s->fname))) == NULL) || (*p++ != ','))
+        return NULL;
+    if (((p = parse_field(p, s->lname, sizeof(s->lname))) == NULL) || (*p++ != ','))
+        return NULL;
+    if ((p = parse_int(p, &s->gpa)) == NULL)
+        return NULL;
+    if (*p == '\r')
+        p++;
+    if ((*p != '\n') && (*p != '\0'))
+        return NULL;
+    if ((s->fname[0] == '\0') || (s->lname[0] == '\0') ||
+        (validate_range(s->id, s->gpa) != NO_ERROR))
+        return NULL;
+    return (*p == '\n') ? p + 1 : p;
+}
+
+//the whole file, '\0' terminated
+static char *read_file(const char *path)
+{
+    struct stat st;
+    char *buff;
+    ssize_t n;
+    size_t len = 0;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+    if ((fstat(fd, &st) < 0) || ((buff = malloc(st.st_size + 1)) == NULL))
+    {
+        close(fd);
+        return NULL;
+    }
+    while ((len < (size_t)st.st_size) &&
+           ((n = read(fd, buff + len, st.st_size - len)) > 0))
+        len += n;
+    close(fd);
+    buff[len] = '\0';
+    return buff;
+}
+
+static int mark_student(student_t *s, void *arg)
+{
+    ((bool *)arg)[s->id] = true;
+    return NO_ERROR;
+}
+
+//pwritev() until all of iov is written, it may write less on a signal
+static int pwritev_all(int fd, struct iovec *iov, int iov_cnt, off_t offset)
+{
+    while (iov_cnt > 0)
+    {
+        ssize_t n = pwritev(fd, iov, iov_cnt, offset);
+        if (n <= 0)
+            return ERR_DB_FILE;
+        offset += n;
+        while ((iov_cnt > 0) && ((size_t)n >= iov->iov_len))
+        {
+            n -= iov->iov_len;
+            iov++;
+            iov_cnt--;
+        }
+        if (iov_cnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return NO_ERROR;
+}
+
+//every student in by_id, one pwritev() per run of ids (or per IOV_MAX)
+static int write_runs(int fd, student_t **by_id, bool *taken)
+{
+    static struct iovec iov[IOV_MAX];
+    int iov_cnt = 0;
+    int run_start = 0;
+    int last = -1;
+
+    for (int id = MIN_STD_ID; id <= MAX_STD_ID; id++)
+    {
+        if (by_id[id] == NULL)
+            continue;
+
+        int gap = (last < 0) ? INT_MAX : id - last - 1;
+        bool fill = (gap > 0) && (gap < CSV_FILL_GAP) && (iov_cnt + gap < IOV_MAX);
+        for (int i = last + 1; fill && (i < id); i++)
+            fill = !taken[i];
+
+        if ((gap > 0 && !fill) || (iov_cnt == IOV_MAX))
+        {
+            if ((iov_cnt > 0) &&
+                (pwritev_all(fd, iov, iov_cnt, (off_t)run_start * STUDENT_RECORD_SIZE) != NO_ERROR))
+                return ERR_DB_FILE;
+            iov_cnt = 0;
+        }
+        if (iov_cnt == 0)
+            run_start = id;
+        else
+        {
+            for (int i = last + 1; i < id; i++)
+            {
+                iov[iov_cnt].iov_base = (void *)&EMPTY_STUDENT_RECORD;
+                iov[iov_cnt++].iov_len = STUDENT_RECORD_SIZE;
+            }
+        }
+        iov[iov_cnt].iov_base = by_id[id];
+        iov[iov_cnt++].iov_len = STUDENT_RECORD_SIZE;
+        last = id;
+    }
+
+    if ((iov_cnt > 0) &&
+        (pwritev_all(fd, iov, iov_cnt, (off_t)run_start * STUDENT_RECORD_SIZE) != NO_ERROR))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+//the whole import is logged as one commit before any of it is written
+static int log_students(int fd, student_t **by_id)
+{
+    if (!wal_active(fd))
+        return NO_ERROR;
+
+    bool was = wal_defer(true);
+    int rc = NO_ERROR;
+
+    for (int id = MIN_STD_ID; (rc == NO_ERROR) && (id <= MAX_STD_ID); id++)
+        if (by_id[id] != NULL)
+            rc = wal_log(id, by_id[id]);
+    if (rc == NO_ERROR)
+        rc = wal_sync();
+    // none of it is written if it could not be logged
+    if (rc != NO_ERROR)
+        wal_discard();
+    wal_defer(was);
+    return rc;
+}
+
+/*
+ *  import_csv
+ *      fd:    linux file descriptor of the database
+ *      path:  the CSV file
+ *
+ *  Adds every student in the CSV file.  Either all of them are added or,
+ *  if any line is not a valid student or is a student that already
+ *  exists, in the database or earlier in the file, none are.  The last
+ *  name index is rebuilt after, one sorted pass instead of an insert per
+ *  student.
+ *
+ *  returns:  <number>       students imported
+ *            ERR_DB_OP      the CSV file is bad, nothing was imported
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_CSV_IMPORTED   on success
+ *            M_ERR_CSV_OPEN   the CSV file could not be read
+ *            M_ERR_CSV_LINE   a line that is not a valid student
+ *            M_ERR_CSV_DUP    a student that already exists
+ *            M_ERR_DB_READ    error reading the database file
+ *            M_ERR_DB_WRITE   error writing the database file
+ */
+int import_csv(int fd, char *path)
+{
+    char *csv = read_file(path);
+    student_t *students = NULL;
+    student_t **by_id = NULL;
+    bool *taken = NULL;
+    int num_students = 0;
+    int line_no = 1;
+    int rc = ERR_DB_OP;
+    bool locked = false;
+
+    if (csv == NULL)
+    {
+        printf(M_ERR_CSV_OPEN, path);
+        return ERR_DB_OP;
+    }
+
+    //a line is at least "1,a,b,0\n", which bounds the number of students
+    students = malloc((strlen(csv) / 8 + 1) * sizeof(student_t));
+    by_id = calloc(MAX_STD_ID + 1, sizeof(student_t *));
+    taken = calloc(MAX_STD_ID + 1, sizeof(bool));
+    if ((students == NULL) || (by_id == NULL) || (taken == NULL))
+    {
+        printf(M_ERR_DB_READ);
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    //the students already in the database, holes are skipped.  Nothing
+    //else may write from here to the end, or a student another process
+    //adds could be written over by a gap fill
+    locked = (lock_records(fd, 0, 0, F_WRLCK) == NO_ERROR);
+    if (!locked || (scan_db(fd, mark_student, taken) != NO_ERROR))
+    {
+        printf(M_ERR_DB_READ);
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    char *p = csv;
+    if ((*p != '\0') && ((*p < '0') || (*p > '9')))
+    {
+        p = strchr(p, '\n');
+        p = (p == NULL) ? csv + strlen(csv) : p + 1;
+        line_no++;
+    }
+    for (; *p != '\0'; line_no++)
+    {
+        //an empty line
+        if ((*p == '\n') || ((*p == '\r') && (p[1] == '\n')))
+        {
+            p += (*p == '\r') ? 2 : 1;
+            continue;
+        }
+
+        student_t *s = &students[num_students];
+        char *next = parse_line(p, s);
+        if (next == NULL)
+        {
+            printf(M_ERR_CSV_LINE, line_no, path);
+            goto done;
+        }
+        if (taken[s->id] || (by_id[s->id] != NULL))
+        {
+            printf(M_ERR_CSV_DUP, s->id, line_no, path);
+            goto done;
+        }
+        by_id[s->id] = s;
+        num_students++;
+        p = next;
+    }
+
+    if ((log_students(fd, by_id) != NO_ERROR) ||
+        (write_runs(fd, by_id, taken) != NO_ERROR) || (fsync(fd) < 0))
+    {
+        printf(M_ERR_DB_WRITE);
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    // the students are in either way, an index that could not be built
+    // is built again when it is next opened
+    if (idx_active(fd))
+        idx_rebuild();
+
+    printf(M_CSV_IMPORTED, num_students, path);
+    rc = num_students;
+
+done:
+    if (locked)
+        lock_records(fd, 0, 0, F_UNLCK);
+    free(csv);
+    free(students);
+    free(by_id);
+    free(taken);
+    return rc;
+}
+
+typedef struct csv_out {
+    int fd;
+    int len;
+    int count;
+    int rc;
+    char buff[CSV_IO_BUFF_SZ];
+} csv_out_t;
+
+static int flush_out(csv_out_t *out)
+{
+    int done = 0;
+
+    while (done < out->len)
+    {
+        ssize_t n = write(out->fd, out->buff + done, out->len - done);
+        if (n <= 0)
+            return out->rc = ERR_DB_FILE;
+        done += n;
+    }
+    out->len = 0;
+    return NO_ERROR;
+}
+
+//a name, quoted if it has to be
+static void put_field(csv_out_t *out, const char *name, int max_len)
+{
+    int len = strnlen(name, max_len);
+    bool quote = false;
+
+    for (int i = 0; i < len; i++)
+        if ((name[i] == ',') || (name[i] == '"') || (name[i] == '\r') || (name[i] == '\n'))
+            quote = true;
+    if (!quote)
+    {
+        memcpy(out->buff + out->len, name, len);
+        out->len += len;
+        return;
+    }
+
+    out->buff[out->len++] = '"';
+    for (int i = 0; i < len; i++)
+    {
+        if (name[i] == '"')
+            out->buff[out->len++] = '"';
+        out->buff[out->len++] = name[i];
+    }
+    out->buff[out->len++] = '"';
+}
+
+static int export_student(student_t *s, void *arg)
+{
+    csv_out_t *out = arg;
+
+    //the longest line, every character of both names a quote, fits
+    if ((out->len > CSV_IO_BUFF_SZ - 256) && (flush_out(out) != NO_ERROR))
+        return ERR_DB_FILE;
+
+    out->len += sprintf(out->buff + out->len, "%d,", s->id);
+    put_field(out, s->fname, sizeof(s->fname));
+    out->buff[out->len++] = ',';
+    put_field(out, s->lname, sizeof(s->lname));
+    out->len += sprintf(out->buff + out->len, ",%d\n", s->gpa);
+    out->count++;
+    return NO_ERROR;
+}
+
+/*
+ *  export_csv
+ *      fd:    linux file descriptor of the database
+ *      path:  the CSV file, created or truncated
+ *
+ *  Writes every student, in id order, as CSV that import_csv() reads.
+ *
+ *  returns:  <number>       students exported
+ *            ERR_DB_OP      the CSV file could not be created
+ *            ERR_DB_FILE    database or CSV file I/O issue
+ *
+ *  console:  M_CSV_EXPORTED   on success
+ *            M_ERR_CSV_OPEN   the CSV file could not be created
+ *            M_ERR_DB_READ    error reading the database file
+ *            M_ERR_DB_WRITE   error writing the CSV file
+ */
+int export_csv(int fd, char *path)
+{
+    csv_out_t *out = malloc(sizeof(csv_out_t));
+    int rc;
+
+    if (out == NULL)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+    if (out->fd < 0)
+    {
+        printf(M_ERR_CSV_OPEN, path);
+        free(out);
+        return ERR_DB_OP;
+    }
+    out->len = sprintf(out->buff, "id,first_name,last_name,gpa\n");
+    out->count = 0;
+    out->rc = NO_ERROR;
+
+    rc = scan_db(fd, export_student, out);
+    if ((rc == NO_ERROR) && (flush_out(out) == NO_ERROR))
+    {
+        printf(M_CSV_EXPORTED, out->count, path);
+        rc = out->count;
+    }
+    else
+    {
+        printf((out->rc != NO_ERROR) ? M_ERR_DB_WRITE : M_ERR_DB_READ);
+        rc = ERR_DB_FILE;
+    }
+
+    close(out->fd);
+    free(out);
+    return rc;
+}
@@ -0,0 +1,733 @@
+#define _GNU_SOURCE    //F_OFD_SETLKW
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_index.c - last name index for the student database
+ *
+ * A student's id is where it is in the file, so finding one by id is a
+ * single read, but finding students by last name means looking at every
+ * record.  This keeps a B+tree of (last name, id) keys in IDX_FILE, in 4K
+ * pages: the leaves hold the keys in order and are chained left to right,
+ * the inner pages above them hold the first key of each child after the
+ * first.  A lookup reads one page per level, three levels cover every id
+ * there can be, and a prefix query walks the chain from the first match.
+ *
+ * insert_student() adds the key before it writes the student and
+ * remove_student() takes it out after, both while holding the record's
+ * lock, so the index never misses a student that is there.  It can have
+ * keys for students that are not, after a failed write or while another
+ * process is between the two steps, so find_lname() checks every match
+ * against the record itself.  Deletes do not merge pages, `sdbsc -r`
+ * rebuilds the index packed, and import_csv() rebuilds it rather than
+ * adding its students one at a time.
+ *
+ * Updates are not logged.  Instead the header counts the processes that
+ * have written the index and not yet closed it, flushed before the first
+ * update; a crash leaves the count above zero, and the next process to
+ * open the index with nobody else using it rebuilds it from the database.
+ * An update holds an OFD write lock on the whole file, a query a read
+ * lock, and every process holds a shared flock() for as long as it has
+ * the index open, as with the write ahead log.
+ */
+
+#define IDX_MAGIC       0x58444953      //"SIDX"
+#define IDX_VERSION     1
+#define IDX_PAGE_SIZE   4096
+#define IDX_NAME_LEN    32              //sizeof student_t lname
+#define LEAF_MAX        113
+#define INNER_MAX       101
+#define LEAF_FILL       100             //keys per page when the index is
+#define INNER_FILL      90              //built, room is left for adds
+
+typedef struct idx_key {
+    char lname[IDX_NAME_LEN];
+    int32_t id;
+} idx_key_t;
+
+typedef union idx_page {
+    struct {
+        uint32_t is_leaf;
+        uint32_t n;                     //keys in the page
+        uint32_t next;                  //the leaf to the right, 0 at the end
+        idx_key_t keys[LEAF_MAX];
+    } leaf;
+    struct {
+        uint32_t is_leaf;
+        uint32_t n;
+        uint32_t child[INNER_MAX + 1];  //child[i] holds the keys before keys[i]
+        idx_key_t keys[INNER_MAX];
+    } inner;
+    char raw[IDX_PAGE_SIZE];
+} idx_page_t;
+
+typedef struct idx_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t root;          //0 while the index is being built
+    uint32_t height;        //levels, 1 when the root is a leaf
+    uint32_t num_pages;     //the header is page 0
+    uint32_t writers;       //processes with updates not yet flushed
+} idx_header_t;
+
+static struct {
+    int fd;                 //the index, -1 when there is none
+    int db_fd;
+    bool dirty;             //this process is counted in hdr.writers
+    bool broken;            //an update failed, leave it to be rebuilt
+    idx_header_t hdr;
+} idx = { -1, -1, false, false, {0} };
+
+static int key_cmp(const idx_key_t *a, const idx_key_t *b)
+{
+    int c = strncmp(a->lname, b->lname, IDX_NAME_LEN);
+
+    if (c != 0)
+        return c;
+    return (a->id > b->id) - (a->id < b->id);
+}
+
+static int key_cmp_qsort(const void *a, const void *b)
+{
+    return key_cmp(a, b);
+}
+
+static void make_key(idx_key_t *k, const char *lname, int id)
+{
+    memset(k, 0, sizeof(*k));
+    strncpy(k->lname, lname, IDX_NAME_LEN);
+    k->id = id;
+}
+
+//the first key at or after k
+static int lower_bound(const idx_key_t *keys, int n, const idx_key_t *k)
+{
+    int lo = 0;
+    int hi = n;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (key_cmp(&keys[mid], k) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+//the child of an inner page that k belongs under
+static int child_of(const idx_page_t *page, const idx_key_t *k)
+{
+    int lo = 0;
+    int hi = page->inner.n;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (key_cmp(&page->inner.keys[mid], k) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int read_page(uint32_t pno, idx_page_t *page)
+{
+    if (pread(idx.fd, page, IDX_PAGE_SIZE, (off_t)pno * IDX_PAGE_SIZE) != IDX_PAGE_SIZE)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int write_page(uint32_t pno, const idx_page_t *page)
+{
+    if (pwrite(idx.fd, page, IDX_PAGE_SIZE, (off_t)pno * IDX_PAGE_SIZE) != IDX_PAGE_SIZE)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int read_header(void)
+{
+    if ((pread(idx.fd, &idx.hdr, sizeof(idx.hdr), 0) != sizeof(idx.hdr)) ||
+        (idx.hdr.magic != IDX_MAGIC) || (idx.hdr.version != IDX_VERSION))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int write_header(void)
+{
+    if (pwrite(idx.fd, &idx.hdr, sizeof(idx.hdr), 0) != sizeof(idx.hdr))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int lock_idx(int type)
+{
+    struct flock fl = { .l_type = type, .l_whence = SEEK_SET };
+
+    while (fcntl(idx.fd, F_OFD_SETLKW, &fl) < 0)
+    {
+        if (errno != EINTR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+//counts this process as a writer, on disk before it changes anything
+static int count_writer(void)
+{
+    if (idx.dirty)
+        return NO_ERROR;
+    idx.hdr.writers++;
+    if ((write_header() != NO_ERROR) || (fdatasync(idx.fd) < 0))
+        return ERR_DB_FILE;
+    idx.dirty = true;
+    return NO_ERROR;
+}
+
+static int begin_update(void)
+{
+    if (lock_idx(F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+    if ((read_header() != NO_ERROR) || (idx.hdr.root == 0) ||
+        (count_writer() != NO_ERROR))
+    {
+        lock_idx(F_UNLCK);
+        idx.broken = true;
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+static int end_update(int rc)
+{
+    if ((rc == NO_ERROR) && (write_header() != NO_ERROR))
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR)
+        idx.broken = true;
+    lock_idx(F_UNLCK);
+    return rc;
+}
+
+static int insert_leaf(uint32_t pno, idx_page_t *page, const idx_key_t *k,
+                       idx_key_t *up_key, uint32_t *up_pno)
+{
+    idx_key_t *keys = page->leaf.keys;
+    int n = page->leaf.n;
+    int at = lower_bound(keys, n, k);
+
+    if ((at < n) && (key_cmp(&keys[at], k) == 0))
+        return NO_ERROR;
+
+    if (n < LEAF_MAX)
+    {
+        memmove(&keys[at + 1], &keys[at], (n - at) * sizeof(idx_key_t));
+        keys[at] = *k;
+        page->leaf.n++;
+        return write_page(pno, page);
+    }
+
+    // full, the upper half moves to a new page to the right
+    idx_key_t all[LEAF_MAX + 1];
+    idx_page_t right;
+    int left_n = (LEAF_MAX + 1) / 2;
+
+    memcpy(all, keys, at * sizeof(idx_key_t));
+    all[at] = *k;
+    memcpy(&all[at + 1], &keys[at], (n - at) * sizeof(idx_key_t));
+
+    memset(&right, 0, sizeof(right));
+    right.leaf.is_leaf = 1;
+    right.leaf.n = LEAF_MAX + 1 - left_n;
+    right.leaf.next = page->leaf.next;
+    memcpy(right.leaf.keys, &all[left_n], right.leaf.n * sizeof(idx_key_t));
+
+    *up_pno = idx.hdr.num_pages++;
+    *up_key = right.leaf.keys[0];
+    page->leaf.n = left_n;
+    page->leaf.next = *up_pno;
+    memcpy(keys, all, left_n * sizeof(idx_key_t));
+
+    if (write_page(*up_pno, &right) != NO_ERROR)
+        return ERR_DB_FILE;
+    return write_page(pno, page);
+}
+
+//puts k, with the page to its right, in at keys[at] of an inner page
+static int insert_inner(uint32_t pno, idx_page_t *page, int at, const idx_key_t *k,
+                        uint32_t k_pno, idx_key_t *up_key, uint32_t *up_pno)
+{
+    int n = page->inner.n;
+
+    if (n < INNER_MAX)
+    {
+        memmove(&page->inner.keys[at + 1], &page->inner.keys[at], (n - at) * sizeof(idx_key_t));
+        memmove(&page->inner.child[at + 2], &page->inner.child[at + 1], (n - at) * sizeof(uint32_t));
+        page->inner.keys[at] = *k;
+        page->inner.child[at + 1] = k_pno;
+        page->inner.n++;
+        return write_page(pno, page);
+    }
+
+    // full, the middle key moves up and the keys after it to a new page
+    idx_key_t keys[INNER_MAX + 1];
+    uint32_t kids[INNER_MAX + 2];
+    idx_page_t right;
+    int mid = (INNER_MAX + 1) / 2;
+
+    memcpy(keys, page->inner.keys, at * sizeof(idx_key_t));
+    keys[at] = *k;
+    memcpy(&keys[at + 1], &page->inner.keys[at], (n - at) * sizeof(idx_key_t));
+    memcpy(kids, page->inner.child, (at + 1) * sizeof(uint32_t));
+    kids[at + 1] = k_pno;
+    memcpy(&kids[at + 2], &page->inner.child[at + 1], (n - at) * sizeof(uint32_t));
+
+    memset(&right, 0, sizeof(right));
+    right.inner.n = INNER_MAX - mid;
+    memcpy(right.inner.keys, &keys[mid + 1], right.inner.n * sizeof(idx_key_t));
+    memcpy(right.inner.child, &kids[mid + 1], (right.inner.n + 1) * sizeof(uint32_t));
+
+    page->inner.n = mid;
+    memcpy(page->inner.keys, keys, mid * sizeof(idx_key_t));
+    memcpy(page->inner.child, kids, (mid + 1) * sizeof(uint32_t));
+
+    *up_pno = idx.hdr.num_pages++;
+    *up_key = keys[mid];
+    if (write_page(*up_pno, &right) != NO_ERROR)
+        return ERR_DB_FILE;
+    return write_page(pno, page);
+}
+
+//adds k under page pno.  If the page split, *up_pno is the new page to
+//its right and *up_key the key that separates them, otherwise *up_pno is 0
+static int insert_below(uint32_t pno, const idx_key_t *k, idx_key_t *up_key, uint32_t *up_pno)
+{
+    idx_page_t page;
+    idx_key_t child_key;
+    uint32_t child_pno = 0;
+
+    *up_pno = 0;
+    if (read_page(pno, &page) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (page.leaf.is_leaf)
+        return insert_leaf(pno, &page, k, up_key, up_pno);
+
+    int at = child_of(&page, k);
+    if (insert_below(page.inner.child[at], k, &child_key, &child_pno) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (child_pno == 0)
+        return NO_ERROR;
+    return insert_inner(pno, &page, at, &child_key, child_pno, up_key, up_pno);
+}
+
+//the leaf k belongs in
+static int find_leaf(const idx_key_t *k, uint32_t *pno, idx_page_t *page)
+{
+    *pno = idx.hdr.root;
+    if (read_page(*pno, page) != NO_ERROR)
+        return ERR_DB_FILE;
+    while (!page->leaf.is_leaf)
+    {
+        *pno = page->inner.child[child_of(page, k)];
+        if (read_page(*pno, page) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  idx_insert
+ *      *s:  the student about to be added
+ *
+ *  returns:  NO_ERROR       the key is in the index
+ *            ERR_DB_FILE    it could not be added, the index will be
+ *                           rebuilt
+ */
+int idx_insert(const student_t *s)
+{
+    idx_key_t k;
+    idx_key_t up_key;
+    uint32_t up_pno;
+    int rc;
+
+    make_key(&k, s->lname, s->id);
+    if (begin_update() != NO_ERROR)
+        return ERR_DB_FILE;
+
+    rc = insert_below(idx.hdr.root, &k, &up_key, &up_pno);
+    if ((rc == NO_ERROR) && (up_pno != 0))
+    {
+        // the root split, a new root goes over the two halves
+        idx_page_t root;
+
+        memset(&root, 0, sizeof(root));
+        root.inner.n = 1;
+        root.inner.keys[0] = up_key;
+        root.inner.child[0] = idx.hdr.root;
+        root.inner.child[1] = up_pno;
+        idx.hdr.root = idx.hdr.num_pages++;
+        idx.hdr.height++;
+        rc = write_page(idx.hdr.root, &root);
+    }
+    return end_update(rc);
+}
+
+/*
+ *  idx_delete
+ *      *s:  the student that was deleted
+ *
+ *  returns:  NO_ERROR       the key is not in the index
+ *            ERR_DB_FILE    it could not be taken out, the index will be
+ *                           rebuilt
+ */
+int idx_delete(const student_t *s)
+{
+    idx_page_t page;
+    idx_key_t k;
+    uint32_t pno;
+    int rc;
+
+    make_key(&k, s->lname, s->id);
+    if (begin_update() != NO_ERROR)
+        return ERR_DB_FILE;
+
+    rc = find_leaf(&k, &pno, &page);
+    if (rc == NO_ERROR)
+    {
+        idx_key_t *keys = page.leaf.keys;
+        int n = page.leaf.n;
+        int at = lower_bound(keys, n, &k);
+
+        if ((at < n) && (key_cmp(&keys[at], &k) == 0))
+        {
+            memmove(&keys[at], &keys[at + 1], (n - at - 1) * sizeof(idx_key_t));
+            page.leaf.n--;
+            rc = write_page(pno, &page);
+        }
+    }
+    return end_update(rc);
+}
+
+/*
+ *  idx_search
+ *      pattern:  a last name, or a prefix followed by '*', either cut
+ *                to the IDX_NAME_LEN - 1 characters a last name keeps
+ *      visit:    called with the id of every key that matches, in last
+ *                name order; stops the search if it does not return
+ *                NO_ERROR
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the index could not be read
+ *            or what visit returned
+ */
+int idx_search(const char *pattern, int (*visit)(int id, const char *lname, void *arg), void *arg)
+{
+    size_t len = strlen(pattern);
+    bool prefix = (len > 0) && (pattern[len - 1] == '*');
+    idx_page_t page;
+    idx_key_t from;
+    uint32_t pno;
+    int rc;
+
+    if (prefix)
+        len--;
+    // add_student() keeps the first IDX_NAME_LEN - 1 characters of a last
+    // name, so a longer pattern is cut down the same way
+    if (len > IDX_NAME_LEN - 1)
+        len = IDX_NAME_LEN - 1;
+    memset(&from, 0, sizeof(from));
+    memcpy(from.lname, pattern, len);
+    from.id = INT_MIN;
+    if (!prefix)
+        len = IDX_NAME_LEN;
+
+    if (lock_idx(F_RDLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = ((read_header() != NO_ERROR) || (idx.hdr.root == 0)) ? ERR_DB_FILE :
+         find_leaf(&from, &pno, &page);
+
+    int at = (rc == NO_ERROR) ? lower_bound(page.leaf.keys, page.leaf.n, &from) : 0;
+    while (rc == NO_ERROR)
+    {
+        // deletes can leave leaves empty, the chain goes on past them
+        if (at == (int)page.leaf.n)
+        {
+            if (page.leaf.next == 0)
+                break;
+            rc = read_page(page.leaf.next, &page);
+            at = 0;
+            continue;
+        }
+        idx_key_t *k = &page.leaf.keys[at++];
+        if (strncmp(k->lname, from.lname, len) != 0)
+            break;
+        rc = visit(k->id, k->lname, arg);
+    }
+
+    lock_idx(F_UNLCK);
+    return rc;
+}
+
+typedef struct key_list {
+    idx_key_t *keys;
+    int n;
+    int cap;
+} key_list_t;
+
+static int collect_key(student_t *s, void *arg)
+{
+    key_list_t *list = arg;
+
+    if (list->n == list->cap)
+    {
+        int cap = (list->cap == 0) ? 1024 : list->cap * 2;
+        idx_key_t *keys = realloc(list->keys, cap * sizeof(idx_key_t));
+        if (keys == NULL)
+            return ERR_DB_FILE;
+        list->keys = keys;
+        list->cap = cap;
+    }
+    make_key(&list->keys[list->n++], s->lname, s->id);
+    return NO_ERROR;
+}
+
+//writes the sorted keys out as a new tree, leaves first then each level of
+//inner pages above them, and then the header pointing at its root
+static int build(const idx_key_t *keys, int n)
+{
+    int count = (n + LEAF_FILL - 1) / LEAF_FILL;
+    uint32_t next_pno = 1;
+    idx_page_t page;
+
+    if (count == 0)
+        count = 1;
+    uint32_t *pnos = malloc(count * sizeof(uint32_t));
+    idx_key_t *firsts = malloc(count * sizeof(idx_key_t));
+    if ((pnos == NULL) || (firsts == NULL))
+    {
+        free(pnos);
+        free(firsts);
+        return ERR_DB_FILE;
+    }
+
+    int rc = NO_ERROR;
+    for (int i = 0; (rc == NO_ERROR) && (i < count); i++)
+    {
+        int first = i * LEAF_FILL;
+        memset(&page, 0, sizeof(page));
+        page.leaf.is_leaf = 1;
+        page.leaf.n = (n - first < LEAF_FILL) ? n - first : LEAF_FILL;
+        page.leaf.next = (i + 1 < count) ? next_pno + 1 : 0;
+        memcpy(page.leaf.keys, &keys[first], page.leaf.n * sizeof(idx_key_t));
+        pnos[i] = next_pno;
+        if (page.leaf.n > 0)
+            firsts[i] = keys[first];
+        rc = write_page(next_pno++, &page);
+    }
+
+    uint32_t height = 1;
+    while ((rc == NO_ERROR) && (count > 1))
+    {
+        int parents = (count + INNER_FILL) / (INNER_FILL + 1);
+        for (int j = 0; (rc == NO_ERROR) && (j < parents); j++)
+        {
+            int first = j * (INNER_FILL + 1);
+            int kids = (count - first < INNER_FILL + 1) ? count - first : INNER_FILL + 1;
+
+            memset(&page, 0, sizeof(page));
+            page.inner.n = kids - 1;
+            for (int c = 0; c < kids; c++)
+            {
+                page.inner.child[c] = pnos[first + c];
+                if (c > 0)
+                    page.inner.keys[c - 1] = firsts[first + c];
+            }
+            pnos[j] = next_pno;
+            firsts[j] = firsts[first];
+            rc = write_page(next_pno++, &page);
+        }
+        count = parents;
+        height++;
+    }
+
+    if (rc == NO_ERROR)
+    {
+        idx.hdr.root = pnos[0];
+        idx.hdr.height = height;
+        idx.hdr.num_pages = next_pno;
+        if ((write_header() != NO_ERROR) ||
+            (ftruncate(idx.fd, (off_t)next_pno * IDX_PAGE_SIZE) < 0))
+            rc = ERR_DB_FILE;
+    }
+    free(pnos);
+    free(firsts);
+    return rc;
+}
+
+//a new index from the students in the database.  fresh: nobody else has
+//the index open, any writers it counts crashed
+static int rebuild(bool fresh)
+{
+    key_list_t list = { NULL, 0, 0 };
+    uint32_t writers;
+    int rc;
+
+    if (lock_idx(F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    writers = ((read_header() == NO_ERROR) && !fresh) ? idx.hdr.writers : 0;
+    if (!idx.dirty)
+        writers++;
+    memset(&idx.hdr, 0, sizeof(idx.hdr));
+    idx.hdr.magic = IDX_MAGIC;
+    idx.hdr.version = IDX_VERSION;
+    idx.hdr.writers = writers;
+    idx.dirty = true;
+    idx.broken = false;
+
+    // root 0 marks the index as being built until build() is done
+    rc = ((write_header() == NO_ERROR) && (fdatasync(idx.fd) == 0)) ? NO_ERROR : ERR_DB_FILE;
+    if (rc == NO_ERROR)
+        rc = scan_db(idx.db_fd, collect_key, &list);
+    if (rc == NO_ERROR)
+    {
+        qsort(list.keys, list.n, sizeof(idx_key_t), key_cmp_qsort);
+        rc = build(list.keys, list.n);
+    }
+    if (rc != NO_ERROR)
+        idx.broken = true;
+
+    lock_idx(F_UNLCK);
+    free(list.keys);
+    return (rc == NO_ERROR) ? list.n : rc;
+}
+
+/*
+ *  idx_rebuild
+ *
+ *  Builds the index again from the database, packed, e.g. for a database
+ *  written by something that does not keep the index.
+ *
+ *  returns:  <number>       the students in the index
+ *            ERR_DB_FILE    the database could not be read or the index
+ *                           written
+ */
+int idx_rebuild(void)
+{
+    if (idx.fd < 0)
+        return ERR_DB_FILE;
+    return rebuild(false);
+}
+
+/*
+ *  idx_open
+ *      db_fd:  database file from open_db()
+ *      path:   the index, IDX_FILE for DB_FILE
+ *
+ *  Opens the last name index for the database.  If no other process has
+ *  it open and it is missing, not an index, or was left behind by a
+ *  crash, it is rebuilt first.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the index could not be opened or rebuilt
+ */
+int idx_open(int db_fd, const char *path)
+{
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    int rc = NO_ERROR;
+
+    if (idx.fd >= 0)
+        idx_close();
+
+    idx.fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, mode);
+    if (idx.fd < 0)
+        return ERR_DB_FILE;
+    idx.db_fd = db_fd;
+    idx.dirty = false;
+    idx.broken = false;
+
+    if ((flock(idx.fd, LOCK_EX | LOCK_NB) == 0) &&
+        ((read_header() != NO_ERROR) || (idx.hdr.writers != 0) || (idx.hdr.root == 0)))
+        rc = rebuild(true);
+
+    if ((rc < 0) || (flock(idx.fd, LOCK_SH) < 0))
+    {
+        close(idx.fd);
+        idx.fd = -1;
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+int idx_active(int db_fd)
+{
+    return (idx.fd >= 0) && (idx.db_fd == db_fd);
+}
+
+/*
+ *  idx_close
+ *
+ *  Flushes what this process wrote to the index and stops counting it as
+ *  a writer, unless an update failed, then closes the index.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the index could not be flushed, it will be
+ *                           rebuilt
+ */
+int idx_close(void)
+{
+    int rc = NO_ERROR;
+
+    if (idx.fd < 0)
+        return NO_ERROR;
+
+    if (idx.dirty && !idx.broken)
+    {
+        rc = ERR_DB_FILE;
+        if ((fdatasync(idx.fd) == 0) && (lock_idx(F_WRLCK) == NO_ERROR))
+        {
+            if ((read_header() == NO_ERROR) && (idx.hdr.writers > 0))
+            {
+                idx.hdr.writers--;
+                rc = write_header();
+            }
+            lock_idx(F_UNLCK);
+        }
+    }
+    close(idx.fd);
+    idx.fd = -1;
+    idx.db_fd = -1;
+    idx.dirty = false;
+    idx.broken = false;
+    return rc;
+}
+
+/*
+ *  idx_reset
+ *      path:  the index, IDX_FILE for DB_FILE
+ *
+ *  Empties the index of a database that was itself just emptied, it is
+ *  rebuilt, empty, when it is next opened.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int idx_reset(const char *path)
+{
+    if ((truncate(path, 0) < 0) && (errno != ENOENT))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE    //fallocate()
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_mmap.c - memory mapped storage engine for the student database
+ *
+ * The fd engine pays for an lseek() and a read() on every record it looks
+ * at, so a full scan of a MAX_STD_ID file is 100k syscalls.  This engine
+ * maps the file once and student `id` is simply the record at
+ * base + id * sizeof(student_t).  The mapping always covers the largest
+ * file the id range allows, so it never has to be moved when the file
+ * grows; only the part up to the end of the file may be touched, so an
+ * add past the end extends the file with fallocate() of the record first,
+ * leaving the same sparse hole before it a write() there would have.
+ * Unlike ftruncate() that never shrinks the file, so it is safe with
+ * another process extending it past us at the same time.
+ *
+ * Point lookups are the common case, the mapping is set up MADV_RANDOM so
+ * a lookup does not drag in read ahead, and a scan switches it over to
+ * MADV_SEQUENTIAL.  Records written are tracked as a range of ids and
+ * flushed with msync() when the database is closed, that is the commit,
+ * or by mmap_sync() for a long running process like the server.
+ *
+ * There is one database per process, so the state is kept here rather
+ * than being handed around with the fd.
+ */
+
+#define DB_MAP_RECORDS  (MAX_STD_ID + 1)
+#define DB_MAP_SIZE     ((size_t)DB_MAP_RECORDS * sizeof(student_t))
+
+static struct {
+    int fd;             //-1 when nothing is mapped
+    student_t *base;
+    int num_records;    //whole records in the file, the rest is past EOF
+    int dirty_lo;       //ids written since the last msync(),
+    int dirty_hi;       //nothing is dirty when dirty_lo > dirty_hi
+} db_map = { -1, NULL, 0, 1, 0 };
+
+//the file may have grown underneath us, e.g. another sdbsc adding a student
+static int refresh_size(void)
+{
+    struct stat st;
+
+    if (fstat(db_map.fd, &st) < 0)
+        return ERR_DB_FILE;
+    db_map.num_records = st.st_size / STUDENT_RECORD_SIZE;
+    if (db_map.num_records > DB_MAP_RECORDS)
+        db_map.num_records = DB_MAP_RECORDS;
+    return NO_ERROR;
+}
+
+/*
+ *  mmap_open
+ *      fd:  database file from open_db(), opened O_RDWR
+ *
+ *  returns:  NO_ERROR       the file is mapped
+ *            ERR_DB_FILE    it could not be
+ */
+int mmap_open(int fd)
+{
+    void *base;
+
+    if (db_map.base != NULL)
+        mmap_close();
+
+    base = mmap(NULL, DB_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+        return ERR_DB_FILE;
+
+    db_map.fd = fd;
+    db_map.base = base;
+    db_map.dirty_lo = 1;
+    db_map.dirty_hi = 0;
+    if (refresh_size() != NO_ERROR)
+    {
+        mmap_close();
+        return ERR_DB_FILE;
+    }
+    madvise(base, DB_MAP_SIZE, MADV_RANDOM);
+    return NO_ERROR;
+}
+
+int mmap_active(int fd)
+{
+    return (db_map.base != NULL) && (db_map.fd == fd);
+}
+
+/*
+ *  mmap_get_student
+ *      id:  the student id we are looking for
+ *      *s:  where the student is copied if found
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            ERR_DB_FILE    the file size could not be checked
+ *            SRCH_NOT_FOUND student was not located in the database
+ */
+int mmap_get_student(int id, student_t *s)
+{
+    if ((id < 0) || (id >= DB_MAP_RECORDS))
+        return SRCH_NOT_FOUND;
+    if ((id >= db_map.num_records) && (refresh_size() != NO_ERROR))
+        return ERR_DB_FILE;
+    if (id >= db_map.num_records)
+        return SRCH_NOT_FOUND;
+
+    *s = db_map.base[id];
+    if (memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
+        return SRCH_NOT_FOUND;
+    return NO_ERROR;
+}
+
+/*
+ *  mmap_put_student
+ *      id:  the slot to write
+ *      *s:  the record, EMPTY_STUDENT_RECORD to clear the slot
+ *
+ *  returns:  NO_ERROR       record written to the mapping
+ *            ERR_DB_FILE    id is outside the mapping or the file could
+ *                           not be extended
+ */
+int mmap_put_student(int id, const student_t *s)
+{
+    if ((id < 0) || (id >= DB_MAP_RECORDS))
+        return ERR_DB_FILE;
+    if ((id >= db_map.num_records) && (refresh_size() != NO_ERROR))
+        return ERR_DB_FILE;
+    if (id >= db_map.num_records)
+    {
+        off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
+        if ((fallocate(db_map.fd, 0, offset, STUDENT_RECORD_SIZE) < 0) &&
+            ((errno != EOPNOTSUPP) ||
+             (ftruncate(db_map.fd, offset + STUDENT_RECORD_SIZE) < 0)))
+            return ERR_DB_FILE;
+        if (refresh_size() != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    db_map.base[id] = *s;
+    if (db_map.dirty_lo > db_map.dirty_hi)
+    {
+        db_map.dirty_lo = id;
+        db_map.dirty_hi = id;
+    }
+    else if (id < db_map.dirty_lo)
+        db_map.dirty_lo = id;
+    else if (id > db_map.dirty_hi)
+        db_map.dirty_hi = id;
+    return NO_ERROR;
+}
+
+/*
+ *  mmap_table
+ *      *num_records:  set to the number of slots in the file
+ *
+ *  Hands a scan the records in the file as an array, and tells the kernel
+ *  it is about to be read front to back.
+ *
+ *  returns:  the first record, slot 0
+ */
+student_t *mmap_table(int *num_records)
+{
+    refresh_size();
+    if (db_map.num_records > 0)
+        madvise(db_map.base, (size_t)db_map.num_records * STUDENT_RECORD_SIZE,
+                MADV_SEQUENTIAL);
+    *num_records = db_map.num_records;
+    return db_map.base;
+}
+
+/*
+ *  mmap_sync
+ *
+ *  Commits the records written since the last commit with msync().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    msync() failed, the writes may not be on disk
+ */
+int mmap_sync(void)
+{
+    if ((db_map.base == NULL) || (db_map.dirty_lo > db_map.dirty_hi))
+        return NO_ERROR;
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t start = (size_t)db_map.dirty_lo * STUDENT_RECORD_SIZE;
+    size_t end = (size_t)(db_map.dirty_hi + 1) * STUDENT_RECORD_SIZE;
+
+    start -= start % page;
+    if (msync((char *)db_map.base + start, end - start, MS_SYNC) < 0)
+        return ERR_DB_FILE;
+    db_map.dirty_lo = 1;
+    db_map.dirty_hi = 0;
+    return NO_ERROR;
+}
+
+/*
+ *  mmap_close
+ *
+ *  Commits the records written with mmap_sync() and unmaps the file.  The
+ *  fd itself is left open for the caller.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    msync() failed, the writes may not be on disk
+ */
+int mmap_close(void)
+{
+    int rc;
+
+    if (db_map.base == NULL)
+        return NO_ERROR;
+
+    rc = mmap_sync();
+    munmap(db_map.base, DB_MAP_SIZE);
+    db_map.base = NULL;
+    db_map.fd = -1;
+    db_map.dirty_lo = 1;
+    db_map.dirty_hi = 0;
+    return rc;
+}
@@ -0,0 +1,632 @@
+#define _GNU_SOURCE    //F_OFD_SETLKW, fallocate()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_paged.c - format 2 of the student database, a paged hash
+ *
+ * In the original format a student's id is its slot, at id * 64 bytes
+ * into the file, which caps ids at MAX_STD_ID and makes a file as big as
+ * its highest id.  Format 2 keeps students in 4K bucket pages instead,
+ * each an array of PDB_SLOTS (64 bit id, student_t) slots, and finds the
+ * bucket for an id with extendible hashing: the low global_depth bits of
+ * a hash of the id index a directory of bucket page numbers.  A bucket
+ * that fills up is split in two on the next bit of the hash, doubling the
+ * directory first if it has to, so the file grows with the number of
+ * students rather than with their ids, and any id from 1 to INT64_MAX
+ * can be stored.
+ *
+ * Page 0 is the header, which is where the legacy format's slot 0 (id 0,
+ * never a student) was, so the two formats tell themselves apart by the
+ * first 8 bytes.  Each process keeps the directory in memory and reads it
+ * again only when the header's dir_version says another process changed
+ * it, so a lookup is the header and one bucket page: O(1) reads whatever
+ * the number of students.
+ *
+ * Operations hold an OFD lock on the whole file, a read lock for lookups
+ * and scans and a write lock for changes.  A split writes the new page
+ * before the directory points at it and rewrites the old page last, so a
+ * process that dies part way leaves at worst a page nothing points at or
+ * students still in the old page as well; lookups and scans only believe
+ * a slot in the page the directory has for its id.  Format 2 does not go
+ * through the write ahead log yet, so writes are only flushed when the
+ * database is closed.
+ */
+
+#define PDB_MAGIC           0x3245474150424453ULL   //"SDBPAGE2"
+#define PDB_VERSION         2
+#define PDB_PAGE_SIZE       4096
+#define PDB_BUCKET_MAGIC    0x544b4355              //"UCKT"
+#define PDB_SLOTS           56
+#define PDB_DIR_ENTRIES     (PDB_PAGE_SIZE / (int)sizeof(uint32_t))
+#define PDB_MAX_DEPTH       24
+#define PDB_SCAN_PAGES      64                      //pages read at a time
+
+typedef struct pdb_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t global_depth;  //the directory has 2^global_depth entries
+    uint32_t dir_page;      //where it starts
+    uint32_t dir_pages;
+    uint32_t num_pages;     //header included
+    uint32_t dir_version;   //bumped every time the directory changes
+} pdb_header_t;
+
+typedef struct pdb_slot {
+    int64_t id;
+    student_t rec;          //rec.id is the id if it fits, otherwise 0
+} pdb_slot_t;
+
+typedef union pdb_page {
+    struct {
+        uint32_t magic;
+        uint32_t local_depth;   //the hash bits every id in the page shares
+        uint32_t n;             //slots in use, they come first
+        uint32_t unused;
+        pdb_slot_t slots[PDB_SLOTS];
+    } bucket;
+    uint32_t dir[PDB_DIR_ENTRIES];
+    char raw[PDB_PAGE_SIZE];
+} pdb_page_t;
+
+static struct {
+    int fd;                 //-1 when no database is open
+    bool dirty;             //written since it was opened
+    pdb_header_t hdr;
+    uint32_t *dir;          //dir_pages worth of entries
+    uint32_t dir_version;   //the version dir holds, if dir is not NULL
+} pdb = { -1, false, {0}, NULL, 0 };
+
+//splitmix64's finalizer, a bijection, so no two ids share a hash
+static uint64_t hash_id(int64_t id)
+{
+    uint64_t h = (uint64_t)id;
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static uint32_t dir_index(uint64_t h)
+{
+    return (uint32_t)(h & ((1ULL << pdb.hdr.global_depth) - 1));
+}
+
+static int read_pages(uint32_t pno, void *buff, int count)
+{
+    size_t len = (size_t)count * PDB_PAGE_SIZE;
+
+    if (pread(pdb.fd, buff, len, (off_t)pno * PDB_PAGE_SIZE) != (ssize_t)len)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int write_pages(uint32_t pno, const void *buff, int count)
+{
+    size_t len = (size_t)count * PDB_PAGE_SIZE;
+
+    pdb.dirty = true;
+    if (pwrite(pdb.fd, buff, len, (off_t)pno * PDB_PAGE_SIZE) != (ssize_t)len)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int write_header(void)
+{
+    pdb.dirty = true;
+    if (pwrite(pdb.fd, &pdb.hdr, sizeof(pdb.hdr), 0) != sizeof(pdb.hdr))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int write_dir(void)
+{
+    return write_pages(pdb.hdr.dir_page, pdb.dir, pdb.hdr.dir_pages);
+}
+
+static int lock_pdb(int type)
+{
+    struct flock fl = { .l_type = type, .l_whence = SEEK_SET };
+
+    while (fcntl(pdb.fd, F_OFD_SETLKW, &fl) < 0)
+    {
+        if (errno != EINTR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+//the header, and the directory if another process has changed it
+static int load(void)
+{
+    if ((pread(pdb.fd, &pdb.hdr, sizeof(pdb.hdr), 0) != sizeof(pdb.hdr)) ||
+        (pdb.hdr.magic != PDB_MAGIC) || (pdb.hdr.version != PDB_VERSION) ||
+        (pdb.hdr.page_size != PDB_PAGE_SIZE) || (pdb.hdr.global_depth > PDB_MAX_DEPTH) ||
+        ((1ULL << pdb.hdr.global_depth) > (uint64_t)pdb.hdr.dir_pages * PDB_DIR_ENTRIES))
+        return ERR_DB_FILE;
+    if ((pdb.dir != NULL) && (pdb.dir_version == pdb.hdr.dir_version))
+        return NO_ERROR;
+
+    uint32_t *dir = realloc(pdb.dir, (size_t)pdb.hdr.dir_pages * PDB_PAGE_SIZE);
+    if (dir == NULL)
+        return ERR_DB_FILE;
+    pdb.dir = dir;
+    if (read_pages(pdb.hdr.dir_page, pdb.dir, pdb.hdr.dir_pages) != NO_ERROR)
+    {
+        free(pdb.dir);
+        pdb.dir = NULL;
+        return ERR_DB_FILE;
+    }
+    pdb.dir_version = pdb.hdr.dir_version;
+    return NO_ERROR;
+}
+
+//reads the bucket id belongs in, *at is the slot it is in or -1
+static int find(int64_t id, uint32_t *pno, pdb_page_t *page, int *at)
+{
+    *pno = pdb.dir[dir_index(hash_id(id))];
+    if ((read_pages(*pno, page, 1) != NO_ERROR) || (page->bucket.magic != PDB_BUCKET_MAGIC) ||
+        (page->bucket.n > PDB_SLOTS))
+        return ERR_DB_FILE;
+
+    *at = -1;
+    for (int i = 0; i < (int)page->bucket.n; i++)
+        if (page->bucket.slots[i].id == id)
+            *at = i;
+    return NO_ERROR;
+}
+
+//twice the entries, the second half a copy of the first
+static int double_dir(void)
+{
+    uint32_t n = 1U << pdb.hdr.global_depth;
+    uint32_t pages = (2 * n + PDB_DIR_ENTRIES - 1) / PDB_DIR_ENTRIES;
+
+    if (pdb.hdr.global_depth == PDB_MAX_DEPTH)
+        return ERR_DB_FILE;
+
+    if (pages > pdb.hdr.dir_pages)
+    {
+        // a bigger directory goes at the end of the file, counted in the
+        // header before it is written, and the old one is given back
+        uint32_t *dir = realloc(pdb.dir, (size_t)pages * PDB_PAGE_SIZE);
+        uint32_t old_page = pdb.hdr.dir_page;
+        uint32_t old_pages = pdb.hdr.dir_pages;
+
+        if (dir == NULL)
+            return ERR_DB_FILE;
+        pdb.dir = dir;
+        memcpy(pdb.dir + n, pdb.dir, n * sizeof(uint32_t));
+        memset(pdb.dir + 2 * n, 0, ((size_t)pages * PDB_DIR_ENTRIES - 2 * n) * sizeof(uint32_t));
+
+        uint32_t new_page = pdb.hdr.num_pages;
+        pdb.hdr.num_pages += pages;
+        if (write_header() != NO_ERROR)
+            return ERR_DB_FILE;
+        pdb.hdr.dir_page = new_page;
+        pdb.hdr.dir_pages = pages;
+        pdb.hdr.global_depth++;
+        pdb.hdr.dir_version++;
+        if ((write_dir() != NO_ERROR) || (write_header() != NO_ERROR))
+            return ERR_DB_FILE;
+        pdb.dir_version = pdb.hdr.dir_version;
+
+        // zeros either way, which no scan takes for a bucket
+        if (fallocate(pdb.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      (off_t)old_page * PDB_PAGE_SIZE, (off_t)old_pages * PDB_PAGE_SIZE) < 0)
+        {
+            pdb_page_t zero;
+            memset(&zero, 0, sizeof(zero));
+            for (uint32_t p = 0; p < old_pages; p++)
+                write_pages(old_page + p, &zero, 1);
+        }
+        return NO_ERROR;
+    }
+
+    memcpy(pdb.dir + n, pdb.dir, n * sizeof(uint32_t));
+    pdb.hdr.global_depth++;
+    pdb.hdr.dir_version++;
+    if ((write_dir() != NO_ERROR) || (write_header() != NO_ERROR))
+        return ERR_DB_FILE;
+    pdb.dir_version = pdb.hdr.dir_version;
+    return NO_ERROR;
+}
+
+//splits the full bucket in page pno on the next bit of the hash
+static int split(uint32_t pno, pdb_page_t *page)
+{
+    uint32_t depth = page->bucket.local_depth;
+    pdb_page_t high;
+    int kept = 0;
+
+    if ((depth == pdb.hdr.global_depth) && (double_dir() != NO_ERROR))
+        return ERR_DB_FILE;
+
+    // the new page is counted in the header before it is written, so no
+    // other split can be handed the same page
+    uint32_t high_pno = pdb.hdr.num_pages++;
+    if (write_header() != NO_ERROR)
+        return ERR_DB_FILE;
+
+    memset(&high, 0, sizeof(high));
+    high.bucket.magic = PDB_BUCKET_MAGIC;
+    high.bucket.local_depth = depth + 1;
+    for (int i = 0; i < (int)page->bucket.n; i++)
+    {
+        pdb_slot_t *slot = &page->bucket.slots[i];
+        if ((hash_id(slot->id) >> depth) & 1)
+            high.bucket.slots[high.bucket.n++] = *slot;
+        else
+            page->bucket.slots[kept++] = *slot;
+    }
+    memset(&page->bucket.slots[kept], 0, (page->bucket.n - kept) * sizeof(pdb_slot_t));
+    page->bucket.n = kept;
+    page->bucket.local_depth = depth + 1;
+
+    if (write_pages(high_pno, &high, 1) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (uint32_t i = 0; i < (1U << pdb.hdr.global_depth); i++)
+        if ((pdb.dir[i] == pno) && ((i >> depth) & 1))
+            pdb.dir[i] = high_pno;
+    pdb.hdr.dir_version++;
+    if ((write_dir() != NO_ERROR) || (write_header() != NO_ERROR))
+        return ERR_DB_FILE;
+    pdb.dir_version = pdb.hdr.dir_version;
+    return write_pages(pno, page, 1);
+}
+
+/*
+ *  pdb_detect
+ *      fd:  database file from open_db()
+ *
+ *  returns:  true if the file is in format 2, false if it is in the
+ *            original format (or empty)
+ */
+bool pdb_detect(int fd)
+{
+    uint64_t magic = 0;
+
+    return (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic)) && (magic == PDB_MAGIC);
+}
+
+/*
+ *  pdb_create
+ *      fd:  an empty file
+ *
+ *  Writes an empty format 2 database: the header, a directory of one
+ *  entry, and the one empty bucket it points at.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int pdb_create(int fd)
+{
+    pdb_header_t hdr = { PDB_MAGIC, PDB_VERSION, PDB_PAGE_SIZE, 0, 1, 1, 3, 0 };
+    pdb_page_t page;
+
+    memset(&page, 0, sizeof(page));
+    page.dir[0] = 2;
+    if (pwrite(fd, &page, sizeof(page), (off_t)1 * PDB_PAGE_SIZE) != sizeof(page))
+        return ERR_DB_FILE;
+
+    memset(&page, 0, sizeof(page));
+    page.bucket.magic = PDB_BUCKET_MAGIC;
+    if (pwrite(fd, &page, sizeof(page), (off_t)2 * PDB_PAGE_SIZE) != sizeof(page))
+        return ERR_DB_FILE;
+
+    // the header last, the file is not format 2 until it is complete
+    memset(&page, 0, sizeof(page));
+    memcpy(&page, &hdr, sizeof(hdr));
+    if (pwrite(fd, &page, sizeof(page), 0) != sizeof(page))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  pdb_open
+ *      fd:  a format 2 database file, see pdb_detect()
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the file is not a format 2 database
+ */
+int pdb_open(int fd)
+{
+    int rc;
+
+    if (pdb.fd >= 0)
+        pdb_close();
+    pdb.fd = fd;
+    pdb.dirty = false;
+
+    if (lock_pdb(F_RDLCK) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    else
+    {
+        rc = load();
+        lock_pdb(F_UNLCK);
+    }
+    if (rc != NO_ERROR)
+        pdb.fd = -1;
+    return rc;
+}
+
+/*
+ *  pdb_get
+ *      id:  the student to find
+ *      *s:  the student, if it was found
+ *
+ *  returns:  NO_ERROR       student found
+ *            SRCH_NOT_FOUND no student with that id
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int pdb_get(long long id, student_t *s)
+{
+    pdb_page_t page;
+    uint32_t pno;
+    int at;
+    int rc;
+
+    if (lock_pdb(F_RDLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = load();
+    if (rc == NO_ERROR)
+        rc = find(id, &pno, &page, &at);
+    if ((rc == NO_ERROR) && (at < 0))
+        rc = SRCH_NOT_FOUND;
+    if (rc == NO_ERROR)
+        *s = page.bucket.slots[at].rec;
+    lock_pdb(F_UNLCK);
+    return rc;
+}
+
+/*
+ *  pdb_insert
+ *      id:  the student's id, from 1 to PDB_MAX_ID
+ *      *s:  the student
+ *
+ *  returns:  NO_ERROR       student added
+ *            ERR_DB_OP      a student with that id already exists
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int pdb_insert(long long id, const student_t *s)
+{
+    pdb_page_t page;
+    uint32_t pno;
+    int at;
+    int rc;
+
+    if (lock_pdb(F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = load();
+    while ((rc == NO_ERROR) && ((rc = find(id, &pno, &page, &at)) == NO_ERROR))
+    {
+        if (at >= 0)
+        {
+            rc = ERR_DB_OP;
+            break;
+        }
+        if (page.bucket.n < PDB_SLOTS)
+        {
+            pdb_slot_t *slot = &page.bucket.slots[page.bucket.n++];
+            slot->id = id;
+            slot->rec = *s;
+            rc = write_pages(pno, &page, 1);
+            break;
+        }
+        // full, split it and look again, the id may land in either half
+        rc = split(pno, &page);
+    }
+    lock_pdb(F_UNLCK);
+    return rc;
+}
+
+/*
+ *  pdb_remove
+ *      id:  the student to delete
+ *
+ *  The last slot in the bucket moves into the one freed.  Buckets are not
+ *  merged when they empty.
+ *
+ *  returns:  NO_ERROR       student deleted
+ *            SRCH_NOT_FOUND no student with that id
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int pdb_remove(long long id)
+{
+    pdb_page_t page;
+    uint32_t pno;
+    int at;
+    int rc;
+
+    if (lock_pdb(F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = load();
+    if (rc == NO_ERROR)
+        rc = find(id, &pno, &page, &at);
+    if ((rc == NO_ERROR) && (at < 0))
+        rc = SRCH_NOT_FOUND;
+    if (rc == NO_ERROR)
+    {
+        uint32_t last = --page.bucket.n;
+        page.bucket.slots[at] = page.bucket.slots[last];
+        memset(&page.bucket.slots[last], 0, sizeof(pdb_slot_t));
+        rc = write_pages(pno, &page, 1);
+    }
+    lock_pdb(F_UNLCK);
+    return rc;
+}
+
+/*
+ *  pdb_scan
+ *      visit:  called with each student and its id, in no particular
+ *              order; stops the scan if it does not return NO_ERROR
+ *
+ *  Reads the file front to back PDB_SCAN_PAGES pages at a time.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *            or what visit returned
+ */
+int pdb_scan(int (*visit)(long long id, student_t *s, void *arg), void *arg)
+{
+    pdb_page_t *pages = malloc(PDB_SCAN_PAGES * sizeof(pdb_page_t));
+    int rc;
+
+    if (pages == NULL)
+        return ERR_DB_FILE;
+    if (lock_pdb(F_RDLCK) != NO_ERROR)
+    {
+        free(pages);
+        return ERR_DB_FILE;
+    }
+
+    rc = load();
+    for (uint32_t pno = 1; (rc == NO_ERROR) && (pno < pdb.hdr.num_pages); pno += PDB_SCAN_PAGES)
+    {
+        int count = (pdb.hdr.num_pages - pno < PDB_SCAN_PAGES) ? pdb.hdr.num_pages - pno : PDB_SCAN_PAGES;
+        ssize_t n = pread(pdb.fd, pages, (size_t)count * PDB_PAGE_SIZE, (off_t)pno * PDB_PAGE_SIZE);
+        if (n < 0)
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+
+        // a page the file ends before was never written, it is no bucket
+        for (int p = 0; (rc == NO_ERROR) && (p < (int)(n / PDB_PAGE_SIZE)); p++)
+        {
+            pdb_page_t *page = &pages[p];
+            if ((page->bucket.magic != PDB_BUCKET_MAGIC) || (page->bucket.n > PDB_SLOTS) ||
+                ((pno + p >= pdb.hdr.dir_page) && (pno + p < pdb.hdr.dir_page + pdb.hdr.dir_pages)))
+                continue;
+            for (int i = 0; (rc == NO_ERROR) && (i < (int)page->bucket.n); i++)
+            {
+                pdb_slot_t *slot = &page->bucket.slots[i];
+                // left behind by a split that did not finish
+                if (pdb.dir[dir_index(hash_id(slot->id))] != pno + p)
+                    continue;
+                rc = visit(slot->id, &slot->rec, arg);
+            }
+        }
+    }
+
+    lock_pdb(F_UNLCK);
+    free(pages);
+    return rc;
+}
+
+/*
+ *  pdb_close
+ *
+ *  Flushes what was written to the database, it is not closed.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int pdb_close(void)
+{
+    int rc = NO_ERROR;
+
+    if (pdb.fd < 0)
+        return NO_ERROR;
+    if (pdb.dirty && (fdatasync(pdb.fd) < 0))
+        rc = ERR_DB_FILE;
+    free(pdb.dir);
+    pdb.dir = NULL;
+    pdb.fd = -1;
+    pdb.dirty = false;
+    return rc;
+}
+
+static int migrate_student(student_t *s, void *arg)
+{
+    int rc = pdb_insert(s->id, s);
+
+    if (rc == NO_ERROR)
+        (*(int *)arg)++;
+    return rc;
+}
+
+/*
+ *  migrate_db
+ *      fd:  the database, in the original format, with attach_engine()
+ *
+ *  Rewrites DB_FILE in format 2, the way compress_db() rewrites it: every
+ *  student is copied into a new format 2 file, which is flushed and then
+ *  renamed over DB_FILE.  The database is locked against writers while it
+ *  is copied, but a process that has DB_FILE open keeps the old file, so
+ *  nothing else should be using the database.  The write ahead log has
+ *  been checkpointed by then and is emptied, and so is the last name
+ *  index, which format 2 does not keep yet.
+ *
+ *  returns:  <fd>           of DB_FILE in format 2
+ *            ERR_DB_FILE    database file I/O issue, DB_FILE is unchanged
+ *
+ *  console:  M_DB_MIGRATED    on success
+ *            M_ERR_DB_READ    error reading the database
+ *            M_ERR_DB_WRITE   error writing the new file
+ *            M_ERR_DB_CREATE  error replacing the database
+ */
+int migrate_db(int fd)
+{
+    int count = 0;
+    int rc;
+
+    if (lock_records(fd, 0, 0, F_WRLCK) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    int tmp_fd = open_db(TMP_DB_FILE, true);
+    if (tmp_fd < 0)
+        return ERR_DB_FILE;
+    rc = ((pdb_create(tmp_fd) == NO_ERROR) && (pdb_open(tmp_fd) == NO_ERROR)) ? NO_ERROR : ERR_DB_FILE;
+    if (rc == NO_ERROR)
+        rc = scan_db(fd, migrate_student, &count);
+    if ((pdb_close() != NO_ERROR) || (fsync(tmp_fd) < 0))
+        rc = ERR_DB_FILE;
+    close(tmp_fd);
+    if (rc != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        unlink(TMP_DB_FILE);
+        return ERR_DB_FILE;
+    }
+
+    if (close_db(fd) != NO_ERROR)
+    {
+        unlink(TMP_DB_FILE);
+        return ERR_DB_FILE;
+    }
+    if (rename(TMP_DB_FILE, DB_FILE) < 0)
+    {
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+    int dir_fd = open(".", O_RDONLY | O_DIRECTORY);
+    if ((dir_fd < 0) || (fsync(dir_fd) < 0) ||
+        (wal_reset(WAL_FILE) != NO_ERROR) || (idx_reset(IDX_FILE) != NO_ERROR))
+    {
+        printf(M_ERR_DB_CREATE);
+        if (dir_fd >= 0)
+            close(dir_fd);
+        return ERR_DB_FILE;
+    }
+    close(dir_fd);
+
+    printf(M_DB_MIGRATED, count);
+    return open_db(DB_FILE, false);
+}
@@ -0,0 +1,597 @@
+#define _GNU_SOURCE    //accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_server.c - the student database as a long running server
+ *
+ * Every sdbsc command opens DB_FILE, does one thing and exits, so nothing
+ * stays cached from one command to the next.  `sdbsc -s [socket]` instead
+ * opens the database once, maps it with the mmap engine, and serves
+ * requests for it on a Unix domain socket until it gets SIGINT or
+ * SIGTERM.
+ *
+ * The protocol is binary and fixed size.  A request is an sdb_req_t,
+ * followed by a student_t for SDB_OP_ADD and SDB_OP_LNAME.  A response is
+ * an sdb_rsp_t, followed by rsp.count student_t records.  A client may
+ * send as many requests as it likes without waiting (pipelining), the
+ * responses come back in the same order; the server works through
+ * everything a read() brings in and answers it with one write().  A
+ * client that is not reading its responses stops being read from once
+ * SDB_OUT_HIGH bytes are waiting for it.
+ *
+ * One thread serves every client with poll().  The records written while
+ * answering everything that came in on one poll() are logged as a single
+ * commit to the write ahead log, so clients writing at the same time
+ * share the fdatasync(), and no response goes out before it.  When the
+ * server has been idle for SDB_IDLE_MS, or busy for SDB_MAINT_MS, it
+ * checkpoints the log and gives back a slice of the empty blocks with
+ * compact_db().
+ *
+ * The client side is db_connect(), db_request(), db_response() and
+ * db_read(), sdbsc uses them when SDB_SOCKET is set, see remote_cmd() in
+ * sdb_cli.c.
+ */
+
+#define SDB_MAX_CLIENTS     64
+#define SDB_IN_BUFF_SZ      (64 * 1024)
+#define SDB_OUT_HIGH        (1024 * 1024)
+#define SDB_IDLE_MS         100
+#define SDB_MAINT_MS        1000
+#define SDB_COMPACT_SLICE   64
+
+typedef struct sdb_conn {
+    int sock;               //-1 when the slot is free
+    int in_len;
+    char in[SDB_IN_BUFF_SZ];
+    char *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    size_t unsynced;        //where the responses waiting on a commit start
+} sdb_conn_t;
+
+static volatile sig_atomic_t stop_server = 0;
+
+static void on_stop(int sig)
+{
+    (void)sig;
+    stop_server = 1;
+}
+
+static long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static size_t out_pending(sdb_conn_t *c)
+{
+    return c->out_len - c->out_sent;
+}
+
+//what can go out now, the responses a commit has covered
+static size_t out_ready(sdb_conn_t *c)
+{
+    return c->unsynced - c->out_sent;
+}
+
+static int out_append(sdb_conn_t *c, const void *data, size_t len)
+{
+    if (c->out_len + len > c->out_cap)
+    {
+        //slide what is left to send down before growing
+        if (c->out_sent > 0)
+        {
+            memmove(c->out, c->out + c->out_sent, out_pending(c));
+            c->out_len -= c->out_sent;
+            c->unsynced -= c->out_sent;
+            c->out_sent = 0;
+        }
+        if (c->out_len + len > c->out_cap)
+        {
+            size_t cap = (c->out_cap == 0) ? SDB_IN_BUFF_SZ : c->out_cap;
+            while (cap < c->out_len + len)
+                cap *= 2;
+            char *out = realloc(c->out, cap);
+            if (out == NULL)
+                return ERR_DB_FILE;
+            c->out = out;
+            c->out_cap = cap;
+        }
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return NO_ERROR;
+}
+
+typedef struct scan_out {
+    sdb_conn_t *conn;
+    int count;
+} scan_out_t;
+
+static int scan_student(student_t *s, void *arg)
+{
+    scan_out_t *scan = arg;
+
+    scan->count++;
+    return out_append(scan->conn, s, sizeof(student_t));
+}
+
+//one request, its response is queued on c
+static int handle_request(int fd, sdb_conn_t *c, sdb_req_t *req, student_t *s)
+{
+    sdb_rsp_t rsp = { NO_ERROR, 0 };
+    student_t found;
+    int next_block = 0;
+
+    switch (req->op)
+    {
+    case SDB_OP_GET:
+        rsp.rc = get_student(fd, req->id, &found);
+        if (rsp.rc == NO_ERROR)
+        {
+            rsp.count = 1;
+            if (out_append(c, &rsp, sizeof(rsp)) != NO_ERROR)
+                return ERR_DB_FILE;
+            return out_append(c, &found, sizeof(found));
+        }
+        break;
+
+    case SDB_OP_ADD:
+        // the same checks sdbsc -a makes, a client could skip them
+        if (validate_range(req->id, s->gpa) != NO_ERROR)
+        {
+            rsp.rc = ERR_DB_RANGE;
+            break;
+        }
+        s->id = req->id;
+        s->fname[sizeof(s->fname) - 1] = '\0';
+        s->lname[sizeof(s->lname) - 1] = '\0';
+        rsp.rc = insert_student(fd, s);
+        break;
+
+    case SDB_OP_DEL:
+        rsp.rc = remove_student(fd, req->id);
+        break;
+
+    case SDB_OP_COUNT:
+        rsp.rc = 0;
+        if (scan_db(fd, count_student, &rsp.rc) != NO_ERROR)
+            rsp.rc = ERR_DB_FILE;
+        break;
+
+    case SDB_OP_SCAN:
+    case SDB_OP_LNAME:
+    {
+        // the records go out behind the response, which is filled in
+        // after; the buffer may slide while they are added so find it from
+        // the end
+        scan_out_t scan = { c, 0 };
+        size_t at;
+
+        if (out_append(c, &rsp, sizeof(rsp)) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (req->op == SDB_OP_SCAN)
+            rsp.rc = scan_db(fd, scan_student, &scan);
+        else
+        {
+            s->lname[sizeof(s->lname) - 1] = '\0';
+            rsp.rc = find_lname(fd, s->lname, scan_student, &scan);
+        }
+        at = c->out_len - sizeof(rsp) - (size_t)scan.count * sizeof(student_t);
+        if (rsp.rc != NO_ERROR)
+        {
+            c->out_len = at + sizeof(rsp);
+            scan.count = 0;
+        }
+        rsp.count = scan.count;
+        memcpy(c->out + at, &rsp, sizeof(rsp));
+        return NO_ERROR;
+    }
+
+    case SDB_OP_COMPACT:
+        rsp.rc = compact_db(fd, &next_block, INT_MAX);
+        if (rsp.rc > 0)
+            rsp.rc = NO_ERROR;
+        break;
+
+    default:
+        rsp.rc = ERR_DB_OP;
+        break;
+    }
+
+    return out_append(c, &rsp, sizeof(rsp));
+}
+
+//the ops whose request carries a student_t
+static bool has_student(int op)
+{
+    return (op == SDB_OP_ADD) || (op == SDB_OP_LNAME);
+}
+
+//answers every whole request that has come in
+static int serve_input(int fd, sdb_conn_t *c)
+{
+    int pos = 0;
+    sdb_req_t req;
+    student_t s;
+
+    while ((c->in_len - pos >= (int)sizeof(req)) && (out_pending(c) < SDB_OUT_HIGH))
+    {
+        memcpy(&req, c->in + pos, sizeof(req));
+        int need = sizeof(req) + (has_student(req.op) ? sizeof(s) : 0);
+        if (c->in_len - pos < need)
+            break;
+        if (has_student(req.op))
+            memcpy(&s, c->in + pos + sizeof(req), sizeof(s));
+        if (handle_request(fd, c, &req, &s) != NO_ERROR)
+            return ERR_DB_FILE;
+        pos += need;
+    }
+
+    memmove(c->in, c->in + pos, c->in_len - pos);
+    c->in_len -= pos;
+    return NO_ERROR;
+}
+
+static int flush_output(sdb_conn_t *c)
+{
+    while (out_ready(c) > 0)
+    {
+        ssize_t n = send(c->sock, c->out + c->out_sent, out_ready(c), MSG_NOSIGNAL);
+        if (n < 0)
+            return ((errno == EAGAIN) || (errno == EINTR)) ? NO_ERROR : ERR_DB_FILE;
+        c->out_sent += n;
+    }
+    if (c->out_sent == c->out_len)
+    {
+        c->out_len = 0;
+        c->out_sent = 0;
+        c->unsynced = 0;
+    }
+    return NO_ERROR;
+}
+
+static void close_conn(sdb_conn_t *c)
+{
+    close(c->sock);
+    free(c->out);
+    memset(c, 0, sizeof(*c));
+    c->sock = -1;
+}
+
+//a read's worth of requests from c, the responses wait for the commit
+static int serve_client(int fd, sdb_conn_t *c)
+{
+    if (c->in_len < SDB_IN_BUFF_SZ)
+    {
+        ssize_t n = recv(c->sock, c->in + c->in_len, SDB_IN_BUFF_SZ - c->in_len, 0);
+        if (n == 0)
+            return ERR_DB_OP;
+        if (n < 0)
+            return ((errno == EAGAIN) || (errno == EINTR)) ? NO_ERROR : ERR_DB_FILE;
+        c->in_len += n;
+    }
+    return serve_input(fd, c);
+}
+
+//true if addr is a socket left behind by a server that did not stop
+//cleanly: it is a socket, and nothing is listening on it
+static bool stale_socket(const struct sockaddr_un *addr)
+{
+    struct stat st;
+    int sock;
+    int rc;
+
+    if ((lstat(addr->sun_path, &st) < 0) || !S_ISSOCK(st.st_mode))
+        return false;
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return false;
+    rc = connect(sock, (const struct sockaddr *)addr, sizeof(*addr));
+    close(sock);
+    return (rc < 0) && (errno == ECONNREFUSED);
+}
+
+//returns the listening socket, ERR_DB_OP if sock_path is something else
+//or another server's, ERR_DB_FILE if it cannot be set up
+static int listen_on(char *sock_path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct stat st;
+    int sock;
+
+    if (strlen(sock_path) >= sizeof(addr.sun_path))
+        return ERR_DB_FILE;
+    strcpy(addr.sun_path, sock_path);
+
+    // never remove a file that is not a socket, or a running server's
+    if (lstat(sock_path, &st) == 0)
+    {
+        if (!stale_socket(&addr))
+            return ERR_DB_OP;
+        unlink(sock_path);
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return ERR_DB_FILE;
+    if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+        (listen(sock, SDB_MAX_CLIENTS) < 0))
+    {
+        close(sock);
+        return ERR_DB_FILE;
+    }
+    return sock;
+}
+
+/*
+ *  start_db_server
+ *      sock_path:  the Unix domain socket to serve on
+ *
+ *  Opens DB_FILE, and its last name index, with the mmap engine and
+ *  serves it until SIGINT or SIGTERM.  Writes are logged with the log
+ *  deferred, see sdb_wal.c, and committed once per round of requests.
+ *
+ *  returns:  NO_ERROR       the server was stopped
+ *            ERR_DB_FILE    the database could not be opened or the
+ *                           socket set up
+ *
+ *  console:  M_SRV_STARTED and M_SRV_STOPPED, M_ERR_DB_OPEN,
+ *            M_ERR_DB_PAGED, M_ERR_SRV_IN_USE if sock_path exists and is
+ *            not a socket left behind, or M_ERR_SRV_LISTEN on error
+ */
+int start_db_server(char *sock_path)
+{
+    static sdb_conn_t conns[SDB_MAX_CLIENTS];
+    struct pollfd pfds[SDB_MAX_CLIENTS + 1];
+    struct sigaction sa = { .sa_handler = on_stop };
+    int compact_next = 0;
+    long last_maint = now_ms();
+    int listen_sock;
+    int fd;
+
+    fd = open_db(DB_FILE, false);
+    if (fd < 0)
+        return ERR_DB_FILE;
+    if (pdb_detect(fd))
+    {
+        printf(M_ERR_DB_PAGED);
+        close(fd);
+        return ERR_DB_FILE;
+    }
+    if ((wal_open(fd, WAL_FILE, false) != NO_ERROR) ||
+        (idx_open(fd, IDX_FILE) != NO_ERROR) || (mmap_open(fd) != NO_ERROR))
+    {
+        printf(M_ERR_DB_OPEN);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+    wal_defer(true);
+    listen_sock = listen_on(sock_path);
+    if (listen_sock < 0)
+    {
+        printf((listen_sock == ERR_DB_OP) ? M_ERR_SRV_IN_USE : M_ERR_SRV_LISTEN, sock_path);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    //no SA_RESTART, poll() has to return to see stop_server
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    for (int i = 0; i < SDB_MAX_CLIENTS; i++)
+        conns[i].sock = -1;
+
+    printf(M_SRV_STARTED, DB_FILE, sock_path);
+    fflush(stdout);
+
+    while (!stop_server)
+    {
+        int nfds = 1;
+        int conn_of[SDB_MAX_CLIENTS + 1];
+
+        pfds[0].fd = listen_sock;
+        pfds[0].events = POLLIN;
+        for (int i = 0; i < SDB_MAX_CLIENTS; i++)
+        {
+            sdb_conn_t *c = &conns[i];
+            if (c->sock < 0)
+                continue;
+            pfds[nfds].fd = c->sock;
+            pfds[nfds].events = 0;
+            if ((c->in_len < SDB_IN_BUFF_SZ) && (out_pending(c) < SDB_OUT_HIGH))
+                pfds[nfds].events |= POLLIN;
+            if (out_ready(c) > 0)
+                pfds[nfds].events |= POLLOUT;
+            conn_of[nfds++] = i;
+        }
+
+        int ready = poll(pfds, nfds, SDB_IDLE_MS);
+        if ((ready < 0) && (errno != EINTR))
+            break;
+
+        if ((ready == 0) || (now_ms() - last_maint >= SDB_MAINT_MS))
+        {
+            wal_checkpoint();
+            compact_db(fd, &compact_next, SDB_COMPACT_SLICE);
+            last_maint = now_ms();
+        }
+        for (int p = 1; (ready > 0) && (p < nfds); p++)
+        {
+            sdb_conn_t *c = &conns[conn_of[p]];
+            int rc = NO_ERROR;
+
+            if (pfds[p].revents & (POLLIN | POLLHUP | POLLERR))
+                rc = serve_client(fd, c);
+            else if (pfds[p].revents & POLLOUT)
+            {
+                //output drained, there may be requests waiting on it
+                rc = flush_output(c);
+                if (rc == NO_ERROR)
+                    rc = serve_input(fd, c);
+            }
+            if (rc != NO_ERROR)
+                close_conn(c);
+        }
+
+        //group commit, one fdatasync() of the log for every write this
+        //round from every client, and only then are they answered.  If it
+        //fails the records stay in the log's buffer, they are in the
+        //mapping already, and the answers wait for a later round, idle or
+        //not, whose commit gets them on disk
+        bool synced = (wal_sync() == NO_ERROR);
+        for (int i = 0; i < SDB_MAX_CLIENTS; i++)
+        {
+            sdb_conn_t *c = &conns[i];
+            if (c->sock < 0)
+                continue;
+            if (synced)
+                c->unsynced = c->out_len;
+            if ((out_ready(c) > 0) && (flush_output(c) != NO_ERROR))
+                close_conn(c);
+        }
+
+        if ((ready > 0) && (pfds[0].revents & POLLIN))
+        {
+            int sock = accept4(listen_sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            int slot = 0;
+
+            while ((slot < SDB_MAX_CLIENTS) && (conns[slot].sock >= 0))
+                slot++;
+            if ((sock >= 0) && (slot == SDB_MAX_CLIENTS))
+                close(sock);
+            else if (sock >= 0)
+                conns[slot].sock = sock;
+        }
+    }
+
+    for (int i = 0; i < SDB_MAX_CLIENTS; i++)
+        if (conns[i].sock >= 0)
+            close_conn(&conns[i]);
+    close(listen_sock);
+    unlink(sock_path);
+    close_db(fd);
+    printf(M_SRV_STOPPED);
+    return NO_ERROR;
+}
+
+/*
+ *  db_connect
+ *      sock_path:  where the server is listening
+ *
+ *  returns:  the connected socket, or ERR_DB_FILE
+ */
+int db_connect(char *sock_path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int sock;
+
+    if (strlen(sock_path) >= sizeof(addr.sun_path))
+        return ERR_DB_FILE;
+    strcpy(addr.sun_path, sock_path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return ERR_DB_FILE;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(sock);
+        return ERR_DB_FILE;
+    }
+    return sock;
+}
+
+/*
+ *  db_request
+ *      sock:  from db_connect()
+ *      op:    SDB_OP_...
+ *      id:    the student, for the ops that take one
+ *      *s:    the student to add for SDB_OP_ADD, the last name to look
+ *             up for SDB_OP_LNAME, otherwise unused
+ *
+ *  Sends one request.  More can be sent before reading the responses.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_request(int sock, int op, int id, const student_t *s)
+{
+    char buff[sizeof(sdb_req_t) + sizeof(student_t)];
+    sdb_req_t req = { op, id };
+    size_t len = sizeof(req);
+
+    memcpy(buff, &req, sizeof(req));
+    if (has_student(op))
+    {
+        memcpy(buff + len, s, sizeof(*s));
+        len += sizeof(*s);
+    }
+
+    for (size_t done = 0; done < len; )
+    {
+        ssize_t n = send(sock, buff + done, len - done, MSG_NOSIGNAL);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        done += n;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  db_read
+ *      sock:  from db_connect()
+ *      buff:  where len bytes of response are read to
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the connection was lost
+ */
+int db_read(int sock, void *buff, size_t len)
+{
+    for (size_t done = 0; done < len; )
+    {
+        ssize_t n = recv(sock, (char *)buff + done, len - done, 0);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        done += n;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  db_response
+ *      sock:  from db_connect()
+ *      *rsp:  the response to the oldest request not answered yet
+ *      *s:    the student for an SDB_OP_GET that found one.  For
+ *             SDB_OP_SCAN and SDB_OP_LNAME pass NULL and db_read() the
+ *             rsp->count records
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the connection was lost
+ */
+int db_response(int sock, sdb_rsp_t *rsp, student_t *s)
+{
+    if (db_read(sock, rsp, sizeof(*rsp)) != NO_ERROR)
+        return ERR_DB_FILE;
+    if ((s != NULL) && (rsp->count == 1))
+        return db_read(sock, s, sizeof(*s));
+    return NO_ERROR;
+}
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_stats.c - GPA analytics over the whole student table
+ *
+ * The count, average, minimum, maximum and histogram of gpa, and the
+ * number of students in a GPA range, only need the id (to tell a student
+ * from an empty slot) and the gpa of each record, 8 of its 64 bytes.
+ * scan_db() copies out every record and calls a function for it; this
+ * reads the two fields straight out of a read only mapping of the file
+ * instead, 8 records to a step, into vectors of ids and gpas (GCC vector
+ * extensions, so SSE2 or NEON without -march) and keeps the sums, minima
+ * and maxima in 8 lanes, masked by id != 0.
+ *
+ * Only the runs of data next_extent() finds are looked at.  Their records
+ * are dealt out to SDB_THREADS threads (the number of CPUs by default) in
+ * equal contiguous shares, at least STATS_MIN_RECORDS each, so a small
+ * database is done on the calling thread.  Each thread keeps its own
+ * totals, added up after.  Nothing is locked: like print_db(), a student
+ * being written at the same moment may or may not be counted.
+ */
+
+#define STATS_LANES         8
+#define STATS_MAX_THREADS   64
+#define STATS_MIN_RECORDS   4096        //256K of records per thread
+#define GPA_BUCKET_WIDTH    (MAX_STD_GPA / GPA_BUCKETS)     //5.00 goes in the last
+#define GPA_BAR_WIDTH       40
+
+typedef int32_t v8si __attribute__((vector_size(STATS_LANES * sizeof(int32_t))));
+
+typedef struct extent {
+    int first;
+    int end;
+} extent_t;
+
+typedef struct stats_share {
+    const student_t *table;
+    const extent_t *extents;
+    int num_extents;
+    long from;              //the share, counted in records of data
+    long to;
+    int lo;
+    int hi;
+    gpa_stats_t st;
+} stats_share_t;
+
+static int bucket_of(int gpa)
+{
+    int b = gpa / GPA_BUCKET_WIDTH;
+
+    return (b < 0) ? 0 : (b >= GPA_BUCKETS) ? GPA_BUCKETS - 1 : b;
+}
+
+static void stats_init(gpa_stats_t *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->min = INT_MAX;
+    st->max = INT_MIN;
+}
+
+//n records from recs into st
+static void scan_records(const student_t *recs, long n, int lo, int hi, gpa_stats_t *st)
+{
+    v8si count = { 0 };
+    v8si sum = { 0 };
+    v8si in_range = { 0 };
+    v8si vmin = { 0 };
+    v8si vmax = { 0 };
+    long i = 0;
+
+    vmin += INT_MAX;
+    vmax += INT_MIN;
+    for (; i + STATS_LANES <= n; i += STATS_LANES)
+    {
+        v8si id;
+        v8si gpa;
+
+        // a strided load, the fields are 64 bytes apart
+        for (int j = 0; j < STATS_LANES; j++)
+        {
+            id[j] = recs[i + j].id;
+            gpa[j] = recs[i + j].gpa;
+        }
+
+        // comparisons give -1 in the lanes where they hold
+        v8si used = (id != 0);
+        v8si lower = used & (gpa < vmin);
+        v8si higher = used & (gpa > vmax);
+
+        count -= used;
+        sum += gpa & used;
+        in_range -= used & (gpa >= lo) & (gpa <= hi);
+        vmin = (gpa & lower) | (vmin & ~lower);
+        vmax = (gpa & higher) | (vmax & ~higher);
+        for (int j = 0; j < STATS_LANES; j++)
+            st->hist[bucket_of(gpa[j])] -= used[j];
+    }
+
+    for (int j = 0; j < STATS_LANES; j++)
+    {
+        st->count += count[j];
+        st->sum += sum[j];
+        st->in_range += in_range[j];
+        if (vmin[j] < st->min)
+            st->min = vmin[j];
+        if (vmax[j] > st->max)
+            st->max = vmax[j];
+    }
+
+    for (; i < n; i++)
+    {
+        int gpa = recs[i].gpa;
+
+        if (recs[i].id == 0)
+            continue;
+        st->count++;
+        st->sum += gpa;
+        st->in_range += (gpa >= lo) && (gpa <= hi);
+        st->hist[bucket_of(gpa)]++;
+        if (gpa < st->min)
+            st->min = gpa;
+        if (gpa > st->max)
+            st->max = gpa;
+    }
+}
+
+//the records of one share, which can start and end inside extents
+static void *scan_share(void *arg)
+{
+    stats_share_t *share = arg;
+    long at = 0;
+
+    stats_init(&share->st);
+    for (int e = 0; (e < share->num_extents) && (at < share->to); e++)
+    {
+        long len = share->extents[e].end - share->extents[e].first;
+        long from = (share->from > at) ? share->from - at : 0;
+        long to = (share->to < at + len) ? share->to - at : len;
+
+        if (from < to)
+            scan_records(share->table + share->extents[e].first + from, to - from,
+                         share->lo, share->hi, &share->st);
+        at += len;
+    }
+    return NULL;
+}
+
+static void stats_add(gpa_stats_t *to, const gpa_stats_t *from)
+{
+    to->count += from->count;
+    to->sum += from->sum;
+    to->in_range += from->in_range;
+    if (from->min < to->min)
+        to->min = from->min;
+    if (from->max > to->max)
+        to->max = from->max;
+    for (int b = 0; b < GPA_BUCKETS; b++)
+        to->hist[b] += from->hist[b];
+}
+
+//SDB_THREADS if it is set, otherwise one per CPU
+static int default_threads(void)
+{
+    char *env = getenv(SDB_THREADS_ENV);
+    long n = (env != NULL) ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (n < 1) ? 1 : (n > STATS_MAX_THREADS) ? STATS_MAX_THREADS : (int)n;
+}
+
+/*
+ *  gpa_stats
+ *      fd:       linux file descriptor
+ *      threads:  threads to scan with, 0 for SDB_THREADS or the number of
+ *                CPUs
+ *      lo, hi:   the GPA range st->in_range counts, as 3 digit ints
+ *      *st:      filled in with the totals over every student
+ *
+ *  returns:  NO_ERROR       on success, st->min and st->max are only
+ *                           meaningful if st->count is not 0
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int gpa_stats(int fd, int threads, int lo, int hi, gpa_stats_t *st)
+{
+    stats_share_t shares[STATS_MAX_THREADS];
+    pthread_t tids[STATS_MAX_THREADS];
+    extent_t *extents = NULL;
+    int num_extents = 0;
+    int cap = 0;
+    long total = 0;
+    int first = 0;
+    int end;
+    int rc;
+    struct stat sb;
+
+    stats_init(st);
+    if (fstat(fd, &sb) < 0)
+        return ERR_DB_FILE;
+    int num_records = sb.st_size / STUDENT_RECORD_SIZE;
+    if (num_records == 0)
+        return NO_ERROR;
+
+    const student_t *table = mmap(NULL, (size_t)num_records * STUDENT_RECORD_SIZE,
+                                  PROT_READ, MAP_SHARED, fd, 0);
+    if (table == MAP_FAILED)
+        return ERR_DB_FILE;
+
+    // where the students are, and how many records of data that is
+    while ((rc = next_extent(fd, &first, &end)) == NO_ERROR)
+    {
+        if (end > num_records)
+            end = num_records;
+        if (num_extents == cap)
+        {
+            cap = (cap == 0) ? 64 : cap * 2;
+            extent_t *more = realloc(extents, cap * sizeof(extent_t));
+            if (more == NULL)
+            {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            extents = more;
+        }
+        extents[num_extents].first = first;
+        extents[num_extents].end = end;
+        num_extents++;
+        total += end - first;
+        first = end;
+    }
+    if (rc != SRCH_NOT_FOUND)
+    {
+        munmap((void *)table, (size_t)num_records * STUDENT_RECORD_SIZE);
+        free(extents);
+        return ERR_DB_FILE;
+    }
+
+    if (threads <= 0)
+        threads = default_threads();
+    if (threads > STATS_MAX_THREADS)
+        threads = STATS_MAX_THREADS;
+    if (threads > total / STATS_MIN_RECORDS)
+        threads = (total / STATS_MIN_RECORDS > 0) ? total / STATS_MIN_RECORDS : 1;
+
+    for (int t = 0; t < threads; t++)
+    {
+        shares[t] = (stats_share_t){ table, extents, num_extents,
+                                     total * t / threads, total * (t + 1) / threads, lo, hi,
+                                     { 0 } };
+    }
+
+    // the calling thread takes the first share itself
+    int started = 1;
+    for (; started < threads; started++)
+        if (pthread_create(&tids[started], NULL, scan_share, &shares[started]) != 0)
+            break;
+    scan_share(&shares[0]);
+    for (int t = 1; t < threads; t++)
+    {
+        // a thread that could not be started is done here instead
+        if (t < started)
+            pthread_join(tids[t], NULL);
+        else
+            scan_share(&shares[t]);
+        stats_add(&shares[0].st, &shares[t].st);
+    }
+    *st = shares[0].st;
+
+    munmap((void *)table, (size_t)num_records * STUDENT_RECORD_SIZE);
+    free(extents);
+    return NO_ERROR;
+}
+
+/*
+ *  print_gpa_stats
+ *      fd:      linux file descriptor
+ *      lo, hi:  a GPA range as 3 digit ints, or -1 for everything
+ *
+ *  Prints the number of students with their average, lowest and highest
+ *  GPA and a histogram of GPAs, or with a range only the number of
+ *  students in it.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_GPA_STATS and the histogram, or M_GPA_RANGE
+ *            M_DB_EMPTY       there are no students
+ *            M_ERR_DB_READ    error reading the database file
+ */
+int print_gpa_stats(int fd, int lo, int hi)
+{
+    gpa_stats_t st;
+    bool range = (lo >= 0);
+
+    if (gpa_stats(fd, 0, range ? lo : MIN_STD_GPA, range ? hi : MAX_STD_GPA, &st) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (range)
+    {
+        printf(M_GPA_RANGE, st.in_range, lo / 100.0, hi / 100.0);
+        return NO_ERROR;
+    }
+    if (st.count == 0)
+    {
+        printf(M_DB_EMPTY);
+        return NO_ERROR;
+    }
+
+    int most = 0;
+    for (int b = 0; b < GPA_BUCKETS; b++)
+        if (st.hist[b] > most)
+            most = st.hist[b];
+
+    printf(M_GPA_STATS, st.count, (double)st.sum / st.count / 100.0,
+           st.min / 100.0, st.max / 100.0);
+    printf(GPA_HIST_HDR_STRING, "GPA", "STUDENTS");
+    for (int b = 0; b < GPA_BUCKETS; b++)
+    {
+        char bar[GPA_BAR_WIDTH + 1];
+        int len = (int)((long)st.hist[b] * GPA_BAR_WIDTH / most);
+        int top = (b == GPA_BUCKETS - 1) ? MAX_STD_GPA : (b + 1) * GPA_BUCKET_WIDTH - 1;
+
+        memset(bar, '#', len);
+        bar[len] = '\0';
+        printf(GPA_HIST_FMT_STRING, b * GPA_BUCKET_WIDTH / 100.0, top / 100.0, st.hist[b], bar);
+    }
+    return NO_ERROR;
+}
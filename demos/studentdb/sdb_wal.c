@@ -0,0 +1,474 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ * sdb_wal.c - write ahead log for the student database
+ *
+ * add_student() and del_student() overwrite a record in place.  A crash
+ * part way through that write can leave half a record behind, and nothing
+ * says what the record should have been.  With the log, every record is
+ * first appended to WAL_FILE as a checksummed entry holding the whole new
+ * record, and the log is flushed with fdatasync() before the database is
+ * touched.  After a crash whatever made it into the log is written again;
+ * an entry is a whole record at a fixed place, so writing it twice does
+ * no harm.
+ *
+ * Entries go to the log in commits, one write() of one or more entries
+ * that each know their place in the commit.  Recovery only writes a commit
+ * back if all of its entries check out, so a commit is all or nothing; an
+ * import is a single commit.
+ *
+ * wal_log() buffers an entry and, unless the caller has asked for
+ * wal_defer(), writes and flushes it straight away.  A caller with many
+ * records to write defers, logs them all and then calls wal_sync() once:
+ * group commit.  The server does this for each round of requests from all
+ * of its clients, and only answers them after the wal_sync().
+ *
+ * When the log grows past WAL_CHECKPOINT_SIZE, and when the database is
+ * closed, the database is flushed and the log emptied, the checkpoint.
+ * Any number of processes can have the database open; each one holds a
+ * shared flock() on the log, and only a process that can get it
+ * exclusively, because it is the only one, replays and empties the log.
+ *
+ * As with the mmap engine there is one database per process, so the state
+ * is kept here.
+ */
+
+#define WAL_MAGIC           0x4c415753      //"SWAL"
+#define WAL_CHECKPOINT_SIZE (1024 * 1024)
+
+typedef struct wal_entry {
+    uint32_t magic;
+    uint32_t crc;       //crc32 of the entry with crc set to 0
+    uint32_t txn;       //the commit it belongs to
+    uint32_t seq;       //this is entry seq of count in the commit
+    uint32_t count;
+    int32_t id;
+    student_t rec;      //the whole record, as it is to be written
+} wal_entry_t;
+
+static struct {
+    int fd;             //the log, -1 when there is none
+    int db_fd;
+    bool defer;
+    uint32_t txn;
+    wal_entry_t *buff;  //logged, not written yet
+    int len;
+    int cap;
+    char *crash;        //SDB_CRASH, see wal_crash_point()
+} wal = { -1, -1, false, 0, NULL, 0, 0, NULL };
+
+static uint32_t crc32(const void *data, size_t len)
+{
+    static uint32_t table[256];
+    const unsigned char *p = data;
+    uint32_t crc = 0xffffffff;
+
+    if (table[1] == 0)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    while (len-- > 0)
+        crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t entry_crc(const wal_entry_t *e)
+{
+    wal_entry_t copy = *e;
+
+    copy.crc = 0;
+    return crc32(&copy, sizeof(copy));
+}
+
+static bool entry_ok(const wal_entry_t *e)
+{
+    return (e->magic == WAL_MAGIC) && (e->crc == entry_crc(e)) &&
+           (e->id >= 0) && (e->id <= MAX_STD_ID);
+}
+
+//the commit starting at log[i] is whole, every entry is there and checks out
+static bool commit_ok(const wal_entry_t *log, size_t i, size_t n)
+{
+    const wal_entry_t *first = &log[i];
+
+    if (!entry_ok(first) || (first->seq != 0) || (first->count == 0) ||
+        (first->count > n - i))
+        return false;
+    for (uint32_t k = 1; k < first->count; k++)
+    {
+        const wal_entry_t *e = &log[i + k];
+        if (!entry_ok(e) || (e->txn != first->txn) || (e->seq != k) ||
+            (e->count != first->count))
+            return false;
+    }
+    return true;
+}
+
+//writes the entry's record, unless it is already there
+static int apply_entry(const wal_entry_t *e)
+{
+    off_t offset = (off_t)e->id * STUDENT_RECORD_SIZE;
+    student_t now;
+
+    ssize_t n = pread(wal.db_fd, &now, sizeof(now), offset);
+    if (n < 0)
+        return ERR_DB_FILE;
+    memset((char *)&now + n, 0, sizeof(now) - n);
+    if (memcmp(&now, &e->rec, sizeof(now)) == 0)
+        return NO_ERROR;
+    if (pwrite(wal.db_fd, &e->rec, sizeof(e->rec), offset) != sizeof(e->rec))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+//writes every whole commit in the log back to the database and flushes it
+static int replay(void)
+{
+    struct stat st;
+    wal_entry_t *log;
+    size_t n;
+    int rc = NO_ERROR;
+
+    if (fstat(wal.fd, &st) < 0)
+        return ERR_DB_FILE;
+    n = st.st_size / sizeof(wal_entry_t);
+    if (n == 0)
+        return NO_ERROR;
+
+    log = malloc(n * sizeof(wal_entry_t));
+    if (log == NULL)
+        return ERR_DB_FILE;
+    if (pread(wal.fd, log, n * sizeof(wal_entry_t), 0) != (ssize_t)(n * sizeof(wal_entry_t)))
+        rc = ERR_DB_FILE;
+
+    //a commit that did not make it whole is skipped an entry at a time,
+    //the commits after it, from other processes, can still be good
+    for (size_t i = 0; (rc == NO_ERROR) && (i < n); )
+    {
+        if (!commit_ok(log, i, n))
+        {
+            i++;
+            continue;
+        }
+        for (uint32_t k = 0; (rc == NO_ERROR) && (k < log[i].count); k++)
+            rc = apply_entry(&log[i + k]);
+        i += log[i].count;
+    }
+    free(log);
+
+    if ((rc == NO_ERROR) && (fdatasync(wal.db_fd) < 0))
+        rc = ERR_DB_FILE;
+    return rc;
+}
+
+static int lock_log(int op)
+{
+    while (flock(wal.fd, op) < 0)
+    {
+        if (errno != EINTR)
+            return ERR_DB_OP;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  wal_crash_point
+ *      point:  the name of this point
+ *      fd:     where to write part of what was about to be written, or -1
+ *      buff:   the part to write
+ *      len:    how much of it
+ *
+ *  For the crash tests.  If SDB_CRASH names this point the process writes
+ *  len bytes of buff to fd, a torn write, and exits with SDB_CRASH_EXIT
+ *  without closing anything.
+ *
+ *  returns:  nothing, it returns only if SDB_CRASH is not this point
+ */
+void wal_crash_point(const char *point, int fd, const void *buff, size_t len)
+{
+    if ((wal.crash == NULL) || (strcmp(wal.crash, point) != 0))
+        return;
+    if ((fd >= 0) && (write(fd, buff, len) < 0))
+        _exit(EXIT_FAIL_DB);
+    if (fd >= 0)
+        fdatasync(fd);
+    _exit(SDB_CRASH_EXIT);
+}
+
+/*
+ *  wal_open
+ *      db_fd:    database file from open_db()
+ *      path:     the log, WAL_FILE for DB_FILE
+ *      discard:  drop what is in the log, the database was just emptied
+ *
+ *  Opens the log for the database, first replaying and emptying it if no
+ *  other process has it open: a crashed process left it behind.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the log could not be opened or replayed
+ */
+int wal_open(int db_fd, const char *path, bool discard)
+{
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    int rc = NO_ERROR;
+
+    if (wal.fd >= 0)
+        wal_close();
+
+    wal.fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, mode);
+    if (wal.fd < 0)
+        return ERR_DB_FILE;
+    wal.db_fd = db_fd;
+    wal.defer = false;
+    wal.txn = (uint32_t)getpid() << 16;
+    wal.crash = getenv(SDB_CRASH_ENV);
+
+    if (flock(wal.fd, LOCK_EX | LOCK_NB) == 0)
+    {
+        if (discard)
+            rc = (ftruncate(wal.fd, 0) < 0) ? ERR_DB_FILE : NO_ERROR;
+        else if ((rc = replay()) == NO_ERROR)
+            rc = (ftruncate(wal.fd, 0) < 0) ? ERR_DB_FILE : NO_ERROR;
+    }
+    if ((rc != NO_ERROR) || (lock_log(LOCK_SH) != NO_ERROR))
+    {
+        close(wal.fd);
+        wal.fd = -1;
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+int wal_active(int db_fd)
+{
+    return (wal.fd >= 0) && (wal.db_fd == db_fd);
+}
+
+/*
+ *  wal_defer
+ *      defer:  true to hold logged entries until wal_sync()
+ *
+ *  returns:  the setting before
+ */
+bool wal_defer(bool defer)
+{
+    bool was = wal.defer;
+
+    wal.defer = defer;
+    return was;
+}
+
+/*
+ *  wal_log
+ *      id:  the slot about to be written
+ *      *s:  the record, EMPTY_STUDENT_RECORD to clear the slot
+ *
+ *  Logs a record before it is written to the database.  Unless deferred
+ *  it is written and flushed with wal_sync() before this returns, and if
+ *  that fails it is dropped again, the caller will not write the record.
+ *
+ *  returns:  NO_ERROR       logged
+ *            ERR_DB_FILE    the log could not be written
+ */
+int wal_log(int id, const student_t *s)
+{
+    if (wal.len == wal.cap)
+    {
+        int cap = (wal.cap == 0) ? 64 : wal.cap * 2;
+        wal_entry_t *buff = realloc(wal.buff, cap * sizeof(wal_entry_t));
+        if (buff == NULL)
+            return ERR_DB_FILE;
+        wal.buff = buff;
+        wal.cap = cap;
+    }
+
+    wal_entry_t *e = &wal.buff[wal.len++];
+    memset(e, 0, sizeof(*e));
+    e->magic = WAL_MAGIC;
+    e->id = id;
+    e->rec = *s;
+
+    if (wal.defer)
+        return NO_ERROR;
+    if (wal_sync() != NO_ERROR)
+    {
+        wal.len--;
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  wal_sync
+ *
+ *  Writes everything logged since the last wal_sync() as one commit and
+ *  flushes it with fdatasync().  Once the log is past WAL_CHECKPOINT_SIZE
+ *  it also tries a checkpoint.  If the write or the flush fails the
+ *  entries are kept, a deferred caller may already have written them to
+ *  the database, and the next wal_sync() tries them again as a new
+ *  commit; what the failed one left in the log is torn and skipped by
+ *  replay().  A caller that gives up on them uses wal_discard().
+ *
+ *  returns:  NO_ERROR       the commit is on disk
+ *            ERR_DB_FILE    it may not be
+ */
+int wal_sync(void)
+{
+    size_t len = wal.len * sizeof(wal_entry_t);
+    struct stat st;
+
+    if ((wal.fd < 0) || (wal.len == 0))
+        return NO_ERROR;
+
+    wal.txn++;
+    for (int i = 0; i < wal.len; i++)
+    {
+        wal.buff[i].txn = wal.txn;
+        wal.buff[i].seq = i;
+        wal.buff[i].count = wal.len;
+        wal.buff[i].crc = entry_crc(&wal.buff[i]);
+    }
+
+    // a torn commit is cut short on an odd byte, not on an entry
+    wal_crash_point("torn_log", wal.fd, wal.buff, len / 2 + 1);
+
+    for (size_t done = 0; done < len; )
+    {
+        ssize_t n = write(wal.fd, (char *)wal.buff + done, len - done);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        done += n;
+    }
+    if (fdatasync(wal.fd) < 0)
+        return ERR_DB_FILE;
+    wal.len = 0;
+
+    wal_crash_point("log", -1, NULL, 0);
+
+    if ((fstat(wal.fd, &st) == 0) && (st.st_size >= WAL_CHECKPOINT_SIZE))
+        wal_checkpoint();
+    return NO_ERROR;
+}
+
+/*
+ *  wal_discard
+ *
+ *  Drops everything logged since the last wal_sync(), for a deferred
+ *  caller whose records were not written to the database after all.
+ */
+void wal_discard(void)
+{
+    wal.len = 0;
+}
+
+/*
+ *  wal_checkpoint
+ *
+ *  Flushes the database and empties the log, if no other process has it
+ *  open.  The log is replayed first, a process that crashed may have left
+ *  commits in it that never made it to the database.
+ *
+ *  returns:  NO_ERROR       the log is empty
+ *            ERR_DB_OP      another process has the log open, it was left
+ *            ERR_DB_FILE    the database or the log could not be written
+ */
+int wal_checkpoint(void)
+{
+    struct stat st;
+    int rc;
+
+    if (wal.fd < 0)
+        return NO_ERROR;
+    if (wal_sync() != NO_ERROR)
+        return ERR_DB_FILE;
+    if (fstat(wal.fd, &st) < 0)
+        return ERR_DB_FILE;
+    if (st.st_size == 0)
+        return NO_ERROR;
+
+    if (flock(wal.fd, LOCK_EX | LOCK_NB) < 0)
+    {
+        //the shared lock may have gone with the attempt
+        lock_log(LOCK_SH);
+        return ERR_DB_OP;
+    }
+    if (mmap_active(wal.db_fd) && (mmap_sync() != NO_ERROR))
+        rc = ERR_DB_FILE;
+    else
+        rc = replay();
+
+    wal_crash_point("checkpoint", -1, NULL, 0);
+
+    if ((rc == NO_ERROR) && (ftruncate(wal.fd, 0) < 0))
+        rc = ERR_DB_FILE;
+    if (lock_log(LOCK_SH) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    return rc;
+}
+
+/*
+ *  wal_close
+ *
+ *  Writes anything still deferred, checkpoints if it can and closes the
+ *  log.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the log or the database could not be written
+ */
+int wal_close(void)
+{
+    int rc;
+
+    if (wal.fd < 0)
+        return NO_ERROR;
+
+    rc = wal_checkpoint();
+    if (rc == ERR_DB_OP)
+        rc = NO_ERROR;
+    close(wal.fd);
+    free(wal.buff);
+    wal.fd = -1;
+    wal.db_fd = -1;
+    wal.buff = NULL;
+    wal.len = 0;
+    wal.cap = 0;
+    wal.defer = false;
+    return rc;
+}
+
+/*
+ *  wal_reset
+ *      path:  the log, WAL_FILE for DB_FILE
+ *
+ *  Empties the log of a database that was itself just emptied, so nothing
+ *  in it is replayed.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_reset(const char *path)
+{
+    if ((truncate(path, 0) < 0) && (errno != ENOENT))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
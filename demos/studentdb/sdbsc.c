@@ -0,0 +1,1070 @@
+#define _GNU_SOURCE    //SEEK_DATA, SEEK_HOLE and fallocate()
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h> //c library for system call file routines
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  open_db
+ *      dbFile:  name of the database file
+ *      should_truncate:  indicates if opening the file also empties it
+ *
+ *  returns:  File descriptor on success, or ERR_DB_FILE on failure
+ *
+ *  console:  Does not produce any console I/O on success
+ *            M_ERR_DB_OPEN on error
+ *
+ */
+int open_db(char *dbFile, bool should_truncate)
+{
+    // Set permissions: rw-rw----
+    // see sys/stat.h for constants
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+
+    // open the file if it exists for Read and Write,
+    // create it if it does not exist
+    int flags = O_RDWR | O_CREAT;
+
+    if (should_truncate)
+        flags += O_TRUNC;
+
+    // Now open file
+    int fd = open(dbFile, flags, mode);
+
+    if (fd == -1)
+    {
+        // Handle the error
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    return fd;
+}
+
+/*
+ *  db_engine
+ *
+ *  The storage engine to use, from the SDB_ENGINE environment variable:
+ *  "mmap" selects the memory mapped engine in sdb_mmap.c, anything else
+ *  the fd engine that does an lseek() plus a read() or write() of one
+ *  record per operation.
+ *
+ *  returns:  ENGINE_FD or ENGINE_MMAP
+ */
+int db_engine(void)
+{
+    char *engine = getenv(SDB_ENGINE_ENV);
+
+    if ((engine != NULL) && (strcmp(engine, "mmap") == 0))
+        return ENGINE_MMAP;
+    return ENGINE_FD;
+}
+
+/*
+ *  attach_engine
+ *      fd:  database file from open_db()
+ *
+ *  Opens the write ahead log for fd, which replays it if an earlier
+ *  process crashed, then the last name index, and sets up the storage
+ *  engine picked by db_engine().  The fd engine needs nothing more, the
+ *  mmap engine maps the file.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the log or the index could not be opened or
+ *                           the file could not be mapped, or the file is
+ *                           in format 2, see sdb_paged.c
+ *
+ *  console:  M_ERR_DB_OPEN on error, M_ERR_DB_PAGED for format 2
+ */
+int attach_engine(int fd)
+{
+    // none of it knows format 2, and the log would write over its pages
+    if (pdb_detect(fd))
+    {
+        printf(M_ERR_DB_PAGED);
+        return ERR_DB_FILE;
+    }
+    if (wal_open(fd, WAL_FILE, false) != NO_ERROR)
+    {
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+    if ((idx_open(fd, IDX_FILE) != NO_ERROR) ||
+        ((db_engine() == ENGINE_MMAP) && (mmap_open(fd) != NO_ERROR)))
+    {
+        printf(M_ERR_DB_OPEN);
+        idx_close();
+        wal_close();
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  close_db
+ *      fd:  database file from open_db()
+ *
+ *  Closes the database.  With the mmap engine the records written are
+ *  flushed with msync() first, and then the write ahead log is
+ *  checkpointed and closed, and the last name index flushed and closed.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the records could not be written back
+ *
+ *  console:  M_ERR_DB_WRITE on error
+ */
+int close_db(int fd)
+{
+    int rc = NO_ERROR;
+
+    if (mmap_active(fd) && (mmap_close() != NO_ERROR))
+        rc = ERR_DB_FILE;
+    if (wal_active(fd) && (wal_close() != NO_ERROR))
+        rc = ERR_DB_FILE;
+    if (idx_active(fd) && (idx_close() != NO_ERROR))
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR)
+        printf(M_ERR_DB_WRITE);
+    close(fd);
+    return rc;
+}
+
+/*
+ *  put_student
+ *      fd:  linux file descriptor
+ *      id:  the student id, picks the slot
+ *      *s:  the record to write, EMPTY_STUDENT_RECORD to clear the slot
+ *
+ *  With the write ahead log open the record is logged first, see
+ *  sdb_wal.c, so a write torn by a crash is redone from the log.
+ *
+ *  returns:  NO_ERROR       record written
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+static int put_student(int fd, int id, const student_t *s)
+{
+    if (wal_active(fd) && (wal_log(id, s) != NO_ERROR))
+        return ERR_DB_FILE;
+    if (mmap_active(fd))
+        return mmap_put_student(id, s);
+
+    off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
+
+    if (lseek(fd, offset, SEEK_SET) < 0)
+        return ERR_DB_FILE;
+    wal_crash_point("torn_apply", fd, s, STUDENT_RECORD_SIZE / 2);
+    if (write(fd, s, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  next_extent
+ *      fd:      linux file descriptor
+ *      *first:  on the way in, the slot to start looking from; on the way
+ *               out, the first slot of the next run of data
+ *      *end:    set to one past the last slot of that run
+ *
+ *  Student ids are file offsets, so the file is mostly holes: one student
+ *  with id 99999 puts 6.4MB of them in front of it.  Holes read back as
+ *  zeros, which is the empty record, so a scan has no reason to read
+ *  them.  lseek(SEEK_DATA) finds where the next data is and
+ *  lseek(SEEK_HOLE) where it stops.  Data is allocated in whole blocks, so
+ *  a run holds whole records, other than a partial record at the end of
+ *  the file, which is left out.
+ *
+ *  returns:  NO_ERROR       *first and *end are set
+ *            SRCH_NOT_FOUND there is no more data after *first
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int next_extent(int fd, int *first, int *end)
+{
+    off_t data = lseek(fd, (off_t)*first * STUDENT_RECORD_SIZE, SEEK_DATA);
+
+    if (data < 0)
+        return (errno == ENXIO) ? SRCH_NOT_FOUND : ERR_DB_FILE;
+
+    off_t hole = lseek(fd, data, SEEK_HOLE);
+    if (hole < 0)
+        return ERR_DB_FILE;
+
+    *first = data / STUDENT_RECORD_SIZE;
+    *end = hole / STUDENT_RECORD_SIZE;
+    return (*end > *first) ? NO_ERROR : SRCH_NOT_FOUND;
+}
+
+/*
+ *  scan_db
+ *      fd:     linux file descriptor
+ *      visit:  called with each student in the database, in id order
+ *      arg:    passed through to visit
+ *
+ *  The full table scan behind count_db_records(), print_db() and
+ *  compress_db().  Only the parts of the file next_extent() finds data in
+ *  are looked at, so a scan costs what is in the file rather than the
+ *  highest id.  The fd engine reads those a record at a time, the mmap
+ *  engine walks the mapping.  Empty and deleted slots are skipped.  The
+ *  scan stops early if visit returns anything but NO_ERROR.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *            <other>        whatever visit returned to stop the scan
+ *
+ *  console:  Does not produce any console I/O
+ */
+int scan_db(int fd, int (*visit)(student_t *s, void *arg), void *arg)
+{
+    student_t student;
+    student_t *table = NULL;
+    int num_records = 0;
+    int first = 0;
+    int end;
+    int rc;
+
+    if (mmap_active(fd))
+        table = mmap_table(&num_records);
+
+    while ((rc = next_extent(fd, &first, &end)) == NO_ERROR)
+    {
+        if (table == NULL && lseek(fd, (off_t)first * STUDENT_RECORD_SIZE, SEEK_SET) < 0)
+            return ERR_DB_FILE;
+        if (table != NULL && end > num_records)
+            end = num_records;
+
+        for (int i = first; i < end; i++)
+        {
+            if (table != NULL)
+                student = table[i];
+            else
+            {
+                ssize_t bytes_read = read(fd, &student, STUDENT_RECORD_SIZE);
+                if (bytes_read < 0)
+                    return ERR_DB_FILE;
+                // a short read at the end is a partial record, not an error
+                if (bytes_read < STUDENT_RECORD_SIZE)
+                    return NO_ERROR;
+            }
+
+            if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
+                continue;
+            int visit_rc = visit(&student, arg);
+            if (visit_rc != NO_ERROR)
+                return visit_rc;
+        }
+        first = end;
+    }
+
+    return (rc == SRCH_NOT_FOUND) ? NO_ERROR : rc;
+}
+
+/*
+ *  lock_records
+ *      fd:     linux file descriptor
+ *      first:  the first slot to lock
+ *      count:  how many slots, 0 for every slot from first on
+ *      type:   F_WRLCK to lock them, F_UNLCK to unlock them
+ *
+ *  Several sdbsc processes, and the server, can write the database at the
+ *  same time.  A writer holds a write lock on the bytes of the records it
+ *  is about to check and write, so two adds of the same id cannot both
+ *  find the slot empty, while writers to other ids go ahead.  The locks
+ *  are open file description (OFD) locks: they belong to this open of the
+ *  file rather than to the process, so closing some other fd on the file
+ *  does not drop them.  Waits for a conflicting lock.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the lock could not be taken
+ *
+ *  console:  Does not produce any console I/O
+ */
+int lock_records(int fd, int first, int count, int type)
+{
+    struct flock fl = {
+        .l_type = type,
+        .l_whence = SEEK_SET,
+        .l_start = (off_t)first * STUDENT_RECORD_SIZE,
+        .l_len = (off_t)count * STUDENT_RECORD_SIZE,
+    };
+
+    while (fcntl(fd, F_OFD_SETLKW, &fl) < 0)
+    {
+        if (errno != EINTR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  punch_block
+ *      fd:     linux file descriptor
+ *      block:  which DB_BLOCK_SIZE block of the file, DB_BLOCK_RECORDS
+ *              records to a block
+ *
+ *  If every record in the block is empty, gives its storage back with
+ *  fallocate(FALLOC_FL_PUNCH_HOLE).  The file keeps its size and the
+ *  block reads back as zeros, so a student's id is still its offset.
+ *  Both engines check the block with pread(), the page cache is shared
+ *  with the mapping so the mmap engine's writes are there too.  The whole
+ *  block is locked from the check to the punch, so a student added to it
+ *  by another process in between is not punched away.
+ *
+ *  returns:  1              the block was punched
+ *            0              there are students in it
+ *            ERR_DB_OP      the file system cannot punch holes
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+static int punch_block(int fd, int block)
+{
+    static const char empty_block[DB_BLOCK_SIZE];
+    char buff[DB_BLOCK_SIZE];
+    off_t offset = (off_t)block * DB_BLOCK_SIZE;
+    int rc = 1;
+
+    if (lock_records(fd, block * DB_BLOCK_RECORDS, DB_BLOCK_RECORDS, F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    ssize_t bytes_read = pread(fd, buff, DB_BLOCK_SIZE, offset);
+    if (bytes_read < 0)
+        rc = ERR_DB_FILE;
+    else
+    {
+        // the last block of the file may be short, the rest is past EOF
+        memset(buff + bytes_read, 0, DB_BLOCK_SIZE - bytes_read);
+        if ((bytes_read == 0) || (memcmp(buff, empty_block, DB_BLOCK_SIZE) != 0))
+            rc = 0;
+    }
+
+    if ((rc == 1) &&
+        (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, DB_BLOCK_SIZE) < 0))
+        rc = (errno == EOPNOTSUPP) ? ERR_DB_OP : ERR_DB_FILE;
+
+    lock_records(fd, block * DB_BLOCK_RECORDS, DB_BLOCK_RECORDS, F_UNLCK);
+    return rc;
+}
+
+/*
+ *  compact_db
+ *      fd:           linux file descriptor
+ *      *next_block:  the block to carry on from, 0 to start at the top.
+ *                    Set to where the next call should carry on, or back
+ *                    to 0 once the end of the file is reached
+ *      max_blocks:   the most blocks with data in them to look at
+ *
+ *  Incremental compaction: punches every block that holds nothing but
+ *  empty records, looking only at the parts of the file with data in them
+ *  (see next_extent()).  It does a bounded slice of the file per call so
+ *  it can be run a little at a time in the background of other work,
+ *  compress_db() runs it over the whole file.
+ *
+ *  returns:  <number>       blocks punched by this call
+ *            ERR_DB_OP      the file system cannot punch holes
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int compact_db(int fd, int *next_block, int max_blocks)
+{
+    int first = *next_block * DB_BLOCK_RECORDS;
+    int end;
+    int punched = 0;
+    int rc;
+
+    while ((max_blocks > 0) && ((rc = next_extent(fd, &first, &end)) == NO_ERROR))
+    {
+        int block = first / DB_BLOCK_RECORDS;
+        int last = (end - 1) / DB_BLOCK_RECORDS;
+
+        for (; (block <= last) && (max_blocks > 0); block++, max_blocks--)
+        {
+            int was_punched = punch_block(fd, block);
+            if (was_punched < 0)
+                return was_punched;
+            punched += was_punched;
+        }
+        *next_block = block;
+        first = block * DB_BLOCK_RECORDS;
+    }
+
+    if (max_blocks > 0)
+    {
+        if (rc != SRCH_NOT_FOUND)
+            return rc;
+        *next_block = 0;
+    }
+    return punched;
+}
+
+/*
+ *  get_student
+ *      fd:  linux file descriptor
+ *      id:  the student id we are looking forname of the
+ *      *s:  a pointer where the located (if found) student data will be
+ *           copied
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student was not located in the database
+ *
+ *  console:  Does not produce any console I/O used by other functions
+ */
+int get_student(int fd, int id, student_t *s)
+{
+    if (mmap_active(fd))
+        return mmap_get_student(id, s);
+
+    off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
+
+    if (lseek(fd, offset, SEEK_SET) < 0)
+        return ERR_DB_FILE;
+
+    ssize_t bytes_read = read(fd, s, STUDENT_RECORD_SIZE);
+    if (bytes_read < 0)
+        return ERR_DB_FILE;
+
+    // past the end of the file, or an empty or deleted slot
+    if ((bytes_read < STUDENT_RECORD_SIZE) ||
+        (memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0))
+        return SRCH_NOT_FOUND;
+
+    return NO_ERROR;
+}
+
+/*
+ *  add_student
+ *      fd:     linux file descriptor
+ *      id:     student id (range is defined in db.h )
+ *      fname:  student first name
+ *      lname:  student last name
+ *      gpa:    GPA as an integer (range defined in db.h)
+ *
+ *  Adds a new student to the database.  After calculating the index for the
+ *  student, check if there is another student already at that location.  A good
+ *  way is to use something like memcmp() to ensure that the location for this
+ *  student contains all zero byes indicating the space is empty.
+ *
+ *  returns:  NO_ERROR       student added to database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           already exists)
+ *
+ *
+ *  console:  M_STD_ADDED       on success
+ *            M_ERR_DB_ADD_DUP  student already exists
+ *            M_ERR_DB_READ     error reading or seeking the database file
+ *            M_ERR_DB_WRITE    error writing to db file (adding student)
+ *
+ */
+int add_student(int fd, int id, char *fname, char *lname, int gpa)
+{
+    student_t student = EMPTY_STUDENT_RECORD;
+
+    student.id = id;
+    strncpy(student.fname, fname, sizeof(student.fname) - 1);
+    strncpy(student.lname, lname, sizeof(student.lname) - 1);
+    student.gpa = gpa;
+
+    switch (insert_student(fd, &student))
+    {
+    case NO_ERROR:
+        printf(M_STD_ADDED, id);
+        return NO_ERROR;
+    case ERR_DB_OP:
+        printf(M_ERR_DB_ADD_DUP, id);
+        return ERR_DB_OP;
+    case ERR_DB_WRITE:
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    default:
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+}
+
+/*
+ *  insert_student
+ *      fd:  linux file descriptor
+ *      *s:  the student to add, s->id picks the slot
+ *
+ *  What add_student() does, without the console output, for callers like
+ *  the server in sdb_server.c that report back some other way.  The slot
+ *  is locked from the check to the write, see lock_records(), so of two
+ *  processes adding the same id one gets ERR_DB_OP.  The student goes in
+ *  the last name index before the database, a failed write leaves a key
+ *  that find_lname() skips.
+ *
+ *  returns:  NO_ERROR       student added to database
+ *            ERR_DB_OP      student already exists
+ *            ERR_DB_FILE    error reading or seeking the database file
+ *            ERR_DB_WRITE   error writing the student
+ *
+ *  console:  Does not produce any console I/O
+ */
+int insert_student(int fd, const student_t *s)
+{
+    student_t existing;
+    int rc;
+
+    // the check and the write are one step for any other writer
+    if (lock_records(fd, s->id, 1, F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    rc = get_student(fd, s->id, &existing);
+    if (rc == NO_ERROR)
+        rc = ERR_DB_OP;
+    else if (rc != SRCH_NOT_FOUND)
+        rc = ERR_DB_FILE;
+    else if (idx_active(fd) && (idx_insert(s) != NO_ERROR))
+        rc = ERR_DB_WRITE;
+    else if (put_student(fd, s->id, s) != NO_ERROR)
+        rc = ERR_DB_WRITE;
+    else
+        rc = NO_ERROR;
+
+    lock_records(fd, s->id, 1, F_UNLCK);
+    return rc;
+}
+
+/*
+ *  del_student
+ *      fd:     linux file descriptor
+ *      id:     student id to be deleted
+ *
+ *  Removes a student to the database.  Use the get_student() function to
+ *  locate the student to be deleted. If there is a student at that location
+ *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at
+ *  that location.
+ *
+ *  returns:  NO_ERROR       student deleted from database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           not in database)
+ *
+ *
+ *  console:  M_STD_DEL_MSG      on success
+ *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
+ *            M_ERR_DB_READ      error reading or seeking the database file
+ *            M_ERR_DB_WRITE     error writing to db file (adding student)
+ *
+ */
+int del_student(int fd, int id)
+{
+    switch (remove_student(fd, id))
+    {
+    case NO_ERROR:
+        printf(M_STD_DEL_MSG, id);
+        return NO_ERROR;
+    case SRCH_NOT_FOUND:
+        printf(M_STD_NOT_FND_MSG, id);
+        return ERR_DB_OP;
+    case ERR_DB_WRITE:
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    default:
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+}
+
+/*
+ *  remove_student
+ *      fd:  linux file descriptor
+ *      id:  student id to be deleted
+ *
+ *  What del_student() does, without the console output.  The student
+ *  comes out of the last name index after the database.  If the student
+ *  was the last one in its block, the block's storage goes too, see
+ *  punch_block().
+ *
+ *  returns:  NO_ERROR       student deleted from database
+ *            SRCH_NOT_FOUND student not in database
+ *            ERR_DB_FILE    error reading or seeking the database file
+ *            ERR_DB_WRITE   error writing the empty record
+ *
+ *  console:  Does not produce any console I/O
+ */
+int remove_student(int fd, int id)
+{
+    student_t student;
+    int rc;
+
+    if (lock_records(fd, id, 1, F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    rc = get_student(fd, id, &student);
+    if ((rc == NO_ERROR) && (put_student(fd, id, &EMPTY_STUDENT_RECORD) != NO_ERROR))
+        rc = ERR_DB_WRITE;
+
+    // a key left behind is skipped by find_lname(), and gone at the
+    // next rebuild, so the delete stands even if this fails
+    if ((rc == NO_ERROR) && idx_active(fd))
+        idx_delete(&student);
+
+    // let go of the record before punch_block() locks the whole block,
+    // two deletes in one block would otherwise each wait on the other
+    lock_records(fd, id, 1, F_UNLCK);
+
+    // the student is gone either way, punching is only to save space
+    if (rc == NO_ERROR)
+        punch_block(fd, id / DB_BLOCK_RECORDS);
+    return rc;
+}
+
+int count_student(student_t *s, void *arg)
+{
+    (void)s;
+    (*(int *)arg)++;
+    return NO_ERROR;
+}
+
+/*
+ *  count_db_records
+ *      fd:     linux file descriptor
+ *
+ *  Counts the number of records in the database.  Start by reading the
+ *  database at the beginning, and continue reading individual records
+ *  until you it EOF.  EOF is when the read() syscall returns 0. Check
+ *  if a slot is empty or previously deleted by investigating if all of
+ *  the bytes in the record read are zeros - I would suggest using memory
+ *  compare memcmp() for this. Create a counter variable and initialize it
+ *  to zero, every time a non-zero record is read increment the counter.
+ *
+ *  returns:  <number>       returns the number of records in db on success
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           not in database)
+ *
+ *
+ *  console:  M_DB_RECORD_CNT  on success, to report the number of students in db
+ *            M_DB_EMPTY       on success if the record count in db is zero
+ *            M_ERR_DB_READ    error reading or seeking the database file
+ *            M_ERR_DB_WRITE   error writing to db file (adding student)
+ *
+ */
+int count_db_records(int fd)
+{
+    int record_count = 0;
+
+    if (scan_db(fd, count_student, &record_count) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (record_count == 0)
+        printf(M_DB_EMPTY);
+    else
+        printf(M_DB_RECORD_CNT, record_count);
+
+    return record_count;
+}
+
+int print_row(student_t *s, void *arg)
+{
+    int *rows = arg;
+
+    if ((*rows)++ == 0)
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, s->gpa / 100.0);
+    return NO_ERROR;
+}
+
+/*
+ *  print_db
+ *      fd:     linux file descriptor
+ *
+ *  Prints all records in the database.  Start by reading the
+ *  database at the beginning, and continue reading individual records
+ *  until you it EOF.  EOF is when the read() syscall returns 0. Check
+ *  if a slot is empty or previously deleted by investigating if all of
+ *  the bytes in the record read are zeros - I would suggest using memory
+ *  compare memcmp() for this. Be careful as the database might be empty.
+ *  on the first real row encountered print the header for the required output:
+ *
+ *     printf(STUDENT_PRINT_HDR_STRING, "ID",
+ *                  "FIRST_NAME", "LAST_NAME", "GPA");
+ *
+ *  then for each valid record encountered print the required output:
+ *
+ *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
+ *                    student.lname, calculated_gpa_from_student);
+ *
+ *  The code above assumes you are reading student records into a local
+ *  variable named student that is of type student_t. Also dont forget that
+ *  the GPA in the student structure is an int, to convert it into a real
+ *  gpa divide by 100.0 and store in a float variable.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *
+ *  console:  <see above>      on success, print table or database empty
+ *            M_ERR_DB_READ    error reading or seeking the database file
+ *
+ */
+int print_db(int fd)
+{
+    int rows = 0;
+
+    if (scan_db(fd, print_row, &rows) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (rows == 0)
+        printf(M_DB_EMPTY);
+
+    return NO_ERROR;
+}
+
+typedef struct lname_visit {
+    int fd;
+    int (*visit)(student_t *s, void *arg);
+    void *arg;
+} lname_visit_t;
+
+//the index can be ahead of the database, only students still there count
+static int visit_lname(int id, const char *lname, void *arg)
+{
+    lname_visit_t *lv = arg;
+    student_t student;
+    int rc = get_student(lv->fd, id, &student);
+
+    if (rc == SRCH_NOT_FOUND)
+        return NO_ERROR;
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+    if (strncmp(student.lname, lname, sizeof(student.lname)) != 0)
+        return NO_ERROR;
+    return lv->visit(&student, lv->arg);
+}
+
+/*
+ *  find_lname
+ *      fd:       linux file descriptor
+ *      pattern:  a last name, or the start of one followed by '*'
+ *      visit:    called for each student found, see scan_db()
+ *
+ *  Finds students by last name through the index in IDX_FILE, in last
+ *  name then id order, reading only the students that match.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the index is not open or could not be read,
+ *                           or the database could not be read
+ *            or what visit returned
+ *
+ *  console:  Does not produce any console I/O
+ */
+int find_lname(int fd, char *pattern, int (*visit)(student_t *s, void *arg), void *arg)
+{
+    lname_visit_t lv = { fd, visit, arg };
+
+    if (!idx_active(fd))
+        return ERR_DB_FILE;
+    return idx_search(pattern, visit_lname, &lv);
+}
+
+/*
+ *  print_lname
+ *      fd:       linux file descriptor
+ *      pattern:  a last name, or the start of one followed by '*'
+ *
+ *  Prints the students with that last name, as print_db() does, sorted by
+ *  last name and then id.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_OP      no student has that last name
+ *            ERR_DB_FILE    database or index file I/O issue
+ *
+ *  console:  <see print_db()> on success
+ *            M_LNAME_NOT_FND  no student has that last name
+ *            M_ERR_DB_READ    error reading the database or the index
+ */
+int print_lname(int fd, char *pattern)
+{
+    int rows = 0;
+
+    if (find_lname(fd, pattern, print_row, &rows) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (rows == 0)
+    {
+        printf(M_LNAME_NOT_FND, pattern);
+        return ERR_DB_OP;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  rebuild_index
+ *      fd:  linux file descriptor
+ *
+ *  Builds the last name index again from the database, for a database
+ *  that was written without it or an index that has become sparse.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or index file I/O issue
+ *
+ *  console:  M_IDX_REBUILT    on success
+ *            M_ERR_DB_WRITE   the index could not be built
+ */
+int rebuild_index(int fd)
+{
+    int count = idx_active(fd) ? idx_rebuild() : ERR_DB_FILE;
+
+    if (count < 0)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    printf(M_IDX_REBUILT, count);
+    return NO_ERROR;
+}
+
+/*
+ *  print_student
+ *      *s:   a pointer to a student_t structure that should
+ *            contain a valid student to be printed
+ *
+ *  Start by ensuring that provided student pointer is valid.  To do this
+ *  make sure it is not NULL and that s->id is not zero.  After ensuring
+ *  that the student is valid, print it the exact way that is described
+ *  in the print_db() function by first printing the header then the
+ *  student data:
+ *
+ *     printf(STUDENT_PRINT_HDR_STRING, "ID",
+ *                  "FIRST NAME", "LAST_NAME", "GPA");
+ *
+ *     printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname,
+ *                    student.lname, calculated_gpa_from_s);
+ *
+ *  Dont forget that  the GPA in the student structure is an int, to convert
+ *  it into a real gpa divide by 100.0 and store in a float variable.
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *
+ *  console:  <see above>      on success, print table or database empty
+ *            M_ERR_STD_PRINT  if the function argument s is NULL or if
+ *                             s->id is zero
+ *
+ */
+void print_student(student_t *s)
+{
+    if ((s == NULL) || (s->id == 0))
+    {
+        printf(M_ERR_STD_PRINT);
+        return;
+    }
+
+    float calculated_gpa_from_s = s->gpa / 100.0;
+
+    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname,
+           calculated_gpa_from_s);
+}
+
+//scan_db() visitor for rewrite_db(), puts s into the fd at *arg
+static int copy_student(student_t *s, void *arg)
+{
+    return put_student(*(int *)arg, s->id, s);
+}
+
+/*
+ *  rewrite_db
+ *      fd:     linux file descriptor
+ *
+ *  The way compress_db() worked before deletes could punch holes, and
+ *  what it still falls back on where the file system cannot.
+ *
+ *  This assignment takes advantage of the way Linux handles sparse files
+ *  on disk. Thus if there is a large hole between student records, Linux
+ *  will not use any physical storage.  However, when a database record is
+ *  deleted storage is used to write a blank - see EMPTY_STUDENT_RECORD from
+ *  db.h - record.
+ *
+ *  Since Linux provides no way to delete data in the middle of a file, and
+ *  deleted records take up physical storage, this function will compress the
+ *  database by rewriting a new database file that only includes valid student
+ *  records. There are a number of ways to do this, but since this is extra credit
+ *  you need to figure this out on your own.
+ *
+ *  At a high level create a temporary database file then copy all valid students from
+ *  the active database (passed in via fd) to the temporary file. When this is done
+ *  rename the temporary database file to the name of the real database file. See
+ *  the constants in db.h for required file names:
+ *
+ *         #define DB_FILE     "student.db"        //name of database file
+ *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit
+ *
+ *  Note that you are passed in the fd of the database file to be compressed,
+ *  it is very likely you will need to close it to overwrite it with the
+ *  compressed version of the file.  To ensure the caller can work with the
+ *  compressed file after you create it, it is a good design to return the fd
+ *  of the new compressed file from this function
+ *
+ *  returns:  <number>       returns the fd of the compressed database file
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *
+ *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
+ *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
+ *                             this error should also be returned after you
+ *                             compressed the database file and if you are unable
+ *                             to open it to pass the fd back to the caller
+ *            M_ERR_DB_CREATE  error creating the db file. For instance the
+ *                             inability to copy the temporary file back as
+ *                             the primary database file.
+ *            M_ERR_DB_READ    error reading or seeking the the db or tempdb file
+ *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
+ *
+ */
+static int rewrite_db(int fd)
+{
+    // the copy goes through the file, so mapped records are written back
+    // first, and the new file gets the same engine as the old one
+    if (mmap_active(fd) && (mmap_close() != NO_ERROR))
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    int tmp_fd = open_db(TMP_DB_FILE, true);
+    if (tmp_fd < 0)
+        return ERR_DB_FILE;
+
+    // the copy has to be on disk before it replaces the database, or a
+    // crash after the rename can leave an empty file in its place
+    int rc = scan_db(fd, copy_student, &tmp_fd);
+    if ((rc == NO_ERROR) && (fsync(tmp_fd) < 0))
+        rc = ERR_DB_FILE;
+    close(tmp_fd);
+    if (rc != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        unlink(TMP_DB_FILE);
+        return ERR_DB_FILE;
+    }
+
+    if (close_db(fd) != NO_ERROR)
+    {
+        unlink(TMP_DB_FILE);
+        return ERR_DB_FILE;
+    }
+    if (rename(TMP_DB_FILE, DB_FILE) < 0)
+    {
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+
+    // and the rename itself is only durable once the directory is
+    int dir_fd = open(".", O_RDONLY | O_DIRECTORY);
+    if ((dir_fd < 0) || (fsync(dir_fd) < 0))
+    {
+        printf(M_ERR_DB_CREATE);
+        if (dir_fd >= 0)
+            close(dir_fd);
+        return ERR_DB_FILE;
+    }
+    close(dir_fd);
+
+    fd = open_db(DB_FILE, false);
+    if (fd < 0)
+        return ERR_DB_FILE;
+    if (attach_engine(fd) != NO_ERROR)
+    {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+    return fd;
+}
+
+/*
+ *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
+ *
+ *  compress_db
+ *      fd:     linux file descriptor
+ *
+ *  Deleted records are written as EMPTY_STUDENT_RECORD and keep using
+ *  storage.  del_student() already gives back the block it empties, this
+ *  runs compact_db() over the whole file to give back any other block of
+ *  nothing but empty records, e.g. from deletes made before that, in
+ *  place.  Nothing is copied or renamed and the fd stays the same.  Only
+ *  if the file system cannot punch holes is the database rewritten into
+ *  TMP_DB_FILE and renamed over DB_FILE, see rewrite_db().
+ *
+ *  returns:  <number>       returns the fd of the compressed database file
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *
+ *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
+ *            M_ERR_DB_READ    error reading or seeking the db file
+ *            M_ERR_DB_WRITE   error punching holes in the db file
+ *            and those of rewrite_db() if it falls back on that
+ *
+ */
+int compress_db(int fd)
+{
+    int next_block = 0;
+    int rc = compact_db(fd, &next_block, INT_MAX);
+
+    if (rc == ERR_DB_OP)
+        fd = rewrite_db(fd);
+    else if (rc < 0)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    if (fd < 0)
+        return ERR_DB_FILE;
+
+    printf(M_DB_COMPRESSED_OK);
+    return fd;
+}
+
+/*
+ *  validate_range
+ *      id:  proposed student id
+ *      gpa: proposed gpa
+ *
+ *  This function validates that the id and gpa are in the allowable ranges
+ *  as per the specifications.  It checks if the values are within the
+ *  inclusive range using constents in db.h
+ *
+ *  returns:    NO_ERROR       on success, both ID and GPA are in range
+ *              EXIT_FAIL_ARGS if either ID or GPA is out of range
+ *
+ *  console:  This function does not produce any output
+ *
+ */
+int validate_range(int id, int gpa)
+{
+
+    if ((id < MIN_STD_ID) || (id > MAX_STD_ID))
+        return EXIT_FAIL_ARGS;
+
+    if ((gpa < MIN_STD_GPA) || (gpa > MAX_STD_GPA))
+        return EXIT_FAIL_ARGS;
+
+    return NO_ERROR;
+}
+
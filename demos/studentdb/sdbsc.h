@@ -0,0 +1,239 @@
+#ifndef __SDB_H__
+    #define __SDB_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "db.h" //get student record type
+
+//prototypes for functions go below for this assignment
+int open_db(char *dbFile, bool should_truncate);
+int add_student(int fd, int id, char *fname, char *lname, int gpa);
+int get_student(int fd, int id, student_t *s);
+int del_student(int fd, int id);
+int compress_db(int fd);
+void print_student(student_t *s);
+int validate_range(int id, int gpa);
+int count_db_records(int fd);
+int print_db(int fd);
+void usage(char *);
+
+//storage engines, picked with SDB_ENGINE in the environment.  The fd engine
+//does an lseek() plus a read() or write() per record, SDB_ENGINE=mmap maps
+//the file and works on the records in memory, see sdb_mmap.c
+#define SDB_ENGINE_ENV  "SDB_ENGINE"
+#define ENGINE_FD       0
+#define ENGINE_MMAP     1
+
+//storage is given back a block of records at a time, see compact_db()
+#define DB_BLOCK_SIZE       4096
+#define DB_BLOCK_RECORDS    (DB_BLOCK_SIZE / (int)sizeof(student_t))
+
+int compact_db(int fd, int *next_block, int max_blocks);
+int lock_records(int fd, int first, int count, int type);
+int next_extent(int fd, int *first, int *end);
+int scan_db(int fd, int (*visit)(student_t *s, void *arg), void *arg);
+int count_student(student_t *s, void *arg);
+int print_row(student_t *s, void *arg);
+int insert_student(int fd, const student_t *s);
+int remove_student(int fd, int id);
+int find_lname(int fd, char *pattern, int (*visit)(student_t *s, void *arg), void *arg);
+int print_lname(int fd, char *pattern);
+int rebuild_index(int fd);
+
+//bulk CSV import and export, sdb_csv.c
+int import_csv(int fd, char *path);
+int export_csv(int fd, char *path);
+
+//GPA analytics, sdb_stats.c.  The table is scanned by SDB_THREADS threads,
+//one per CPU if it is not set
+#define SDB_THREADS_ENV "SDB_THREADS"
+#define GPA_BUCKETS     10              //histogram buckets, 0.50 of GPA wide
+
+typedef struct gpa_stats {
+    int count;                  //students
+    long long sum;              //of their gpa
+    int min;
+    int max;
+    int in_range;               //students with a gpa from lo to hi
+    int hist[GPA_BUCKETS];      //students with a gpa in each bucket
+} gpa_stats_t;
+
+int gpa_stats(int fd, int threads, int lo, int hi, gpa_stats_t *st);
+int print_gpa_stats(int fd, int lo, int hi);
+
+//long running server, sdb_server.c.  sdbsc -s [socket] starts it, and with
+//SDB_SOCKET set sdbsc sends its operation to the server instead
+#define SDB_SOCKET_ENV  "SDB_SOCKET"
+#define SDB_DEF_SOCKET  "student.sock"
+
+//a request is an sdb_req_t, followed by a student_t for SDB_OP_ADD and
+//SDB_OP_LNAME (the last name or prefix* to look up in its lname).  The
+//response is an sdb_rsp_t followed by rsp.count student_t.  Requests can
+//be pipelined, the responses come back in order
+#define SDB_OP_GET      1
+#define SDB_OP_ADD      2
+#define SDB_OP_DEL      3
+#define SDB_OP_COUNT    4
+#define SDB_OP_SCAN     5
+#define SDB_OP_COMPACT  6
+#define SDB_OP_LNAME    7
+
+typedef struct sdb_req {
+    int op;         //SDB_OP_...
+    int id;         //student id for GET, ADD and DEL
+} sdb_req_t;
+
+typedef struct sdb_rsp {
+    int rc;         //error code below, or the count for SDB_OP_COUNT
+    int count;      //number of student_t that follow
+} sdb_rsp_t;
+
+int start_db_server(char *sock_path);
+int db_connect(char *sock_path);
+int db_request(int sock, int op, int id, const student_t *s);
+int db_response(int sock, sdb_rsp_t *rsp, student_t *s);
+int db_read(int sock, void *buff, size_t len);
+int remote_cmd(char *sock_path, int argc, char *argv[]);   //sdb_cli.c
+
+//write ahead log, sdb_wal.c.  Records are logged to WAL_FILE before they
+//are written to DB_FILE, and replayed from it after a crash
+#define WAL_FILE        "student.db-wal"
+#define SDB_CRASH_ENV   "SDB_CRASH"     //crash tests, see wal_crash_point()
+#define SDB_CRASH_EXIT  99
+
+int wal_open(int db_fd, const char *path, bool discard);
+int wal_active(int db_fd);
+bool wal_defer(bool defer);
+int wal_log(int id, const student_t *s);
+int wal_sync(void);
+void wal_discard(void);
+int wal_checkpoint(void);
+int wal_close(void);
+int wal_reset(const char *path);
+void wal_crash_point(const char *point, int fd, const void *buff, size_t len);
+
+//last name index, sdb_index.c.  A B+tree of (lname, id) in IDX_FILE, kept
+//up to date by insert_student() and remove_student()
+#define IDX_FILE        "student.db-lname"
+
+int idx_open(int db_fd, const char *path);
+int idx_active(int db_fd);
+int idx_insert(const student_t *s);
+int idx_delete(const student_t *s);
+int idx_search(const char *pattern, int (*visit)(int id, const char *lname, void *arg), void *arg);
+int idx_rebuild(void);
+int idx_close(void);
+int idx_reset(const char *path);
+
+//format 2 of DB_FILE, sdb_paged.c.  A header, a directory of 4K bucket
+//pages found by hashing the id, and ids from 1 to PDB_MAX_ID.  sdbsc -m
+//rewrites a database in the original format in format 2
+#define PDB_MAX_ID      9223372036854775807LL
+
+bool pdb_detect(int fd);
+int pdb_create(int fd);
+int pdb_open(int fd);
+int pdb_get(long long id, student_t *s);
+int pdb_insert(long long id, const student_t *s);
+int pdb_remove(long long id);
+int pdb_scan(int (*visit)(long long id, student_t *s, void *arg), void *arg);
+int pdb_close(void);
+int migrate_db(int fd);
+int paged_cmd(int fd, int argc, char *argv[]);         //sdb_cli.c
+
+int db_engine(void);
+int attach_engine(int fd);
+int close_db(int fd);
+
+//mmap engine, sdb_mmap.c
+int mmap_open(int fd);
+int mmap_active(int fd);
+int mmap_get_student(int id, student_t *s);
+int mmap_put_student(int id, const student_t *s);
+student_t *mmap_table(int *num_records);
+int mmap_sync(void);
+int mmap_close(void);
+
+//error codes to be returned from individual functions
+// NO_ERROR is returned if there are no errors
+// ERR_DB_FILE is returned if there is are any issues with the database file itself
+// ERR_DB_OP is returned if an operation did not work aka add or delete a student
+// SRCH_NOT_FOUND is returned if the student is not found (get_student, and del_student)
+// ERR_DB_RANGE is returned if the id or gpa is out of range (the server)
+// ERR_DB_WRITE is returned if a record could not be written (insert_student,
+//              and remove_student)
+#define NO_ERROR        0
+#define ERR_DB_FILE     -1
+#define ERR_DB_OP       -2
+#define SRCH_NOT_FOUND  -3
+#define ERR_DB_RANGE    -4
+#define ERR_DB_WRITE    -5
+#define NOT_IMPLEMENTED_YET 0
+
+
+//error codes to be returned to the shell
+// EXIT_OK          program executed without error
+// EXIT_FAIL_DB     a database operation failed
+// EXIT_FAIL_ARGS   one or more arguments to program were not valid
+// EXIT_NOT_IMPL    the operation has not been implemented yet
+#define EXIT_OK         0
+#define EXIT_FAIL_DB    1
+#define EXIT_FAIL_ARGS  2
+#define EXIT_NOT_IMPL   3
+
+//Output messages
+#define M_ERR_STD_RNG     "Cant add student, either ID or GPA out of allowable range!\n"
+#define M_ERR_DB_CREATE   "Error creating DB file, exiting!\n"
+#define M_ERR_DB_OPEN     "Error opening DB file, exiting!\n"
+#define M_ERR_DB_READ     "Error reading DB file, exiting!\n"
+#define M_ERR_DB_WRITE    "Error writing DB file, exiting!\n"
+#define M_ERR_DB_ADD_DUP  "Cant add student with ID=%d, already exists in db.\n"
+#define M_ERR_STD_PRINT   "Cant print student. Student is NULL or ID is zero\n"
+
+#define M_STD_ADDED       "Student %d added to database.\n"
+#define M_STD_DEL_MSG     "Student %d was deleted from database.\n"
+#define M_STD_NOT_FND_MSG "Student %d was not found in database.\n"
+#define M_DB_COMPRESSED_OK "Database successfully compressed!\n"
+#define M_DB_ZERO_OK      "All database records removed!\n"
+#define M_DB_EMPTY        "Database contains no student records.\n"
+#define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
+#define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
+#define M_ERR_CSV_OPEN    "Error opening CSV file %s!\n"
+#define M_ERR_CSV_LINE    "Line %d of %s is not a valid student, nothing imported.\n"
+#define M_ERR_CSV_DUP     "Student %d on line %d of %s already exists, nothing imported.\n"
+#define M_CSV_IMPORTED    "%d student(s) imported from %s.\n"
+#define M_CSV_EXPORTED    "%d student(s) exported to %s.\n"
+#define M_LNAME_NOT_FND   "No student with last name %s found in database.\n"
+#define M_IDX_REBUILT     "Last name index rebuilt, %d student(s) indexed.\n"
+#define M_GPA_STATS       "%d student(s), GPA average %.2f, lowest %.2f, highest %.2f.\n"
+#define M_GPA_RANGE       "%d student(s) with a GPA from %.2f to %.2f.\n"
+#define M_ERR_GPA_RNG     "Cant count students, GPA range not within 0 to 500 or lowest above highest!\n"
+#define M_DB_MIGRATED     "%d student(s) migrated to format 2.\n"
+#define M_DB_IS_PAGED     "Database is already in format 2.\n"
+#define M_ERR_DB_PAGED    "Database is in format 2, which this operation does not support!\n"
+#define M_PDB_ADDED       "Student %lld added to database.\n"
+#define M_PDB_ADD_DUP     "Cant add student with ID=%lld, already exists in db.\n"
+#define M_PDB_DEL_MSG     "Student %lld was deleted from database.\n"
+#define M_PDB_NOT_FND_MSG "Student %lld was not found in database.\n"
+#define M_SRV_STARTED     "Serving %s on %s\n"
+#define M_SRV_STOPPED     "Server stopped.\n"
+#define M_ERR_SRV_LISTEN  "Error listening on %s, exiting!\n"
+#define M_ERR_SRV_IN_USE  "%s is not a socket, or a server is already using it, exiting!\n"
+#define M_ERR_SRV_CONNECT "Error connecting to the server on %s, exiting!\n"
+#define M_ERR_SRV_LOST    "Lost the connection to the server, exiting!\n"
+
+//useful format strings for print students
+//For example to print the header in the required output:
+//  printf(STUDENT_PRINT_HDR_STRING, "ID","FIRST NAME", 
+//                                   "LAST_NAME", "GPA");
+#define  STUDENT_PRINT_HDR_STRING   "%-6s %-24s %-32s %-3s\n"
+#define  STUDENT_PRINT_FMT_STRING   "%-6d %-24.24s %-32.32s %-3.2f\n"
+
+//a row of a format 2 database, whose ids can be wider
+#define  PDB_PRINT_FMT_STRING       "%-6lld %-24.24s %-32.32s %-3.2f\n"
+
+//and for the GPA histogram from print_gpa_stats()
+#define  GPA_HIST_HDR_STRING        "%-9s %8s\n"
+#define  GPA_HIST_FMT_STRING        "%.2f-%.2f %8d %s\n"
+
+#endif
\ No newline at end of file
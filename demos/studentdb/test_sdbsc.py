@@ -0,0 +1,765 @@
+#!/usr/bin/env python3
+"""
+Test suite for Simple Database (sdbsc) assignment
+Converted from BATS to pytest
+"""
+
+import subprocess
+import os
+import socket
+import time
+import pytest
+
+
+# Setup fixture that runs once before all tests
+@pytest.fixture(scope="session", autouse=True)
+def setup_test_environment():
+    """Delete student.db file if it exists before running tests"""
+    if os.path.exists("student.db"):
+        os.remove("student.db")
+    if os.path.exists("student.db-wal"):
+        os.remove("student.db-wal")
+    if os.path.exists("student.db-lname"):
+        os.remove("student.db-lname")
+    yield
+    # Cleanup after all tests (optional)
+    # if os.path.exists("student.db"):
+    #     os.remove("student.db")
+
+
+def run_sdbsc(*args):
+    """
+    Helper function to run sdbsc with arguments
+    Returns (returncode, stdout, stderr)
+    """
+    cmd = ["./sdbsc"] + list(args)
+    result = subprocess.run(
+        cmd,
+        capture_output=True,
+        text=True
+    )
+    return result.returncode, result.stdout, result.stderr
+
+
+def run_sdbsc_in(db_dir, *args, engine="fd", socket=None, env=None):
+    """
+    Run sdbsc on the student.db in db_dir with the given storage engine,
+    or through the server listening on socket, with env added to the
+    environment
+    Returns (returncode, stdout, stderr)
+    """
+    cmd = [os.path.abspath("./sdbsc")] + list(args)
+    env = dict(os.environ, SDB_ENGINE=engine, **(env or {}))
+    if socket is not None:
+        env["SDB_SOCKET"] = socket
+    result = subprocess.run(
+        cmd,
+        capture_output=True,
+        text=True,
+        cwd=db_dir,
+        env=env
+    )
+    return result.returncode, result.stdout, result.stderr
+
+
+def normalize_whitespace(text):
+    """Normalize multiple spaces to single space and strip"""
+    return ' '.join(text.split())
+
+
+class TestDatabaseBasics:
+    """Test basic database operations"""
+    
+    def test_01_database_empty_at_start(self):
+        """Check if database is empty to start"""
+        returncode, stdout, stderr = run_sdbsc("-p")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        assert stdout.strip() == "Database contains no student records."
+    
+    def test_02_add_student_1(self):
+        """Add student 1 to database"""
+        returncode, stdout, stderr = run_sdbsc("-a", "1", "john", "doe", "345")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Student 1 added to database."
+    
+    def test_03_add_more_students(self):
+        """Add multiple students to database"""
+        # Add student 3
+        returncode, stdout, stderr = run_sdbsc("-a", "3", "jane", "doe", "390")
+        assert returncode == 0, f"Expected return code 0, got {returncode}\nOutput: {stdout}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Student 3 added to database.", f"Failed Output: {stdout}"
+        
+        # Add student 63
+        returncode, stdout, stderr = run_sdbsc("-a", "63", "jim", "doe", "285")
+        assert returncode == 0, f"Expected return code 0, got {returncode}\nOutput: {stdout}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Student 63 added to database.", f"Failed Output: {stdout}"
+        
+        # Add student 64
+        returncode, stdout, stderr = run_sdbsc("-a", "64", "janet", "doe", "310")
+        assert returncode == 0, f"Expected return code 0, got {returncode}\nOutput: {stdout}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Student 64 added to database.", f"Failed Output: {stdout}"
+        
+        # Add student 99999
+        returncode, stdout, stderr = run_sdbsc("-a", "99999", "big", "dude", "205")
+        assert returncode == 0, f"Expected return code 0, got {returncode}\nOutput: {stdout}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Student 99999 added to database.", f"Failed Output: {stdout}"
+    
+    def test_04_check_student_count(self):
+        """Check student count is 5"""
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Database contains 5 student record(s).", f"Failed Output: {stdout}"
+    
+    def test_05_add_duplicate_student_fails(self):
+        """Make sure adding duplicate student fails"""
+        returncode, stdout, stderr = run_sdbsc("-a", "63", "dup", "student", "300")
+        assert returncode == 1, f"Expected return code 1, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Cant add student with ID=63, already exists in db.", f"Failed Output: {stdout}"
+    
+    def test_06_check_file_size(self):
+        """Make sure the file size is correct"""
+        file_size = os.path.getsize("student.db")
+        assert file_size == 6400000, f"Expected file size 6400000, got {file_size}"
+
+
+class TestDatabaseSearch:
+    """Test database search operations"""
+    
+    def test_07_find_student_3(self):
+        """Find student 3 in database"""
+        returncode, stdout, stderr = run_sdbsc("-f", "3")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        
+        lines = stdout.strip().split('\n')
+        # Second line should be the student record (first line is header)
+        normalized_output = normalize_whitespace(lines[1])
+        expected_output = "3 jane doe 3.90"
+        
+        assert normalized_output == expected_output, \
+            f"Failed Output: {normalized_output}\nExpected: {expected_output}"
+    
+    def test_08_find_nonexistent_student(self):
+        """Try looking up non-existent student"""
+        returncode, stdout, stderr = run_sdbsc("-f", "4")
+        assert returncode == 1, f"Expected return code 1, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Student 4 was not found in database.", f"Failed Output: {stdout}"
+
+
+class TestDatabaseDelete:
+    """Test database delete operations"""
+    
+    def test_09_delete_student_64(self):
+        """Delete student 64 from database"""
+        returncode, stdout, stderr = run_sdbsc("-d", "64")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Student 64 was deleted from database.", f"Failed Output: {stdout}"
+    
+    def test_10_delete_nonexistent_student(self):
+        """Try deleting non-existent student"""
+        returncode, stdout, stderr = run_sdbsc("-d", "65")
+        assert returncode == 1, f"Expected return code 1, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Student 65 was not found in database.", f"Failed Output: {stdout}"
+    
+    def test_11_check_student_count_after_delete(self):
+        """Check student count is 4 after deletion"""
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Database contains 4 student record(s).", f"Failed Output: {stdout}"
+
+
+class TestDatabasePrint:
+    """Test database print operations"""
+    
+    def test_12_print_student_records(self):
+        """Print all student records"""
+        returncode, stdout, stderr = run_sdbsc("-p")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        
+        # Normalize the output
+        normalized_output = normalize_whitespace(stdout.strip())
+        
+        # Expected output (normalized)
+        expected_output = "ID FIRST_NAME LAST_NAME GPA 1 john doe 3.45 3 jane doe 3.90 63 jim doe 2.85 99999 big dude 2.05"
+        
+        assert normalized_output == expected_output, \
+            f"Failed Output: {normalized_output}\nExpected: {expected_output}"
+
+
+class TestDatabaseCompress:
+    """Test database compression (extra credit)"""
+    
+    def test_13_compress_db_try_1(self):
+        """Compress database - first attempt"""
+        returncode, stdout, stderr = run_sdbsc("-x")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Database successfully compressed!", f"Failed Output: {stdout}"
+    
+    def test_14_delete_student_99999(self):
+        """Delete student 99999 from database"""
+        returncode, stdout, stderr = run_sdbsc("-d", "99999")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Student 99999 was deleted from database.", f"Failed Output: {stdout}"
+    
+    def test_15_compress_db_try_2(self):
+        """Compress database - second attempt"""
+        returncode, stdout, stderr = run_sdbsc("-x")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Database successfully compressed!", f"Failed Output: {stdout}"
+
+
+class TestMmapEngine:
+    """The mmap engine (SDB_ENGINE=mmap) shares the file format"""
+
+    def test_mmap_engine_matches_fd_engine(self, tmp_path):
+        """Records written by one engine are seen by the other"""
+        for id, engine in (("1", "mmap"), ("64", "fd"), ("99999", "mmap")):
+            returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-a", id, "ann", "lee", "350", engine=engine)
+            assert returncode == 0, f"Failed Output: {stdout}"
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-a", "64", "dup", "lee", "300", engine="mmap")
+        assert returncode == 1
+        assert stdout.strip() == "Cant add student with ID=64, already exists in db."
+        # the mapping never runs past the end of the file, it is extended
+        assert os.path.getsize(tmp_path / "student.db") == 6400000
+
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-d", "64", engine="mmap")
+        assert returncode == 0
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-f", "64", engine="fd")
+        assert returncode == 1
+
+        fd_print = run_sdbsc_in(tmp_path, "-p", engine="fd")[1]
+        mmap_print = run_sdbsc_in(tmp_path, "-p", engine="mmap")[1]
+        assert fd_print == mmap_print
+        assert normalize_whitespace(mmap_print) == \
+            "ID FIRST_NAME LAST_NAME GPA 1 ann lee 3.50 99999 ann lee 3.50"
+        assert run_sdbsc_in(tmp_path, "-c", engine="mmap")[1].strip() == \
+            "Database contains 2 student record(s)."
+
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-x", engine="mmap")
+        assert returncode == 0
+        assert run_sdbsc_in(tmp_path, "-f", "99999", engine="mmap")[0] == 0
+
+
+class TestSparseScan:
+    """Scans only read the parts of the file that have data in them"""
+
+    @pytest.mark.parametrize("engine", ["fd", "mmap"])
+    def test_scan_skips_holes(self, tmp_path, engine):
+        """Students far apart, with holes between them, are all found"""
+        for id in ("2", "5000", "70000", "99999"):
+            assert run_sdbsc_in(tmp_path, "-a", id, "ann", "lee", "350", engine=engine)[0] == 0
+        assert run_sdbsc_in(tmp_path, "-d", "5000", engine=engine)[0] == 0
+        # a partial record at the end of the file is not a student
+        with open(tmp_path / "student.db", "ab") as db:
+            db.write(b"\x01" * 10)
+
+        assert run_sdbsc_in(tmp_path, "-c", engine=engine)[1].strip() == \
+            "Database contains 3 student record(s)."
+        stdout = run_sdbsc_in(tmp_path, "-p", engine=engine)[1]
+        assert normalize_whitespace(stdout) == "ID FIRST_NAME LAST_NAME GPA " \
+            "2 ann lee 3.50 70000 ann lee 3.50 99999 ann lee 3.50"
+
+
+class TestPunchHole:
+    """Emptied 4K blocks are given back with fallocate(PUNCH_HOLE)"""
+
+    def test_delete_punches_empty_block(self, tmp_path):
+        """Deleting the last student in a block frees the block"""
+        # ids 64..127 fill the second 4K block of the file
+        for id in ("64", "100", "127", "200"):
+            assert run_sdbsc_in(tmp_path, "-a", id, "ann", "lee", "350")[0] == 0
+        db = tmp_path / "student.db"
+        blocks = os.stat(db).st_blocks
+
+        for id in ("64", "100"):
+            assert run_sdbsc_in(tmp_path, "-d", id)[0] == 0
+        assert os.stat(db).st_blocks == blocks
+        assert run_sdbsc_in(tmp_path, "-d", "127", engine="mmap")[0] == 0
+        assert os.stat(db).st_blocks < blocks
+        assert os.path.getsize(db) == 201 * 64
+        assert normalize_whitespace(run_sdbsc_in(tmp_path, "-p")[1]) == \
+            "ID FIRST_NAME LAST_NAME GPA 200 ann lee 3.50"
+
+    def test_compress_in_place(self, tmp_path):
+        """-x punches blocks of deleted records without rewriting the file"""
+        assert run_sdbsc_in(tmp_path, "-a", "130", "ann", "lee", "350")[0] == 0
+        db = tmp_path / "student.db"
+        # a block of deleted records written before deletes punched holes
+        with open(db, "r+b") as f:
+            f.seek(4096)
+            f.write(b"\x00" * 4096)
+            os.fsync(f.fileno())
+        before = os.stat(db)
+
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-x")
+        assert returncode == 0
+        assert stdout.strip() == "Database successfully compressed!"
+        after = os.stat(db)
+        assert after.st_ino == before.st_ino
+        assert after.st_blocks < before.st_blocks
+        assert run_sdbsc_in(tmp_path, "-f", "130")[0] == 0
+
+
+class TestCsv:
+    """Bulk import (-i) and export (-e)"""
+
+    def test_import_export_round_trip(self, tmp_path):
+        """Exported students import into an empty database unchanged"""
+        csv = tmp_path / "in.csv"
+        csv.write_text("id,first_name,last_name,gpa\n"
+                       "99999,big,dude,205\n"
+                       "3,jane,doe,390\r\n"
+                       "\n"
+                       "1,\"o\"\"neil, jr\",doe,345\n"
+                       "2,jim,doe,285")
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-i", "in.csv")
+        assert returncode == 0
+        assert stdout.strip() == "4 student(s) imported from in.csv."
+        assert normalize_whitespace(run_sdbsc_in(tmp_path, "-p")[1]) == \
+            "ID FIRST_NAME LAST_NAME GPA 1 o\"neil, jr doe 3.45 2 jim doe 2.85 " \
+            "3 jane doe 3.90 99999 big dude 2.05"
+
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-e", "out.csv")
+        assert returncode == 0
+        assert stdout.strip() == "4 student(s) exported to out.csv."
+        exported = (tmp_path / "out.csv").read_text()
+        assert exported.splitlines()[1] == "1,\"o\"\"neil, jr\",doe,345"
+
+        first = (tmp_path / "student.db").read_bytes()
+        os.remove(tmp_path / "student.db")
+        assert run_sdbsc_in(tmp_path, "-i", "out.csv")[0] == 0
+        assert (tmp_path / "student.db").read_bytes() == first
+
+    def test_import_is_all_or_nothing(self, tmp_path):
+        """A bad line or a duplicate student imports nothing"""
+        assert run_sdbsc_in(tmp_path, "-a", "7", "ann", "lee", "350")[0] == 0
+        (tmp_path / "dup.csv").write_text("1,a,b,100\n7,c,d,200\n")
+        (tmp_path / "bad.csv").write_text("1,a,b,100\n2,c,d,600\n")
+
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-i", "dup.csv")
+        assert returncode == 1
+        assert stdout.strip() == "Student 7 on line 2 of dup.csv already exists, nothing imported."
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-i", "bad.csv")
+        assert returncode == 1
+        assert stdout.strip() == "Line 2 of bad.csv is not a valid student, nothing imported."
+        assert run_sdbsc_in(tmp_path, "-c")[1].strip() == "Database contains 1 student record(s)."
+
+
+def crash_sdbsc_in(db_dir, point, *args, engine="fd"):
+    """
+    Run sdbsc with SDB_CRASH=point, it exits with 99 when it gets there
+    Returns the returncode
+    """
+    cmd = [os.path.abspath("./sdbsc")] + list(args)
+    env = dict(os.environ, SDB_ENGINE=engine, SDB_CRASH=point)
+    return subprocess.run(cmd, capture_output=True, cwd=db_dir, env=env).returncode
+
+
+class TestWal:
+    """Crash injection, every write goes through student.db-wal first"""
+
+    @pytest.mark.parametrize("engine", ["fd", "mmap"])
+    def test_logged_add_is_recovered(self, tmp_path, engine):
+        """A crash after the log is flushed but before the write is redone"""
+        assert run_sdbsc_in(tmp_path, "-a", "1", "ann", "lee", "350", engine=engine)[0] == 0
+        assert crash_sdbsc_in(tmp_path, "log", "-a", "2", "john", "doe", "345", engine=engine) == 99
+        assert (tmp_path / "student.db-wal").stat().st_size > 0
+
+        assert normalize_whitespace(run_sdbsc_in(tmp_path, "-p", engine=engine)[1]) == \
+            "ID FIRST_NAME LAST_NAME GPA 1 ann lee 3.50 2 john doe 3.45"
+        assert (tmp_path / "student.db-wal").stat().st_size == 0
+
+    def test_torn_log_is_dropped(self, tmp_path):
+        """A commit only partly in the log is not applied"""
+        assert run_sdbsc_in(tmp_path, "-a", "1", "ann", "lee", "350")[0] == 0
+        assert crash_sdbsc_in(tmp_path, "torn_log", "-a", "2", "john", "doe", "345") == 99
+
+        assert run_sdbsc_in(tmp_path, "-f", "2")[0] == 1
+        assert run_sdbsc_in(tmp_path, "-a", "3", "jim", "doe", "285")[0] == 0
+        assert run_sdbsc_in(tmp_path, "-c")[1].strip() == "Database contains 2 student record(s)."
+
+    def test_torn_record_is_repaired(self, tmp_path):
+        """Half a record written to student.db is rewritten from the log"""
+        assert run_sdbsc_in(tmp_path, "-a", "1", "ann", "lee", "350")[0] == 0
+        assert crash_sdbsc_in(tmp_path, "torn_apply", "-a", "2", "john", "doe", "345") == 99
+        assert crash_sdbsc_in(tmp_path, "torn_apply", "-d", "1") == 99
+
+        assert normalize_whitespace(run_sdbsc_in(tmp_path, "-p")[1]) == \
+            "ID FIRST_NAME LAST_NAME GPA 2 john doe 3.45"
+
+    def test_replay_twice(self, tmp_path):
+        """A crash during the checkpoint leaves a log that is safe to replay"""
+        assert crash_sdbsc_in(tmp_path, "checkpoint", "-a", "1", "ann", "lee", "350") == 99
+        assert (tmp_path / "student.db-wal").stat().st_size > 0
+        assert run_sdbsc_in(tmp_path, "-d", "1")[0] == 0
+        assert (tmp_path / "student.db-wal").stat().st_size == 0
+
+        assert run_sdbsc_in(tmp_path, "-c")[1].strip() == "Database contains no student records."
+
+    def test_import_is_one_commit(self, tmp_path):
+        """An import torn in the log imports nothing, a logged one everything"""
+        (tmp_path / "in.csv").write_text("1,a,b,100\n2,c,d,200\n3,e,f,300\n")
+        assert crash_sdbsc_in(tmp_path, "torn_log", "-i", "in.csv") == 99
+        assert run_sdbsc_in(tmp_path, "-c")[1].strip() == "Database contains no student records."
+        assert crash_sdbsc_in(tmp_path, "log", "-i", "in.csv") == 99
+        assert run_sdbsc_in(tmp_path, "-c")[1].strip() == "Database contains 3 student record(s)."
+
+    def test_zero_discards_log(self, tmp_path):
+        """-z leaves nothing in the log to bring students back"""
+        assert crash_sdbsc_in(tmp_path, "log", "-a", "1", "ann", "lee", "350") == 99
+        assert run_sdbsc_in(tmp_path, "-z")[0] == 0
+        assert run_sdbsc_in(tmp_path, "-c")[1].strip() == "Database contains no student records."
+
+
+class TestLocking:
+    """Several sdbsc processes writing one database at once"""
+
+    @pytest.mark.parametrize("engine", ["fd", "mmap"])
+    def test_one_add_wins(self, tmp_path, engine):
+        """Of 8 processes adding the same id exactly one succeeds"""
+        cmd = [os.path.abspath("./sdbsc"), "-a", "5", "ann", "lee", "350"]
+        env = dict(os.environ, SDB_ENGINE=engine)
+        procs = [subprocess.Popen(cmd, cwd=tmp_path, env=env, stdout=subprocess.PIPE, text=True)
+                 for _ in range(8)]
+        results = sorted((p.wait(), p.stdout.read().strip()) for p in procs)
+
+        assert results[0] == (0, "Student 5 added to database.")
+        assert results[1:] == [(1, "Cant add student with ID=5, already exists in db.")] * 7
+
+    def test_delete_does_not_punch_concurrent_add(self, tmp_path):
+        """Adds racing deletes that empty the same block are all kept"""
+        sdbsc = os.path.abspath("./sdbsc")
+        churn = subprocess.Popen(
+            f"for i in $(seq 30); do {sdbsc} -a 1 a b 100; {sdbsc} -d 1; done",
+            shell=True, cwd=tmp_path, stdout=subprocess.DEVNULL)
+        adds = subprocess.Popen(
+            f"for i in $(seq 2 31); do {sdbsc} -a $i c d 200 || exit 1; done",
+            shell=True, cwd=tmp_path, stdout=subprocess.DEVNULL)
+        assert adds.wait() == 0
+        assert churn.wait() == 0
+
+        assert run_sdbsc_in(tmp_path, "-c")[1].strip() == "Database contains 30 student record(s)."
+
+
+class TestLnameIndex:
+    """Finding students by last name (-n) through student.db-lname"""
+
+    STUDENTS = [("4", "al", "smith", "100"), ("1", "john", "smith", "300"),
+                ("2", "jane", "smithers", "310"), ("3", "bob", "doe", "200")]
+
+    def add_students(self, tmp_path):
+        for student in self.STUDENTS:
+            assert run_sdbsc_in(tmp_path, "-a", *student)[0] == 0
+
+    def test_exact_and_prefix(self, tmp_path):
+        """An exact name, and a prefix*, sorted by last name then id"""
+        self.add_students(tmp_path)
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-n", "smith")
+        assert returncode == 0
+        assert normalize_whitespace(stdout) == \
+            "ID FIRST_NAME LAST_NAME GPA 1 john smith 3.00 4 al smith 1.00"
+        assert normalize_whitespace(run_sdbsc_in(tmp_path, "-n", "smi*")[1]) == \
+            "ID FIRST_NAME LAST_NAME GPA 1 john smith 3.00 4 al smith 1.00 " \
+            "2 jane smithers 3.10"
+        assert run_sdbsc_in(tmp_path, "-n", "*")[1].count("\n") == 5
+
+    def test_long_name(self, tmp_path):
+        """A last name longer than is kept is found by the whole name or a prefix"""
+        long_name = "abcdefghijklmnopqrstuvwxyz0123456789XYZ"
+        assert run_sdbsc_in(tmp_path, "-a", "8", "d", long_name, "300")[0] == 0
+        for pattern in (long_name, long_name[:31], long_name + "*", long_name[:35] + "*"):
+            returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-n", pattern)
+            assert returncode == 0, pattern
+            assert normalize_whitespace(stdout) == \
+                f"ID FIRST_NAME LAST_NAME GPA 8 d {long_name[:31]} 3.00"
+        assert run_sdbsc_in(tmp_path, "-n", long_name[:30] + "Q*")[0] == 1
+
+    def test_not_found(self, tmp_path):
+        """No match is a database error, as for -f"""
+        self.add_students(tmp_path)
+        for pattern in ("smit", "x*", "smithers2"):
+            returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-n", pattern)
+            assert returncode == 1
+            assert stdout.strip() == f"No student with last name {pattern} found in database."
+
+    @pytest.mark.parametrize("engine", ["fd", "mmap"])
+    def test_delete_and_zero(self, tmp_path, engine):
+        """Deleted students are not found, and -z empties the index"""
+        self.add_students(tmp_path)
+        assert run_sdbsc_in(tmp_path, "-d", "1", engine=engine)[0] == 0
+        assert normalize_whitespace(run_sdbsc_in(tmp_path, "-n", "smith", engine=engine)[1]) == \
+            "ID FIRST_NAME LAST_NAME GPA 4 al smith 1.00"
+        assert run_sdbsc_in(tmp_path, "-z", engine=engine)[0] == 0
+        assert run_sdbsc_in(tmp_path, "-n", "*", engine=engine)[0] == 1
+
+    def test_rebuild(self, tmp_path):
+        """A missing or crashed index is rebuilt on open, and -r rebuilds it"""
+        self.add_students(tmp_path)
+        os.remove(tmp_path / "student.db-lname")
+        assert run_sdbsc_in(tmp_path, "-n", "doe")[0] == 0
+        assert crash_sdbsc_in(tmp_path, "torn_apply", "-a", "5", "ed", "doe", "250") == 99
+        assert normalize_whitespace(run_sdbsc_in(tmp_path, "-n", "doe")[1]) == \
+            "ID FIRST_NAME LAST_NAME GPA 3 bob doe 2.00 5 ed doe 2.50"
+
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-r")
+        assert returncode == 0
+        assert stdout.strip() == "Last name index rebuilt, 5 student(s) indexed."
+
+    def test_import_and_many_adds(self, tmp_path):
+        """Enough students to split pages, from an import and one at a time"""
+        (tmp_path / "in.csv").write_text(
+            "".join(f"{i},f,name{i % 7},100\n" for i in range(1, 2001)))
+        assert run_sdbsc_in(tmp_path, "-i", "in.csv")[0] == 0
+        sdbsc = os.path.abspath("./sdbsc")
+        adds = subprocess.run(
+            f"for i in $(seq 2001 2300); do {sdbsc} -a $i f name$((i % 7)) 100 || exit 1; done",
+            shell=True, cwd=tmp_path, stdout=subprocess.DEVNULL)
+        assert adds.returncode == 0
+
+        stdout = run_sdbsc_in(tmp_path, "-n", "name3")[1]
+        ids = [int(line.split()[0]) for line in stdout.splitlines()[1:]]
+        assert ids == [i for i in range(1, 2301) if i % 7 == 3]
+        assert run_sdbsc_in(tmp_path, "-n", "name*")[1].count("\n") == 2301
+
+
+class TestGpaStats:
+    """GPA statistics (-g) from the columnar scan in sdb_stats.c"""
+
+    def test_stats_and_histogram(self, tmp_path):
+        """Count, average, lowest, highest and the histogram"""
+        for id, gpa in ((1, "345"), (2, "390"), (99999, "205"), (7, "500"), (8, "0")):
+            assert run_sdbsc_in(tmp_path, "-a", str(id), "a", "b", gpa)[0] == 0
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-g")
+        assert returncode == 0
+        lines = stdout.splitlines()
+        assert lines[0] == "5 student(s), GPA average 2.88, lowest 0.00, highest 5.00."
+        assert normalize_whitespace(lines[1]) == "GPA STUDENTS"
+        assert [normalize_whitespace(line) for line in lines[2:]] == [
+            "0.00-0.49 1 ########################################",
+            "0.50-0.99 0", "1.00-1.49 0", "1.50-1.99 0",
+            "2.00-2.49 1 ########################################",
+            "2.50-2.99 0",
+            "3.00-3.49 1 ########################################",
+            "3.50-3.99 1 ########################################",
+            "4.00-4.49 0",
+            "4.50-5.00 1 ########################################"]
+
+    def test_range(self, tmp_path):
+        """Students with a GPA in a range, and ranges that are not"""
+        for id, gpa in ((1, "345"), (2, "390"), (3, "205")):
+            assert run_sdbsc_in(tmp_path, "-a", str(id), "a", "b", gpa)[0] == 0
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-g", "205", "345")
+        assert returncode == 0
+        assert stdout.strip() == "2 student(s) with a GPA from 2.05 to 3.45."
+        for lo, hi in (("300", "200"), ("-1", "100"), ("100", "501")):
+            returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-g", lo, hi)
+            assert returncode == 2
+        assert run_sdbsc_in(tmp_path, "-g", "100")[0] == 2
+
+    def test_empty(self, tmp_path):
+        assert run_sdbsc_in(tmp_path, "-g")[1].strip() == "Database contains no student records."
+        assert run_sdbsc_in(tmp_path, "-g", "0", "500")[1].strip() == \
+            "0 student(s) with a GPA from 0.00 to 5.00."
+
+    @pytest.mark.parametrize("engine", ["fd", "mmap"])
+    def test_threads_agree(self, tmp_path, engine):
+        """Split over threads, with holes between the students, it adds up the same"""
+        (tmp_path / "in.csv").write_text(
+            "".join(f"{i},f,l,{i * 7 % 501}\n" for i in range(1, 100001) if i % 5000 < 3000))
+        assert run_sdbsc_in(tmp_path, "-i", "in.csv", engine=engine)[0] == 0
+        results = []
+        for threads in ("1", "3", "8"):
+            env = {"SDB_THREADS": threads}
+            results.append(run_sdbsc_in(tmp_path, "-g", engine=engine, env=env))
+            results.append(run_sdbsc_in(tmp_path, "-g", "100", "250", engine=engine, env=env))
+        assert results[0][1].startswith("60000 student(s)")
+        assert results[0:2] * 3 == results
+
+
+class TestPagedFormat:
+    """Format 2, the paged hash in sdb_paged.c, and -m to migrate to it"""
+
+    def test_migrate(self, tmp_path):
+        """-m keeps every student, and -p prints them the same after"""
+        for id, gpa in ((1, "345"), (2, "390"), (99999, "205")):
+            assert run_sdbsc_in(tmp_path, "-a", str(id), "a", "b", gpa)[0] == 0
+        before = run_sdbsc_in(tmp_path, "-p")
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-m")
+        assert returncode == 0
+        assert stdout.strip() == "3 student(s) migrated to format 2."
+        assert (tmp_path / "student.db").read_bytes()[:8] == b"SDBPAGE2"
+        assert run_sdbsc_in(tmp_path, "-p") == before
+        assert run_sdbsc_in(tmp_path, "-m")[1].strip() == "Database is already in format 2."
+
+    def test_big_ids(self, tmp_path):
+        """Ids past MAX_STD_ID, up to the largest 64 bit one"""
+        assert run_sdbsc_in(tmp_path, "-m")[0] == 0
+        for id in ("5000000000", "9223372036854775807", "100001"):
+            returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-a", id, "big", "id", "250")
+            assert returncode == 0
+            assert stdout.strip() == f"Student {id} added to database."
+        assert run_sdbsc_in(tmp_path, "-a", "5000000000", "big", "id", "250")[0] == 1
+        assert run_sdbsc_in(tmp_path, "-a", "0", "bad", "id", "250")[0] == 2
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-f", "5000000000")
+        assert returncode == 0
+        assert normalize_whitespace(stdout) == "ID FIRST_NAME LAST_NAME GPA 5000000000 big id 2.50"
+        ids = [line.split()[0] for line in run_sdbsc_in(tmp_path, "-p")[1].splitlines()[1:]]
+        assert ids == ["100001", "5000000000", "9223372036854775807"]
+        assert run_sdbsc_in(tmp_path, "-d", "5000000000")[0] == 0
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-f", "5000000000")
+        assert returncode == 1
+        assert stdout.strip() == "Student 5000000000 was not found in database."
+
+    def test_many_students(self, tmp_path):
+        """Enough students to split buckets and grow the directory"""
+        (tmp_path / "in.csv").write_text("".join(f"{i},f{i},l{i},{i % 501}\n" for i in range(1, 2001)))
+        assert run_sdbsc_in(tmp_path, "-i", "in.csv")[0] == 0
+        assert run_sdbsc_in(tmp_path, "-m")[1].strip() == "2000 student(s) migrated to format 2."
+        for i in range(1, 301):
+            assert run_sdbsc_in(tmp_path, "-a", str(i * 1000003), "n", "m", "100")[0] == 0
+        for i in range(1, 2001, 2):
+            assert run_sdbsc_in(tmp_path, "-d", str(i))[0] == 0
+        assert run_sdbsc_in(tmp_path, "-c")[1].strip() == "Database contains 1300 student record(s)."
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-f", "1998")
+        assert normalize_whitespace(stdout) == "ID FIRST_NAME LAST_NAME GPA 1998 f1998 l1998 4.95"
+        assert run_sdbsc_in(tmp_path, "-f", "1999")[0] == 1
+
+    def test_unsupported_and_zero(self, tmp_path):
+        """What needs the original format is refused, -z empties but keeps format 2"""
+        assert run_sdbsc_in(tmp_path, "-a", "1", "a", "b", "100")[0] == 0
+        assert run_sdbsc_in(tmp_path, "-m")[0] == 0
+        for args in (("-x",), ("-g",), ("-n", "b"), ("-r",), ("-e", "out.csv")):
+            returncode, stdout, stderr = run_sdbsc_in(tmp_path, *args)
+            assert returncode == 3
+            assert stdout.strip() == "Database is in format 2, which this operation does not support!"
+        assert run_sdbsc_in(tmp_path, "-z")[1].strip() == "All database records removed!"
+        assert run_sdbsc_in(tmp_path, "-c")[1].strip() == "Database contains no student records."
+        assert (tmp_path / "student.db").read_bytes()[:8] == b"SDBPAGE2"
+
+    def test_server_refuses(self, tmp_path):
+        """The server needs the original format"""
+        assert run_sdbsc_in(tmp_path, "-m")[0] == 0
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-s", "test.sock")
+        assert returncode == 1
+        assert "format 2" in stdout
+
+
+@pytest.fixture
+def server(tmp_path):
+    """Start sdbsc -s on a student.db in tmp_path, stop it afterwards"""
+    proc = subprocess.Popen([os.path.abspath("./sdbsc"), "-s", "test.sock"],
+                            cwd=tmp_path, stdout=subprocess.PIPE, text=True)
+    for _ in range(200):
+        if (tmp_path / "test.sock").exists():
+            break
+        time.sleep(0.01)
+    yield "test.sock"
+    proc.terminate()
+    assert proc.wait(timeout=5) == 0
+    assert proc.stdout.read() == "Serving student.db on test.sock\nServer stopped.\n"
+    assert not (tmp_path / "test.sock").exists()
+
+
+class TestServer:
+    """sdbsc with SDB_SOCKET set, against a server started with -s"""
+
+    COMMANDS = [
+        ("-c",),
+        ("-p",),
+        ("-a", "1", "john", "doe", "345"),
+        ("-a", "1", "john", "doe", "345"),
+        ("-a", "99999", "big", "dude", "205"),
+        ("-a", "0", "bad", "id", "100"),
+        ("-a", "5", "bad", "gpa", "600"),
+        ("-f", "1"),
+        ("-f", "2"),
+        ("-n", "doe"),
+        ("-n", "d*"),
+        ("-n", "lee"),
+        ("-c",),
+        ("-p",),
+        ("-d", "99999"),
+        ("-d", "99999"),
+        ("-x",),
+        ("-p",),
+    ]
+
+    def test_same_as_local(self, tmp_path, server):
+        """Every command gives the same output and exit code as without the server"""
+        local = tmp_path / "local"
+        local.mkdir()
+        for args in self.COMMANDS:
+            assert run_sdbsc_in(tmp_path, *args, socket=server) == \
+                run_sdbsc_in(local, *args), args
+
+    def test_server_writes_student_db(self, tmp_path, server):
+        """What is added through the server is in student.db for sdbsc without it"""
+        assert run_sdbsc_in(tmp_path, "-a", "3", "jane", "doe", "390", socket=server)[0] == 0
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-f", "3")
+        assert returncode == 0
+        assert normalize_whitespace(stdout) == "ID FIRST_NAME LAST_NAME GPA 3 jane doe 3.90"
+
+    def test_file_commands_not_sent(self, tmp_path, server):
+        """-z, -i, -e, -r, -g and -m need the file and are refused with a server"""
+        assert run_sdbsc_in(tmp_path, "-a", "3", "jane", "doe", "390", socket=server)[0] == 0
+        (tmp_path / "in.csv").write_text("7,new,student,100\n")
+        for args in (("-z",), ("-i", "in.csv"), ("-e", "out.csv"), ("-r",), ("-g",), ("-m",)):
+            # refused before connecting, so the same with nobody listening
+            for sock in (server, "none.sock"):
+                returncode, stdout, stderr = run_sdbsc_in(tmp_path, *args, socket=sock)
+                assert returncode == 3, args
+                assert stdout.strip() == "The requested operation is not implemented yet!"
+        # and nothing was done to the database
+        assert not (tmp_path / "out.csv").exists()
+        assert (tmp_path / "student.db").read_bytes()[:8] != b"SDBPAGE2"
+        assert run_sdbsc_in(tmp_path, "-c", socket=server)[1].strip() == \
+            "Database contains 1 student record(s)."
+
+    def test_socket_path_in_use(self, tmp_path, server):
+        """-s never removes a file that is not a socket, or a running server's"""
+        assert run_sdbsc_in(tmp_path, "-a", "3", "jane", "doe", "390", socket=server)[0] == 0
+        for path, what in (("student.db", "not a socket"), (server, "in use")):
+            returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-s", path)
+            assert returncode == 1, what
+            assert stdout.strip() == \
+                f"{path} is not a socket, or a server is already using it, exiting!"
+        assert run_sdbsc_in(tmp_path, "-c", socket=server)[1].strip() == \
+            "Database contains 1 student record(s)."
+
+    def test_stale_socket_replaced(self, tmp_path):
+        """A socket nobody listens on, left by a server that died, is taken over"""
+        stale = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        stale.bind(str(tmp_path / "test.sock"))
+        stale.close()
+        proc = subprocess.Popen([os.path.abspath("./sdbsc"), "-s", "test.sock"],
+                                cwd=tmp_path, stdout=subprocess.PIPE, text=True)
+        try:
+            assert proc.stdout.readline() == "Serving student.db on test.sock\n"
+            assert run_sdbsc_in(tmp_path, "-c", socket="test.sock")[0] == 0
+        finally:
+            proc.terminate()
+            proc.wait(timeout=5)
+
+    def test_no_server(self, tmp_path):
+        """A socket nobody is listening on is a database error"""
+        returncode, stdout, stderr = run_sdbsc_in(tmp_path, "-c", socket="none.sock")
+        assert returncode == 1
+        assert stdout.strip() == "Error connecting to the server on none.sock, exiting!"
+
+
+if __name__ == "__main__":
+    # Run pytest when script is executed directly
+    pytest.main([__file__, "-v"])
\ No newline at end of file